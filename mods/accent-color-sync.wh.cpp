@@ -5,7 +5,7 @@
 // @description:fr-FR   Restaurer la fonctionnalité d'opacité des couleurs du Panneau de configuration
 // @description:es-ES   Recuperar la funcionalidad de opacidad de colores del Panel de control
 // @description:ja-JP   コントロールパネルの色の不透明度機能を復元する
-// @version             1.6
+// @version             1.7
 // @author              CatmanFan / Mr._Lechkar
 // @github              https://github.com/CatmanFan
 // @include             explorer.exe
@@ -131,7 +131,10 @@ Brings back the functionality of the Control Panel's "Color intensity" slider to
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
 #include <cmath>
 #include <windhawk_api.h>
 #include <windhawk_utils.h>
@@ -189,110 +192,265 @@ std::wstring read_SZ(std::wstring sk, std::wstring v, std::wstring defaultValue)
 }
 
 /**
- * Reads a DWORD value from a registry key within HKCU.
+ * Checks for the existence of a registry key within HKCU.
  *
  * @param sk The path to the key, not including "HKCU\".
- * @param v The name of the value.
- * @return The DWORD value if it is found, otherwise `NULL`.
+ * @return `TRUE` if found, otherwise `FALSE`.
  */
-DWORD read_DWORD(std::wstring sk, std::wstring v)
+BOOL exists_Key(std::wstring sk)
 {
     const LPCTSTR subkey = sk.c_str();
-    const LPCTSTR value = v.c_str();
-    DWORD data(0);
-    DWORD size(sizeof(DWORD));
 
     HKEY hKey;
-    LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, subkey, 0, KEY_READ, &hKey);
+    LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, subkey, 0, KEY_ALL_ACCESS, &hKey);
     if (openRes != ERROR_SUCCESS) {
-        return NULL;
-    }
-
-    LONG setRes = RegQueryValueEx(hKey, value, 0, NULL, reinterpret_cast<LPBYTE>(&data), &size);
-    RegCloseKey(hKey);
-
-    if (setRes == ERROR_SUCCESS) {
-        return data;
+        return FALSE;
     } else {
-        return NULL;
+        return TRUE;
     }
 }
 
 /**
- * Checks for the existence of a DWORD value within an HKCU registry key.
- *
- * @param sk The path to the key, not including "HKCU\".
- * @param v The name of the value.
- * @return `TRUE` if found, otherwise `FALSE`.
+ * Storage for the values of a single registry key. This allows the session
+ * below to run on top of the real registry or an in-memory store.
  */
-BOOL exists_DWORD(std::wstring sk, std::wstring v)
+class RegistryBackend
 {
-    const LPCTSTR subkey = sk.c_str();
-    const LPCTSTR value = v.c_str();
-    DWORD data(0);
-    DWORD size(sizeof(DWORD));
+public:
+    virtual ~RegistryBackend() = default;
 
-    HKEY hKey;
-    LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, subkey, 0, KEY_ALL_ACCESS, &hKey);
-    LONG setRes = RegQueryValueEx(hKey, value, 0, NULL, reinterpret_cast<LPBYTE>(&data), &size);
-    RegCloseKey(hKey);
+    virtual bool read(const std::wstring& v, DWORD* data) = 0;
+    virtual bool write(const std::wstring& v, DWORD data) = 0;
+    virtual bool remove(const std::wstring& v) = 0;
 
-    if (openRes != ERROR_SUCCESS || setRes != ERROR_SUCCESS) {
-        return FALSE;
-    } else {
-        return TRUE;
+    /**
+     * @return `TRUE` if the values might have been changed since the last call, including by other processes.
+     */
+    virtual bool consumeChanges() = 0;
+};
+
+/**
+ * A registry key within HKCU. The key handle is opened once and kept, and
+ * changes are detected with `RegNotifyChangeKeyValue`.
+ */
+class HkcuRegistryBackend : public RegistryBackend
+{
+public:
+    explicit HkcuRegistryBackend(std::wstring sk) : subkey(std::move(sk)) {}
+    ~HkcuRegistryBackend() override { close(); }
+
+    bool read(const std::wstring& v, DWORD* data) override
+    {
+        if (!open())
+            return false;
+
+        DWORD size(sizeof(DWORD));
+        return RegQueryValueEx(hKey, v.c_str(), 0, NULL, reinterpret_cast<LPBYTE>(data), &size) == ERROR_SUCCESS;
     }
-}
+
+    bool write(const std::wstring& v, DWORD data) override
+    {
+        if (!open())
+            return false;
+
+        return RegSetValueEx(hKey, v.c_str(), 0, REG_DWORD, (const BYTE*)&data, sizeof(data)) == ERROR_SUCCESS;
+    }
+
+    bool remove(const std::wstring& v) override
+    {
+        if (!open())
+            return false;
+
+        return RegDeleteValue(hKey, v.c_str()) == ERROR_SUCCESS;
+    }
+
+    bool consumeChanges() override
+    {
+        if (!hChangeEvent || WaitForSingleObject(hChangeEvent, 0) != WAIT_TIMEOUT) {
+            watch();
+            return true;
+        }
+
+        return false;
+    }
+
+    void close()
+    {
+        if (hKey) {
+            RegCloseKey(hKey);
+            hKey = NULL;
+        }
+
+        if (hChangeEvent) {
+            CloseHandle(hChangeEvent);
+            hChangeEvent = NULL;
+        }
+    }
+
+private:
+    bool open()
+    {
+        if (hKey)
+            return true;
+
+        if (RegOpenKeyEx(HKEY_CURRENT_USER, subkey.c_str(), 0, KEY_READ | KEY_WRITE, &hKey) != ERROR_SUCCESS) {
+            hKey = NULL;
+            Wh_Log(L"Failed to open registry key");
+            return false;
+        }
+
+        return true;
+    }
+
+    void watch()
+    {
+        if (!open())
+            return;
+
+        if (!hChangeEvent)
+            hChangeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        // Without a registered notification, every call reports a change and the values are read again.
+        if (hChangeEvent &&
+            RegNotifyChangeKeyValue(hKey, FALSE, REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC, hChangeEvent, TRUE) != ERROR_SUCCESS) {
+            CloseHandle(hChangeEvent);
+            hChangeEvent = NULL;
+        }
+    }
+
+    std::wstring subkey;
+    HKEY hKey = NULL;
+    HANDLE hChangeEvent = NULL;
+};
 
 /**
- * Checks for the existence of a registry key within HKCU.
- *
- * @param sk The path to the key, not including "HKCU\".
- * @return `TRUE` if found, otherwise `FALSE`.
+ * An in-memory key, used to exercise the session without touching the registry.
  */
-BOOL exists_Key(std::wstring sk)
+class MemoryRegistryBackend : public RegistryBackend
 {
-    const LPCTSTR subkey = sk.c_str();
+public:
+    bool read(const std::wstring& v, DWORD* data) override
+    {
+        auto it = values.find(v);
+        if (it == values.end())
+            return false;
 
-    HKEY hKey;
-    LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, subkey, 0, KEY_ALL_ACCESS, &hKey);
-    if (openRes != ERROR_SUCCESS) {
-        return FALSE;
-    } else {
-        return TRUE;
+        *data = it->second;
+        return true;
     }
-}
+
+    bool write(const std::wstring& v, DWORD data) override
+    {
+        values[v] = data;
+        writes++;
+        return true;
+    }
+
+    bool remove(const std::wstring& v) override { return values.erase(v) > 0; }
+    bool consumeChanges() override { return std::exchange(changed, false); }
+
+    std::unordered_map<std::wstring, DWORD> values;
+    int writes = 0;
+    bool changed = false;
+};
 
 /**
- * Writes a DWORD value to a registry key within HKCU.
- *
- * @param sk The path to the key, not including "HKCU\".
- * @param v The name of the value.
- * @param data The DWORD value to write.
- * @return `TRUE` if the operation succeeded, otherwise `FALSE`.
+ * Caches the values of a registry key and only writes values that actually
+ * change. The cache is dropped whenever the backend reports a change, so
+ * values written by Windows or by the DWM software are picked up.
  */
-BOOL set_DWORD(std::wstring sk, std::wstring v, unsigned long data, bool del = FALSE)
+class RegistrySession
 {
-    const LPCTSTR subkey = sk.c_str();
-    const LPCTSTR value = v.c_str();
+public:
+    explicit RegistrySession(RegistryBackend* backend) : backend(backend) {}
+
+    /**
+     * Reads a DWORD value.
+     *
+     * @param v The name of the value.
+     * @return The DWORD value if it is found, otherwise `NULL`.
+     */
+    DWORD read_DWORD(const std::wstring& v)
+    {
+        const CachedValue& cached = lookup(v);
+        return cached.exists ? cached.data : NULL;
+    }
 
-    HKEY hKey;
-    LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, subkey, 0, KEY_ALL_ACCESS, &hKey);
-    if (openRes != ERROR_SUCCESS) {
-        Wh_Log(L"Failed to open registry key");
-        return FALSE;
+    /**
+     * Checks for the existence of a DWORD value.
+     *
+     * @param v The name of the value.
+     * @return `TRUE` if found, otherwise `FALSE`.
+     */
+    BOOL exists_DWORD(const std::wstring& v)
+    {
+        return lookup(v).exists;
     }
 
-    LONG setRes = del ? RegDeleteValue(hKey, value) : RegSetValueEx(hKey, value, 0, REG_DWORD, (const BYTE*)&data, sizeof(data));
-    RegCloseKey(hKey);
+    /**
+     * Writes a DWORD value, unless it's already set to the same data.
+     *
+     * @param v The name of the value.
+     * @param data The DWORD value to write.
+     * @param del Deletes the value instead.
+     * @return `TRUE` if the operation succeeded, otherwise `FALSE`.
+     */
+    BOOL set_DWORD(const std::wstring& v, unsigned long data, bool del = FALSE)
+    {
+        const CachedValue& cached = lookup(v);
+        if (del ? !cached.exists : (cached.exists && cached.data == data))
+            return TRUE;
+
+        bool succeeded = del ? backend->remove(v) : backend->write(v, data);
+        if (!succeeded) {
+            Wh_Log(L"Failed writing to registry");
+            cache.erase(v);
+            return FALSE;
+        }
 
-    if (setRes == ERROR_SUCCESS) {
+        cache[v] = CachedValue{!del, del ? 0 : data};
+        changed = true;
         return TRUE;
-    } else {
-        Wh_Log(L"Failed writing to registry");
-        return FALSE;
     }
-}
+
+    /**
+     * @return `TRUE` if any value was written since the last call.
+     */
+    bool consumeWrites()
+    {
+        return std::exchange(changed, false);
+    }
+
+private:
+    struct CachedValue
+    {
+        bool exists;
+        DWORD data;
+    };
+
+    const CachedValue& lookup(const std::wstring& v)
+    {
+        if (backend->consumeChanges())
+            cache.clear();
+
+        auto it = cache.find(v);
+        if (it == cache.end()) {
+            CachedValue value{};
+            value.exists = backend->read(v, &value.data);
+            it = cache.emplace(v, value).first;
+        }
+
+        return it->second;
+    }
+
+    RegistryBackend* backend;
+    std::unordered_map<std::wstring, CachedValue> cache;
+    bool changed = false;
+};
+
+HkcuRegistryBackend dwmRegistryBackend(dwmKey);
+RegistrySession dwmRegistry(&dwmRegistryBackend);
+
 #pragma endregion
 
 #pragma region ----- DWM colorization calculator -----
@@ -555,10 +713,10 @@ DWORD readColor()
 {
     const std::wstring value = L"ColorizationColor";
 
-    if (!exists_DWORD(dwmKey, value))
+    if (!dwmRegistry.exists_DWORD(value))
         return 0xFF000000;
     else
-        return read_DWORD(dwmKey, value);
+        return dwmRegistry.read_DWORD(value);
 }
 
 void loadColorValues(DWORD input)
@@ -577,12 +735,12 @@ void loadColorValues(DWORD input)
 void writeColorizationBalance(int c, int a, int b)
 {
     if (settings.glassApp == GlassSoftware::Glass8) {
-        set_DWORD(dwmKey, balanceColor, c);
-        set_DWORD(dwmKey, balanceBlur, b);
+        dwmRegistry.set_DWORD(balanceColor, c);
+        dwmRegistry.set_DWORD(balanceBlur, b);
     } else {
-        set_DWORD(dwmKey, balanceColor, c);
-        set_DWORD(dwmKey, balanceAfterglow, a);
-        set_DWORD(dwmKey, balanceBlur, b);
+        dwmRegistry.set_DWORD(balanceColor, c);
+        dwmRegistry.set_DWORD(balanceAfterglow, a);
+        dwmRegistry.set_DWORD(balanceBlur, b);
     }
 }
 
@@ -663,8 +821,8 @@ void bruteforceOpacity()
         opacity = 0x54;
 
     DWORD New = (dwm.value & 0x00ffffff) | (opacity << 24);
-    set_DWORD(dwmKey, L"ColorizationColor", New);
-    set_DWORD(dwmKey, L"ColorizationAfterglow", New);
+    dwmRegistry.set_DWORD(L"ColorizationColor", New);
+    dwmRegistry.set_DWORD(L"ColorizationAfterglow", New);
 
     dwmSettings.color = dwmSettings.afterglow = New;
 }
@@ -682,7 +840,7 @@ void setColorizationBalance(bool bruteforce = FALSE)
         settings.opacity = 42; // 40.7853080838;
     if (opacity < 0 || opacity > 100)
         opacity = settings.opacity;
-    set_DWORD(dwmKey, opacityValue, opacity);
+    dwmRegistry.set_DWORD(opacityValue, opacity);
     
     // Return if the function has already been run once under a fixed opacity.
     // This is to prevent useless DWM refreshing afterward.
@@ -707,12 +865,102 @@ void setColorizationBalance(bool bruteforce = FALSE)
     writeColorizationBalance(dwmSettings.color_balance, dwmSettings.afterglow_balance, dwmSettings.blur_balance);
     
     // Other registry values
-    set_DWORD(dwmKey, L"GlassType", 1);    // settings.boolTransparency ? 1 : 0);
+    dwmRegistry.set_DWORD(L"GlassType", 1);    // settings.boolTransparency ? 1 : 0);
 
     if (bruteforce)
 		bruteforceOpacity();
 
-    PostMessage(FindWindow(TEXT("dwm"), nullptr), WM_DWMCOLORIZATIONCOLORCHANGED, 0, 0);
+    // One notification for the whole batch, and none if nothing was actually changed.
+    if (dwmRegistry.consumeWrites())
+        PostMessage(FindWindow(TEXT("dwm"), nullptr), WM_DWMCOLORIZATIONCOLORCHANGED, 0, 0);
+}
+
+// The hooks run on the Control Panel thread, and the slider timer on a thread pool thread.
+std::recursive_mutex stateMutex;
+
+/**
+ * -------------------------
+ * Slider drags are applied at most once per display frame. The last position
+ * of a drag is applied by a timer when its frame is over.
+ * -------------------------
+ */
+PTP_TIMER sliderTimer;
+LONGLONG sliderFramePeriod;
+LONGLONG sliderLastApplied;
+bool sliderPending;
+
+void applySliderOpacity()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    sliderLastApplied = now.QuadPart;
+    sliderPending = FALSE;
+    setColorizationBalance();
+}
+
+void CALLBACK sliderTimerCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer)
+{
+    std::lock_guard<std::recursive_mutex> guard(stateMutex);
+    if (sliderPending)
+        applySliderOpacity();
+}
+
+void setSliderOpacity(int value)
+{
+    opacity = value;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    LONGLONG elapsed = now.QuadPart - sliderLastApplied;
+
+    if (!sliderTimer || elapsed >= sliderFramePeriod) {
+        applySliderOpacity();
+        return;
+    }
+
+    if (sliderPending)
+        return;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    // Negative due times are relative, in 100-nanosecond units.
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = static_cast<ULONGLONG>(-((sliderFramePeriod - elapsed) * 10000000 / frequency.QuadPart));
+    FILETIME fileDueTime;
+    fileDueTime.dwLowDateTime = dueTime.LowPart;
+    fileDueTime.dwHighDateTime = dueTime.HighPart;
+
+    sliderPending = TRUE;
+    SetThreadpoolTimer(sliderTimer, &fileDueTime, 0, 0);
+}
+
+void initSliderTimer()
+{
+    DEVMODE devMode = { };
+    devMode.dmSize = sizeof(devMode);
+    DWORD frequency = 60;
+    if (EnumDisplaySettings(NULL, ENUM_CURRENT_SETTINGS, &devMode) && devMode.dmDisplayFrequency > 1)
+        frequency = devMode.dmDisplayFrequency;
+
+    LARGE_INTEGER counterFrequency;
+    QueryPerformanceFrequency(&counterFrequency);
+    sliderFramePeriod = counterFrequency.QuadPart / frequency;
+
+    sliderTimer = CreateThreadpoolTimer(sliderTimerCallback, NULL, NULL);
+    if (!sliderTimer)
+        Wh_Log(L"Failed to create slider timer, applying every position");
+}
+
+void uninitSliderTimer()
+{
+    if (!sliderTimer)
+        return;
+
+    SetThreadpoolTimer(sliderTimer, NULL, 0, 0);
+    WaitForThreadpoolTimerCallbacks(sliderTimer, TRUE);
+    CloseThreadpoolTimer(sliderTimer);
+    sliderTimer = NULL;
 }
 
 #pragma region ----- DirectUI hooks -----
@@ -734,6 +982,8 @@ void THISCALL Element_OnPropertyChanged_hook(class Element* This, class Property
     auto ptr = reinterpret_cast<intptr_t>(This);
     if (ptr <= 0) return;
 
+    std::lock_guard<std::recursive_mutex> guard(stateMutex);
+
     ATOM id = Element_GetID(This, &This);
 
     if (intensitySlider != id && id == StrToID((unsigned const short*)L"IntensitySlider"))
@@ -759,9 +1009,8 @@ long THISCALL CCTrackBar_SetThumbPosition_hook(class CCTrackBar* This, int value
 
     // Track bar value
     if (intensitySlider > 0 && intensitySlider == ptr) {
-        opacity = value;
-        set_DWORD(dwmKey, opacityValue, opacity);
-        setColorizationBalance();
+        std::lock_guard<std::recursive_mutex> guard(stateMutex);
+        setSliderOpacity(value);
     }
 
     return CCTrackBar_SetThumbPosition(This, value);
@@ -778,6 +1027,8 @@ void THISCALL CCPushButton_OnSelectedPropertyChanged_hook(class CCPushButton* Th
 {
     auto ptr = reinterpret_cast<intptr_t>(This);
 
+    std::unique_lock<std::recursive_mutex> guard(stateMutex);
+
     // OK button
     if (ptr > 0 && ptr == okButton) {
         settings.opacity = opacity;
@@ -794,6 +1045,8 @@ void THISCALL CCPushButton_OnSelectedPropertyChanged_hook(class CCPushButton* Th
             CCTrackBar_SetThumbPosition(reinterpret_cast<class CCTrackBar*>(intensitySlider), opacity);
     }
 
+    guard.unlock();
+
     CCPushButton_OnSelectedPropertyChanged(This, that);
 }
 #pragma endregion
@@ -814,6 +1067,8 @@ enum DWMPGLASSATTRIBUTE : INT {
  */
 void SetDwmColorizationColor_hookFunction(unsigned long color, enum DWMPGLASSATTRIBUTE attribute)
 {
+    std::lock_guard<std::recursive_mutex> guard(stateMutex);
+
     settings.opacity = opacity = round(argb(color).get_a() / 255.0 * 100.0);
     old = colorization_color(color);
 	loadColorValues(old.value);
@@ -921,10 +1176,10 @@ WinVersion getWinVer()
 BOOL isInstalled(bool strict = FALSE)
 {
     return settings.glassApp == GlassSoftware::Glass8
-           ? (strict ? exists_DWORD(dwmKey, balanceColor) && exists_DWORD(dwmKey, balanceBlur)
-                     : exists_DWORD(dwmKey, balanceColor) || exists_DWORD(dwmKey, balanceBlur))
-           : (strict ? exists_DWORD(dwmKey, balanceColor) && exists_DWORD(dwmKey, balanceAfterglow) && exists_DWORD(dwmKey, balanceBlur)
-                     : exists_DWORD(dwmKey, balanceColor) || exists_DWORD(dwmKey, balanceAfterglow) || exists_DWORD(dwmKey, balanceBlur));
+           ? (strict ? dwmRegistry.exists_DWORD(balanceColor) && dwmRegistry.exists_DWORD(balanceBlur)
+                     : dwmRegistry.exists_DWORD(balanceColor) || dwmRegistry.exists_DWORD(balanceBlur))
+           : (strict ? dwmRegistry.exists_DWORD(balanceColor) && dwmRegistry.exists_DWORD(balanceAfterglow) && dwmRegistry.exists_DWORD(balanceBlur)
+                     : dwmRegistry.exists_DWORD(balanceColor) || dwmRegistry.exists_DWORD(balanceAfterglow) || dwmRegistry.exists_DWORD(balanceBlur));
 }
 
 void setValueNames()
@@ -955,22 +1210,22 @@ void setValueNames()
         balanceAfterglow = new2;
         balanceBlur = new3;
 
-        if (exists_DWORD(dwmKey, old1)) {
-            value = read_DWORD(dwmKey, old1);
-            set_DWORD(dwmKey, new1, value);
-            set_DWORD(dwmKey, old1, value, TRUE);
+        if (dwmRegistry.exists_DWORD(old1)) {
+            value = dwmRegistry.read_DWORD(old1);
+            dwmRegistry.set_DWORD(new1, value);
+            dwmRegistry.set_DWORD(old1, value, TRUE);
         }
 
-        if (exists_DWORD(dwmKey, old2)) {
-            value = read_DWORD(dwmKey, old2);
-            set_DWORD(dwmKey, new2, value);
-            set_DWORD(dwmKey, old2, value, TRUE);
+        if (dwmRegistry.exists_DWORD(old2)) {
+            value = dwmRegistry.read_DWORD(old2);
+            dwmRegistry.set_DWORD(new2, value);
+            dwmRegistry.set_DWORD(old2, value, TRUE);
         }
 
-        if (exists_DWORD(dwmKey, old3)) {
-            value = read_DWORD(dwmKey, old3);
-            set_DWORD(dwmKey, new3, value);
-            set_DWORD(dwmKey, old3, value, TRUE);
+        if (dwmRegistry.exists_DWORD(old3)) {
+            value = dwmRegistry.read_DWORD(old3);
+            dwmRegistry.set_DWORD(new3, value);
+            dwmRegistry.set_DWORD(old3, value, TRUE);
         }
     }
 }
@@ -1022,10 +1277,10 @@ BOOL LoadSettings()
     // *********************************************
     // Check/load from opacity DWORD in registry
     // *********************************************
-    if (!exists_DWORD(dwmKey, opacityValue))
+    if (!dwmRegistry.exists_DWORD(opacityValue))
         regSetup = TRUE;
     else
-        settings.opacity = read_DWORD(dwmKey, opacityValue);
+        settings.opacity = dwmRegistry.read_DWORD(opacityValue);
 
     // *********************************************
     // Setup if those checks were not fully met
@@ -1035,9 +1290,9 @@ BOOL LoadSettings()
 		
         int def = 42;
 
-        if (!set_DWORD(dwmKey, opacityValue, def))
+        if (!dwmRegistry.set_DWORD(opacityValue, def))
             return FALSE;
-        if (!exists_DWORD(dwmKey, opacityValue))
+        if (!dwmRegistry.exists_DWORD(opacityValue))
             return FALSE;
 
         opacity = settings.opacity = def;
@@ -1107,6 +1362,14 @@ BOOL Wh_ModInit()
         return FALSE;
     }
 
+    initSliderTimer();
+
     setColorizationBalance();
     return TRUE;
 }
+
+void Wh_ModUninit()
+{
+    uninitSliderTimer();
+    dwmRegistryBackend.close();
+}
@@ -2,7 +2,7 @@
 // @id              aerexplorer
 // @name            Aerexplorer
 // @description     Various tweaks for Windows Explorer to make it more like older versions.
-// @version         1.8.2
+// @version         1.8.3
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -1193,6 +1193,125 @@ void HandleTvItem(HWND hTreeView, LPTVITEMEXW lptvi)
     }
 }
 
+/* Per-tree state, kept in a window property so that the class of the
+   tree's grandparent is only checked once per tree. The upper bits count
+   nested batches (expansions, redraw disabled) which insert many items. */
+#define NSCTREE_STATE_PROP      L"Aerexplorer_NscTreeState"
+#define NSCTREE_CLASSIFIED      0x1
+#define NSCTREE_NAVPANE         0x2
+#define NSCTREE_REDRAW_OFF      0x4
+#define NSCTREE_BATCH_SHIFT     8
+
+UINT_PTR GetNscTreeState(HWND hwnd)
+{
+    UINT_PTR state = (UINT_PTR)GetPropW(hwnd, NSCTREE_STATE_PROP);
+    if (state & NSCTREE_CLASSIFIED)
+    {
+        return state;
+    }
+
+    /* For some UNGODLY reason, other shit (StartIsBack++, folder dialog)
+       use this same class so we have to get creative */
+    HWND hPar = GetParent(GetParent(hwnd));
+    if (!hPar || !IsWindow(hPar))
+    {
+        /* Not parented yet, try again with the next message */
+        return 0;
+    }
+
+    state = NSCTREE_CLASSIFIED;
+
+    WCHAR szClass[256];
+    if (GetClassNameW(hPar, szClass, 256)
+    && 0 == wcscmp(szClass, L"CtrlNotifySink"))
+    {
+        state |= NSCTREE_NAVPANE;
+    }
+
+    SetPropW(hwnd, NSCTREE_STATE_PROP, (HANDLE)state);
+    return state;
+}
+
+/* Items with iReserved == 1 are 2 rows high, except for the first
+   visible one. Used after inserting items without checking that. */
+void FixFirstVisibleIntegral(HWND hTreeView)
+{
+    if (settings.npst == NPST_VISTA)
+    {
+        return;
+    }
+
+    HTREEITEM hFirst = TreeView_GetFirstVisible(hTreeView);
+    if (!hFirst)
+    {
+        return;
+    }
+
+    TVITEMEXW tvi = { 0 };
+    tvi.mask = TVIF_HANDLE | TVIF_INTEGRAL;
+    tvi.hItem = hFirst;
+    if (TreeView_GetItem(hTreeView, &tvi) && tvi.iIntegral == 2)
+    {
+        tvi.iIntegral = 1;
+        TreeView_SetItem(hTreeView, &tvi);
+    }
+}
+
+void BeginNscTreeBatch(HWND hwnd, UINT_PTR state)
+{
+    SetPropW(hwnd, NSCTREE_STATE_PROP, (HANDLE)(state + (1 << NSCTREE_BATCH_SHIFT)));
+}
+
+void EndNscTreeBatch(HWND hwnd)
+{
+    UINT_PTR state = (UINT_PTR)GetPropW(hwnd, NSCTREE_STATE_PROP);
+    if (!(state >> NSCTREE_BATCH_SHIFT))
+    {
+        return;
+    }
+
+    state -= 1 << NSCTREE_BATCH_SHIFT;
+    SetPropW(hwnd, NSCTREE_STATE_PROP, (HANDLE)state);
+
+    if (!(state >> NSCTREE_BATCH_SHIFT))
+    {
+        FixFirstVisibleIntegral(hwnd);
+    }
+}
+
+/* Set the height of an item before it's inserted, so that it doesn't
+   have to be set again afterwards. */
+void HandleTvInsert(HWND hTreeView, UINT_PTR state, LPTVINSERTSTRUCTW lpis, bool *pbMayBeFirst)
+{
+    LPTVITEMEXW lptvi = &lpis->itemex;
+    *pbMayBeFirst = false;
+
+    if (!(lptvi->mask & TVIF_INTEGRAL))
+    {
+        return;
+    }
+
+    if (settings.npst == NPST_VISTA || lptvi->iReserved != 1)
+    {
+        lptvi->iIntegral = 1;
+    }
+    else if (state >> NSCTREE_BATCH_SHIFT)
+    {
+        /* The first visible item is fixed up once the batch is done */
+        lptvi->iIntegral = 2;
+    }
+    else if (!TreeView_GetFirstVisible(hTreeView))
+    {
+        lptvi->iIntegral = 1;
+    }
+    else
+    {
+        lptvi->iIntegral = 2;
+        *pbMayBeFirst = (!lpis->hParent || lpis->hParent == TVI_ROOT)
+            && (lpis->hInsertAfter == TVI_FIRST || lpis->hInsertAfter == TVI_SORT);
+    }
+}
+
 /* Set old height */
 SUBCLASSPROC CNscTree_s_SubClassTreeWndProc_orig = nullptr;
 LRESULT CALLBACK CNscTree_s_SubClassTreeWndProc_hook(
@@ -1206,60 +1325,93 @@ LRESULT CALLBACK CNscTree_s_SubClassTreeWndProc_hook(
 {
     if (settings.npst != NPST_DEFAULT)
     {
-        /* For some UNGODLY reason, other shit (StartIsBack++, folder dialog)
-           use this same class so we have to get creative */
-        HWND hPar = GetParent(GetParent(hwnd));
-        if (hPar && IsWindow(hPar))
+        switch (uMsg)
         {
-            WCHAR szClass[256];
-            if (GetClassNameW(hPar, szClass, 256))
+            case TVM_INSERTITEMW:
+            case TVM_SETITEMW:
+            case TVM_SETITEMHEIGHT:
+            case TVM_SETTOPMARGIN:
+            case TVM_SETINDENT:
+            case TVM_EXPAND:
+            case WM_SETREDRAW:
+                break;
+            case WM_NCDESTROY:
+                RemovePropW(hwnd, NSCTREE_STATE_PROP);
+                /* fall through */
+            default:
+                /* Paints, mouse moves etc. go straight through */
+                return CNscTree_s_SubClassTreeWndProc_orig(
+                    hwnd, uMsg, wParam, lParam, uIdSubclass, dwRefData
+                );
+        }
+
+        UINT_PTR state = GetNscTreeState(hwnd);
+        if (state & NSCTREE_NAVPANE)
+        {
+            switch (uMsg)
             {
-                if (0 == wcscmp(szClass, L"CtrlNotifySink"))
+                case TVM_INSERTITEMW:
                 {
-                    switch (uMsg)
+                    bool bMayBeFirst;
+                    HandleTvInsert(hwnd, state, (LPTVINSERTSTRUCTW)lParam, &bMayBeFirst);
+                    HTREEITEM hItem = (HTREEITEM)DefSubclassProc(hwnd, uMsg, wParam, lParam);
+                    if (hItem)
                     {
-                        case TVM_INSERTITEMW:
-                        {
-                            LPTVINSERTSTRUCTW lpis = (LPTVINSERTSTRUCTW)lParam;
-                            LPTVITEMEXW lptvi = &lpis->itemex;
-                            HTREEITEM hItem = (HTREEITEM)DefSubclassProc(hwnd, uMsg, wParam, lParam);
-                            lptvi->hItem = hItem;
-                            /* The TVM_SETITEMW handle here already calls HandleTvItem, no need to here */
-                            TreeView_SetItem(hwnd, lptvi);
-                            if (hItem)
-                            {
-                                return (LRESULT)hItem;
-                            }
-                            break;
-                        }
-                        case TVM_SETITEMW:
+                        if (bMayBeFirst)
                         {
-                            HandleTvItem(hwnd, (LPTVITEMEXW)lParam);
-                            break;
+                            FixFirstVisibleIntegral(hwnd);
                         }
-                        case TVM_SETITEMHEIGHT:
-                            if (settings.npst == NPST_VISTA)
-                            {
-                                wParam = ScaleForDPI(19);
-                            }
-                            else
-                            {
-                                wParam = ScaleForDPI(21);
-                            }
-                            break;
-                        case TVM_SETTOPMARGIN:
-                            wParam = (settings.npst == NPST_VISTA)
-                            ? 0
-                            : ScaleForDPI(9);
-                            break;
-                        case TVM_SETINDENT:
-                            if (settings.npst == NPST_VISTA)
-                            {
-                                wParam = ScaleForDPI(1);
-                            }
-                            break;
+                        return (LRESULT)hItem;
                     }
+                    break;
+                }
+                case TVM_SETITEMW:
+                {
+                    HandleTvItem(hwnd, (LPTVITEMEXW)lParam);
+                    break;
+                }
+                case TVM_EXPAND:
+                {
+                    /* Expanding a node inserts all of its children at once */
+                    BeginNscTreeBatch(hwnd, state);
+                    LRESULT lRes = CNscTree_s_SubClassTreeWndProc_orig(
+                        hwnd, uMsg, wParam, lParam, uIdSubclass, dwRefData
+                    );
+                    EndNscTreeBatch(hwnd);
+                    return lRes;
                 }
+                case WM_SETREDRAW:
+                    if (!wParam && !(state & NSCTREE_REDRAW_OFF))
+                    {
+                        BeginNscTreeBatch(hwnd, state | NSCTREE_REDRAW_OFF);
+                    }
+                    else if (wParam && (state & NSCTREE_REDRAW_OFF))
+                    {
+                        SetPropW(hwnd, NSCTREE_STATE_PROP, (HANDLE)(state & ~(UINT_PTR)NSCTREE_REDRAW_OFF));
+                        EndNscTreeBatch(hwnd);
+                    }
+                    break;
+                case TVM_SETITEMHEIGHT:
+                    if (settings.npst == NPST_VISTA)
+                    {
+                        wParam = ScaleForDPI(19);
+                    }
+                    else
+                    {
+                        wParam = ScaleForDPI(21);
+                    }
+                    break;
+                case TVM_SETTOPMARGIN:
+                    wParam = (settings.npst == NPST_VISTA)
+                    ? 0
+                    : ScaleForDPI(9);
+                    break;
+                case TVM_SETINDENT:
+                    if (settings.npst == NPST_VISTA)
+                    {
+                        wParam = ScaleForDPI(1);
+                    }
+                    break;
             }
         }
     }
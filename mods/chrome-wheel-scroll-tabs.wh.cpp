@@ -2,7 +2,7 @@
 // @id              chrome-wheel-scroll-tabs
 // @name            Chrome/Edge scroll tabs with mouse wheel
 // @description     Use the mouse wheel while hovering over the tab bar to switch between tabs
-// @version         1.2.1
+// @version         1.2.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -12,7 +12,7 @@
 // @include         opera.exe
 // @include         brave.exe
 // @include         *\YandexBrowser\Application\browser.exe
-// @compilerOptions -lcomctl32 -lgdi32
+// @compilerOptions -lcomctl32 -lgdi32 -ldwmapi
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -60,8 +60,11 @@ Yandex Browser.
 // ==/WindhawkModSettings==
 
 #include <commctrl.h>
+#include <dwmapi.h>
 #include <windowsx.h>
 
+#include <vector>
+
 struct {
     bool reverseScrollingDirection;
     bool horizontalScrolling;
@@ -75,6 +78,26 @@ DWORD g_lastScrollTime;
 HWND g_lastScrollWnd;
 short g_lastScrollDeltaRemainder;
 
+// Used to accumulate the wheel deltas of a fast flick into a single tab
+// switch, instead of making the browser activate every intermediate tab.
+constexpr UINT_PTR kPendingScrollTimerId = 0x57484354;  // 'WHCT'
+
+// Per browser window state, passed as the subclass data.
+struct BrowserWindowState {
+    // Invalidated on WM_WINDOWPOSCHANGED and WM_DPICHANGED.
+    bool geometryValid;
+    RECT rect;
+    UINT dpi;
+
+    // The last hit test result, reused while the cursor doesn't move.
+    bool hitTestValid;
+    POINT hitTestPoint;
+    LRESULT hitTestResult;
+
+    int pendingDelta;
+    bool scrollPending;
+};
+
 // wParam - TRUE to subclass, FALSE to unsubclass
 // lParam - subclass data
 UINT g_subclassRegisteredMsg = RegisterWindowMessage(
@@ -161,15 +184,106 @@ BOOL SetWindowSubclassFromAnyThread(HWND hWnd,
     return param.result;
 }
 
-bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
+UINT GetPendingScrollTimeout() {
+    // Wait for one display frame, the browser can't paint an intermediate tab
+    // faster than that anyway.
+    DWM_TIMING_INFO timingInfo{
+        .cbSize = sizeof(DWM_TIMING_INFO),
+    };
+    if (FAILED(DwmGetCompositionTimingInfo(nullptr, &timingInfo)) ||
+        !timingInfo.rateRefresh.uiNumerator) {
+        return 16;
+    }
+
+    UINT timeout = MulDiv(1000, timingInfo.rateRefresh.uiDenominator,
+                          timingInfo.rateRefresh.uiNumerator);
+    return timeout > USER_TIMER_MINIMUM ? timeout : USER_TIMER_MINIMUM;
+}
+
+void SendTabSwitch(int clicks) {
+    WORD key = VK_NEXT;
+    if (clicks < 0) {
+        clicks = -clicks;
+        key = VK_PRIOR;
+    }
+
+    std::vector<INPUT> input(clicks * 2 + 2);
+    for (auto& item : input) {
+        item.type = INPUT_KEYBOARD;
+    }
+
+    input[0].ki.wVk = VK_CONTROL;
+
+    for (int i = 0; i < clicks; i++) {
+        input[1 + i * 2].ki.wVk = key;
+        input[1 + i * 2 + 1].ki.wVk = key;
+        input[1 + i * 2 + 1].ki.dwFlags = KEYEVENTF_KEYUP;
+    }
+
+    input[1 + clicks * 2].ki.wVk = VK_CONTROL;
+    input[1 + clicks * 2].ki.dwFlags = KEYEVENTF_KEYUP;
+
+    SendInput(input.size(), input.data(), sizeof(input[0]));
+}
+
+void FlushPendingScroll(HWND hWnd, BrowserWindowState* state) {
+    KillTimer(hWnd, kPendingScrollTimerId);
+    state->scrollPending = false;
+
+    int delta = state->pendingDelta;
+    state->pendingDelta = 0;
+
+    // The keys are sent to the foreground window, make sure it didn't change
+    // while the deltas were accumulated.
+    HWND hForegroundWnd = GetForegroundWindow();
+    if (!hForegroundWnd || GetAncestor(hForegroundWnd, GA_ROOTOWNER) != hWnd) {
+        g_lastScrollWnd = nullptr;
+        return;
+    }
+
+    if (hWnd == g_lastScrollWnd &&
+        GetTickCount() - g_lastScrollTime < 1000 * 5) {
+        delta += g_lastScrollDeltaRemainder;
+    }
+
+    int clicks = delta / WHEEL_DELTA;
+    Wh_Log(L"%d clicks (delta=%d)", clicks, delta);
+
+    if (clicks) {
+        SendTabSwitch(clicks);
+    }
+
+    g_lastScrollTime = GetTickCount();
+    g_lastScrollWnd = hWnd;
+    g_lastScrollDeltaRemainder = delta % WHEEL_DELTA;
+}
+
+void CancelPendingScroll(HWND hWnd, BrowserWindowState* state) {
+    if (state->scrollPending) {
+        KillTimer(hWnd, kPendingScrollTimerId);
+        state->scrollPending = false;
+        state->pendingDelta = 0;
+    }
+}
+
+bool OnMouseWheel(HWND hWnd,
+                  BrowserWindowState* state,
+                  WORD keys,
+                  short delta,
+                  int xPos,
+                  int yPos) {
     if (keys) {
         return false;
     }
 
-    RECT rect{};
-    GetWindowRect(hWnd, &rect);
+    if (!state->geometryValid) {
+        GetWindowRect(hWnd, &state->rect);
+        state->dpi = GetDpiForWindowWithFallback(hWnd);
+        state->geometryValid = true;
+    }
 
-    UINT dpi = GetDpiForWindowWithFallback(hWnd);
+    const RECT& rect = state->rect;
+    UINT dpi = state->dpi;
 
     if (int scrollAreaLimitPixelsFromTop =
             g_settings.scrollAreaLimitPixelsFromTop) {
@@ -191,7 +305,15 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
         }
     }
 
-    switch (SendMessage(hWnd, WM_NCHITTEST, 0, MAKELPARAM(xPos, yPos))) {
+    if (!state->hitTestValid || state->hitTestPoint.x != xPos ||
+        state->hitTestPoint.y != yPos) {
+        state->hitTestResult =
+            SendMessage(hWnd, WM_NCHITTEST, 0, MAKELPARAM(xPos, yPos));
+        state->hitTestPoint = {xPos, yPos};
+        state->hitTestValid = true;
+    }
+
+    switch (state->hitTestResult) {
         case HTCLIENT:
         case HTCAPTION:
         case HTSYSMENU:
@@ -210,9 +332,10 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
         return false;
     }
 
-    if (GetKeyState(VK_MENU) < 0 || GetKeyState(VK_LWIN) < 0 ||
-        GetKeyState(VK_RWIN) < 0 || GetKeyState(VK_PRIOR) < 0 ||
-        GetKeyState(VK_NEXT) < 0) {
+    BYTE keyState[256];
+    if (!GetKeyboardState(keyState) || (keyState[VK_MENU] & 0x80) ||
+        (keyState[VK_LWIN] & 0x80) || (keyState[VK_RWIN] & 0x80) ||
+        (keyState[VK_PRIOR] & 0x80) || (keyState[VK_NEXT] & 0x80)) {
         return false;
     }
 
@@ -226,49 +349,17 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
         }
     }
 
-    if (hWnd == g_lastScrollWnd &&
-        GetTickCount() - g_lastScrollTime < 1000 * 5) {
-        delta += g_lastScrollDeltaRemainder;
-    }
-
-    int clicks = delta / WHEEL_DELTA;
-    Wh_Log(L"%d clicks (delta=%d)", clicks, delta);
-
-    WORD key = VK_NEXT;
-    if (clicks < 0) {
-        clicks = -clicks;
-        key = VK_PRIOR;
+    state->pendingDelta += delta;
+    if (!state->scrollPending &&
+        SetTimer(hWnd, kPendingScrollTimerId, GetPendingScrollTimeout(),
+                 nullptr)) {
+        state->scrollPending = true;
     }
 
-    INPUT* input = new INPUT[clicks * 2 + 2];
-    for (int i = 0; i < clicks * 2 + 2; i++) {
-        input[i].type = INPUT_KEYBOARD;
-        input[i].ki.wScan = 0;
-        input[i].ki.time = 0;
-        input[i].ki.dwExtraInfo = 0;
+    if (!state->scrollPending) {
+        FlushPendingScroll(hWnd, state);
     }
 
-    input[0].ki.wVk = VK_CONTROL;
-    input[0].ki.dwFlags = 0;
-
-    for (int i = 0; i < clicks; i++) {
-        input[1 + i * 2].ki.wVk = key;
-        input[1 + i * 2].ki.dwFlags = 0;
-        input[1 + i * 2 + 1].ki.wVk = key;
-        input[1 + i * 2 + 1].ki.dwFlags = KEYEVENTF_KEYUP;
-    }
-
-    input[1 + clicks * 2].ki.wVk = VK_CONTROL;
-    input[1 + clicks * 2].ki.dwFlags = KEYEVENTF_KEYUP;
-
-    SendInput(clicks * 2 + 2, input, sizeof(input[0]));
-
-    delete[] input;
-
-    g_lastScrollTime = GetTickCount();
-    g_lastScrollWnd = hWnd;
-    g_lastScrollDeltaRemainder = delta % WHEEL_DELTA;
-
     return true;
 }
 
@@ -278,11 +369,29 @@ LRESULT CALLBACK BrowserWindowSubclassProc(_In_ HWND hWnd,
                                            _In_ LPARAM lParam,
                                            _In_ UINT_PTR uIdSubclass,
                                            _In_ DWORD_PTR dwRefData) {
+    auto* state = (BrowserWindowState*)dwRefData;
+
     if (uMsg == WM_NCDESTROY || (uMsg == g_subclassRegisteredMsg && !wParam)) {
         RemoveWindowSubclass(hWnd, BrowserWindowSubclassProc, 0);
+        CancelPendingScroll(hWnd, state);
+        delete state;
+        return DefSubclassProc(hWnd, uMsg, wParam, lParam);
     }
 
     switch (uMsg) {
+        case WM_WINDOWPOSCHANGED:
+        case WM_DPICHANGED:
+            state->geometryValid = false;
+            state->hitTestValid = false;
+            break;
+
+        case WM_TIMER:
+            if (wParam == kPendingScrollTimerId) {
+                FlushPendingScroll(hWnd, state);
+                return 0;
+            }
+            break;
+
         case WM_MOUSEWHEEL:
         case WM_MOUSEHWHEEL: {
             WORD fwKeys = GET_KEYSTATE_WPARAM(wParam);
@@ -306,7 +415,7 @@ LRESULT CALLBACK BrowserWindowSubclassProc(_In_ HWND hWnd,
                 zDelta = -zDelta;
             }
 
-            if (OnMouseWheel(hWnd, fwKeys, zDelta, xPos, yPos)) {
+            if (OnMouseWheel(hWnd, state, fwKeys, zDelta, xPos, yPos)) {
                 return 0;
             }
             break;
@@ -360,7 +469,11 @@ BOOL CALLBACK InitialEnumBrowserWindowsFunc(HWND hWnd, LPARAM lParam) {
             g_uiThreadId = dwThreadId;
         }
 
-        SetWindowSubclassFromAnyThread(hWnd, BrowserWindowSubclassProc, 0, 0);
+        auto* state = new BrowserWindowState{};
+        if (!SetWindowSubclassFromAnyThread(hWnd, BrowserWindowSubclassProc, 0,
+                                            (DWORD_PTR)state)) {
+            delete state;
+        }
     }
 
     return TRUE;
@@ -409,7 +522,11 @@ HWND WINAPI CreateWindowExWHook(DWORD dwExStyle,
             g_uiThreadId = GetCurrentThreadId();
         }
 
-        SetWindowSubclass(hWnd, BrowserWindowSubclassProc, 0, 0);
+        auto* state = new BrowserWindowState{};
+        if (!SetWindowSubclass(hWnd, BrowserWindowSubclassProc, 0,
+                               (DWORD_PTR)state)) {
+            delete state;
+        }
     }
 
     return hWnd;
@@ -2,7 +2,7 @@
 // @id              classic-explorer-treeview
 // @name            Classic Explorer Treeview
 // @description     Modifies Folder Treeview in file explorer so as to make it look more classic.
-// @version         1.1.3
+// @version         1.1.4
 // @author          Waldemar
 // @github          https://github.com/CyprinusCarpio
 // @include         explorer.exe
@@ -66,6 +66,9 @@ For issue reports, contact waldemar3194 on Discord, or file a report at my [gith
 
 
 # Changelog:
+## 1.1.4
+- Expando buttons are drawn from pre-rendered glyphs for faster scrolling
+
 ## 1.1.3
 - Use Microsoft::WRL::ComPtr instead of winrt::com_ptr
 - Symbol hooks made compatible with Win7
@@ -165,6 +168,7 @@ are enabled.
 
 #include <wingdi.h>
 #include <wrl.h>
+#include <mutex>
 #include <vector>
 #include <shlwapi.h>
 #include <shdeprecated.h>
@@ -305,10 +309,116 @@ double ColorDistance(DWORD color1, DWORD color2)
     return std::sqrt(std::pow(r2 - r1, 2) + std::pow(g2 - g1, 2) + std::pow(b2 - b1, 2));
 }
 
-void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
+#define EXPANDO_GLYPH_SIZE 9
+
+// The expando buttons only depend on the system colors, so both of them are
+// pre-rendered side by side (collapsed, then expanded) and blitted for each
+// item. The atlas is re-rendered after WM_SYSCOLORCHANGE, WM_THEMECHANGED or a
+// settings change. Explorer windows paint on different threads, hence the lock.
+struct ExpandoGlyphAtlas
+{
+    HDC hdc = nullptr;
+    HBITMAP bitmap = nullptr;
+    HBITMAP originalBitmap = nullptr;
+    bool valid = false;
+};
+
+std::mutex g_expandoGlyphAtlasMutex;
+ExpandoGlyphAtlas g_expandoGlyphAtlas;
+
+// Geometry of the treeview being painted, captured at CDDS_PREPAINT. The text
+// position of an item is derived from its level in the custom draw data,
+// instead of querying every item's rect.
+struct TreePaintState
+{
+    HWND hTree;
+    int indent;
+    bool hasLevelZeroLeft;
+    int levelZeroLeft;
+};
+
+thread_local TreePaintState g_treePaintState;
+
+void InvalidateExpandoGlyphs()
+{
+    std::lock_guard<std::mutex> guard(g_expandoGlyphAtlasMutex);
+    g_expandoGlyphAtlas.valid = false;
+}
+
+void DestroyExpandoGlyphs()
+{
+    std::lock_guard<std::mutex> guard(g_expandoGlyphAtlasMutex);
+    if (g_expandoGlyphAtlas.hdc)
+    {
+        SelectObject(g_expandoGlyphAtlas.hdc, g_expandoGlyphAtlas.originalBitmap);
+        DeleteObject(g_expandoGlyphAtlas.bitmap);
+        DeleteDC(g_expandoGlyphAtlas.hdc);
+    }
+    g_expandoGlyphAtlas = {};
+}
+
+void DrawExpandoGlyph(HDC hdc, int left, int top, bool expanded,
+                      DWORD windowColor, DWORD frameColor, DWORD textColor)
 {
-    RECT rect;
-    TreeView_GetItemRect(hTree, hItem, &rect, TRUE);
+    // Define the rectangle for the button
+    RECT buttonRect;
+    buttonRect.left = left;
+    buttonRect.top = top;
+    buttonRect.right = left + EXPANDO_GLYPH_SIZE;
+    buttonRect.bottom = top + EXPANDO_GLYPH_SIZE;
+
+    // Fill the rectangle with the window color and draw a frame around it
+    HBRUSH brush = CreateSolidBrush(windowColor);
+    FillRect(hdc, &buttonRect, brush);
+    DeleteObject(brush);
+
+    brush = CreateSolidBrush(frameColor);
+    FrameRect(hdc, &buttonRect, brush);
+    DeleteObject(brush);
+
+    // Create a pen with a solid style and the button text color, and select it into the device context
+    HPEN hPen = CreatePen(PS_SOLID, 1, textColor);
+    HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+
+    // Draw a +/- symbol based on the expanded state
+    MoveToEx(hdc, left + 2, top + 4, NULL);
+    LineTo(hdc, left + 7, top + 4);
+    if (!expanded)
+    {
+        MoveToEx(hdc, left + 4, top + 2, NULL);
+        LineTo(hdc, left + 4, top + 7);
+    }
+
+    // Restore the original pen to the device context and delete the pen
+    SelectObject(hdc, hOldPen);
+    DeleteObject(hPen);
+}
+
+// Must be called with g_expandoGlyphAtlasMutex held.
+bool RenderExpandoGlyphs()
+{
+    if (!g_expandoGlyphAtlas.hdc)
+    {
+        HDC screenDc = GetDC(NULL);
+        g_expandoGlyphAtlas.hdc = CreateCompatibleDC(screenDc);
+        g_expandoGlyphAtlas.bitmap = CreateCompatibleBitmap(
+            screenDc, EXPANDO_GLYPH_SIZE * 2, EXPANDO_GLYPH_SIZE);
+        ReleaseDC(NULL, screenDc);
+
+        if (!g_expandoGlyphAtlas.hdc || !g_expandoGlyphAtlas.bitmap)
+        {
+            Wh_Log(L"Failed to create the expando glyph atlas");
+            if (g_expandoGlyphAtlas.bitmap)
+                DeleteObject(g_expandoGlyphAtlas.bitmap);
+            if (g_expandoGlyphAtlas.hdc)
+                DeleteDC(g_expandoGlyphAtlas.hdc);
+            g_expandoGlyphAtlas = {};
+            return false;
+        }
+
+        g_expandoGlyphAtlas.originalBitmap = (HBITMAP)SelectObject(
+            g_expandoGlyphAtlas.hdc, g_expandoGlyphAtlas.bitmap);
+    }
 
     // Get system colors
     bool useHighlight = false;
@@ -334,84 +444,82 @@ void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
         }
     }
 
-    // Even though the item height should be 16, I'm accomodating some more heights
-    UINT itemHeight = TreeView_GetItemHeight(hTree);
-    switch(itemHeight)
-    {
-    default:
-    case 16:
-        rect.left -= 34;
-        rect.top += 4;
-        break;
-    case 18:
-        rect.left -= 33;
-        rect.top += 6;
-        break;
-    }
-
-    // Define a TVITEM struct to retrieve the number of children for the specified item
-    TVITEM tvi;
-    tvi.mask = TVIF_CHILDREN; // Specify that we are interested in the number of children
-    tvi.hItem = hItem; // Set the handle of the tree view item
+    DWORD frameColor = useHighlight ? highlightColor : shadowColor;
+    DWORD textColor = GetSysColor(COLOR_BTNTEXT);
 
-    // Check if the item is at the top level by comparing the left position of the rectangle
-    // to either 10 or -10 based on the value of g_settingLinesAtRoot
-    bool isTopLevel = rect.left <= (g_settingLinesAtRoot ? 10 : -10);
+    DrawExpandoGlyph(g_expandoGlyphAtlas.hdc, 0, 0, false,
+                     windowColor, frameColor, textColor);
+    DrawExpandoGlyph(g_expandoGlyphAtlas.hdc, EXPANDO_GLYPH_SIZE, 0, true,
+                     windowColor, frameColor, textColor);
 
-    // Check if the setting to draw buttons is enabled and the node is not a top-level node when lines at root is disabled
-    // and the node has one or more children
-    if (!(isTopLevel && !g_settingLinesAtRoot) && TreeView_GetItem(hTree, &tvi) && tvi.cChildren > 0)
-    {
-        // Get the state of the item
-        UINT state = TreeView_GetItemState(hTree, hItem, TVIS_EXPANDED);
+    g_expandoGlyphAtlas.valid = true;
+    return true;
+}
 
-        // Create a solid brush with the window color and select it into the device context
-        HBRUSH brush = CreateSolidBrush(windowColor);
-        HBRUSH original = (HBRUSH)SelectObject(hdc, brush);
+void BeginTreePaint(HWND hTree)
+{
+    g_treePaintState.hTree = hTree;
+    g_treePaintState.indent = TreeView_GetIndent(hTree);
+    g_treePaintState.hasLevelZeroLeft = false;
+}
 
-        // Define the rectangle for the button
-        RECT buttonRect;
-        buttonRect.left = rect.left;
-        buttonRect.top = rect.top;
-        buttonRect.right = rect.left + 9;
-        buttonRect.bottom = rect.top + 9;
+void DrawExpandoButton(HWND hTree, const NMTVCUSTOMDRAW* pCustomDraw)
+{
+    HTREEITEM hItem = reinterpret_cast<HTREEITEM>(pCustomDraw->nmcd.dwItemSpec);
 
-        // Fill the rectangle with the brush color and delete the brush
-        FillRect(hdc, &buttonRect, brush);
-        DeleteObject(brush);
+    // Top-level nodes have no button when lines at root is disabled
+    if (pCustomDraw->iLevel == 0 && !g_settingLinesAtRoot)
+        return;
 
-        // Create a new brush with the highlight color if useHighlight is true, otherwise shadowColor
-        brush = CreateSolidBrush(useHighlight ? highlightColor : shadowColor);
+    // Retrieve the number of children and the expanded state in one go
+    TVITEM tvi;
+    tvi.mask = TVIF_CHILDREN | TVIF_STATE;
+    tvi.stateMask = TVIS_EXPANDED;
+    tvi.hItem = hItem;
+    if (!TreeView_GetItem(hTree, &tvi) || tvi.cChildren <= 0)
+        return;
+
+    // The text of each level is indented by a fixed amount, so a single item
+    // rect per paint is enough to position all items
+    TreePaintState& paintState = g_treePaintState;
+    if (paintState.hTree != hTree)
+        BeginTreePaint(hTree);
+
+    if (!paintState.hasLevelZeroLeft)
+    {
+        RECT textRect;
+        if (!TreeView_GetItemRect(hTree, hItem, &textRect, TRUE))
+            return;
 
-        // Draw a frame around the button rectangle with the new brush and delete the brush
-        FrameRect(hdc, &buttonRect, brush);
-        DeleteObject(brush);
+        paintState.levelZeroLeft = textRect.left - pCustomDraw->iLevel * paintState.indent;
+        paintState.hasLevelZeroLeft = true;
+    }
 
-        // Restore the original brush to the device context
-        SelectObject(hdc, original);
+    int left = paintState.levelZeroLeft + pCustomDraw->iLevel * paintState.indent;
+    int top = pCustomDraw->nmcd.rc.top;
 
-        // Create a pen with a solid style and the button text color, and select it into the device context
-        HPEN hPen = CreatePen(PS_SOLID, 1, GetSysColor(COLOR_BTNTEXT));
-        HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+    // Even though the item height should be 16, I'm accomodating some more heights
+    int itemHeight = pCustomDraw->nmcd.rc.bottom - pCustomDraw->nmcd.rc.top;
+    switch(itemHeight)
+    {
+    default:
+    case 16:
+        left -= 34;
+        top += 4;
+        break;
+    case 18:
+        left -= 33;
+        top += 6;
+        break;
+    }
 
-        // Draw a +/- symbol in the item's button based on its expanded state
-        if (state & TVIS_EXPANDED)
-        {
-            MoveToEx(hdc, rect.left + 2, rect.top + 4, NULL);
-            LineTo(hdc, rect.left + 7, rect.top + 4);
-        }
-        else
-        {
-            MoveToEx(hdc, rect.left + 2, rect.top + 4, NULL);
-            LineTo(hdc, rect.left + 7, rect.top + 4);
-            MoveToEx(hdc, rect.left + 4, rect.top + 2, NULL);
-            LineTo(hdc, rect.left + 4, rect.top + 7);
-        }
+    std::lock_guard<std::mutex> guard(g_expandoGlyphAtlasMutex);
+    if (!g_expandoGlyphAtlas.valid && !RenderExpandoGlyphs())
+        return;
 
-        // Restore the original pen to the device context and delete the pen
-        SelectObject(hdc, hOldPen);
-        DeleteObject(hPen);
-    }
+    int glyphLeft = (tvi.state & TVIS_EXPANDED) ? EXPANDO_GLYPH_SIZE : 0;
+    BitBlt(pCustomDraw->nmcd.hdc, left, top, EXPANDO_GLYPH_SIZE, EXPANDO_GLYPH_SIZE,
+           g_expandoGlyphAtlas.hdc, glyphLeft, 0, SRCCOPY);
 }
 
 int GetThemedBandOffset()  // extremely retarded and only semi-accurate
@@ -513,10 +621,11 @@ LRESULT CALLBACK NTCSubclassProc(_In_ HWND hWnd,
         {
         case NM_CUSTOMDRAW: // Handle custom drawing notifications sent by the treeview control
         {
-            HWND hTree = FindWindowEx(hWnd, NULL, L"SysTreeView32", NULL); // Find the treeview control
+            HWND hTree = lpnmh->hwndFrom; // The treeview control
             LPNMTVCUSTOMDRAW pCustomDraw = (LPNMTVCUSTOMDRAW)lParam;
             if(pCustomDraw->nmcd.dwDrawStage == CDDS_PREPAINT)
             {
+                BeginTreePaint(hTree);
                 return CDRF_NOTIFYITEMDRAW;
             }
             if(pCustomDraw->nmcd.dwDrawStage == CDDS_ITEMPREPAINT)
@@ -525,8 +634,7 @@ LRESULT CALLBACK NTCSubclassProc(_In_ HWND hWnd,
             }
             if(pCustomDraw->nmcd.dwDrawStage == CDDS_ITEMPOSTPAINT)
             {
-                HTREEITEM hItem = reinterpret_cast<HTREEITEM>(pCustomDraw->nmcd.dwItemSpec);
-                DrawExpandoButton(hTree, pCustomDraw->nmcd.hdc, hItem);
+                DrawExpandoButton(hTree, pCustomDraw);
                 return S_OK;
             }
         }
@@ -1024,7 +1132,12 @@ LRESULT CALLBACK TVSubclassProc(_In_ HWND hWnd,
             lptvi->iIntegral = 1;
         }
     }
-    else if(uMsg == WM_SYSCOLORCHANGE && g_lineColorOptionInt == 2)
+    else if(uMsg == WM_SYSCOLORCHANGE || uMsg == WM_THEMECHANGED)
+    {
+        InvalidateExpandoGlyphs();
+    }
+
+    if(uMsg == WM_SYSCOLORCHANGE && g_lineColorOptionInt == 2)
     {
         //If the automatic line color setting is enabled, new best color needs to be set
         DWORD windowColor = GetSysColor(COLOR_WINDOW);
@@ -1322,6 +1435,7 @@ void Wh_ModUninit()
         WindhawkUtils::RemoveWindowSubclassFromAnyThread(g_FEWExtras[i].hNSTC, NTCSubclassProc);
         WindhawkUtils::RemoveWindowSubclassFromAnyThread(g_FEWExtras[i].hTV, TVSubclassProc);
     }
+    DestroyExpandoGlyphs();
     Wh_Log(L"Classic Explorer Treeview uninit completed successfully.");
 }
 
@@ -1349,4 +1463,6 @@ void Wh_ModSettingsChanged()
     {
         g_lineColorOptionInt = 2;
     }
+
+    InvalidateExpandoGlyphs();
 }
\ No newline at end of file
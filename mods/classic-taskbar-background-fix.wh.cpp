@@ -2,7 +2,7 @@
 // @id              classic-taskbar-background-fix
 // @name            Classic Taskbar background fix
 // @description     Fixes Taskbar background in classic theme by replacing black background with a classic button face colour
-// @version         1.0.3
+// @version         1.0.4
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -75,10 +75,13 @@ I would like to thank @Anixx and @OrthodoxWindows for testing the mod during its
 #include <winnt.h>      //defines HRESULT, needed for Visual Studio intellisense only, in clang the HRESULT seems to be defined already elsewhere, but the include does not harm either
 //#include <uxtheme.h>    //currently not needed since we use our own declaration of DrawThemeParentBackground and DrawThemeParentBackgroundEx
 #include <intrin.h>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 #include <map>
 #include <mutex>
-#include <new>          //std::nothrow
+#include <utility>      //std::pair
 
 
 
@@ -377,121 +380,237 @@ bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* pa
     return false;
 }
 
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+const DWORD pixelRgbMask = 0x00FFFFFF;
+
+//DIB section pixels are stored as 0x00RRGGBB, while COLORREF is 0x00BBGGRR
+DWORD ColorRefToPixel(COLORREF color) {
+    return (GetRValue(color) << 16) | (GetGValue(color) << 8) | GetBValue(color);
+}
+
+//Replaces the RGB value of all pixels which have the RGB value oldPixel with newPixel, keeping the alpha channel. Returns true if any pixel was replaced.
+bool ReplacePixelsScalar(DWORD* pixels, size_t pixelCount, DWORD oldPixel, DWORD newPixel) {
+
+    bool replaced = false;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        if ((pixels[i] & pixelRgbMask) == oldPixel) {
+            pixels[i] = (pixels[i] & ~pixelRgbMask) | newPixel;
+            replaced = true;
+        }
+    }
+    return replaced;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+__attribute__((target("sse2")))
+bool ReplacePixelsSse2(DWORD* pixels, size_t pixelCount, DWORD oldPixel, DWORD newPixel) {
+
+    const __m128i rgbMask = _mm_set1_epi32(pixelRgbMask);
+    const __m128i oldPixels = _mm_set1_epi32(oldPixel);
+    const __m128i newPixels = _mm_set1_epi32(newPixel);
+    __m128i replacedMask = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= pixelCount; i += 4) {
+        __m128i current = _mm_loadu_si128((const __m128i*)(pixels + i));
+        __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(current, rgbMask), oldPixels);
+        if (_mm_movemask_epi8(mask)) {
+            __m128i replacement = _mm_or_si128(_mm_andnot_si128(rgbMask, current), newPixels);
+            __m128i result = _mm_or_si128(_mm_and_si128(mask, replacement), _mm_andnot_si128(mask, current));
+            _mm_storeu_si128((__m128i*)(pixels + i), result);
+            replacedMask = _mm_or_si128(replacedMask, mask);
+        }
+    }
+
+    bool replaced = _mm_movemask_epi8(replacedMask) != 0;
+    return ReplacePixelsScalar(pixels + i, pixelCount - i, oldPixel, newPixel) || replaced;
+}
+
+__attribute__((target("avx2")))
+bool ReplacePixelsAvx2(DWORD* pixels, size_t pixelCount, DWORD oldPixel, DWORD newPixel) {
+
+    const __m256i rgbMask = _mm256_set1_epi32(pixelRgbMask);
+    const __m256i oldPixels = _mm256_set1_epi32(oldPixel);
+    const __m256i newPixels = _mm256_set1_epi32(newPixel);
+    __m256i replacedMask = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 8 <= pixelCount; i += 8) {
+        __m256i current = _mm256_loadu_si256((const __m256i*)(pixels + i));
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(current, rgbMask), oldPixels);
+        if (!_mm256_testz_si256(mask, mask)) {
+            __m256i replacement = _mm256_or_si256(_mm256_andnot_si256(rgbMask, current), newPixels);
+            _mm256_storeu_si256((__m256i*)(pixels + i), _mm256_blendv_epi8(current, replacement, mask));
+            replacedMask = _mm256_or_si256(replacedMask, mask);
+        }
+    }
+
+    bool replaced = !_mm256_testz_si256(replacedMask, replacedMask);
+    return ReplacePixelsScalar(pixels + i, pixelCount - i, oldPixel, newPixel) || replaced;
+}
+
+#endif
+
+bool ReplacePixels(DWORD* pixels, size_t pixelCount, DWORD oldPixel, DWORD newPixel) {
+
+#if defined(_M_IX86) || defined(_M_X64)
+    static const bool avx2Available = IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE);    //returns false on systems older than Windows 10, which is fine since the SSE2 version is used then
+    if (avx2Available)
+        return ReplacePixelsAvx2(pixels, pixelCount, oldPixel, newPixel);
+    else
+        return ReplacePixelsSse2(pixels, pixelCount, oldPixel, newPixel);
+#else
+    return ReplacePixelsScalar(pixels, pixelCount, oldPixel, newPixel);
+#endif
+}
+
+
+typedef struct tagPixelSurface {
+    HDC memDC;
+    HBITMAP dibSection;
+    HGDIOBJ oldBitmap;
+    DWORD* pixels;      //top-down rows, so the pixel at (x, y) is pixels[y * width + x]
+} PixelSurface;
+
+const size_t maxCachedPixelSurfaces = 16;
+
+std::mutex g_pixelSurfaceCacheMutex;
+std::map<std::pair<int, int>, PixelSurface> g_pixelSurfaceCache;     //keyed by width and height. Only a few distinct sizes are expected, so the cache is simply emptied if it grows too large
+
+void FreePixelSurface(PixelSurface& surface) {
+
+    SelectObject(surface.memDC, surface.oldBitmap);
+    DeleteObject(surface.dibSection);
+    DeleteDC(surface.memDC);
+}
+
+void FreePixelSurfaces() {      //g_pixelSurfaceCacheMutex must be held by the caller
+
+    for (auto& entry : g_pixelSurfaceCache) {
+        FreePixelSurface(entry.second);
+    }
+    g_pixelSurfaceCache.clear();
+}
+
+PixelSurface* GetCachedPixelSurface(HDC hdc, int width, int height) {      //g_pixelSurfaceCacheMutex must be held by the caller
+
+    auto it = g_pixelSurfaceCache.find({ width, height });
+    if (it != g_pixelSurfaceCache.end())
+        return &it->second;
+
+    if (g_pixelSurfaceCache.size() >= maxCachedPixelSurfaces)
+        FreePixelSurfaces();
+
+    PixelSurface surface = {};
+
+    surface.memDC = CreateCompatibleDC(hdc);
+    if (!surface.memDC) {
+        Wh_Log(L"CreateCompatibleDC failed");
+        return NULL;
+    }
+
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;   //negative height for a top-down DIB
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;  //32-bit color depth
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    surface.dibSection = CreateDIBSection(hdc, &bmi, DIB_RGB_COLORS, (void**)&surface.pixels, NULL, 0);
+    if (!surface.dibSection || !surface.pixels) {
+        Wh_Log(L"CreateDIBSection failed");
+        DeleteDC(surface.memDC);
+        return NULL;
+    }
+
+    surface.oldBitmap = SelectObject(surface.memDC, surface.dibSection);
+    if (!surface.oldBitmap) {
+        Wh_Log(L"SelectObject for dibSection failed");
+        DeleteObject(surface.dibSection);
+        DeleteDC(surface.memDC);
+        return NULL;
+    }
+
+    return &g_pixelSurfaceCache.insert({ { width, height }, surface }).first->second;
+}
+
 void ConditionalFillRect(HDC hdc, const RECT& rect, COLORREF oldColor, COLORREF newColor, int newColorIndex, bool useFloodFill) {
 
-    int pixelCount = (rect.right - rect.left) * (rect.bottom - rect.top);
-    if (pixelCount == 0) {
+    int width = rect.right - rect.left;
+    int height = rect.bottom - rect.top;
+    if (width <= 0 || height <= 0) {
         //Wh_Log(L"pixelCount == 0");
         return;
     }
 
-    //Create a compatible DC and bitmap. Even though hdc is already a memDC, we need to create one more memDC, since we need to get access to pixels using ExtFloodFill which does not support providing top-left coordinates, or alternatively, using GetDIBits and SetDIBits, which does not support providing left-right coordinates.
-    HDC memDC = CreateCompatibleDC(hdc);
-    if (!memDC) {
-        Wh_Log(L"CreateCompatibleDC failed");
+    std::lock_guard<std::mutex> guard(g_pixelSurfaceCacheMutex);
+
+    //Get a cached DIB section memDC. Even though hdc is already a memDC, we need one more memDC, since we need to get access to pixels using ExtFloodFill which does not support providing top-left coordinates. The DIB section also provides direct access to the pixels, without GetDIBits and SetDIBits round trip.
+    PixelSurface* surface = GetCachedPixelSurface(hdc, width, height);
+    if (!surface)
         return;
-    }
 
-    HBITMAP memBitmap = CreateCompatibleBitmap(hdc, rect.right - rect.left, rect.bottom - rect.top);
-    if (!memBitmap) {
-        Wh_Log(L"CreateCompatibleBitmap failed");
+    //copy the existing content from hdc
+    if (!BitBlt(surface->memDC, 0, 0, width, height, hdc, rect.left, rect.top, SRCCOPY)) {
+        Wh_Log(L"BitBlt to memDC failed");
+        return;
     }
-    else {
-        HGDIOBJ oldBitmap = SelectObject(memDC, memBitmap);
-        if (!oldBitmap) {
-            Wh_Log(L"SelectObject for memBitmap failed");
+
+    GdiFlush();     //make sure that GDI has finished drawing to the DIB section before accessing its pixels directly
+
+    DWORD oldPixel = ColorRefToPixel(oldColor);
+
+    if (useFloodFill) {
+
+        //ExtFloodFill would fail anyway if the starting pixel does not have the old colour, so skip it and the blit back in that case
+        DWORD startPixel = surface->pixels[(size_t)(height - 1) * width + (width - 1)];
+        if ((startPixel & pixelRgbMask) != oldPixel)
+            return;
+
+        HBRUSH newBrush = GetSysColorBrush(newColorIndex);
+        if (!newBrush) {
+            Wh_Log(L"GetSysColorBrush failed - is the colour supported by current OS?");
         }
         else {
-            //copy the existing content from hdc
-            if (!BitBlt(memDC, 0, 0, rect.right - rect.left, rect.bottom - rect.top, hdc, rect.left, rect.top, SRCCOPY)) {
-                Wh_Log(L"BitBlt to memDC failed");
+            HGDIOBJ oldBrush = SelectObject(surface->memDC, newBrush);
+            if (!oldBrush) {
+                Wh_Log(L"SelectObject for newBrush failed");
             }
             else {
-                if (useFloodFill) {
-
-                    HBRUSH newBrush = GetSysColorBrush(newColorIndex);
-                    if (!newBrush) {
-                        Wh_Log(L"GetSysColorBrush failed - is the colour supported by current OS?");
-                    }
-                    else {
-                        HGDIOBJ oldBrush = SelectObject(memDC, newBrush);
-                        if (!oldBrush) {
-                            Wh_Log(L"SelectObject for newBrush failed");
-                        }
-                        else {
-                            if (!ExtFloodFill(
-                                memDC,
-                                //start from bottom right corner
-                                rect.right - rect.left - 1, //right
-                                rect.bottom - rect.top - 1, //bottom
-                                oldColor,
-                                FLOODFILLSURFACE
-                            )) {
-                                //Wh_Log(L"ExtFloodFill failed");
-                            }
-                            else {
-                                //blit the modified content back to hdc
-                                //TODO: try to blit directly to original hdc, not to memDC from BeginPaint?
-                                if (!BitBlt(hdc, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top, memDC, 0, 0, SRCCOPY))
-                                    Wh_Log(L"BitBlt to hdc failed");
-                            }
-
-                            SelectObject(memDC, oldBrush);
-                        }
-                    }
+                if (!ExtFloodFill(
+                    surface->memDC,
+                    //start from bottom right corner
+                    width - 1, //right
+                    height - 1, //bottom
+                    oldColor,
+                    FLOODFILLSURFACE
+                )) {
+                    //Wh_Log(L"ExtFloodFill failed");
                 }
-                else {      //use conditional colour replacement on all pixels
-
-                    //get pixels array from bitmap
-                    BITMAPINFO bmi = {};
-                    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-                    bmi.bmiHeader.biWidth = rect.right - rect.left;
-                    bmi.bmiHeader.biHeight = rect.bottom - rect.top;
-                    bmi.bmiHeader.biPlanes = 1;
-                    bmi.bmiHeader.biBitCount = 32;  //32-bit color depth
-                    bmi.bmiHeader.biCompression = BI_RGB;
-
-                    COLORREF* pixels = new(std::nothrow) COLORREF[pixelCount];
-                    if (!pixels) {
-                        Wh_Log(L"Allocating pixels array failed");
-                    }
-                    else {
-                        int getDIBitsResult = GetDIBits(memDC, memBitmap, 0, rect.bottom - rect.top, pixels, &bmi, DIB_RGB_COLORS);
-                        if (getDIBitsResult == NULL || getDIBitsResult == ERROR_INVALID_PARAMETER) {
-                            Wh_Log(L"GetDIBits failed");
-                            delete[] pixels;
-                        }
-                        else {
-                            //modify the pixels
-                            for (int i = 0; i < pixelCount; ++i) {
-                                if (pixels[i] == oldColor)
-                                    pixels[i] = newColor;
-                            }
-
-                            //save pixels array back to bitmap
-                            int setDIBitsResult = SetDIBits(memDC, memBitmap, 0, rect.bottom - rect.top, pixels, &bmi, DIB_RGB_COLORS);
-                            delete[] pixels;
-
-                            if (setDIBitsResult == NULL || setDIBitsResult == ERROR_INVALID_PARAMETER) {
-                                Wh_Log(L"SetDIBits failed");
-                            }
-                            else {
-                                //blit the modified content back to hdc
-                                //TODO: try to blit directly to original hdc, not to memDC from BeginPaint?
-                                if (!BitBlt(hdc, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top, memDC, 0, 0, SRCCOPY))
-                                    Wh_Log(L"BitBlt to hdc failed");
-                            }
-                        }
-                    }
+                else {
+                    //blit the modified content back to hdc
+                    //TODO: try to blit directly to original hdc, not to memDC from BeginPaint?
+                    if (!BitBlt(hdc, rect.left, rect.top, width, height, surface->memDC, 0, 0, SRCCOPY))
+                        Wh_Log(L"BitBlt to hdc failed");
                 }
-            }
 
-            //clean up
-            SelectObject(memDC, oldBitmap);
-            DeleteObject(memBitmap);
+                SelectObject(surface->memDC, oldBrush);
+            }
         }
+    }
+    else {      //use conditional colour replacement on all pixels, in place in the DIB section
 
-        DeleteDC(memDC);
+        if (ReplacePixels(surface->pixels, (size_t)width * height, oldPixel, ColorRefToPixel(newColor))) {
+            //blit the modified content back to hdc
+            //TODO: try to blit directly to original hdc, not to memDC from BeginPaint?
+            if (!BitBlt(hdc, rect.left, rect.top, width, height, surface->memDC, 0, 0, SRCCOPY))
+                Wh_Log(L"BitBlt to hdc failed");
+        }
     }
 }
 
@@ -1069,6 +1188,12 @@ void Wh_ModUninit() {
     }
 
 
+    {
+        std::lock_guard<std::mutex> guard(g_pixelSurfaceCacheMutex);
+        FreePixelSurfaces();
+    }
+
+
     if (hUxtheme) {
         FreeLibrary(hUxtheme);
         hUxtheme = NULL;
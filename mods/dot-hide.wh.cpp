@@ -2,7 +2,7 @@
 // @id              dot-hide
 // @name            Dot Hide
 // @description     Keep dot files and directories out of sight, Because it wouldn't happen in Linux...
-// @version         1.0.0
+// @version         1.0.1
 // @author          Tomer Zait (realgam3)
 // @github          https://github.com/realgam3
 // @twitter         https://twitter.com/realgam3
@@ -26,59 +26,77 @@ Dot Hide tackles this by automatically hiding these files and directories, creat
 */
 // ==/WindhawkModReadme==
 
-#include <string_view>
+#include <array>
 #include <winternl.h>
 #include <windhawk_utils.h>
 
-template<typename FileInfoType>
-void HideFilesInDirectory(void* FileInformation) {
-    FileInfoType* fileInformation = static_cast<FileInfoType *>(FileInformation);
-
-    while (fileInformation) {
-        std::wstring_view fileName(fileInformation->FileName, fileInformation->FileNameLength / sizeof(WCHAR));
+// All FILE_*_INFORMATION structures which have file attributes share the same
+// layout up to FileNameLength, and only differ in where FileName starts. This
+// allows handling all of them with the same code and a table of offsets.
+constexpr ULONG kFileAttributesOffset = 56;
+constexpr ULONG kFileNameLengthOffset = 60;
+
+// Indexed by FILE_INFORMATION_CLASS, zero for classes without file attributes.
+constexpr auto kFileNameOffsets = [] {
+    std::array<USHORT, 82> offsets{};
+    offsets[1] = 64;    // FileDirectoryInformation
+    offsets[2] = 68;    // FileFullDirectoryInformation
+    offsets[3] = 94;    // FileBothDirectoryInformation
+    offsets[37] = 104;  // FileIdBothDirectoryInformation
+    offsets[38] = 80;   // FileIdFullDirectoryInformation
+    offsets[50] = 92;   // FileIdGlobalTxDirectoryInformation
+    offsets[60] = 88;   // FileIdExtdDirectoryInformation
+    offsets[63] = 114;  // FileIdExtdBothDirectoryInformation
+    offsets[78] = 80;   // FileId64ExtdDirectoryInformation
+    offsets[79] = 106;  // FileId64ExtdBothDirectoryInformation
+    offsets[80] = 96;   // FileIdAllExtdDirectoryInformation
+    offsets[81] = 122;  // FileIdAllExtdBothDirectoryInformation
+    return offsets;
+}();
+
+static_assert(offsetof(FILE_FULL_DIR_INFORMATION, FileAttributes) == kFileAttributesOffset);
+static_assert(offsetof(FILE_FULL_DIR_INFORMATION, FileNameLength) == kFileNameLengthOffset);
+static_assert(offsetof(FILE_FULL_DIR_INFORMATION, FileName) == kFileNameOffsets[FileFullDirectoryInformation]);
+static_assert(offsetof(FILE_BOTH_DIR_INFORMATION, FileName) == kFileNameOffsets[FileBothDirectoryInformation]);
+static_assert(offsetof(FILE_ID_BOTH_DIR_INFORMATION, FileName) == kFileNameOffsets[FileIdBothDirectoryInformation]);
+
+// A single pass over the entries chain, without building strings. Entries are
+// only marked as hidden, never removed, so NextEntryOffset stays intact.
+void HideFilesInDirectory(LPBYTE buffer, ULONG length, ULONG fileNameOffset) {
+    ULONG offset = 0;
+    while (length - offset >= fileNameOffset) {
+        LPBYTE entry = buffer + offset;
+        ULONG nextEntryOffset = *reinterpret_cast<ULONG*>(entry);
+        ULONG fileNameLength = *reinterpret_cast<ULONG*>(entry + kFileNameLengthOffset);
+        const WCHAR* fileName = reinterpret_cast<const WCHAR*>(entry + fileNameOffset);
 
         // fileName starts with . but not in [".", ".."]
-        if (!(fileInformation->FileAttributes & FILE_ATTRIBUTE_HIDDEN) 
-			&& fileName.length() >= 2 && fileName[0] == '.'
-            && (fileName[1] != '.' || fileName.length() > 2)) {
-            Wh_Log(L"Class->Hide: %.*s", static_cast<int>(fileName.length()), fileName.data());
-            fileInformation->FileAttributes |= FILE_ATTRIBUTE_HIDDEN;
+        if (fileNameLength >= 2 * sizeof(WCHAR) && fileName[0] == L'.') {
+            bool isDotDot = fileNameLength == 2 * sizeof(WCHAR) && fileName[1] == L'.';
+            *reinterpret_cast<ULONG*>(entry + kFileAttributesOffset) |=
+                isDotDot ? 0 : FILE_ATTRIBUTE_HIDDEN;
         }
 
-        if (fileInformation->NextEntryOffset == 0) {
+        if (nextEntryOffset == 0 || nextEntryOffset > length - offset) {
             break;
         }
 
-        fileInformation = reinterpret_cast<FileInfoType *>(
-            reinterpret_cast<LPBYTE>(fileInformation) + fileInformation->NextEntryOffset);
+        offset += nextEntryOffset;
     }
 }
 
-void NtHideDirectoryFile(LPVOID FileInformation, FILE_INFORMATION_CLASS FileInformationClass) {
-    switch (FileInformationClass) {
-        case FileFullDirectoryInformation: {
-            Wh_Log(L"Class: FileFullDirectoryInformation");
-            HideFilesInDirectory<FILE_FULL_DIR_INFORMATION>(FileInformation);
-            break;
-        }
-
-        case FileBothDirectoryInformation: {
-            Wh_Log(L"Class: FileBothDirectoryInformation");
-            HideFilesInDirectory<FILE_BOTH_DIR_INFORMATION>(FileInformation);
-            break;
-        }
-
-        case FileIdBothDirectoryInformation: {
-            Wh_Log(L"Class: FileIdBothDirectoryInformation");
-            HideFilesInDirectory<FILE_ID_BOTH_DIR_INFORMATION>(FileInformation);
-            break;
-        }
+void NtHideDirectoryFile(LPVOID FileInformation, ULONG Length, FILE_INFORMATION_CLASS FileInformationClass) {
+    ULONG fileInformationClass = static_cast<ULONG>(FileInformationClass);
+    if (fileInformationClass >= kFileNameOffsets.size()) {
+        return;
+    }
 
-        default: {
-            Wh_Log(L"Class: ID-%d", FileInformationClass);
-            break;
-        }
+    ULONG fileNameOffset = kFileNameOffsets[fileInformationClass];
+    if (fileNameOffset == 0) {
+        return;
     }
+
+    HideFilesInDirectory(static_cast<LPBYTE>(FileInformation), Length, fileNameOffset);
 }
 
 typedef NTSTATUS (NTAPI* NtQueryDirectoryFile_t)(
@@ -101,13 +119,12 @@ NTSTATUS NTAPI NtQueryDirectoryFile_Hook(HANDLE FileHandle, HANDLE Event, PIO_AP
                                           LPVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock, LPVOID FileInformation,
                                           ULONG Length, FILE_INFORMATION_CLASS FileInformationClass,
                                           BOOLEAN ReturnSingleEntry, PUNICODE_STRING FileName, BOOLEAN RestartScan) {
-    Wh_Log(L"NtQueryDirectoryFile_Hook called");
-
     NTSTATUS status = NtQueryDirectoryFile_Original(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock,
                                                     FileInformation, Length, FileInformationClass, ReturnSingleEntry,
                                                     FileName, RestartScan);
-    if (NT_SUCCESS(status)) {
-        NtHideDirectoryFile(FileInformation, FileInformationClass);
+    // STATUS_PENDING is a success code, but the buffer isn't filled yet.
+    if (NT_SUCCESS(status) && status != STATUS_PENDING) {
+        NtHideDirectoryFile(FileInformation, Length, FileInformationClass);
     }
 
     return status;
@@ -132,13 +149,12 @@ NTSTATUS NTAPI NtQueryDirectoryFileEx_Hook(HANDLE FileHandle, HANDLE Event, PIO_
                                             PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation,
                                             ULONG Length, FILE_INFORMATION_CLASS FileInformationClass, ULONG QueryFlags,
                                             PUNICODE_STRING FileName) {
-    Wh_Log(L"NtQueryDirectoryFileEx_Hook called");
-
     NTSTATUS status = NtQueryDirectoryFileEx_Original(FileHandle, Event, ApcRoutine, ApcContext, IoStatusBlock,
                                                       FileInformation, Length, FileInformationClass, QueryFlags,
                                                       FileName);
-    if (NT_SUCCESS(status)) {
-        NtHideDirectoryFile(FileInformation, FileInformationClass);
+    // STATUS_PENDING is a success code, but the buffer isn't filled yet.
+    if (NT_SUCCESS(status) && status != STATUS_PENDING) {
+        NtHideDirectoryFile(FileInformation, Length, FileInformationClass);
     }
 
     return status;
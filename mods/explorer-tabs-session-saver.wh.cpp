@@ -3,7 +3,7 @@
 // @name            Explorer Tabs Session Saver
 // @description     Saves and restores Explorer tabs when reopening
 // @github          https://github.com/noX1st
-// @version         1.0.0
+// @version         1.1.0
 // @author          noX1st
 // @include         explorer.exe
 // @compilerOptions -lshlwapi -lole32 -loleaut32 -lshell32 -luuid
@@ -21,6 +21,8 @@ It works independently of the built-in Windows feature "Restore previous folder
 
 Tab session save path - C:\Users\"User"\AppData\Roaming\WindhawkModsData\explorer-tabs-session-saver\LastExplorerTabs.txt
 
+Changes are appended to `LastExplorerTabs.journal` in the same folder as they happen, and are periodically merged into the tab session file.
+
 **NOTE:** To restore tabs into a single Explorer window, the [Explorer Tab Utility](https://github.com/w4po/ExplorerTabUtility) program is required with its "Window Hook" feature enabled (or any similar program with such functionality). Otherwise, each tab will be restored in its own separate window.
 
 *Tested on Windows 11 24H2 26100.4946.*
@@ -29,20 +31,169 @@ Tab session save path - C:\Users\"User"\AppData\Roaming\WindhawkModsData\explore
 
 #include <windhawk_api.h>
 #include <windows.h>
+#include <exdisp.h>
+#include <exdispid.h>
 #include <shlobj.h>
 #include <shlwapi.h>
 #include <vector>
 #include <string>
-#include <fstream>
+#include <map>
+#include <deque>
 #include <olectl.h>
 #include <algorithm>
 
+// Tabs which are closed are removed from the session with a delay, so that
+// when all windows go away at once (e.g. Explorer is restarted), the whole
+// session is kept and not only the last tab.
+const UINT kRemovalDelayMs = 2000;
+// Restored folders are opened one at a time, each one as soon as the shell
+// registers the previous one, or after this timeout.
+const UINT kRestoreStepTimeoutMs = 500;
+// Retry interval for when the shell windows collection isn't available yet,
+// which happens if the mod is loaded early during Explorer startup.
+const UINT kConnectRetryMs = 2000;
+// Once the journal has this many records, it's merged into the session file.
+const int kMaxJournalRecords = 128;
+
+enum {
+    WM_APP_EVENT = WM_APP,
+    WM_APP_RESTORE,
+};
+
+enum {
+    kConnectTimerId = 1,
+    kRemovalTimerId,
+    kRestoreTimerId,
+};
+
+// A minimal event sink which forwards the relevant events of an Explorer
+// dispinterface to the main thread's window, so that they are handled outside
+// of the incoming COM call.
+class EventSink : public IDispatch {
+public:
+    EventSink(REFIID eventsIid, ULONG context)
+        : m_eventsIid(eventsIid), m_context(context) {}
+
+    bool Connect(IUnknown* pSource) {
+        IConnectionPointContainer* pContainer = NULL;
+        if (FAILED(pSource->QueryInterface(IID_PPV_ARGS(&pContainer)))) {
+            return false;
+        }
+
+        HRESULT hr = pContainer->FindConnectionPoint(m_eventsIid, &m_pConnectionPoint);
+        pContainer->Release();
+        if (FAILED(hr)) {
+            m_pConnectionPoint = NULL;
+            return false;
+        }
+
+        if (FAILED(m_pConnectionPoint->Advise(this, &m_cookie))) {
+            m_pConnectionPoint->Release();
+            m_pConnectionPoint = NULL;
+            return false;
+        }
+
+        return true;
+    }
+
+    void Disconnect() {
+        if (m_pConnectionPoint) {
+            m_pConnectionPoint->Unadvise(m_cookie);
+            m_pConnectionPoint->Release();
+            m_pConnectionPoint = NULL;
+        }
+    }
+
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == IID_IUnknown || riid == IID_IDispatch || riid == m_eventsIid) {
+            *ppv = static_cast<IDispatch*>(this);
+            AddRef();
+            return S_OK;
+        }
+
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef() override {
+        return InterlockedIncrement(&m_refCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release() override {
+        ULONG refCount = InterlockedDecrement(&m_refCount);
+        if (refCount == 0) {
+            delete this;
+        }
+        return refCount;
+    }
+
+    STDMETHODIMP GetTypeInfoCount(UINT* pctinfo) override {
+        *pctinfo = 0;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetTypeInfo(UINT, LCID, ITypeInfo**) override {
+        return E_NOTIMPL;
+    }
+
+    STDMETHODIMP GetIDsOfNames(REFIID, LPOLESTR*, UINT, LCID, DISPID*) override {
+        return E_NOTIMPL;
+    }
+
+    STDMETHODIMP Invoke(DISPID dispIdMember, REFIID, LCID, WORD, DISPPARAMS*,
+                        VARIANT*, EXCEPINFO*, UINT*) override;
+
+private:
+    IID m_eventsIid;
+    ULONG m_context;
+    LONG m_refCount = 1;
+    IConnectionPoint* m_pConnectionPoint = NULL;
+    DWORD m_cookie = 0;
+};
+
+struct TrackedTab {
+    ULONG id;
+    IUnknown* pIdentity;
+    IDispatch* pDispatch;
+    EventSink* pSink;
+    std::wstring path;
+};
+
 HANDLE g_hMainThread = NULL;
-bool   g_bIsRunning  = false;
-std::vector<std::wstring> g_lastKnownTabs;
+HANDLE g_hMainThreadReady = NULL;
+HWND   g_hMessageWnd = NULL;
 static volatile LONG g_restoreScheduled = 0;
 
-std::wstring GetTabListFilePath() {
+IShellWindows* g_pShellWindows = NULL;
+EventSink* g_pShellWindowsSink = NULL;
+std::vector<TrackedTab> g_trackedTabs;
+ULONG g_nextTabId = 1;
+
+// The saved session, keyed by tab id so that the tabs keep their order. It
+// lags behind the tracked tabs by the pending removals.
+std::map<ULONG, std::wstring> g_sessionTabs;
+std::vector<ULONG> g_pendingRemovals;
+bool g_sessionActive = false;
+int  g_journalRecords = 0;
+
+std::deque<std::wstring> g_restoreQueue;
+bool g_restoreOpening = false;
+bool g_restoreStepRequested = false;
+
+STDMETHODIMP EventSink::Invoke(DISPID dispIdMember, REFIID, LCID, WORD,
+                               DISPPARAMS*, VARIANT*, EXCEPINFO*, UINT*) {
+    switch (dispIdMember) {
+        case DISPID_WINDOWREGISTERED:
+        case DISPID_WINDOWREVOKED:
+        case DISPID_NAVIGATECOMPLETE2:
+            PostMessage(g_hMessageWnd, WM_APP_EVENT, dispIdMember, m_context);
+            break;
+    }
+
+    return S_OK;
+}
+
+std::wstring GetModStorageFilePath(PCWSTR fileName) {
     wchar_t modPathBuffer[MAX_PATH];
     if (!Wh_GetModStoragePath(modPathBuffer, MAX_PATH)) {
         Wh_Log(L"Failed to get mod storage path.");
@@ -53,116 +204,502 @@ std::wstring GetTabListFilePath() {
 
     SHCreateDirectoryExW(NULL, modPath.c_str(), NULL);
 
-    modPath += L"\\LastExplorerTabs.txt";
+    modPath += L"\\";
+    modPath += fileName;
     return modPath;
 }
 
-std::vector<std::wstring> GetCurrentTabs() {
-    std::vector<std::wstring> currentTabs;
-    IShellWindows* pShellWindows = NULL;
-    if (FAILED(CoCreateInstance(CLSID_ShellWindows, NULL, CLSCTX_ALL, IID_PPV_ARGS(&pShellWindows)))) {
-        return currentTabs;
+std::wstring GetTabListFilePath() {
+    return GetModStorageFilePath(L"LastExplorerTabs.txt");
+}
+
+std::wstring GetJournalFilePath() {
+    return GetModStorageFilePath(L"LastExplorerTabs.journal");
+}
+
+std::string ToUtf8(const std::wstring& str) {
+    int size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), NULL, 0, NULL, NULL);
+    std::string result(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, str.c_str(), (int)str.size(), &result[0], size, NULL, NULL);
+    return result;
+}
+
+std::wstring FromUtf8(const char* str, int length) {
+    int size = MultiByteToWideChar(CP_UTF8, 0, str, length, NULL, 0);
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, str, length, &result[0], size);
+    return result;
+}
+
+// Session files consist of "<id>\t<path>" lines, and a line with an empty path
+// removes the tab. The tab list file is a snapshot in this format and the
+// journal is appended to it, so that loading a session is applying the
+// snapshot and then the journal. Applying a record is idempotent, which means
+// that a journal which outlived a compaction does no harm. Lines without an id
+// come from older versions of the mod, which saved plain paths.
+void ApplySessionRecords(const std::string& data, std::map<ULONG, std::wstring>* tabs, ULONG* nextLegacyId) {
+    size_t lineStart = 0;
+    size_t lineEnd;
+    // An unterminated last line is a record which was interrupted by a crash.
+    while ((lineEnd = data.find('\n', lineStart)) != std::string::npos) {
+        size_t length = lineEnd - lineStart;
+        if (length > 0 && data[lineEnd - 1] == '\r') {
+            length--;
+        }
+
+        std::string line = data.substr(lineStart, length);
+        lineStart = lineEnd + 1;
+
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos && tab > 0 &&
+            std::all_of(line.begin(), line.begin() + tab, [](char c) { return c >= '0' && c <= '9'; })) {
+            ULONG id = strtoul(line.c_str(), NULL, 10);
+            if (tab + 1 < line.size()) {
+                (*tabs)[id] = FromUtf8(line.c_str() + tab + 1, (int)(line.size() - tab - 1));
+            } else {
+                tabs->erase(id);
+            }
+        } else if (!line.empty()) {
+            (*tabs)[(*nextLegacyId)++] = FromUtf8(line.c_str(), (int)line.size());
+        }
     }
+}
 
-    long count = 0;
-    pShellWindows->get_Count(&count);
-    for (long i = count - 1; i >= 0; i--) {
-        VARIANT v; VariantInit(&v); v.vt = VT_I4; v.lVal = i;
-        IDispatch* pDispatch = NULL;
-        if (SUCCEEDED(pShellWindows->Item(v, &pDispatch)) && pDispatch) {
-            IServiceProvider* pServiceProvider = NULL;
-            if (SUCCEEDED(pDispatch->QueryInterface(IID_PPV_ARGS(&pServiceProvider)))) {
-                IShellBrowser* pShellBrowser = NULL;
-                if (SUCCEEDED(pServiceProvider->QueryService(SID_STopLevelBrowser, IID_PPV_ARGS(&pShellBrowser)))) {
-                    IShellView* pShellView = NULL;
-                    if (SUCCEEDED(pShellBrowser->QueryActiveShellView(&pShellView))) {
-                        IFolderView* pFolderView = NULL;
-                        if (SUCCEEDED(pShellView->QueryInterface(IID_PPV_ARGS(&pFolderView)))) {
-                            IPersistFolder2* pPersistFolder2 = NULL;
-                            if (SUCCEEDED(pFolderView->GetFolder(IID_PPV_ARGS(&pPersistFolder2)))) {
-                                PIDLIST_ABSOLUTE pidl;
-                                if (SUCCEEDED(pPersistFolder2->GetCurFolder(&pidl))) {
-                                    wchar_t path[MAX_PATH];
-                                    if (SHGetPathFromIDListW(pidl, path)) {
-                                        currentTabs.push_back(path);
-                                    }
-                                    CoTaskMemFree(pidl);
-                                }
-                                pPersistFolder2->Release();
+bool ReadFileContents(const std::wstring& filePath, std::string* contents) {
+    HANDLE hFile = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    bool succeeded = GetFileSizeEx(hFile, &size) && size.QuadPart < 0x10000000;
+    if (succeeded) {
+        contents->resize((size_t)size.QuadPart);
+        DWORD bytesRead = 0;
+        succeeded = size.QuadPart == 0 ||
+                    (ReadFile(hFile, &(*contents)[0], (DWORD)size.QuadPart, &bytesRead, NULL) &&
+                     bytesRead == size.QuadPart);
+    }
+
+    CloseHandle(hFile);
+    return succeeded;
+}
+
+std::vector<std::wstring> LoadSession() {
+    std::map<ULONG, std::wstring> tabs;
+    ULONG nextLegacyId = 1;
+    std::string contents;
+
+    std::wstring filePath = GetTabListFilePath();
+    if (!filePath.empty() && ReadFileContents(filePath, &contents)) {
+        ApplySessionRecords(contents, &tabs, &nextLegacyId);
+    }
+
+    std::wstring journalPath = GetJournalFilePath();
+    if (!journalPath.empty() && ReadFileContents(journalPath, &contents)) {
+        ApplySessionRecords(contents, &tabs, &nextLegacyId);
+    }
+
+    std::vector<std::wstring> paths;
+    for (const auto& tab : tabs) {
+        paths.push_back(tab.second);
+    }
+    return paths;
+}
+
+std::string FormatSessionRecord(ULONG id, const std::wstring& path) {
+    return std::to_string(id) + '\t' + ToUtf8(path) + '\n';
+}
+
+// Writes the session to a temporary file which then replaces the tab list
+// file, so that a crash can't leave a partially written session behind.
+void CompactSession() {
+    std::wstring filePath = GetTabListFilePath();
+    std::wstring journalPath = GetJournalFilePath();
+    if (filePath.empty() || journalPath.empty()) return;
+
+    std::string contents;
+    for (const auto& tab : g_sessionTabs) {
+        contents += FormatSessionRecord(tab.first, tab.second);
+    }
+
+    std::wstring tempPath = filePath + L".tmp";
+    HANDLE hFile = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Wh_Log(L"Failed to create %s: %u", tempPath.c_str(), GetLastError());
+        return;
+    }
+
+    DWORD bytesWritten = 0;
+    bool written = WriteFile(hFile, contents.data(), (DWORD)contents.size(), &bytesWritten, NULL) &&
+                   bytesWritten == contents.size() &&
+                   FlushFileBuffers(hFile);
+    CloseHandle(hFile);
+
+    if (!written ||
+        !MoveFileExW(tempPath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Wh_Log(L"Failed to save the session: %u", GetLastError());
+        DeleteFileW(tempPath.c_str());
+        return;
+    }
+
+    DeleteFileW(journalPath.c_str());
+    g_journalRecords = 0;
+}
+
+void AppendJournalRecord(ULONG id, const std::wstring& path) {
+    std::wstring journalPath = GetJournalFilePath();
+    if (journalPath.empty()) return;
+
+    std::string record = FormatSessionRecord(id, path);
+
+    HANDLE hFile = CreateFileW(journalPath.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Wh_Log(L"Failed to open %s: %u", journalPath.c_str(), GetLastError());
+        return;
+    }
+
+    DWORD bytesWritten = 0;
+    WriteFile(hFile, record.data(), (DWORD)record.size(), &bytesWritten, NULL);
+    CloseHandle(hFile);
+
+    if (++g_journalRecords >= kMaxJournalRecords) {
+        CompactSession();
+    }
+}
+
+void SetSessionTabPath(ULONG id, const std::wstring& path) {
+    if (path.empty()) {
+        if (g_sessionTabs.erase(id)) {
+            AppendJournalRecord(id, path);
+        }
+    } else {
+        auto it = g_sessionTabs.find(id);
+        if (it == g_sessionTabs.end() || it->second != path) {
+            g_sessionTabs[id] = path;
+            AppendJournalRecord(id, path);
+        }
+    }
+}
+
+// Starts saving a new session from the currently open tabs, replacing the
+// previously saved one.
+void BeginNewSession() {
+    g_sessionTabs.clear();
+    g_pendingRemovals.clear();
+    KillTimer(g_hMessageWnd, kRemovalTimerId);
+
+    for (const auto& tab : g_trackedTabs) {
+        if (!tab.path.empty()) {
+            g_sessionTabs[tab.id] = tab.path;
+        }
+    }
+
+    CompactSession();
+    g_sessionActive = true;
+}
+
+void EndSession() {
+    // Tabs which are pending removal were closed together with the rest of
+    // the session, keep them.
+    g_pendingRemovals.clear();
+    KillTimer(g_hMessageWnd, kRemovalTimerId);
+
+    CompactSession();
+    g_sessionActive = false;
+    Wh_Log(L"Last explorer window closed, saving final session.");
+
+    InterlockedExchange(&g_restoreScheduled, 0);
+}
+
+void FlushPendingRemovals() {
+    KillTimer(g_hMessageWnd, kRemovalTimerId);
+
+    for (ULONG id : g_pendingRemovals) {
+        SetSessionTabPath(id, L"");
+    }
+    g_pendingRemovals.clear();
+}
+
+std::wstring GetBrowserFolderPath(IDispatch* pDispatch) {
+    std::wstring folderPath;
+    IServiceProvider* pServiceProvider = NULL;
+    if (SUCCEEDED(pDispatch->QueryInterface(IID_PPV_ARGS(&pServiceProvider)))) {
+        IShellBrowser* pShellBrowser = NULL;
+        if (SUCCEEDED(pServiceProvider->QueryService(SID_STopLevelBrowser, IID_PPV_ARGS(&pShellBrowser)))) {
+            IShellView* pShellView = NULL;
+            if (SUCCEEDED(pShellBrowser->QueryActiveShellView(&pShellView))) {
+                IFolderView* pFolderView = NULL;
+                if (SUCCEEDED(pShellView->QueryInterface(IID_PPV_ARGS(&pFolderView)))) {
+                    IPersistFolder2* pPersistFolder2 = NULL;
+                    if (SUCCEEDED(pFolderView->GetFolder(IID_PPV_ARGS(&pPersistFolder2)))) {
+                        PIDLIST_ABSOLUTE pidl;
+                        if (SUCCEEDED(pPersistFolder2->GetCurFolder(&pidl))) {
+                            wchar_t path[MAX_PATH];
+                            if (SHGetPathFromIDListW(pidl, path)) {
+                                folderPath = path;
                             }
-                            pFolderView->Release();
+                            CoTaskMemFree(pidl);
                         }
-                        pShellView->Release();
+                        pPersistFolder2->Release();
                     }
-                    pShellBrowser->Release();
+                    pFolderView->Release();
                 }
-                pServiceProvider->Release();
+                pShellView->Release();
             }
-            pDispatch->Release();
+            pShellBrowser->Release();
         }
+        pServiceProvider->Release();
     }
-    pShellWindows->Release();
-    std::reverse(currentTabs.begin(), currentTabs.end());
-    return currentTabs;
+    return folderPath;
 }
 
-void WriteTabsToFile(const std::vector<std::wstring>& tabs) {
-    std::wstring filePath = GetTabListFilePath();
-    if (filePath.empty()) return;
+void ReleaseTrackedTab(TrackedTab& tab) {
+    tab.pSink->Disconnect();
+    tab.pSink->Release();
+    tab.pDispatch->Release();
+    tab.pIdentity->Release();
+}
 
-    std::wofstream tabFile(filePath.c_str());
-    if (tabFile.is_open()) {
-        for (const auto& tab : tabs) {
-            tabFile << tab << std::endl;
+// Brings the tracked tabs in sync with the shell windows collection. The
+// collection only changes when a window is registered or revoked, so unlike
+// the folder paths, which are only queried on navigation, it's cheap to
+// enumerate on these events.
+void SyncTrackedTabs() {
+    std::vector<IUnknown*> currentIdentities;
+    std::vector<TrackedTab> addedTabs;
+
+    long count = 0;
+    g_pShellWindows->get_Count(&count);
+    for (long i = 0; i < count; i++) {
+        VARIANT v; VariantInit(&v); v.vt = VT_I4; v.lVal = i;
+        IDispatch* pDispatch = NULL;
+        if (FAILED(g_pShellWindows->Item(v, &pDispatch)) || !pDispatch) {
+            continue;
+        }
+
+        IUnknown* pIdentity = NULL;
+        if (FAILED(pDispatch->QueryInterface(IID_PPV_ARGS(&pIdentity)))) {
+            pDispatch->Release();
+            continue;
         }
+
+        currentIdentities.push_back(pIdentity);
+
+        bool tracked = std::any_of(g_trackedTabs.begin(), g_trackedTabs.end(),
+                                   [pIdentity](const TrackedTab& tab) { return tab.pIdentity == pIdentity; });
+        if (tracked) {
+            pIdentity->Release();
+            pDispatch->Release();
+            continue;
+        }
+
+        TrackedTab tab;
+        tab.id = g_nextTabId++;
+        tab.pIdentity = pIdentity;
+        tab.pDispatch = pDispatch;
+        tab.pSink = new EventSink(DIID_DWebBrowserEvents2, tab.id);
+        if (!tab.pSink->Connect(pDispatch)) {
+            Wh_Log(L"Failed to connect to the events of tab %u", tab.id);
+        }
+        tab.path = GetBrowserFolderPath(pDispatch);
+        addedTabs.push_back(tab);
+    }
+
+    bool hadTabs = !g_trackedTabs.empty();
+
+    for (auto it = g_trackedTabs.begin(); it != g_trackedTabs.end();) {
+        if (std::find(currentIdentities.begin(), currentIdentities.end(), it->pIdentity) != currentIdentities.end()) {
+            ++it;
+            continue;
+        }
+
+        if (g_sessionActive) {
+            g_pendingRemovals.push_back(it->id);
+        }
+
+        ReleaseTrackedTab(*it);
+        it = g_trackedTabs.erase(it);
+    }
+
+    g_trackedTabs.insert(g_trackedTabs.end(), addedTabs.begin(), addedTabs.end());
+
+    if (g_trackedTabs.empty()) {
+        if (hadTabs && g_sessionActive) {
+            EndSession();
+        }
+        return;
+    }
+
+    if (!g_sessionActive) {
+        BeginNewSession();
+        return;
+    }
+
+    for (const auto& tab : addedTabs) {
+        SetSessionTabPath(tab.id, tab.path);
+    }
+
+    if (!g_pendingRemovals.empty()) {
+        SetTimer(g_hMessageWnd, kRemovalTimerId, kRemovalDelayMs, NULL);
     }
 }
 
-void RestoreTabs() {
-    std::wstring filePath = GetTabListFilePath();
-    if (filePath.empty()) return;
+void OnTabNavigated(ULONG id) {
+    auto it = std::find_if(g_trackedTabs.begin(), g_trackedTabs.end(),
+                           [id](const TrackedTab& tab) { return tab.id == id; });
+    if (it == g_trackedTabs.end()) {
+        return;
+    }
+
+    std::wstring path = GetBrowserFolderPath(it->pDispatch);
+    if (path == it->path) {
+        return;
+    }
 
-    std::wifstream tabFile(filePath.c_str());
-    if (!tabFile.is_open()) return;
+    it->path = path;
+    if (g_sessionActive) {
+        SetSessionTabPath(id, path);
+    }
+}
 
-    std::vector<std::wstring> paths;
-    std::wstring line;
-    while (std::getline(tabFile, line)) {
-        if (!line.empty()) paths.push_back(line);
+bool ConnectShellWindows() {
+    if (FAILED(CoCreateInstance(CLSID_ShellWindows, NULL, CLSCTX_ALL, IID_PPV_ARGS(&g_pShellWindows)))) {
+        g_pShellWindows = NULL;
+        return false;
     }
-    tabFile.close();
 
-    DeleteFileW(filePath.c_str());
+    g_pShellWindowsSink = new EventSink(DIID_DShellWindowsEvents, 0);
+    if (!g_pShellWindowsSink->Connect(g_pShellWindows)) {
+        Wh_Log(L"Failed to connect to the shell windows events.");
+    }
+
+    SyncTrackedTabs();
 
-    if (paths.empty()) return;
+    // The mod was loaded while Explorer windows were already open, so there's
+    // no session to restore.
+    if (!g_trackedTabs.empty()) {
+        InterlockedExchange(&g_restoreScheduled, 1);
+    }
+
+    return true;
+}
+
+void DisconnectShellWindows() {
+    for (auto& tab : g_trackedTabs) {
+        ReleaseTrackedTab(tab);
+    }
+    g_trackedTabs.clear();
+
+    if (g_pShellWindowsSink) {
+        g_pShellWindowsSink->Disconnect();
+        g_pShellWindowsSink->Release();
+        g_pShellWindowsSink = NULL;
+    }
+
+    if (g_pShellWindows) {
+        g_pShellWindows->Release();
+        g_pShellWindows = NULL;
+    }
+}
+
+// Opens the next restored folder. Called when a restore starts, when the shell
+// registers a window, and when the shell didn't register one in time.
+void ContinueRestore() {
+    // ShellExecuteExW can dispatch messages while it waits for the shell, so
+    // this can be reentered. Let the outer call open the next folder instead.
+    if (g_restoreOpening) {
+        g_restoreStepRequested = true;
+        return;
+    }
+
+    do {
+        g_restoreStepRequested = false;
+
+        if (g_restoreQueue.empty()) {
+            KillTimer(g_hMessageWnd, kRestoreTimerId);
+            return;
+        }
+
+        std::wstring path = g_restoreQueue.front();
+        g_restoreQueue.pop_front();
 
-    for (const auto& path : paths) {
         SHELLEXECUTEINFOW sei = { sizeof(sei) };
         sei.fMask = SEE_MASK_DEFAULT;
         sei.lpVerb = L"open";
         sei.lpFile = path.c_str();
         sei.nShow = SW_SHOWNORMAL;
+
+        g_restoreOpening = true;
         ShellExecuteExW(&sei);
-        Sleep(50);
-    }
+        g_restoreOpening = false;
+    } while (g_restoreStepRequested);
+
+    SetTimer(g_hMessageWnd, kRestoreTimerId, kRestoreStepTimeoutMs, NULL);
 }
 
-DWORD WINAPI RestoreTabsThread(LPVOID lpParam) {
-    // wait until the first Explorer window is ready
-    HWND targetHwnd = (HWND)lpParam;
-    if (!IsWindow(targetHwnd)) {
-        Wh_Log(L"RestoreTabsThread: Invalid window handle received.");
-        return 1;
-    }
+void RestoreTabs() {
+    std::vector<std::wstring> paths = LoadSession();
 
-    Wh_Log(L"RestoreTabsThread: Triggered for window %p.", targetHwnd);
+    Wh_Log(L"Restoring %zu tabs.", paths.size());
 
-    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-    if (SUCCEEDED(hr)) {
-        RestoreTabs();
-        CoUninitialize();
+    // The restored tabs, together with whatever is open now, are saved as a
+    // new session as they get registered.
+    BeginNewSession();
+
+    g_restoreQueue.insert(g_restoreQueue.end(), paths.begin(), paths.end());
+    ContinueRestore();
+}
+
+LRESULT CALLBACK MessageWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    switch (uMsg) {
+        case WM_APP_EVENT:
+            switch ((DISPID)wParam) {
+                case DISPID_WINDOWREGISTERED:
+                    SyncTrackedTabs();
+                    if (!g_restoreQueue.empty()) {
+                        ContinueRestore();
+                    }
+                    break;
+
+                case DISPID_WINDOWREVOKED:
+                    SyncTrackedTabs();
+                    break;
+
+                case DISPID_NAVIGATECOMPLETE2:
+                    OnTabNavigated((ULONG)lParam);
+                    break;
+            }
+            return 0;
+
+        case WM_APP_RESTORE:
+            RestoreTabs();
+            return 0;
+
+        case WM_TIMER:
+            switch (wParam) {
+                case kConnectTimerId:
+                    if (ConnectShellWindows()) {
+                        KillTimer(hWnd, kConnectTimerId);
+                    }
+                    break;
+
+                case kRemovalTimerId:
+                    FlushPendingRemovals();
+                    break;
+
+                case kRestoreTimerId:
+                    ContinueRestore();
+                    break;
+            }
+            return 0;
+
+        case WM_CLOSE:
+            PostQuitMessage(0);
+            return 0;
     }
-    return 0;
+
+    return DefWindowProc(hWnd, uMsg, wParam, lParam);
 }
 
 typedef HWND (WINAPI *CreateWindowExW_t)(DWORD, LPCWSTR, LPCWSTR, DWORD, int, int, int, int, HWND, HMENU, HINSTANCE, LPVOID);
@@ -180,12 +717,11 @@ HWND WINAPI CreateWindowExW_Hook(
         if (GetClassNameW(hwnd, className, ARRAYSIZE(className)) && lstrcmpW(className, L"CabinetWClass") == 0) {
             // trigger restore once per Explorer restart
             if (InterlockedCompareExchange(&g_restoreScheduled, 1, 0) == 0) {
-                std::wstring filePath = GetTabListFilePath();
-                if (!filePath.empty() && PathFileExistsW(filePath.c_str())) {
-                    HANDLE hThread = CreateThread(NULL, 0, RestoreTabsThread, (LPVOID)hwnd, 0, NULL);
-                    if (hThread) {
-                        CloseHandle(hThread);
-                    }
+                Wh_Log(L"Restore triggered for window %p.", hwnd);
+                // The restore runs on the main thread, before the new window
+                // gets registered and starts a new session.
+                if (!PostMessage(g_hMessageWnd, WM_APP_RESTORE, 0, 0)) {
+                    InterlockedExchange(&g_restoreScheduled, 0);
                 }
             }
         }
@@ -195,30 +731,49 @@ HWND WINAPI CreateWindowExW_Hook(
 }
 
 DWORD WINAPI MainThread(LPVOID) {
-    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
-
-    while (g_bIsRunning) {
-        std::vector<std::wstring> currentTabs = GetCurrentTabs();
-        
-        if (currentTabs != g_lastKnownTabs) {
-            if (currentTabs.empty() && !g_lastKnownTabs.empty()) {
-                WriteTabsToFile(g_lastKnownTabs);
-                Wh_Log(L"Last explorer window closed, saving final session.");
-            }
-            else {
-                WriteTabsToFile(currentTabs);
-            }
-            
-            g_lastKnownTabs = currentTabs;
-        }
+    HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    if (FAILED(hr)) {
+        SetEvent(g_hMainThreadReady);
+        return 1;
+    }
 
-        if (currentTabs.empty()) {
-            InterlockedExchange(&g_restoreScheduled, 0);
-        }
+    WNDCLASS wc = {};
+    wc.lpfnWndProc = MessageWndProc;
+    wc.hInstance = GetModuleHandle(NULL);
+    wc.lpszClassName = L"ExplorerTabsSessionSaver";
+    RegisterClass(&wc);
+
+    g_hMessageWnd = CreateWindowEx(0, wc.lpszClassName, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, wc.hInstance, NULL);
+    SetEvent(g_hMainThreadReady);
+    if (!g_hMessageWnd) {
+        Wh_Log(L"Failed to create the message window.");
+        UnregisterClass(wc.lpszClassName, wc.hInstance);
+        CoUninitialize();
+        return 1;
+    }
+
+    if (!ConnectShellWindows()) {
+        SetTimer(g_hMessageWnd, kConnectTimerId, kConnectRetryMs, NULL);
+    }
+
+    MSG msg;
+    while (GetMessage(&msg, NULL, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
 
-        Sleep(2000);
+    if (g_sessionActive) {
+        FlushPendingRemovals();
+        CompactSession();
     }
 
+    DisconnectShellWindows();
+
+    HWND hMessageWnd = g_hMessageWnd;
+    g_hMessageWnd = NULL;
+    DestroyWindow(hMessageWnd);
+    UnregisterClass(wc.lpszClassName, wc.hInstance);
+
     CoUninitialize();
     return 0;
 }
@@ -227,21 +782,36 @@ DWORD WINAPI MainThread(LPVOID) {
 BOOL Wh_ModInit() {
     Wh_Log(L"Initializing Explorer Tabs Session Saver...");
 
-    Wh_SetFunctionHook((void*)CreateWindowExW, (void*)CreateWindowExW_Hook, (void**)&pCreateWindowExW_Orig);
-    
-    g_bIsRunning = true;
+    g_hMainThreadReady = CreateEvent(NULL, TRUE, FALSE, NULL);
     g_hMainThread = CreateThread(NULL, 0, MainThread, NULL, 0, NULL);
-    
+    if (!g_hMainThread) {
+        CloseHandle(g_hMainThreadReady);
+        g_hMainThreadReady = NULL;
+        return FALSE;
+    }
+
+    // Make sure that the message window exists before a restore is triggered.
+    WaitForSingleObject(g_hMainThreadReady, INFINITE);
+
+    Wh_SetFunctionHook((void*)CreateWindowExW, (void*)CreateWindowExW_Hook, (void**)&pCreateWindowExW_Orig);
+
     return TRUE;
 }
 
 void Wh_ModUninit() {
     Wh_Log(L"Uninitializing Explorer Tabs Session Saver...");
 
-    g_bIsRunning = false;
     if (g_hMainThread) {
-        WaitForSingleObject(g_hMainThread, 2500);
+        if (g_hMessageWnd) {
+            PostMessage(g_hMessageWnd, WM_CLOSE, 0, 0);
+        }
+        WaitForSingleObject(g_hMainThread, INFINITE);
         CloseHandle(g_hMainThread);
         g_hMainThread = NULL;
     }
-}
\ No newline at end of file
+
+    if (g_hMainThreadReady) {
+        CloseHandle(g_hMainThreadReady);
+        g_hMainThreadReady = NULL;
+    }
+}
@@ -2,12 +2,12 @@
 // @id              internet-status-indicator
 // @name            Internet Status Indicator
 // @description     Real-time network connectivity monitoring with visual indicators as a Tray Icon
-// @version         0.7
+// @version         0.8
 // @author          ALMAS CP
 // @github          https://github.com/almas-cp
 // @homepage        https://github.com/almas-cp
 // @include         windhawk.exe
-// @compilerOptions -lwininet -lws2_32 -liphlpapi -lgdi32 -luser32
+// @compilerOptions -lwininet -lws2_32 -liphlpapi -lgdi32 -luser32 -lole32
 // ==/WindhawkMod==
 
 
@@ -21,7 +21,8 @@ connection by pinging target hosts and provides visual feedback.
 
 ## Features
 - **Real-time monitoring**: Continuous network connectivity checks
-- **Simple ping-based checking**: Pings primary host, falls back to secondary if needed
+- **Simple ping-based checking**: Pings the primary and secondary hosts at the same time
+- **Adaptive checking**: Checks less often while the status is stable, and right away when Windows reports a network change
 - **Customizable visual indicators**: Choose colors and shapes for connected/disconnected states
 - **Customizable settings**: Configure check intervals, target hosts, and timeouts
 - **Lightweight**: Minimal system resource usage
@@ -36,10 +37,13 @@ connection by pinging target hosts and provides visual feedback.
 
 ## How it works
 The mod performs periodic connectivity checks by:
-1. Ping primary target host (default: 8.8.8.8)
-2. If primary fails, ping secondary host (default: 1.1.1.1)
-3. If either ping succeeds: Green icon (connected)
-4. If both pings fail: Red icon (disconnected)
+1. Ping primary target host (default: 8.8.8.8) and secondary host (default: 1.1.1.1) at the same time
+2. If either ping succeeds: Green icon (connected)
+3. If both pings fail, ping again right away, and if they fail again: Red icon (disconnected)
+
+While the status stays the same, the time between checks doubles, up to 4 times
+the check interval. A network change reported by Windows triggers a check right
+away and resets the interval.
 
 
 ## Usage
@@ -67,7 +71,7 @@ This mod runs as part of the windhawk.exe process for better stability and resou
 
 - checkInterval: 5000
   $name: Check Interval (ms)
-  $description: How often to check connectivity (minimum 1000ms recommended)
+  $description: How often to check connectivity after a status change, checks become up to 4 times less frequent while the status is stable (minimum 1000ms recommended)
 
 
 - targetHost: "8.8.8.8"
@@ -147,13 +151,13 @@ This mod runs as part of the windhawk.exe process for better stability and resou
 #include <icmpapi.h>
 #include <shellapi.h>
 #include <commctrl.h>
+#include <netlistmgr.h>
 #include <string>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <atomic>
-#include <chrono>
 #include <algorithm>
-#include <condition_variable>
-#include <mutex>
 
 
 #define WM_TRAYICON (WM_USER + 1)
@@ -473,42 +477,328 @@ public:
 const wchar_t* TrayWindow::CLASS_NAME = L"InternetStatusTrayWindow";
 
 
+// Decides when to probe next and what the reported state is. After a change,
+// probes are spaced by the check interval, and while the state stays the same
+// the spacing doubles up to kMaxBackoffFactor times the check interval. A
+// failed probe while connected is confirmed by an immediate second probe
+// before the state flips, so that a single lost echo doesn't flash the icon.
+class ProbeScheduler {
+private:
+    static constexpr int kMaxBackoffFactor = 4;
+    
+    bool connected = false;
+    bool confirmingLoss = false;
+    int backoffFactor = 1;
+    
+public:
+    // Returns true if the reported state changed.
+    bool OnProbeResult(bool reachable) {
+        if (reachable == connected) {
+            confirmingLoss = false;
+            backoffFactor = std::min(backoffFactor * 2, kMaxBackoffFactor);
+            return false;
+        }
+        
+        if (!reachable && !confirmingLoss) {
+            confirmingLoss = true;
+            return false;
+        }
+        
+        connected = reachable;
+        confirmingLoss = false;
+        backoffFactor = 1;
+        return true;
+    }
+    
+    void OnNetworkChanged() {
+        backoffFactor = 1;
+    }
+    
+    bool IsConnected() const { return connected; }
+    
+    int NextDelayMs(int checkInterval) const {
+        return confirmingLoss ? 0 : checkInterval * backoffFactor;
+    }
+};
+
+
+// Checks whether any of the given hosts is reachable. Returns the index of the
+// first host which replied, or -1 if none did. Returns early if stopEvent is
+// signaled.
+class ConnectivityProbe {
+public:
+    virtual ~ConnectivityProbe() = default;
+    virtual int Probe(const std::vector<std::string>& hosts, DWORD timeout, HANDLE stopEvent) = 0;
+};
+
+
+// Pings all hosts at once with IcmpSendEcho2, and returns as soon as one of
+// them replies instead of waiting for each one to time out in turn.
+class IcmpProbe : public ConnectivityProbe {
+private:
+    struct EchoRequest {
+        HANDLE event = NULL;
+        // Owned by the ICMP request until the event is signaled.
+        std::vector<BYTE> replyBuffer;
+        bool pending = false;
+        DWORD timeout = 0;
+    };
+    
+    static constexpr char kEchoData[] = "NetworkStatusCheck";
+    // Extra time to wait for a request to complete after its timeout.
+    static constexpr DWORD kCompletionSlack = 1000;
+    
+    HANDLE hIcmpFile = INVALID_HANDLE_VALUE;
+    std::vector<EchoRequest> requests;
+    
+    static bool ResolveHost(const std::string& hostname, IPAddr* destIP) {
+        struct addrinfo hints = {0};
+        struct addrinfo* result = nullptr;
+        hints.ai_family = AF_INET;
+        
+        if (getaddrinfo(hostname.c_str(), nullptr, &hints, &result) != 0) {
+            return false;
+        }
+        
+        struct sockaddr_in* addr = (struct sockaddr_in*)result->ai_addr;
+        *destIP = addr->sin_addr.s_addr;
+        freeaddrinfo(result);
+        return true;
+    }
+    
+    // A request which was still in flight when the previous probe returned
+    // must complete before its reply buffer can be reused. Gives up if
+    // stopEvent is signaled.
+    static bool WaitForRequest(EchoRequest& request, HANDLE stopEvent) {
+        if (!request.pending) return true;
+        
+        HANDLE handles[] = {stopEvent, request.event};
+        if (WaitForMultipleObjects(2, handles, FALSE, request.timeout + kCompletionSlack) != WAIT_OBJECT_0 + 1) {
+            return false;
+        }
+        
+        request.pending = false;
+        return true;
+    }
+    
+    static bool IsSuccessfulReply(EchoRequest& request) {
+        if (IcmpParseReplies(request.replyBuffer.data(), (DWORD)request.replyBuffer.size()) == 0) {
+            return false;
+        }
+        
+        PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)request.replyBuffer.data();
+        return reply->Status == IP_SUCCESS;
+    }
+    
+public:
+    ~IcmpProbe() {
+        // Closing the handle cancels the requests which are still in flight.
+        if (hIcmpFile != INVALID_HANDLE_VALUE) {
+            IcmpCloseHandle(hIcmpFile);
+        }
+        
+        for (auto& request : requests) {
+            if (request.pending &&
+                WaitForSingleObject(request.event, request.timeout + kCompletionSlack) != WAIT_OBJECT_0) {
+                // The request may still write to its reply buffer, leak it
+                // rather than risk a write to freed memory.
+                Wh_Log(L"⚠️ ICMP request did not complete, leaking its reply buffer");
+                new std::vector<BYTE>(std::move(request.replyBuffer));
+            }
+            CloseHandle(request.event);
+        }
+    }
+    
+    int Probe(const std::vector<std::string>& hosts, DWORD timeout, HANDLE stopEvent) override {
+        if (hIcmpFile == INVALID_HANDLE_VALUE) {
+            hIcmpFile = IcmpCreateFile();
+            if (hIcmpFile == INVALID_HANDLE_VALUE) return -1;
+        }
+        
+        while (requests.size() < hosts.size()) {
+            EchoRequest request;
+            request.event = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (!request.event) return -1;
+            // Room for an ICMP error message and the IO_STATUS_BLOCK which
+            // asynchronous requests write to the buffer.
+            request.replyBuffer.resize(sizeof(ICMP_ECHO_REPLY) + sizeof(kEchoData) + 8 + 2 * sizeof(void*));
+            requests.push_back(std::move(request));
+        }
+        
+        // The stop event comes first, followed by the requests in flight.
+        std::vector<HANDLE> waitHandles{stopEvent};
+        std::vector<size_t> waitRequests;
+        
+        for (size_t i = 0; i < hosts.size(); i++) {
+            EchoRequest& request = requests[i];
+            
+            IPAddr destIP;
+            if (hosts[i].empty() || !ResolveHost(hosts[i], &destIP)) continue;
+            
+            if (!WaitForRequest(request, stopEvent)) continue;
+            
+            ResetEvent(request.event);
+            DWORD result = IcmpSendEcho2(
+                hIcmpFile, request.event, nullptr, nullptr, destIP,
+                (LPVOID)kEchoData, sizeof(kEchoData), nullptr,
+                request.replyBuffer.data(), (DWORD)request.replyBuffer.size(), timeout
+            );
+            
+            if (result == 0 && GetLastError() != ERROR_IO_PENDING) continue;
+            
+            request.pending = true;
+            request.timeout = timeout;
+            waitHandles.push_back(request.event);
+            waitRequests.push_back(i);
+        }
+        
+        DWORD deadline = GetTickCount() + timeout + kCompletionSlack;
+        
+        while (!waitRequests.empty()) {
+            DWORD remaining = deadline - GetTickCount();
+            if ((int)remaining <= 0) break;
+            
+            DWORD wait = WaitForMultipleObjects((DWORD)waitHandles.size(), waitHandles.data(), FALSE, remaining);
+            if (wait <= WAIT_OBJECT_0 || wait >= WAIT_OBJECT_0 + waitHandles.size()) {
+                break;
+            }
+            
+            size_t signaled = wait - WAIT_OBJECT_0;
+            size_t index = waitRequests[signaled - 1];
+            requests[index].pending = false;
+            
+            if (IsSuccessfulReply(requests[index])) {
+                return (int)index;
+            }
+            
+            waitHandles.erase(waitHandles.begin() + signaled);
+            waitRequests.erase(waitRequests.begin() + (signaled - 1));
+        }
+        
+        return -1;
+    }
+};
+
+
+// Signals an event when Windows reports a connectivity change, so that a check
+// runs right away instead of at the next scheduled probe.
+class NetworkChangeListener : public INetworkListManagerEvents {
+private:
+    LONG refCount = 1;
+    HANDLE changedEvent;
+    IConnectionPoint* connectionPoint = nullptr;
+    DWORD cookie = 0;
+    
+public:
+    explicit NetworkChangeListener(HANDLE event) : changedEvent(event) {}
+    
+    bool Start() {
+        INetworkListManager* networkListManager = nullptr;
+        HRESULT hr = CoCreateInstance(__uuidof(NetworkListManager), nullptr, CLSCTX_ALL,
+                                      IID_PPV_ARGS(&networkListManager));
+        if (FAILED(hr)) return false;
+        
+        IConnectionPointContainer* container = nullptr;
+        hr = networkListManager->QueryInterface(IID_PPV_ARGS(&container));
+        networkListManager->Release();
+        if (FAILED(hr)) return false;
+        
+        hr = container->FindConnectionPoint(__uuidof(INetworkListManagerEvents), &connectionPoint);
+        container->Release();
+        if (FAILED(hr)) {
+            connectionPoint = nullptr;
+            return false;
+        }
+        
+        if (FAILED(connectionPoint->Advise(this, &cookie))) {
+            connectionPoint->Release();
+            connectionPoint = nullptr;
+            return false;
+        }
+        
+        return true;
+    }
+    
+    void Stop() {
+        if (connectionPoint) {
+            connectionPoint->Unadvise(cookie);
+            connectionPoint->Release();
+            connectionPoint = nullptr;
+        }
+    }
+    
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == IID_IUnknown || riid == __uuidof(INetworkListManagerEvents)) {
+            *ppv = static_cast<INetworkListManagerEvents*>(this);
+            AddRef();
+            return S_OK;
+        }
+        
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+    
+    STDMETHODIMP_(ULONG) AddRef() override {
+        return InterlockedIncrement(&refCount);
+    }
+    
+    STDMETHODIMP_(ULONG) Release() override {
+        ULONG count = InterlockedDecrement(&refCount);
+        if (count == 0) {
+            delete this;
+        }
+        return count;
+    }
+    
+    STDMETHODIMP ConnectivityChanged(NLM_CONNECTIVITY) override {
+        SetEvent(changedEvent);
+        return S_OK;
+    }
+};
+
+
 class InternetStatusMonitor {
 private:
     std::atomic<bool> isRunning{false};
     std::atomic<bool> isConnected{false};
     std::thread monitorThread;
     NetworkSettings settings;
-    HANDLE hIcmpFile;
+    
+    std::unique_ptr<ConnectivityProbe> probe;
+    ProbeScheduler scheduler;
     
     std::unique_ptr<TrayWindow> trayWindow;
     std::unique_ptr<TrayIconManager> trayIcon;
     bool trayIconInitialized;
     
     // For interruptible waiting
-    std::condition_variable cv;
-    std::mutex cv_mutex;
+    HANDLE stopEvent;
+    HANDLE networkChangedEvent;
     
 public:
-    InternetStatusMonitor() : hIcmpFile(INVALID_HANDLE_VALUE), 
-                              trayIconInitialized(false) {
+    InternetStatusMonitor() : trayIconInitialized(false) {
         WSAData wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
         
+        probe = std::make_unique<IcmpProbe>();
+        stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        networkChangedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        
         trayWindow = std::make_unique<TrayWindow>();
         trayIcon = std::make_unique<TrayIconManager>();
     }
     
     ~InternetStatusMonitor() {
         Stop();
-        if (hIcmpFile != INVALID_HANDLE_VALUE) {
-            IcmpCloseHandle(hIcmpFile);
-        }
+        probe.reset();
         
         if (trayIcon) {
             trayIcon->Cleanup();
         }
         
+        CloseHandle(stopEvent);
+        CloseHandle(networkChangedEvent);
+        
         WSACleanup();
     }
     
@@ -532,77 +822,25 @@ public:
         return true;
     }
     
-    bool InitializeIcmp() {
-        hIcmpFile = IcmpCreateFile();
-        return hIcmpFile != INVALID_HANDLE_VALUE;
-    }
-    
-    bool PingHost(const std::string& hostname) {
-        if (hIcmpFile == INVALID_HANDLE_VALUE) {
-            if (!InitializeIcmp()) return false;
-        }
-        
-        struct addrinfo hints = {0};
-        struct addrinfo* result = nullptr;
-        hints.ai_family = AF_INET;
-        
-        if (getaddrinfo(hostname.c_str(), nullptr, &hints, &result) != 0) {
-            return false;
-        }
-        
-        struct sockaddr_in* addr = (struct sockaddr_in*)result->ai_addr;
-        IPAddr destIP = addr->sin_addr.s_addr;
-        freeaddrinfo(result);
-        
-        char sendData[] = "NetworkStatusCheck";
-        DWORD replySize = sizeof(ICMP_ECHO_REPLY) + sizeof(sendData);
-        LPVOID replyBuffer = malloc(replySize);
-        
-        if (!replyBuffer) return false;
-        
-        // Use shorter timeout for faster shutdown
-        DWORD pingTimeout = std::min((DWORD)settings.timeout, 1000UL);
-        
-        DWORD numReplies = IcmpSendEcho(
-            hIcmpFile, destIP, sendData, sizeof(sendData),
-            nullptr, replyBuffer, replySize, pingTimeout
-        );
-        
-        bool success = false;
-        if (numReplies > 0) {
-            PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)replyBuffer;
-            success = (reply->Status == IP_SUCCESS);
-        }
-        
-        free(replyBuffer);
-        return success;
-    }
-    
     void PerformConnectivityCheck() {
         // Check if we should stop before doing any work
         if (!isRunning.load()) return;
         
-        bool wasConnected = isConnected.load();
-        
-        // SIMPLIFIED LOGIC: Just ping primary host, then secondary if primary fails
-        bool primaryPing = PingHost(settings.targetHost);
-        bool secondaryPing = false;
-        
-        // Check again if we should stop (ping might have taken time)
-        if (!isRunning.load()) return;
-        
-        if (!primaryPing) {
-            secondaryPing = PingHost(settings.secondaryHost);
-        }
+        // Ping both hosts at once, the first reply means we're connected
+        std::vector<std::string> hosts{settings.targetHost, settings.secondaryHost};
+        // Use shorter timeout for faster shutdown
+        DWORD pingTimeout = std::min((DWORD)settings.timeout, 1000UL);
+        int repliedHost = probe->Probe(hosts, pingTimeout, stopEvent);
         
-        // Check one more time if we should stop
+        // Check again if we should stop (ping might have been interrupted)
         if (!isRunning.load()) return;
         
-        // If either ping succeeds, we're connected. That's it!
-        bool currentlyConnected = primaryPing || secondaryPing;
+        bool reachable = repliedHost != -1;
+        bool stateChanged = scheduler.OnProbeResult(reachable);
+        bool currentlyConnected = scheduler.IsConnected();
         
         // Update connection state if changed
-        if (currentlyConnected != wasConnected) {
+        if (stateChanged) {
             isConnected.store(currentlyConnected);
             
             if (currentlyConnected) {
@@ -619,22 +857,40 @@ public:
         
         // Verbose logging
         if (settings.logVerbose) {
-            Wh_Log(L"Status: Primary=%s, Secondary=%s, Result=%s (%s)",
-                   primaryPing ? L"✓" : L"✗",
-                   secondaryPing ? L"✓" : L"✗", 
+            Wh_Log(L"Status: Reply=%S, Result=%s (%s), Next check in %dms",
+                   reachable ? hosts[repliedHost].c_str() : "none",
                    currentlyConnected ? L"CONNECTED" : L"DISCONNECTED",
-                   currentlyConnected ? L"🟢" : L"🔴");
+                   currentlyConnected ? L"🟢" : L"🔴",
+                   scheduler.NextDelayMs(settings.checkInterval));
         }
     }
     
     void MonitorLoop() {
         Wh_Log(L"🚀 Internet Status Monitor started (windhawk.exe)");
         
-        Sleep(1000);
-        PerformConnectivityCheck();
+        // Connectivity change notifications are delivered on COM threads,
+        // which only set the event.
+        HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+        NetworkChangeListener* networkChangeListener = new NetworkChangeListener(networkChangedEvent);
+        if (FAILED(hr) || !networkChangeListener->Start()) {
+            Wh_Log(L"⚠️ Network change notifications unavailable, checking on schedule only");
+        }
+        
+        DWORD delay = 1000;
         
         while (isRunning.load()) {
-            auto startTime = std::chrono::steady_clock::now();
+            HANDLE waitHandles[] = {stopEvent, networkChangedEvent};
+            DWORD wait = WaitForMultipleObjects(ARRAYSIZE(waitHandles), waitHandles, FALSE, delay);
+            
+            // Check if we should stop after waiting
+            if (wait == WAIT_OBJECT_0 || !isRunning.load()) break;
+            
+            if (wait == WAIT_OBJECT_0 + 1) {
+                scheduler.OnNetworkChanged();
+                if (settings.logVerbose) {
+                    Wh_Log(L"🔄 Network change detected, checking now");
+                }
+            }
             
             try {
                 PerformConnectivityCheck();
@@ -642,20 +898,13 @@ public:
                 Wh_Log(L"⚠️ Error during connectivity check");
             }
             
-            // Check if we should stop before waiting
-            if (!isRunning.load()) break;
-            
-            auto endTime = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                endTime - startTime).count();
-            
-            int sleepTime = settings.checkInterval - (int)elapsed;
-            if (sleepTime > 0) {
-                // Use condition variable for interruptible wait
-                std::unique_lock<std::mutex> lock(cv_mutex);
-                cv.wait_for(lock, std::chrono::milliseconds(sleepTime), 
-                           [this] { return !isRunning.load(); });
-            }
+            delay = scheduler.NextDelayMs(settings.checkInterval);
+        }
+        
+        networkChangeListener->Stop();
+        networkChangeListener->Release();
+        if (SUCCEEDED(hr)) {
+            CoUninitialize();
         }
         
         Wh_Log(L"🛑 Internet Status Monitor stopped");
@@ -665,6 +914,7 @@ public:
         if (isRunning.load()) return;
         
         isRunning.store(true);
+        ResetEvent(stopEvent);
         monitorThread = std::thread(&InternetStatusMonitor::MonitorLoop, this);
     }
     
@@ -674,8 +924,8 @@ public:
         Wh_Log(L"🔄 Stopping Internet Status Monitor...");
         isRunning.store(false);
         
-        // Wake up the monitoring thread immediately
-        cv.notify_all();
+        // Wake up the monitoring thread immediately, including from a ping
+        SetEvent(stopEvent);
         
         if (monitorThread.joinable()) {
             monitorThread.join();
@@ -2,12 +2,12 @@
 // @id              magnifier-mod
 // @name            Taskbar Magnifier M🔍d
 // @description     Adds a magnifier window you can customize and dock at the top, bottom, left, or right of your screen and more.
-// @version         0.5.4
+// @version         0.5.5
 // @author          00face
 // @github          https://github.com/00face
 // @homepage        https://hyaenahyaena.com
 // @include         explorer.exe
-// @compilerOptions -lgdi32 -lcomdlg32 -luxtheme -lgdiplus
+// @compilerOptions -lgdi32 -lcomdlg32 -luxtheme -lgdiplus -ldwmapi
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -34,6 +34,13 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 
 # Changelog
 
+## [0.5.5] - 2026-10-19
+### Changed
+- The magnifier follows the cursor as it moves, at most once per display frame, and stays idle while the cursor doesn't move.
+- Cached the work area and zoom transform, which are only refreshed when the display, the work area or the settings change.
+- An idle update interval of 0 disables the idle refresh.
+- Added logging of the cursor-to-update latency.
+
 ## [0.5.4] - 2025-01-20
 ### Added
 - Ensured the magnifier window moves to the correct monitor when switching between monitors.
@@ -74,7 +81,7 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
   $description: The zoom level for the magnifier window (in percentage).
 - idleUpdateInterval: 500
   $name: Idle Update Interval
-  $description: The update interval when the cursor is idle (in milliseconds).
+  $description: The update interval when the cursor is idle (in milliseconds, 0 to disable).
 - magnifierHeight: 100
   $name: Magnifier Height
   $description: The height of the magnifier window.
@@ -115,10 +122,10 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 #include <windhawk_api.h>
 #include <shellapi.h>
 #include <uxtheme.h>
+#include <dwmapi.h>
 #include <algorithm>
 #include <thread>
 #include <atomic>
-#include <chrono>
 #include <gdiplus.h>
 #include <string>
 #include <locale>
@@ -126,6 +133,16 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 
 #define WC_MAGNIFIER L"Magnifier"
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+#define WM_APP_SETTINGS_CHANGED (WM_APP + 1)
+#define IDLE_UPDATE_TIMER_ID 1
+
+// Number of frames after which the latency counters are logged and reset.
+#define LATENCY_REPORT_FRAMES 1000
+
 typedef struct tagMAGRANGEINFO {
     float min;
     float max;
@@ -187,8 +204,50 @@ struct {
     bool isEnabled;
 } settings = {0};
 
+// Cursor movement is reported by a low-level mouse hook, which only arms the
+// frame timer. The source rectangle is then updated once the next DWM frame is
+// due, so that all movement within a frame results in a single update, and the
+// thread stays blocked while the cursor doesn't move. A low-level hook is used
+// rather than raw input, since raw input registrations are per process and
+// would replace the ones of Explorer.
+struct {
+    HANDLE stopEvent;
+    HANDLE frameTimer;
+    HHOOK mouseHook;
+    LARGE_INTEGER qpcFrequency;
+    LONGLONG refreshPeriod;
+    LONGLONG lastFrameTime;
+    LONGLONG firstPendingInputTime;
+    bool frameScheduled;
+    // The monitor the cursor was last on, and its bounds.
+    HMONITOR cursorMonitor;
+    RECT cursorMonitorRect;
+    MAGRECTANGLE lastSourceRect;
+} framePacing;
+
+// Time from the first coalesced cursor movement to the source update.
+struct {
+    DWORD frames;
+    DWORD inputEvents;
+    LONGLONG totalLatency;
+    LONGLONG maxLatency;
+} latencyStats;
+
 void UpdateMagnifierPosition();
 void MagnifierThreadFunc();
+void RefreshDisplayCache();
+void ApplyMagnifierTransform();
+void ApplyIdleUpdateInterval();
+
+LONGLONG QueryPerformanceCounterNow() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+double PerformanceCounterToMilliseconds(LONGLONG ticks) {
+    return ticks * 1000.0 / framePacing.qpcFrequency.QuadPart;
+}
 
 void LoadSettings() {
     settings.zoomLevel = static_cast<float>(Wh_GetIntSetting(L"zoomLevel")) / 100.0f;
@@ -255,62 +314,160 @@ LRESULT CALLBACK HostWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             return 1;
         case WM_DISPLAYCHANGE:
             if (settings.isInitialized) {
+                RefreshDisplayCache();
                 UpdateMagnifierPosition();
             }
             return 0;
+        case WM_SETTINGCHANGE:
+            if (settings.isInitialized && wParam == SPI_SETWORKAREA) {
+                RefreshDisplayCache();
+                UpdateMagnifierPosition();
+            }
+            break;
         case WM_KEYDOWN:
             if (wParam == VK_F5) {
                 UpdateMagnifierPosition();
             }
             break;
-        case WM_MOUSEMOVE:
-            if (settings.isEnabled) {
-                settings.isUpdating = TRUE;
-                POINT currCursorPos;
-                if (GetCursorPos(&currCursorPos)) {
-                    if (currCursorPos.x != settings.prevCursorPos.x ||
-                        currCursorPos.y != settings.prevCursorPos.y) {
-
-                        settings.prevCursorPos = currCursorPos;
-
-                        int sourceWidth = 400;
-                        int sourceHeight = 100;
-
-                        MAGRECTANGLE sourceRect = {
-                            static_cast<LONG>(currCursorPos.x - (sourceWidth / 2)),
-                            static_cast<LONG>(currCursorPos.y - (sourceHeight / 2)),
-                            static_cast<LONG>(currCursorPos.x + (sourceWidth / 2)),
-                            static_cast<LONG>(currCursorPos.y + (sourceHeight / 2))
-                        };
-
-                        RECT screenRect;
-                        SystemParametersInfo(SPI_GETWORKAREA, 0, &screenRect, 0);
-                        sourceRect.left = std::max(screenRect.left, sourceRect.left);
-                        sourceRect.top = std::max(screenRect.top, sourceRect.top);
-                        sourceRect.right = std::min(screenRect.right, sourceRect.right);
-                        sourceRect.bottom = std::min(screenRect.bottom, sourceRect.bottom);
-
-                        if (pfnMagSetWindowSource(settings.hwndMagnifier, sourceRect)) {
-                            float matrix[9] = {
-                                settings.zoomLevel, 0, 0,
-                                0, settings.zoomLevel, 0,
-                                0, 0, 1
-                            };
-                            pfnMagSetWindowTransform(settings.hwndMagnifier, matrix);
-
-                            InvalidateRect(settings.hwndMagnifier, NULL, FALSE);
-                            UpdateWindow(settings.hwndMagnifier);
-                        }
-
-                        settings.isUpdating = FALSE;
-                    }
-                }
+        case WM_TIMER:
+            if (wParam == IDLE_UPDATE_TIMER_ID) {
+                // Refresh the magnified content even if the cursor is idle.
+                InvalidateRect(settings.hwndMagnifier, NULL, FALSE);
+                return 0;
             }
             break;
+        case WM_APP_SETTINGS_CHANGED:
+            LoadSettings();
+            ApplyMagnifierTransform();
+            ApplyIdleUpdateInterval();
+            UpdateMagnifierPosition();
+            // Update the opacity of the magnifier window
+            SetLayeredWindowAttributes(settings.hwndMagnifier, 0, settings.opacity, LWA_ALPHA);
+            return 0;
     }
     return DefWindowProc(hwnd, msg, wParam, lParam);
 }
 
+void RefreshDisplayCache() {
+    // Monitor handles can survive a display change while their bounds
+    // change, so the bounds are queried again on the next frame.
+    framePacing.cursorMonitor = NULL;
+
+    DWM_TIMING_INFO timingInfo = {0};
+    timingInfo.cbSize = sizeof(timingInfo);
+    if (SUCCEEDED(DwmGetCompositionTimingInfo(NULL, &timingInfo)) && timingInfo.qpcRefreshPeriod > 0) {
+        framePacing.refreshPeriod = timingInfo.qpcRefreshPeriod;
+    } else {
+        framePacing.refreshPeriod = framePacing.qpcFrequency.QuadPart / 60;
+    }
+}
+
+void ApplyMagnifierTransform() {
+    float matrix[9] = {
+        settings.zoomLevel, 0, 0,
+        0, settings.zoomLevel, 0,
+        0, 0, 1
+    };
+    pfnMagSetWindowTransform(settings.hwndMagnifier, matrix);
+}
+
+void ApplyIdleUpdateInterval() {
+    if (settings.idleUpdateInterval > 0) {
+        SetTimer(settings.hwndHost, IDLE_UPDATE_TIMER_ID, settings.idleUpdateInterval, NULL);
+    } else {
+        KillTimer(settings.hwndHost, IDLE_UPDATE_TIMER_ID);
+    }
+}
+
+// Centers the magnifier source on the cursor, clamped to the given bounds.
+// Unless forced, nothing is done if the source didn't change.
+void UpdateMagnifierSource(POINT ptCursor, const RECT& bounds, bool force) {
+    int sourceWidth = 400;
+    int sourceHeight = 100;
+
+    MAGRECTANGLE sourceRect = {
+        static_cast<LONG>(ptCursor.x - (sourceWidth / 2)),
+        static_cast<LONG>(ptCursor.y - (sourceHeight / 2)),
+        static_cast<LONG>(ptCursor.x + (sourceWidth / 2)),
+        static_cast<LONG>(ptCursor.y + (sourceHeight / 2))
+    };
+
+    sourceRect.left = std::max(bounds.left, sourceRect.left);
+    sourceRect.top = std::max(bounds.top, sourceRect.top);
+    sourceRect.right = std::min(bounds.right, sourceRect.right);
+    sourceRect.bottom = std::min(bounds.bottom, sourceRect.bottom);
+
+    if (!force && memcmp(&sourceRect, &framePacing.lastSourceRect, sizeof(sourceRect)) == 0) {
+        return;
+    }
+
+    if (pfnMagSetWindowSource(settings.hwndMagnifier, sourceRect)) {
+        framePacing.lastSourceRect = sourceRect;
+        InvalidateRect(settings.hwndMagnifier, NULL, FALSE);
+    }
+}
+
+void RunFrame() {
+    if (!framePacing.frameScheduled) {
+        return;
+    }
+
+    framePacing.frameScheduled = false;
+
+    POINT ptCursor;
+    if (settings.isEnabled && GetCursorPos(&ptCursor)) {
+        HMONITOR hMonitor = MonitorFromPoint(ptCursor, MONITOR_DEFAULTTONEAREST);
+        if (hMonitor != framePacing.cursorMonitor) {
+            MONITORINFO monitorInfo = {sizeof(MONITORINFO)};
+            if (GetMonitorInfo(hMonitor, &monitorInfo)) {
+                framePacing.cursorMonitor = hMonitor;
+                framePacing.cursorMonitorRect = monitorInfo.rcMonitor;
+            }
+        }
+
+        if (framePacing.cursorMonitor) {
+            UpdateMagnifierSource(ptCursor, framePacing.cursorMonitorRect, false);
+        }
+    }
+
+    LONGLONG now = QueryPerformanceCounterNow();
+    framePacing.lastFrameTime = now;
+
+    LONGLONG latency = now - framePacing.firstPendingInputTime;
+    latencyStats.frames++;
+    latencyStats.totalLatency += latency;
+    latencyStats.maxLatency = std::max(latencyStats.maxLatency, latency);
+
+    if (latencyStats.frames >= LATENCY_REPORT_FRAMES) {
+        Wh_Log(L"%u frames for %u mouse moves, latency: %.2f ms average, %.2f ms max",
+               latencyStats.frames, latencyStats.inputEvents,
+               PerformanceCounterToMilliseconds(latencyStats.totalLatency) / latencyStats.frames,
+               PerformanceCounterToMilliseconds(latencyStats.maxLatency));
+        latencyStats = {};
+    }
+}
+
+LRESULT CALLBACK LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION && wParam == WM_MOUSEMOVE && framePacing.frameTimer) {
+        latencyStats.inputEvents++;
+
+        if (!framePacing.frameScheduled) {
+            LONGLONG now = QueryPerformanceCounterNow();
+            framePacing.frameScheduled = true;
+            framePacing.firstPendingInputTime = now;
+
+            // Relative due time in 100 ns units, at least 1 for an immediate
+            // update if a frame has passed since the last one.
+            LONGLONG wait = framePacing.lastFrameTime + framePacing.refreshPeriod - now;
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -std::max(1LL, wait * 10000000 / framePacing.qpcFrequency.QuadPart);
+            SetWaitableTimer(framePacing.frameTimer, &dueTime, 0, NULL, NULL, FALSE);
+        }
+    }
+
+    return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
 HWND CreateMagnifierHost() {
     WNDCLASSEX wc = {0};
     wc.cbSize = sizeof(WNDCLASSEX);
@@ -464,33 +621,7 @@ void UpdateMagnifierPosition() {
     // Get the monitor information for the cursor position
     hMonitor = MonitorFromPoint(ptCursor, MONITOR_DEFAULTTONEAREST);
     if (GetMonitorInfo(hMonitor, &monitorInfo)) {
-        int sourceWidth = 400;
-        int sourceHeight = 100;
-
-        MAGRECTANGLE sourceRect = {
-            static_cast<LONG>(ptCursor.x - (sourceWidth / 2)),
-            static_cast<LONG>(ptCursor.y - (sourceHeight / 2)),
-            static_cast<LONG>(ptCursor.x + (sourceWidth / 2)),
-            static_cast<LONG>(ptCursor.y + (sourceHeight / 2))
-        };
-
-        RECT screenRect = monitorInfo.rcMonitor;
-        sourceRect.left = std::max(screenRect.left, sourceRect.left);
-        sourceRect.top = std::max(screenRect.top, sourceRect.top);
-        sourceRect.right = std::min(screenRect.right, sourceRect.right);
-        sourceRect.bottom = std::min(screenRect.bottom, sourceRect.bottom);
-
-        if (pfnMagSetWindowSource(settings.hwndMagnifier, sourceRect)) {
-            float matrix[9] = {
-                settings.zoomLevel, 0, 0,
-                0, settings.zoomLevel, 0,
-                0, 0, 1
-            };
-            pfnMagSetWindowTransform(settings.hwndMagnifier, matrix);
-
-            InvalidateRect(settings.hwndMagnifier, NULL, FALSE);
-            UpdateWindow(settings.hwndMagnifier);
-        }
+        UpdateMagnifierSource(ptCursor, monitorInfo.rcMonitor, true);
     }
 
     Wh_Log(L"Magnifier position updated");
@@ -524,24 +655,61 @@ void MagnifierThreadFunc() {
     settings.updateCount = 0;
     settings.isEnabled = true;
 
+    QueryPerformanceFrequency(&framePacing.qpcFrequency);
+    RefreshDisplayCache();
+    ApplyMagnifierTransform();
+    ApplyIdleUpdateInterval();
     UpdateMagnifierPosition();
 
-    while (settings.isInitialized) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(8));
+    framePacing.frameTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!framePacing.frameTimer) {
+        framePacing.frameTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    }
 
-        if (!settings.isEnabled) {
+    framePacing.mouseHook = SetWindowsHookEx(WH_MOUSE_LL, LowLevelMouseProc, GetModuleHandle(NULL), 0);
+    if (!framePacing.mouseHook) {
+        Wh_Log(L"SetWindowsHookEx failed, the magnifier will only follow the cursor on idle updates");
+    }
+
+    // Blocks until the cursor moves, a message arrives, or the mod is stopped.
+    HANDLE waitHandles[] = {framePacing.stopEvent, framePacing.frameTimer};
+    DWORD waitCount = framePacing.frameTimer ? 2 : 1;
+    bool running = true;
+    while (running) {
+        DWORD result = MsgWaitForMultipleObjectsEx(waitCount, waitHandles, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+        if (result == WAIT_OBJECT_0) {
+            break;
+        }
+
+        if (result == WAIT_OBJECT_0 + 1 && waitCount == 2) {
+            RunFrame();
             continue;
         }
 
-        // Force update every idleUpdateInterval milliseconds even if the cursor hasn't moved
-        static auto lastForceUpdateTime = std::chrono::steady_clock::now();
-        auto now = std::chrono::steady_clock::now();
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastForceUpdateTime).count() >= settings.idleUpdateInterval) {
-            lastForceUpdateTime = now;
-            UpdateMagnifierPosition();
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                running = false;
+                break;
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
         }
     }
 
+    if (framePacing.mouseHook) {
+        UnhookWindowsHookEx(framePacing.mouseHook);
+    }
+
+    if (framePacing.frameTimer) {
+        CloseHandle(framePacing.frameTimer);
+    }
+
+    framePacing.mouseHook = NULL;
+    framePacing.frameTimer = NULL;
+    framePacing.frameScheduled = false;
+    latencyStats = {};
+
     if (settings.hwndMagnifier) {
         DestroyWindow(settings.hwndMagnifier);
     }
@@ -594,27 +762,33 @@ BOOL Wh_ModInit() {
     Gdiplus::GdiplusStartupInput gdiplusStartupInput;
     Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
 
+    framePacing.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!framePacing.stopEvent) {
+        Gdiplus::GdiplusShutdown(gdiplusToken);
+        return FALSE;
+    }
+
     settings.magnifierThread = std::thread(MagnifierThreadFunc);
     return TRUE;
 }
 
 void Wh_ModUninit() {
-    settings.isInitialized = FALSE;
+    SetEvent(framePacing.stopEvent);
     if (settings.magnifierThread.joinable()) {
         settings.magnifierThread.join();
     }
+    settings.isInitialized = FALSE;
+    CloseHandle(framePacing.stopEvent);
+    framePacing.stopEvent = NULL;
     Gdiplus::GdiplusShutdown(gdiplusToken);
     Wh_Log(L"Mod uninitialized");
 }
 
 void Wh_ModSettingsChanged() {
-    LoadSettings();
-    if (settings.isInitialized) {
-        UpdateMagnifierPosition();
-        // Update the opacity of the magnifier window
-        if (settings.hwndMagnifier) {
-            SetLayeredWindowAttributes(settings.hwndMagnifier, 0, settings.opacity, LWA_ALPHA);
-        }
+    // The settings are reloaded on the magnifier thread, which owns the
+    // windows and the cached transform.
+    if (settings.isInitialized && settings.hwndHost) {
+        PostMessage(settings.hwndHost, WM_APP_SETTINGS_CHANGED, 0, 0);
     }
     Wh_Log(L"Settings changed");
 }
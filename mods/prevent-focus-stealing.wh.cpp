@@ -2,7 +2,7 @@
 // @id              prevent-focus-stealing
 // @name            Prevent Focus Stealing
 // @description     Prevents specific apps from stealing focus when a window is opened.
-// @version         1.0.1
+// @version         1.0.2
 // @author          bawNg
 // @github          https://github.com/bawNg
 // @include         *
@@ -89,6 +89,7 @@ You should set `Excluded Arguments` to `--type` for efficiency so that only the
 #include <windhawk_utils.h>
 #include <windows.h>
 #include <shlwapi.h>
+#include <utility>
 #include <vector>
 
 #ifdef _WIN64
@@ -107,9 +108,10 @@ You should set `Excluded Arguments` to `--type` for efficiency so that only the
 
 #define MOD_MSG_PREFIX L"Wh_FocusSteal_"
 
-#define Wh_SetProp(hWnd, name, value) SetPropW(hWnd, MOD_MSG_PREFIX name, reinterpret_cast<HANDLE>(value))
-#define Wh_GetProp(type, hWnd, name)  static_cast<type>(reinterpret_cast<intptr_t>(GetPropW(hWnd, MOD_MSG_PREFIX name)))
-#define Wh_RemoveProp(hWnd, name)     RemoveProp(hWnd, MOD_MSG_PREFIX name)
+// Properties are accessed through atoms registered once, since a string name is looked up in the atom table on every call
+#define Wh_SetProp(hWnd, atom, value) SetPropW(hWnd, MAKEINTATOM(atom), reinterpret_cast<HANDLE>(value))
+#define Wh_GetProp(type, hWnd, atom)  static_cast<type>(reinterpret_cast<intptr_t>(GetPropW(hWnd, MAKEINTATOM(atom))))
+#define Wh_RemoveProp(hWnd, atom)     RemovePropW(hWnd, MAKEINTATOM(atom))
 
 const intptr_t TS_PRECISION_MS = INTPTR_MAX == INT32_MAX ? 10 : 1;
 
@@ -124,6 +126,8 @@ struct WindowInfo {
 
 std::vector<WindowInfo> g_includedWindows;
 
+ATOM g_noActivateTsAtom;
+
 bool g_initialized;
 
 LPCWSTR ShowCmdToString(int cmd) {
@@ -157,16 +161,83 @@ BOOL CALLBACK EnumWindowsProc(HWND hwnd, LPARAM lParam) {
     return TRUE;
 }
 
-WindowInfo* GetWindowInfo(LPCWSTR title) {
-    for (WindowInfo& info : g_includedWindows) {
-        if (!(*info.title) || _wcsnicmp(title, info.title, wcslen(info.title)) == 0)
-            return &info;
+inline WCHAR FoldTitleChar(WCHAR c) {
+    if (c < 0x80)
+        return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : c;
+    return static_cast<WCHAR>(reinterpret_cast<ULONG_PTR>(CharLowerW(reinterpret_cast<LPWSTR>(static_cast<ULONG_PTR>(c)))));
+}
+
+// Case-folded prefix trie of the configured window titles, built once when settings are loaded. Each node stores the
+// lowest index of a title ending there, so that a lookup returns the same entry as checking the titles in order.
+class TitleMatcher {
+public:
+    void Build(const std::vector<WindowInfo>& windows) {
+        nodes.assign(1, Node{});
+        for (int index = 0; index < static_cast<int>(windows.size()); index++) {
+            int node = 0;
+            for (LPCWSTR p = windows[index].title; *p; p++)
+                node = AddChild(node, FoldTitleChar(*p));
+            if (nodes[node].match < 0)
+                nodes[node].match = index;
+        }
+        // A blank title matches anything, so there's nothing to walk if no earlier entry can match first
+        matchAnything = nodes[0].match;
+    }
+
+    // Returns the index of the first configured title which is a prefix of the given title, or -1
+    int Match(LPCWSTR title) const {
+        if (matchAnything == 0)
+            return 0;
+        int best = matchAnything;
+        int node = 0;
+        for (LPCWSTR p = title; *p; p++) {
+            node = FindChild(node, FoldTitleChar(*p));
+            if (node < 0)
+                break;
+            int match = nodes[node].match;
+            if (match >= 0 && (best < 0 || match < best))
+                best = match;
+        }
+        return best;
+    }
+
+private:
+    struct Node {
+        int match = -1;
+        std::vector<std::pair<WCHAR, int>> children;
+    };
+
+    int FindChild(int node, WCHAR c) const {
+        for (const auto& child : nodes[node].children) {
+            if (child.first == c)
+                return child.second;
+        }
+        return -1;
+    }
+
+    int AddChild(int node, WCHAR c) {
+        int child = FindChild(node, c);
+        if (child >= 0)
+            return child;
+        child = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        nodes[node].children.emplace_back(c, child);
+        return child;
     }
-    return nullptr;
+
+    std::vector<Node> nodes;
+    int matchAnything = -1;
+};
+
+TitleMatcher g_titleMatcher;
+
+WindowInfo* GetWindowInfo(LPCWSTR title) {
+    int index = g_titleMatcher.Match(title);
+    return index >= 0 ? &g_includedWindows[index] : nullptr;
 }
 
 bool CanActivateWindow(HWND hWnd) {
-    intptr_t timestamp = Wh_GetProp(intptr_t, hWnd, L"NoActivateTs");
+    intptr_t timestamp = Wh_GetProp(intptr_t, hWnd, g_noActivateTsAtom);
     return !timestamp || GetTickCount64() / TS_PRECISION_MS - timestamp >= INITIAL_FOCUS_BLOCK_MS / TS_PRECISION_MS;
 }
 
@@ -176,12 +247,12 @@ SetWindowTextW_t SetWindowTextW_Orig;
 // May be called from other threads, in which case it posts a WM_SETTEXT message
 BOOL WINAPI SetWindowTextW_Hook(HWND hWnd, LPCWSTR title) {
     BOOL result = SetWindowTextW_Orig(hWnd, title);
-    if (title && !Wh_GetProp(intptr_t, hWnd, L"NoActivateTs")) {
+    if (title && !Wh_GetProp(intptr_t, hWnd, g_noActivateTsAtom)) {
         WindowInfo* window_info = GetWindowInfo(title);
         if (window_info) {
             Wh_Log(L"SetWindowTextW for new window 0x%p: '%ls'", hWnd, title);
             intptr_t timestamp = window_info->neverFocus ? NEVER_FOCUS_TS : (GetTickCount64() / TS_PRECISION_MS);
-            Wh_SetProp(hWnd, L"NoActivateTs", timestamp);
+            Wh_SetProp(hWnd, g_noActivateTsAtom, timestamp);
         }
     }
     return result;
@@ -258,7 +329,7 @@ HWND WINAPI CreateWindowExW_Hook(DWORD dwExStyle, LPCWSTR lpClassName, LPCWSTR l
     if (hWnd) {
         if (window_info) {
             Wh_Log(L"Created window 0x%p is being tracked: '%ls'", hWnd, lpWindowName);
-            Wh_SetProp(hWnd, L"NoActivateTs", window_info->neverFocus ? NEVER_FOCUS_TS : (GetTickCount64() / TS_PRECISION_MS));
+            Wh_SetProp(hWnd, g_noActivateTsAtom, window_info->neverFocus ? NEVER_FOCUS_TS : (GetTickCount64() / TS_PRECISION_MS));
             ShowWindow_Orig(hWnd, SW_SHOWNOACTIVATE);
         }
     }
@@ -373,6 +444,15 @@ Done:
         return FALSE;
     }
 
+    g_titleMatcher.Build(g_includedWindows);
+
+    // Not deleted on unload, since properties may still be set on existing windows
+    g_noActivateTsAtom = GlobalAddAtomW(MOD_MSG_PREFIX L"NoActivateTs");
+    if (!g_noActivateTsAtom) {
+        Wh_Log(L"Failed to register property atom");
+        goto Failed;
+    }
+
     if (!Wh_SetFunctionHook((void *)CreateWindowExW, (void *)CreateWindowExW_Hook, (void **)&CreateWindowExW_Orig)) {
         Wh_Log(L"Failed to hook CreateWindowExW");
         goto Failed;
@@ -423,16 +503,16 @@ void Wh_ModAfterInit() {
             GetWindowTextW(hWnd, title, _countof(title));
             WindowInfo* window_info = GetWindowInfo(title);
             if (!window_info) {
-                Wh_RemoveProp(hWnd, "NoActivateTs");
+                Wh_RemoveProp(hWnd, g_noActivateTsAtom);
                 continue;
             }
-            intptr_t no_activate_ts = Wh_GetProp(intptr_t, hWnd, L"NoActivateTs");
+            intptr_t no_activate_ts = Wh_GetProp(intptr_t, hWnd, g_noActivateTsAtom);
             if (no_activate_ts) {
                 if (window_info->neverFocus ? no_activate_ts == NEVER_FOCUS_TS : no_activate_ts != NEVER_FOCUS_TS)
                     continue;
             }
             Wh_Log(L"Existing window 0x%p needs to be tracked: '%ls'%ls", hWnd, title, window_info->neverFocus ? L" (never focus)" : L"");
-            Wh_SetProp(hWnd, L"NoActivateTs", window_info->neverFocus ? NEVER_FOCUS_TS : (now / TS_PRECISION_MS));
+            Wh_SetProp(hWnd, g_noActivateTsAtom, window_info->neverFocus ? NEVER_FOCUS_TS : (now / TS_PRECISION_MS));
             if (GetForegroundWindow() == hWnd) {
                 Wh_Log(L"Window 0x%p stole focus before mod initialized - switching to previous", hWnd);
                 SwitchToPreviousWindow(hWnd);
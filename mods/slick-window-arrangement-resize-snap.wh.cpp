@@ -2,7 +2,7 @@
 // @id              slick-window-arrangement-resize-snap
 // @name            Slick Window Arrangement (Resize Snap)
 // @description     Adds snapping not only when moving windows, but also when resizing them (left, right, top, bottom).
-// @version         1.2.0
+// @version         1.2.1
 // @author          m417z (original), J4three6 (fork with resize support)
 // @github          J4three6
 // @license         MIT
@@ -82,6 +82,7 @@ MIT
 #include <windowsx.h>
 
 #include <atomic>
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -505,12 +506,207 @@ private:
     WindowMagnet windowMagnet;
 };
 
+// The sliding animation was originally tuned for frames of the default timer
+// resolution, 15.6 ms. The friction and the duration are still expressed in
+// these reference frames, but the animation is driven by the actual elapsed
+// time, so that it looks the same regardless of the timer resolution and the
+// monitor refresh rate.
+constexpr double kSlideReferenceFrameSeconds = 0.0156;
+constexpr double kSlideMaxDurationSeconds = kSlideReferenceFrameSeconds * 50;
+constexpr double kSlideMaxFrameSeconds = 0.05;
+constexpr double kMoveSampleTimeoutSeconds = 0.1;
+constexpr double kMoveVelocityWindowSeconds = 0.1;
+
+LONGLONG QueryPerformanceCounterNow()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+double PerformanceCounterToSeconds(LONGLONG ticks)
+{
+    static const double frequency = [] {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return (double)frequency.QuadPart;
+    }();
+
+    return ticks / frequency;
+}
+
+// Keeps recent window positions with high resolution timestamps, and estimates
+// the release velocity with a least-squares fit over the last samples, which
+// is much less noisy than a difference of two GetTickCount snapshots.
+class MoveVelocityTracker {
+public:
+    void Reset() {
+        sampleCount = 0;
+    }
+
+    void AddSample(LONGLONG time, int x, int y) {
+        if (sampleCount > 0 &&
+            PerformanceCounterToSeconds(time - GetSample(0).time) >= kMoveSampleTimeoutSeconds) {
+            // Waited for too long, reset.
+            Reset();
+        }
+
+        nextSample = (nextSample + 1) % kMaxSamples;
+        samples[nextSample] = { time, x, y };
+        if (sampleCount < kMaxSamples) {
+            sampleCount++;
+        }
+    }
+
+    bool GetReleaseState(LONGLONG time, int* x, int* y, double* velocityX, double* velocityY) const {
+        if (sampleCount < 2) {
+            return false;
+        }
+
+        const auto& last = GetSample(0);
+        if (PerformanceCounterToSeconds(time - last.time) >= kMoveSampleTimeoutSeconds) {
+            return false;
+        }
+
+        // Fit x(t) and y(t) with a line, t relative to the last sample.
+        int count = 0;
+        double sumT = 0, sumX = 0, sumY = 0, sumTT = 0, sumTX = 0, sumTY = 0;
+        for (int i = 0; i < sampleCount; i++) {
+            const auto& sample = GetSample(i);
+            double t = PerformanceCounterToSeconds(sample.time - last.time);
+            if (-t > kMoveVelocityWindowSeconds) {
+                break;
+            }
+
+            double sampleX = sample.x - last.x;
+            double sampleY = sample.y - last.y;
+
+            count++;
+            sumT += t;
+            sumX += sampleX;
+            sumY += sampleY;
+            sumTT += t * t;
+            sumTX += t * sampleX;
+            sumTY += t * sampleY;
+        }
+
+        if (count < 2) {
+            return false;
+        }
+
+        double denominator = count * sumTT - sumT * sumT;
+        if (denominator <= 0) {
+            return false;
+        }
+
+        *x = last.x;
+        *y = last.y;
+
+        // Velocity in client coordinates per second.
+        *velocityX = (count * sumTX - sumT * sumX) / denominator;
+        *velocityY = (count * sumTY - sumT * sumY) / denominator;
+
+        return true;
+    }
+
+private:
+    static constexpr int kMaxSamples = 16;
+
+    struct Sample {
+        LONGLONG time;
+        int x, y;
+    };
+
+    // 0 is the most recent sample.
+    const Sample& GetSample(int index) const {
+        return samples[(nextSample + kMaxSamples - index) % kMaxSamples];
+    }
+
+    Sample samples[kMaxSamples];
+    int nextSample = 0;
+    int sampleCount = 0;
+};
+
+// Predicts when the next frame is going to be composed by DWM, so that each
+// animation step is computed for the moment it becomes visible, and so that at
+// most one step is made per composed frame.
+class CompositionFramePacer {
+public:
+    CompositionFramePacer() {
+        DWM_TIMING_INFO timingInfo = { sizeof(timingInfo) };
+        if (SUCCEEDED(DwmGetCompositionTimingInfo(nullptr, &timingInfo)) &&
+            timingInfo.qpcRefreshPeriod) {
+            vblankTime = (LONGLONG)timingInfo.qpcVBlank;
+            refreshPeriod = (LONGLONG)timingInfo.qpcRefreshPeriod;
+        }
+    }
+
+    LONGLONG GetNextPresentTime(LONGLONG time) const {
+        if (!refreshPeriod) {
+            // Composition timing is unavailable, use the current time.
+            return time;
+        }
+
+        if (time < vblankTime) {
+            return vblankTime;
+        }
+
+        LONGLONG periods = (time - vblankTime) / refreshPeriod + 1;
+        return vblankTime + periods * refreshPeriod;
+    }
+
+private:
+    LONGLONG vblankTime = 0;
+    LONGLONG refreshPeriod = 0;
+};
+
+// Moves a point with an initial velocity and an exponential friction. Each
+// reference frame, the velocity is multiplied by (100 - slowdown) / 100, and
+// the motion is integrated exactly for any elapsed time, so that the total
+// distance doesn't depend on the frame rate.
+class InertialMotion {
+public:
+    InertialMotion(double x, double y, double velocityX, double velocityY) :
+        x(x), y(y), velocityX(velocityX), velocityY(velocityY) {}
+
+    void Advance(double seconds, int slowdown) {
+        if (slowdown < 1) {
+            slowdown = 1;
+        }
+        else if (slowdown > 99) {
+            slowdown = 99;
+        }
+
+        double frameMultiplier = (100 - slowdown) / 100.0;
+        double frames = seconds / kSlideReferenceFrameSeconds;
+        double multiplier = std::pow(frameMultiplier, frames);
+
+        // The sum of a geometric series of per-frame distances.
+        double distanceFactor =
+            kSlideReferenceFrameSeconds * (1.0 - multiplier) / (1.0 - frameMultiplier);
+
+        x += velocityX * distanceFactor;
+        y += velocityY * distanceFactor;
+
+        velocityX *= multiplier;
+        velocityY *= multiplier;
+    }
+
+    // At rest when moving less than a pixel per reference frame.
+    bool IsAtRest() const {
+        return std::abs(velocityX) * kSlideReferenceFrameSeconds < 1.0 &&
+            std::abs(velocityY) * kSlideReferenceFrameSeconds < 1.0;
+    }
+
+    double x, y;
+    double velocityX, velocityY;
+};
+
 class WindowMove {
 public:
-    void Reset() { lastState.reset(); for (auto& s : snapshot) s = nullptr; }
+    void Reset() { lastState.reset(); velocityTracker.Reset(); }
     void UpdateWithNewPos(HWND hTargetWnd, int x, int y) {
-        DWORD tick = GetTickCount();
-        if (snapshot[0] && tick - snapshot[0]->tickCount >= 100) Reset();
+        LONGLONG time = QueryPerformanceCounterNow();
 
         WindowState st = GetWindowState(hTargetWnd);
         if (lastState && (st.isMinimized != lastState->isMinimized ||
@@ -520,35 +716,15 @@ public:
         }
         lastState = st;
 
-        if (!snapshot[0]) snapshot[0] = &store[0];
-        else if (!snapshot[1]) { snapshot[1] = &store[0]; snapshot[0] = &store[1]; }
-
-        if (snapshot[1] && tick - snapshot[1]->tickCount >= 100) {
-            if (!snapshot[2]) snapshot[2] = &store[2];
-            auto* tmp = snapshot[2]; snapshot[2] = snapshot[1]; snapshot[1] = snapshot[0]; snapshot[0] = tmp;
-        }
-
-        snapshot[0]->tickCount = tick; snapshot[0]->x = x; snapshot[0]->y = y;
+        velocityTracker.AddSample(time, x, y);
     }
 
     bool CompleteMove(int* x, int* y, double* vx, double* vy) {
-        if (!snapshot[0] || !snapshot[1]) return false;
-        if (GetTickCount() - snapshot[0]->tickCount >= 100) return false;
-
-        auto* last = snapshot[0];
-        auto* prev = snapshot[2] ? snapshot[2] : snapshot[1];
-        int dt = last->tickCount - prev->tickCount;
-        if (dt <= 0) return false;
-
-        *x = last->x; *y = last->y;
-        *vx = 1000.0 * (last->x - prev->x) / dt;
-        *vy = 1000.0 * (last->y - prev->y) / dt;
-        return true;
+        return velocityTracker.GetReleaseState(QueryPerformanceCounterNow(), x, y, vx, vy);
     }
 
 private:
     struct WindowState { bool isMinimized; bool isMaximized; bool isArranged; };
-    struct Snap { DWORD tickCount; int x, y; };
 
     static WindowState GetWindowState(HWND hTargetWnd) {
         return WindowState{
@@ -559,7 +735,7 @@ private:
     }
 
     std::optional<WindowState> lastState;
-    Snap store[3]; Snap* snapshot[3]{};
+    MoveVelocityTracker velocityTracker;
 };
 
 std::atomic<bool> g_uninitializing;
@@ -606,12 +782,14 @@ class WindowSlideTimer {
 public:
     WindowSlideTimer(HWND hWnd, int cursorX, int cursorY, int x, int y, double vx, double vy,
                      std::optional<WindowMagnet> wm)
-        : target(hWnd), cursorPoint{cursorX, cursorY}, x((double)x), y((double)y),
-          velocityX(vx), velocityY(vy), windowMagnet(std::move(wm)) {
+        : target(hWnd), cursorPoint{cursorX, cursorY}, motion((double)x, (double)y, vx, vy),
+          windowMagnet(std::move(wm)) {
         HMONITOR monitor = MonitorFromPoint(cursorPoint, MONITOR_DEFAULTTONEAREST);
         MONITORINFO mi = { sizeof(mi) }; GetMonitorInfo(monitor, &mi);
         workArea = mi.rcWork;
-        timerId = SetTimer(nullptr, 0, 10, WindowSlideTimerProc);
+        startTime = lastFrameTime = QueryPerformanceCounterNow();
+        // Wake up as often as possible, the pace is set by composition frames.
+        timerId = SetTimer(nullptr, 0, USER_TIMER_MINIMUM, WindowSlideTimerProc);
         g_activeTimers[hWnd] = timerId;
     }
     ~WindowSlideTimer(){ KillTimer(nullptr, timerId); }
@@ -621,16 +799,20 @@ public:
 
     bool Next() {
         RECT rect; GetWindowRect(target, &rect);
-        if (frame != 0) {
+        if (positioned) {
             if (lastX != rect.left || lastY != rect.top ||
                 lastCx != (rect.right - rect.left) || lastCy != (rect.bottom - rect.top)) return false;
         }
 
-        int prevX = (int)x, prevY = (int)y;
-        x += velocityX / (1000.0 / 15.6);
-        y += velocityY / (1000.0 / 15.6);
-        int currentX = (int)x, currentY = (int)y;
-        if (currentX == prevX && currentY == prevY) return false;
+        LONGLONG frameTime = framePacer.GetNextPresentTime(QueryPerformanceCounterNow());
+        if (frameTime <= lastFrameTime) return true; // Frame already handled.
+        double elapsed = PerformanceCounterToSeconds(frameTime - lastFrameTime);
+        if (elapsed > kSlideMaxFrameSeconds) elapsed = kSlideMaxFrameSeconds;
+        lastFrameTime = frameTime;
+
+        int prevX = (int)motion.x, prevY = (int)motion.y;
+        motion.Advance(elapsed, g_settings.slidingAnimationSlowdown);
+        int currentX = (int)motion.x, currentY = (int)motion.y;
 
         POINT anchor{ currentX + cursorPoint.x, currentY + cursorPoint.y };
         if (!PtInRect(&workArea, anchor)) {
@@ -641,38 +823,41 @@ public:
                 if (PtInRect(&mi.rcWork, anchor)) { foundNewMonitor = true; workArea = mi.rcWork; }
             }
             if (!foundNewMonitor) {
-                if (anchor.x < workArea.left)      { x = workArea.left  - cursorPoint.x;  velocityX = -velocityX * .05; }
-                else if (anchor.x > workArea.right){ x = workArea.right - cursorPoint.x;  velocityX = -velocityX * .05; }
-                if (anchor.y < workArea.top)       { y = workArea.top   - cursorPoint.y;  velocityY = -velocityY * .05; }
-                else if (anchor.y > workArea.bottom){y = workArea.bottom- cursorPoint.y;  velocityY = -velocityY * .05; }
-                currentX = (int)x; currentY = (int)y;
+                if (anchor.x < workArea.left)      { motion.x = workArea.left  - cursorPoint.x;  motion.velocityX = -motion.velocityX * .05; }
+                else if (anchor.x > workArea.right){ motion.x = workArea.right - cursorPoint.x;  motion.velocityX = -motion.velocityX * .05; }
+                if (anchor.y < workArea.top)       { motion.y = workArea.top   - cursorPoint.y;  motion.velocityY = -motion.velocityY * .05; }
+                else if (anchor.y > workArea.bottom){motion.y = workArea.bottom- cursorPoint.y;  motion.velocityY = -motion.velocityY * .05; }
+                currentX = (int)motion.x; currentY = (int)motion.y;
             }
         }
 
-        int slowdown = g_settings.slidingAnimationSlowdown;
-        if (slowdown < 1) slowdown = 1; else if (slowdown > 99) slowdown = 99;
-        double mul = (100 - slowdown) / 100.0;
-        velocityX *= mul; velocityY *= mul;
-
         if (windowMagnet) {
             int mx = currentX, my = currentY, cx = rect.right - rect.left, cy = rect.bottom - rect.top;
             windowMagnet->MagnetMove(target, &mx, &my, &cx, &cy);
-            if (mx != currentX) { x = mx; currentX = mx; velocityX = 0.0; }
-            if (my != currentY) { y = my; currentY = my; velocityY = 0.0; }
+            if (mx != currentX) { motion.x = mx; currentX = mx; motion.velocityX = 0.0; }
+            if (my != currentY) { motion.y = my; currentY = my; motion.velocityY = 0.0; }
         }
 
-        SetWindowPos(target, nullptr, currentX, currentY, 0, 0,
-            SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+        if (currentX != prevX || currentY != prevY) {
+            SetWindowPos(target, nullptr, currentX, currentY, 0, 0,
+                SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+
+            lastX = currentX; lastY = currentY;
+            lastCx = rect.right - rect.left; lastCy = rect.bottom - rect.top;
+            positioned = true;
+        }
 
-        lastX = currentX; lastY = currentY;
-        lastCx = rect.right - rect.left; lastCy = rect.bottom - rect.top;
-        frame++; return frame < 50;
+        if (motion.IsAtRest()) return false;
+        return PerformanceCounterToSeconds(frameTime - startTime) < kSlideMaxDurationSeconds;
     }
 
 private:
-    HWND target; UINT_PTR timerId; int frame = 0;
+    HWND target; UINT_PTR timerId;
+    LONGLONG startTime, lastFrameTime;
+    CompositionFramePacer framePacer;
+    bool positioned = false;
     POINT cursorPoint; RECT workArea{};
-    double x, y, velocityX, velocityY;
+    InertialMotion motion;
     int lastX{}, lastY{}, lastCx{}, lastCy{};
     std::optional<WindowMagnet> windowMagnet;
 };
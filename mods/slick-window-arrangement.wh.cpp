@@ -2,7 +2,7 @@
 // @id              slick-window-arrangement
 // @name            Slick Window Arrangement
 // @description     Make window arrangement more slick and pleasant with a sliding animation and snapping
-// @version         1.0.2
+// @version         1.0.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -61,6 +61,7 @@ sliding animation and window snapping.
 #include <windowsx.h>
 
 #include <atomic>
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -514,86 +515,232 @@ private:
     WindowMagnet windowMagnet;
 };
 
-class WindowMove {
-public:
-    WindowMove() {}
+// The sliding animation was originally tuned for frames of the default timer
+// resolution, 15.6 ms. The friction and the duration are still expressed in
+// these reference frames, but the animation is driven by the actual elapsed
+// time, so that it looks the same regardless of the timer resolution and the
+// monitor refresh rate.
+constexpr double kSlideReferenceFrameSeconds = 0.0156;
+constexpr double kSlideMaxDurationSeconds = kSlideReferenceFrameSeconds * 50;
+constexpr double kSlideMaxFrameSeconds = 0.05;
+constexpr double kMoveSampleTimeoutSeconds = 0.1;
+constexpr double kMoveVelocityWindowSeconds = 0.1;
+
+LONGLONG QueryPerformanceCounterNow()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+double PerformanceCounterToSeconds(LONGLONG ticks)
+{
+    static const double frequency = [] {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return (double)frequency.QuadPart;
+    }();
 
+    return ticks / frequency;
+}
+
+// Keeps recent window positions with high resolution timestamps, and estimates
+// the release velocity with a least-squares fit over the last samples, which
+// is much less noisy than a difference of two GetTickCount snapshots.
+class MoveVelocityTracker {
+public:
     void Reset() {
-        lastState.reset();
-        for (auto& snapshotItem : snapshot) {
-            snapshotItem = nullptr;
-        }
+        sampleCount = 0;
     }
 
-    void UpdateWithNewPos(HWND hTargetWnd, int x, int y) {
-        DWORD tickCount = GetTickCount();
-
-        if (snapshot[0] && tickCount - snapshot[0]->tickCount >= 100) {
+    void AddSample(LONGLONG time, int x, int y) {
+        if (sampleCount > 0 &&
+            PerformanceCounterToSeconds(time - GetSample(0).time) >= kMoveSampleTimeoutSeconds) {
             // Waited for too long, reset.
             Reset();
         }
 
-        WindowState state = GetWindowState(hTargetWnd);
-        if (lastState && (state.isMinimized != lastState->isMinimized ||
-                          state.isMaximized != lastState->isMaximized ||
-                          state.isArranged != lastState->isArranged)) {
-            // Window state changed, e.g. it was snapped, reset.
-            Reset();
+        nextSample = (nextSample + 1) % kMaxSamples;
+        samples[nextSample] = { time, x, y };
+        if (sampleCount < kMaxSamples) {
+            sampleCount++;
         }
+    }
 
-        lastState = state;
-
-        if (!snapshot[0]) {
-            snapshot[0] = &snapshotStorage[0];
+    bool GetReleaseState(LONGLONG time, int* x, int* y, double* velocityX, double* velocityY) const {
+        if (sampleCount < 2) {
+            return false;
         }
-        else if (!snapshot[1]) {
-            snapshot[1] = &snapshotStorage[0];
-            snapshot[0] = &snapshotStorage[1];
+
+        const auto& last = GetSample(0);
+        if (PerformanceCounterToSeconds(time - last.time) >= kMoveSampleTimeoutSeconds) {
+            return false;
         }
 
-        if (snapshot[1] && tickCount - snapshot[1]->tickCount >= 100) {
-            if (!snapshot[2]) {
-                snapshot[2] = &snapshotStorage[2];
+        // Fit x(t) and y(t) with a line, t relative to the last sample.
+        int count = 0;
+        double sumT = 0, sumX = 0, sumY = 0, sumTT = 0, sumTX = 0, sumTY = 0;
+        for (int i = 0; i < sampleCount; i++) {
+            const auto& sample = GetSample(i);
+            double t = PerformanceCounterToSeconds(sample.time - last.time);
+            if (-t > kMoveVelocityWindowSeconds) {
+                break;
             }
 
-            auto* temp = snapshot[2];
-            snapshot[2] = snapshot[1];
-            snapshot[1] = snapshot[0];
-            snapshot[0] = temp;
-        }
-
-        snapshot[0]->tickCount = tickCount;
-        snapshot[0]->x = x;
-        snapshot[0]->y = y;
-    }
+            double sampleX = sample.x - last.x;
+            double sampleY = sample.y - last.y;
 
-    bool CompleteMove(int* x, int* y, double* velocityX, double* velocityY) {
-        if (!snapshot[0] || !snapshot[1]) {
-            return false;
+            count++;
+            sumT += t;
+            sumX += sampleX;
+            sumY += sampleY;
+            sumTT += t * t;
+            sumTX += t * sampleX;
+            sumTY += t * sampleY;
         }
 
-        if (GetTickCount() - snapshot[0]->tickCount >= 100) {
+        if (count < 2) {
             return false;
         }
 
-        auto* winMoveLast = snapshot[0];
-        auto* winMovePrev = snapshot[2] ? snapshot[2] : snapshot[1];
-
-        int tickCountDiff = winMoveLast->tickCount - winMovePrev->tickCount;
-        if (tickCountDiff <= 0) {
+        double denominator = count * sumTT - sumT * sumT;
+        if (denominator <= 0) {
             return false;
         }
 
-        *x = winMoveLast->x;
-        *y = winMoveLast->y;
+        *x = last.x;
+        *y = last.y;
 
         // Velocity in client coordinates per second.
-        *velocityX = 1000.0 * (winMoveLast->x - winMovePrev->x) / tickCountDiff;
-        *velocityY = 1000.0 * (winMoveLast->y - winMovePrev->y) / tickCountDiff;
+        *velocityX = (count * sumTX - sumT * sumX) / denominator;
+        *velocityY = (count * sumTY - sumT * sumY) / denominator;
 
         return true;
     }
 
+private:
+    static constexpr int kMaxSamples = 16;
+
+    struct Sample {
+        LONGLONG time;
+        int x, y;
+    };
+
+    // 0 is the most recent sample.
+    const Sample& GetSample(int index) const {
+        return samples[(nextSample + kMaxSamples - index) % kMaxSamples];
+    }
+
+    Sample samples[kMaxSamples];
+    int nextSample = 0;
+    int sampleCount = 0;
+};
+
+// Predicts when the next frame is going to be composed by DWM, so that each
+// animation step is computed for the moment it becomes visible, and so that at
+// most one step is made per composed frame.
+class CompositionFramePacer {
+public:
+    CompositionFramePacer() {
+        DWM_TIMING_INFO timingInfo = { sizeof(timingInfo) };
+        if (SUCCEEDED(DwmGetCompositionTimingInfo(nullptr, &timingInfo)) &&
+            timingInfo.qpcRefreshPeriod) {
+            vblankTime = (LONGLONG)timingInfo.qpcVBlank;
+            refreshPeriod = (LONGLONG)timingInfo.qpcRefreshPeriod;
+        }
+    }
+
+    LONGLONG GetNextPresentTime(LONGLONG time) const {
+        if (!refreshPeriod) {
+            // Composition timing is unavailable, use the current time.
+            return time;
+        }
+
+        if (time < vblankTime) {
+            return vblankTime;
+        }
+
+        LONGLONG periods = (time - vblankTime) / refreshPeriod + 1;
+        return vblankTime + periods * refreshPeriod;
+    }
+
+private:
+    LONGLONG vblankTime = 0;
+    LONGLONG refreshPeriod = 0;
+};
+
+// Moves a point with an initial velocity and an exponential friction. Each
+// reference frame, the velocity is multiplied by (100 - slowdown) / 100, and
+// the motion is integrated exactly for any elapsed time, so that the total
+// distance doesn't depend on the frame rate.
+class InertialMotion {
+public:
+    InertialMotion(double x, double y, double velocityX, double velocityY) :
+        x(x), y(y), velocityX(velocityX), velocityY(velocityY) {}
+
+    void Advance(double seconds, int slowdown) {
+        if (slowdown < 1) {
+            slowdown = 1;
+        }
+        else if (slowdown > 99) {
+            slowdown = 99;
+        }
+
+        double frameMultiplier = (100 - slowdown) / 100.0;
+        double frames = seconds / kSlideReferenceFrameSeconds;
+        double multiplier = std::pow(frameMultiplier, frames);
+
+        // The sum of a geometric series of per-frame distances.
+        double distanceFactor =
+            kSlideReferenceFrameSeconds * (1.0 - multiplier) / (1.0 - frameMultiplier);
+
+        x += velocityX * distanceFactor;
+        y += velocityY * distanceFactor;
+
+        velocityX *= multiplier;
+        velocityY *= multiplier;
+    }
+
+    // At rest when moving less than a pixel per reference frame.
+    bool IsAtRest() const {
+        return std::abs(velocityX) * kSlideReferenceFrameSeconds < 1.0 &&
+            std::abs(velocityY) * kSlideReferenceFrameSeconds < 1.0;
+    }
+
+    double x, y;
+    double velocityX, velocityY;
+};
+
+class WindowMove {
+public:
+    WindowMove() {}
+
+    void Reset() {
+        lastState.reset();
+        velocityTracker.Reset();
+    }
+
+    void UpdateWithNewPos(HWND hTargetWnd, int x, int y) {
+        LONGLONG time = QueryPerformanceCounterNow();
+
+        WindowState state = GetWindowState(hTargetWnd);
+        if (lastState && (state.isMinimized != lastState->isMinimized ||
+                          state.isMaximized != lastState->isMaximized ||
+                          state.isArranged != lastState->isArranged)) {
+            // Window state changed, e.g. it was snapped, reset.
+            Reset();
+        }
+
+        lastState = state;
+
+        velocityTracker.AddSample(time, x, y);
+    }
+
+    bool CompleteMove(int* x, int* y, double* velocityX, double* velocityY) {
+        return velocityTracker.GetReleaseState(QueryPerformanceCounterNow(),
+            x, y, velocityX, velocityY);
+    }
+
 private:
     struct WindowState {
         bool isMinimized;
@@ -601,11 +748,6 @@ private:
         bool isArranged;
     };
 
-    struct MoveSnapshot {
-        DWORD tickCount;
-        int x, y;
-    };
-
     static WindowState GetWindowState(HWND hTargetWnd) {
         return WindowState{
             .isMinimized = !!IsMaximized(hTargetWnd),
@@ -615,15 +757,19 @@ private:
     }
 
     std::optional<WindowState> lastState;
-    MoveSnapshot snapshotStorage[3];
-    MoveSnapshot* snapshot[3]{};
+    MoveVelocityTracker velocityTracker;
 };
 
 struct WindowSlideTimer {
 public:
     WindowSlideTimer(TIMERPROC proc, int cursorX, int cursorY, int x, int y, double velocityX, double velocityY, std::optional<WindowMagnet> windowMagnet) :
-        cursorPoint{ cursorX, cursorY }, x((double)x), y((double)y), velocityX(velocityX), velocityY(velocityY), windowMagnet(std::move(windowMagnet)) {
-        timerId = SetTimer(nullptr, 0, 10, proc);
+        cursorPoint{ cursorX, cursorY }, motion((double)x, (double)y, velocityX, velocityY), windowMagnet(std::move(windowMagnet)) {
+        // The timer is only used to wake up as often as possible, the actual
+        // pace is determined by the composition frames.
+        timerId = SetTimer(nullptr, 0, USER_TIMER_MINIMUM, proc);
+
+        startTime = QueryPerformanceCounterNow();
+        lastFrameTime = startTime;
 
         HMONITOR monitor = MonitorFromPoint(cursorPoint, MONITOR_DEFAULTTONEAREST);
 
@@ -648,7 +794,7 @@ public:
     bool SlideNextFrame(HWND hWnd) {
         RECT rect;
         GetWindowRect(hWnd, &rect);
-        if (frame != 0) {
+        if (positioned) {
             // If the window's position or size changed, stop timer.
             if (
                 lastX != rect.left ||
@@ -660,19 +806,27 @@ public:
             }
         }
 
-        int prevX = (int)x;
-        int prevY = (int)y;
+        LONGLONG frameTime = framePacer.GetNextPresentTime(QueryPerformanceCounterNow());
+        if (frameTime <= lastFrameTime) {
+            // This frame was already handled.
+            return true;
+        }
 
-        // The default timer resolution on Windows is 15.6 ms.
-        x += velocityX / (1000.0 / 15.6);
-        y += velocityY / (1000.0 / 15.6);
+        double elapsed = PerformanceCounterToSeconds(frameTime - lastFrameTime);
+        if (elapsed > kSlideMaxFrameSeconds) {
+            // Don't jump if the thread was busy.
+            elapsed = kSlideMaxFrameSeconds;
+        }
 
-        int currentX = (int)x;
-        int currentY = (int)y;
+        lastFrameTime = frameTime;
 
-        if (currentX == prevX && currentY == prevY) {
-            return false;
-        }
+        int prevX = (int)motion.x;
+        int prevY = (int)motion.y;
+
+        motion.Advance(elapsed, g_settings.slidingAnimationSlowdown);
+
+        int currentX = (int)motion.x;
+        int currentY = (int)motion.y;
 
         POINT anchor{ currentX + cursorPoint.x, currentY + cursorPoint.y };
         if (!PtInRect(&workArea, anchor)) {
@@ -690,41 +844,28 @@ public:
 
             if (!foundNewMonitor) {
                 if (anchor.x < workArea.left) {
-                    x = workArea.left - cursorPoint.x;
-                    velocityX = -velocityX * .05;
+                    motion.x = workArea.left - cursorPoint.x;
+                    motion.velocityX = -motion.velocityX * .05;
                 }
                 else if (anchor.x > workArea.right) {
-                    x = workArea.right - cursorPoint.x;
-                    velocityX = -velocityX * .05;
+                    motion.x = workArea.right - cursorPoint.x;
+                    motion.velocityX = -motion.velocityX * .05;
                 }
 
                 if (anchor.y < workArea.top) {
-                    y = workArea.top - cursorPoint.y;
-                    velocityY = -velocityY * .05;
+                    motion.y = workArea.top - cursorPoint.y;
+                    motion.velocityY = -motion.velocityY * .05;
                 }
                 else if (anchor.y > workArea.bottom) {
-                    y = workArea.bottom - cursorPoint.y;
-                    velocityY = -velocityY * .05;
+                    motion.y = workArea.bottom - cursorPoint.y;
+                    motion.velocityY = -motion.velocityY * .05;
                 }
 
-                currentX = (int)x;
-                currentY = (int)y;
+                currentX = (int)motion.x;
+                currentY = (int)motion.y;
             }
         }
 
-        int slidingAnimationSlowdown = g_settings.slidingAnimationSlowdown;
-        if (slidingAnimationSlowdown < 1) {
-            slidingAnimationSlowdown = 1;
-        }
-        else if (slidingAnimationSlowdown > 99) {
-            slidingAnimationSlowdown = 99;
-        }
-
-        double slowdownMultiplier = (100 - g_settings.slidingAnimationSlowdown) / 100.0;
-
-        velocityX *= slowdownMultiplier;
-        velocityY *= slowdownMultiplier;
-
         if (windowMagnet) {
             int magnetX = currentX;
             int magnetY = currentY;
@@ -733,37 +874,45 @@ public:
             windowMagnet->MagnetMove(hWnd, &magnetX, &magnetY, &cx, &cy);
 
             if (magnetX != currentX) {
-                x = magnetX;
+                motion.x = magnetX;
                 currentX = magnetX;
-                velocityX = 0.0;
+                motion.velocityX = 0.0;
             }
 
             if (magnetY != currentY) {
-                y = magnetY;
+                motion.y = magnetY;
                 currentY = magnetY;
-                velocityY = 0.0;
+                motion.velocityY = 0.0;
             }
         }
 
-        SetWindowPos(hWnd, nullptr, currentX, currentY, 0, 0,
-            SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+        if (currentX != prevX || currentY != prevY) {
+            SetWindowPos(hWnd, nullptr, currentX, currentY, 0, 0,
+                SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
 
-        lastX = currentX;
-        lastY = currentY;
-        lastCx = rect.right - rect.left;
-        lastCy = rect.bottom - rect.top;
+            lastX = currentX;
+            lastY = currentY;
+            lastCx = rect.right - rect.left;
+            lastCy = rect.bottom - rect.top;
+            positioned = true;
+        }
 
-        frame++;
-        return frame < 50;
+        if (motion.IsAtRest()) {
+            return false;
+        }
+
+        return PerformanceCounterToSeconds(frameTime - startTime) < kSlideMaxDurationSeconds;
     }
 
 private:
     UINT_PTR timerId;
-    int frame = 0;
+    LONGLONG startTime;
+    LONGLONG lastFrameTime;
+    CompositionFramePacer framePacer;
+    bool positioned = false;
     POINT cursorPoint;
     RECT workArea;
-    double x, y;
-    double velocityX, velocityY;
+    InertialMotion motion;
     int lastX, lastY, lastCx, lastCy;
     std::optional<WindowMagnet> windowMagnet;
 };
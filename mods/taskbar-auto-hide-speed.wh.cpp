@@ -2,14 +2,14 @@
 // @id              taskbar-auto-hide-speed
 // @name            Taskbar auto-hide speed
 // @description     Customize the taskbar auto-hide speed and frame rate to make it feel less sluggish and janky
-// @version         1.0
+// @version         1.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
 // @homepage        https://m417z.com/
 // @include         explorer.exe
 // @architecture    x86-64
-// @compilerOptions -lversion
+// @compilerOptions -ldwmapi -lversion
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -43,6 +43,11 @@ sluggish and janky.
   $name: Animation frame rate
   $description: >-
     Frames per second, higher frame rate will use more CPU
+- alignToDwmFrames: false
+  $name: Align frames to display refresh
+  $description: >-
+    Snap each animation frame to the next display refresh, which avoids uneven
+    frame times when the frame rate is close to the refresh rate
 - oldTaskbarOnWin11: false
   $name: Customize the old taskbar on Windows 11
   $description: >-
@@ -53,14 +58,18 @@ sluggish and janky.
 
 #include <windhawk_utils.h>
 
+#include <dwmapi.h>
 #include <psapi.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 
 struct {
     int showSpeedup;
     int hideSpeedup;
     int frameRate;
+    bool alignToDwmFrames;
     bool oldTaskbarOnWin11;
 } g_settings;
 
@@ -76,12 +85,23 @@ WinVersion g_winVersion;
 std::atomic<bool> g_initialized;
 std::atomic<bool> g_explorerPatcherInitialized;
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// The last part of each frame wait is spun instead of slept, since even a high
+// resolution timer can wake up a bit late.
+constexpr double kFrameSpinTime = 0.001;
+
 double g_recipCyclesPerSecond;
 
 std::atomic<DWORD> g_slideWindowThreadId;
 int g_slideWindowSpeedup;
 double g_slideWindowStartTime;
 double g_slideWindowLastFrameStartTime;
+double g_slideWindowFrameDeadline;
+
+HANDLE g_frameTimer;
 
 void TimerInitialize() {
     LARGE_INTEGER freq;
@@ -100,6 +120,126 @@ double TimerGetSeconds() {
     return TimerGetCycles() * g_recipCyclesPerSecond;
 }
 
+#pragma region frame_stats
+
+// Frame times of the current slide are pushed by the slide thread and only
+// summarized once it ends, so that nothing is logged per frame. The ring is
+// single-producer and lock-free, so it can also be read from another thread.
+constexpr UINT kFrameStatsCapacity = 256;
+
+struct FrameStatsRing {
+    float frameTimes[kFrameStatsCapacity];
+    std::atomic<UINT> count;
+    std::atomic<UINT> missedDeadlines;
+
+    void Reset() {
+        count.store(0, std::memory_order_relaxed);
+        missedDeadlines.store(0, std::memory_order_relaxed);
+    }
+
+    void Push(float frameTime, bool missedDeadline) {
+        UINT index = count.load(std::memory_order_relaxed);
+        frameTimes[index % kFrameStatsCapacity] = frameTime;
+        count.store(index + 1, std::memory_order_release);
+
+        if (missedDeadline) {
+            missedDeadlines.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+FrameStatsRing g_frameStats;
+
+void LogFrameStats() {
+    UINT count = g_frameStats.count.load(std::memory_order_acquire);
+    if (count == 0) {
+        return;
+    }
+
+    UINT samples = std::min(count, kFrameStatsCapacity);
+    float frameTimes[kFrameStatsCapacity];
+    std::copy_n(g_frameStats.frameTimes, samples, frameTimes);
+
+    double sum = 0;
+    for (UINT i = 0; i < samples; i++) {
+        sum += frameTimes[i];
+    }
+
+    UINT p99Index = (samples * 99 + 99) / 100 - 1;
+    std::nth_element(frameTimes, frameTimes + p99Index, frameTimes + samples);
+
+    Wh_Log(L"%u frames, mean %.2f ms, p99 %.2f ms, %u missed deadlines", count,
+           sum / samples, frameTimes[p99Index],
+           g_frameStats.missedDeadlines.load(std::memory_order_relaxed));
+}
+
+#pragma endregion  // frame_stats
+
+#pragma region frame_pacing
+
+void FramePacingInitialize() {
+    g_frameTimer = CreateWaitableTimerEx(
+        nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+        TIMER_ALL_ACCESS);
+    if (!g_frameTimer) {
+        // High resolution timers are supported since Windows 10 1803.
+        g_frameTimer = CreateWaitableTimer(nullptr, FALSE, nullptr);
+    }
+}
+
+void FramePacingUninitialize() {
+    if (g_frameTimer) {
+        CloseHandle(g_frameTimer);
+        g_frameTimer = nullptr;
+    }
+}
+
+// Moves the deadline forward to the next DWM composition, or returns it as is
+// if composition timing isn't available.
+double AlignToDwmFrame(double deadline) {
+    DWM_TIMING_INFO timingInfo{
+        .cbSize = sizeof(DWM_TIMING_INFO),
+    };
+    if (FAILED(DwmGetCompositionTimingInfo(nullptr, &timingInfo)) ||
+        !timingInfo.qpcRefreshPeriod) {
+        return deadline;
+    }
+
+    double vblank = timingInfo.qpcVBlank * g_recipCyclesPerSecond;
+    double refreshPeriod =
+        timingInfo.qpcRefreshPeriod * g_recipCyclesPerSecond;
+
+    double periods = (deadline - vblank) / refreshPeriod;
+    if (periods <= 0) {
+        return vblank;
+    }
+
+    // Allow a small tolerance so that a deadline just after a vblank isn't
+    // postponed by a whole refresh period.
+    return vblank + std::ceil(periods - 0.05) * refreshPeriod;
+}
+
+void WaitUntil(double deadline) {
+    double remaining = deadline - TimerGetSeconds();
+
+    if (g_frameTimer && remaining > kFrameSpinTime) {
+        // Negative due times are relative, in 100-nanosecond units.
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart =
+            -static_cast<LONGLONG>((remaining - kFrameSpinTime) * 10000000.0);
+        if (SetWaitableTimer(g_frameTimer, &dueTime, 0, nullptr, nullptr,
+                             FALSE)) {
+            WaitForSingleObject(g_frameTimer, INFINITE);
+        }
+    }
+
+    while (TimerGetSeconds() < deadline) {
+        YieldProcessor();
+    }
+}
+
+#pragma endregion  // frame_pacing
+
 using TrayUI_SlideWindow_t = void(WINAPI*)(void* pThis,
                                            HWND hWnd,
                                            const RECT* rect,
@@ -119,11 +259,15 @@ void WINAPI TrayUI_SlideWindow_Hook(void* pThis,
         show ? g_settings.showSpeedup : g_settings.hideSpeedup;
     g_slideWindowStartTime = TimerGetSeconds();
     g_slideWindowLastFrameStartTime = g_slideWindowStartTime;
+    g_slideWindowFrameDeadline = g_slideWindowStartTime;
+    g_frameStats.Reset();
     g_slideWindowThreadId = GetCurrentThreadId();
 
     TrayUI_SlideWindow_Original(pThis, hWnd, rect, monitor, show, animate);
 
     g_slideWindowThreadId = 0;
+
+    LogFrameStats();
 }
 
 using GetTickCount_t = decltype(&GetTickCount);
@@ -137,8 +281,6 @@ DWORD WINAPI GetTickCount_Hook() {
                    1000.0 * (g_slideWindowSpeedup / 100.0) +
                0.5;
 
-    Wh_Log(L"> %u", ms);
-
     return ms;
 }
 
@@ -150,20 +292,32 @@ void WINAPI Sleep_Hook(DWORD dwMilliseconds) {
         return;
     }
 
-    double frameTotalTime = 1000.0 / g_settings.frameRate;
+    double frameTotalTime = 1.0 / std::max(g_settings.frameRate, 1);
 
-    double frameElapsedTime =
-        (TimerGetSeconds() - g_slideWindowLastFrameStartTime) * 1000.0;
+    // Deadlines are scheduled from the previous deadline rather than from the
+    // time the frame was done, so that frame times don't drift. If a deadline
+    // was missed by more than a frame, the schedule restarts from now.
+    double now = TimerGetSeconds();
+    double deadline = g_slideWindowFrameDeadline + frameTotalTime;
+    bool missedDeadline = now > deadline;
+    if (deadline < now - frameTotalTime) {
+        deadline = now;
+    }
 
-    int sleepTime = frameTotalTime - frameElapsedTime + 0.5;
+    if (g_settings.alignToDwmFrames) {
+        deadline = AlignToDwmFrame(deadline);
+    }
 
-    Wh_Log(L"> %f - %f = %d", frameTotalTime, frameElapsedTime, sleepTime);
+    WaitUntil(deadline);
 
-    if (sleepTime > 0) {
-        Sleep_Original(sleepTime);
-    }
+    double frameStartTime = TimerGetSeconds();
+    g_frameStats.Push(
+        static_cast<float>((frameStartTime - g_slideWindowLastFrameStartTime) *
+                           1000.0),
+        missedDeadline || frameStartTime - deadline > frameTotalTime / 2);
 
-    g_slideWindowLastFrameStartTime = TimerGetSeconds();
+    g_slideWindowFrameDeadline = deadline;
+    g_slideWindowLastFrameStartTime = frameStartTime;
 }
 
 bool HookTaskbarSymbols() {
@@ -370,6 +524,7 @@ void LoadSettings() {
     g_settings.showSpeedup = Wh_GetIntSetting(L"showSpeedup");
     g_settings.hideSpeedup = Wh_GetIntSetting(L"hideSpeedup");
     g_settings.frameRate = Wh_GetIntSetting(L"frameRate");
+    g_settings.alignToDwmFrames = Wh_GetIntSetting(L"alignToDwmFrames");
     g_settings.oldTaskbarOnWin11 = Wh_GetIntSetting(L"oldTaskbarOnWin11");
 }
 
@@ -421,6 +576,7 @@ BOOL Wh_ModInit() {
                                        &Sleep_Original);
 
     TimerInitialize();
+    FramePacingInitialize();
 
     g_initialized = true;
 
@@ -439,6 +595,8 @@ void Wh_ModAfterInit() {
 
 void Wh_ModUninit() {
     Wh_Log(L">");
+
+    FramePacingUninitialize();
 }
 
 BOOL Wh_ModSettingsChanged(BOOL* bReload) {
@@ -2,7 +2,7 @@
 // @id              taskbar-auto-hide-when-maximized
 // @name            Taskbar auto-hide when maximized
 // @description     Makes the taskbar auto-hide only when a window is maximized or intersects the taskbar
-// @version         1.2.3
+// @version         1.2.4
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -80,11 +80,14 @@ or a similar tool), enable the relevant option in the mod's settings.
 
 #include <winrt/base.h>
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 enum class Mode {
     intersected,
@@ -117,7 +120,6 @@ bool g_wasAutoHideDisabled;
 std::mutex g_winEventHookThreadMutex;
 std::atomic<HANDLE> g_winEventHookThread;
 std::unordered_map<void*, HWND> g_taskbarsKeptShown;
-UINT_PTR g_pendingEventsTimer;
 
 // TrayUI::_HandleTrayPrivateSettingMessage
 constexpr UINT kHandleTrayPrivateSettingMessage = WM_USER + 0x1CA;
@@ -127,8 +129,9 @@ enum {
     kTrayPrivateSettingAutoHideSet = 4,
 };
 
-constexpr WCHAR kUpdateTaskbarStatePendingTickCount[] =
-    L"Windhawk_UpdateTaskbarStatePendingTickCount_" WH_MOD_ID;
+// Posted to the win event hook thread.
+constexpr UINT kRebuildTaskbarOccupancyMessage = WM_APP + 1;
+constexpr UINT kCheckTaskbarRectsMessage = WM_APP + 2;
 
 static const UINT g_getTaskbarRectRegisteredMsg =
     RegisterWindowMessage(L"Windhawk_GetTaskbarRect_" WH_MOD_ID);
@@ -371,6 +374,40 @@ bool IsWindowExcluded(HWND hWnd) {
     return false;
 }
 
+std::mutex g_windowExcludedCacheMutex;
+std::unordered_map<HWND, bool> g_windowExcludedCache;
+
+// The verdict is cached until the window is destroyed or the settings change,
+// since resolving the process path and app id is expensive.
+bool IsWindowExcludedCached(HWND hWnd) {
+    if (g_settings.excludedPrograms.empty()) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        auto it = g_windowExcludedCache.find(hWnd);
+        if (it != g_windowExcludedCache.end()) {
+            return it->second;
+        }
+    }
+
+    bool excluded = IsWindowExcluded(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    g_windowExcludedCache[hWnd] = excluded;
+    return excluded;
+}
+
+void InvalidateWindowExcludedCache(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    if (hWnd) {
+        g_windowExcludedCache.erase(hWnd);
+    } else {
+        g_windowExcludedCache.clear();
+    }
+}
+
 bool CanHideTaskbarForWindow(HWND hWnd,
                              HMONITOR monitor,
                              const MONITORINFO* monitorInfo,
@@ -385,7 +422,7 @@ bool CanHideTaskbarForWindow(HWND hWnd,
     }
 
     // Check this after the other checks, as it's the most expensive one.
-    if (IsWindowExcluded(hWnd)) {
+    if (IsWindowExcludedCached(hWnd)) {
         return false;
     }
 
@@ -431,31 +468,267 @@ bool CanHideTaskbarForWindow(HWND hWnd,
     return false;
 }
 
-bool ShouldKeepTaskbarShown(HMONITOR monitor) {
-    if (g_settings.primaryMonitorOnly &&
-        monitor != MonitorFromPoint({0, 0}, MONITOR_DEFAULTTOPRIMARY)) {
-        return false;
+// Tracks, for each monitor, the windows which currently allow its taskbar to
+// auto-hide (maximized on it or intersecting its taskbar). Windows are updated
+// one at a time from win events, so that a decision doesn't require going over
+// all windows. Only bookkeeping is done here, the window state is queried by
+// the caller.
+class TaskbarOccupancyModel {
+   public:
+    static constexpr size_t kMaxMonitors = 64;
+
+    void Reset(size_t monitorCount) {
+        windowMonitors.clear();
+        occupiedCount.assign(std::min(monitorCount, kMaxMonitors), 0);
+    }
+
+    // Returns a mask of the monitors which became occupied or unoccupied.
+    uint64_t SetWindowMonitors(HWND hWnd, uint64_t monitorMask) {
+        monitorMask &= ValidMask();
+
+        uint64_t previousMask = 0;
+        if (monitorMask) {
+            auto [it, inserted] = windowMonitors.try_emplace(hWnd, monitorMask);
+            if (!inserted) {
+                previousMask = it->second;
+                it->second = monitorMask;
+            }
+        } else {
+            auto it = windowMonitors.find(hWnd);
+            if (it == windowMonitors.end()) {
+                return 0;
+            }
+
+            previousMask = it->second;
+            windowMonitors.erase(it);
+        }
+
+        return Apply(previousMask, monitorMask);
     }
 
-    if (g_settings.mode == Mode::never) {
+    uint64_t RemoveWindow(HWND hWnd) { return SetWindowMonitors(hWnd, 0); }
+
+    bool IsOccupied(size_t monitorIndex) const {
+        return monitorIndex < occupiedCount.size() &&
+               occupiedCount[monitorIndex] > 0;
+    }
+
+   private:
+    uint64_t ValidMask() const {
+        return occupiedCount.size() >= 64
+                   ? ~0ULL
+                   : (1ULL << occupiedCount.size()) - 1;
+    }
+
+    uint64_t Apply(uint64_t previousMask, uint64_t monitorMask) {
+        uint64_t changedMask = 0;
+        for (size_t i = 0; i < occupiedCount.size(); i++) {
+            uint64_t bit = 1ULL << i;
+            if ((previousMask & bit) == (monitorMask & bit)) {
+                continue;
+            }
+
+            int& count = occupiedCount[i];
+            bool wasOccupied = count > 0;
+            count += (monitorMask & bit) ? 1 : -1;
+            if (wasOccupied != (count > 0)) {
+                changedMask |= bit;
+            }
+        }
+
+        return changedMask;
+    }
+
+    std::unordered_map<HWND, uint64_t> windowMonitors;
+    std::vector<int> occupiedCount;
+};
+
+// Shared between the win event hook thread, which updates it, and the taskbar
+// thread, which reads it.
+struct {
+    std::mutex mutex;
+    // Monitor index to handle, the index is the bit in the model masks.
+    std::vector<HMONITOR> monitors;
+    TaskbarOccupancyModel model;
+} g_taskbarOccupancy;
+
+struct MonitorTaskbarInfo {
+    HMONITOR monitor;
+    MONITORINFO monitorInfo;
+    RECT taskbarRect;
+};
+
+// Only accessed from the win event hook thread.
+std::vector<MonitorTaskbarInfo> g_monitorTaskbars;
+std::vector<HWND> g_taskbarWindows;
+DWORD g_taskbarThreadId;
+
+uint64_t GetWindowOccupancyMask(HWND hWnd) {
+    if (GetWindowThreadProcessId(hWnd, nullptr) == g_taskbarThreadId) {
+        return 0;
+    }
+
+    uint64_t mask = 0;
+    for (size_t i = 0; i < g_monitorTaskbars.size() &&
+                       i < TaskbarOccupancyModel::kMaxMonitors;
+         i++) {
+        const auto& monitorTaskbar = g_monitorTaskbars[i];
+        if (CanHideTaskbarForWindow(hWnd, monitorTaskbar.monitor,
+                                    &monitorTaskbar.monitorInfo,
+                                    &monitorTaskbar.taskbarRect)) {
+            mask |= 1ULL << i;
+        }
+    }
+
+    return mask;
+}
+
+void PostTaskbarUpdates() {
+    for (HWND hWnd : g_taskbarWindows) {
+        PostMessage(hWnd, g_updateTaskbarStateRegisteredMsg, 0, 0);
+    }
+}
+
+// Called from the win event hook thread. Must not hold the lock while sending
+// messages to the taskbar thread, which might be waiting for it.
+void RebuildTaskbarOccupancy() {
+    Wh_Log(L">");
+
+    std::unordered_set<HWND> secondaryTaskbarWindows;
+    HWND hTaskbarWnd = FindTaskbarWindows(&secondaryTaskbarWindows);
+
+    g_taskbarWindows.clear();
+    if (hTaskbarWnd) {
+        g_taskbarWindows.push_back(hTaskbarWnd);
+    }
+    g_taskbarWindows.insert(g_taskbarWindows.end(),
+                            secondaryTaskbarWindows.begin(),
+                            secondaryTaskbarWindows.end());
+
+    g_taskbarThreadId =
+        hTaskbarWnd ? GetWindowThreadProcessId(hTaskbarWnd, nullptr) : 0;
+
+    g_monitorTaskbars.clear();
+    if (hTaskbarWnd) {
+        auto enumMonitorsProc = [hTaskbarWnd](HMONITOR monitor) -> BOOL {
+            MonitorTaskbarInfo monitorTaskbar{
+                .monitor = monitor,
+                .monitorInfo{
+                    .cbSize = sizeof(MONITORINFO),
+                },
+            };
+            GetMonitorInfo(monitor, &monitorTaskbar.monitorInfo);
+            SendMessage(hTaskbarWnd, g_getTaskbarRectRegisteredMsg,
+                        (WPARAM)monitor, (LPARAM)&monitorTaskbar.taskbarRect);
+            g_monitorTaskbars.push_back(monitorTaskbar);
+            return TRUE;
+        };
+
+        EnumDisplayMonitors(
+            nullptr, nullptr,
+            [](HMONITOR hMonitor, HDC hdc, LPRECT lprcMonitor,
+               LPARAM dwData) -> BOOL {
+                auto& proc =
+                    *reinterpret_cast<decltype(enumMonitorsProc)*>(dwData);
+                return proc(hMonitor);
+            },
+            reinterpret_cast<LPARAM>(&enumMonitorsProc));
+    }
+
+    std::vector<HMONITOR> monitors;
+    for (const auto& monitorTaskbar : g_monitorTaskbars) {
+        monitors.push_back(monitorTaskbar.monitor);
+    }
+
+    TaskbarOccupancyModel model;
+    model.Reset(monitors.size());
+
+    if (!g_settings.foregroundWindowOnly) {
+        auto enumWindowsProc = [&model](HWND hWnd) -> BOOL {
+            model.SetWindowMonitors(hWnd, GetWindowOccupancyMask(hWnd));
+            return TRUE;
+        };
+
+        EnumWindows(
+            [](HWND hWnd, LPARAM lParam) -> BOOL {
+                auto& proc =
+                    *reinterpret_cast<decltype(enumWindowsProc)*>(lParam);
+                return proc(hWnd);
+            },
+            reinterpret_cast<LPARAM>(&enumWindowsProc));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_taskbarOccupancy.mutex);
+        g_taskbarOccupancy.monitors = std::move(monitors);
+        g_taskbarOccupancy.model = std::move(model);
+    }
+
+    PostTaskbarUpdates();
+}
+
+// Called from the win event hook thread. These are the docked rects, which
+// don't change while an auto-hidden taskbar slides in and out, only when it's
+// moved or resized.
+bool HaveTaskbarRectsChanged() {
+    if (g_monitorTaskbars.empty()) {
         return true;
     }
 
-    MONITORINFO monitorInfo{
-        .cbSize = sizeof(MONITORINFO),
-    };
-    GetMonitorInfo(monitor, &monitorInfo);
+    // Monitors are only tracked if the primary taskbar was found, in which
+    // case it comes first.
+    HWND hTaskbarWnd = g_taskbarWindows[0];
+    for (const auto& monitorTaskbar : g_monitorTaskbars) {
+        RECT taskbarRect{};
+        SendMessage(hTaskbarWnd, g_getTaskbarRectRegisteredMsg,
+                    (WPARAM)monitorTaskbar.monitor, (LPARAM)&taskbarRect);
+        if (!EqualRect(&taskbarRect, &monitorTaskbar.taskbarRect)) {
+            return true;
+        }
+    }
 
-    RECT taskbarRect{};
-    GetTaskbarRectForMonitor(monitor, &taskbarRect);
+    return false;
+}
 
-    if (g_settings.foregroundWindowOnly) {
-        HWND hForegroundWnd = GetForegroundWindow();
-        return !hForegroundWnd ||
-               !CanHideTaskbarForWindow(hForegroundWnd, monitor, &monitorInfo,
-                                        &taskbarRect);
+void UpdateTaskbarOccupancyForWindow(HWND hWnd, bool destroyed) {
+    uint64_t mask = destroyed ? 0 : GetWindowOccupancyMask(hWnd);
+
+    uint64_t changedMask;
+    {
+        std::lock_guard<std::mutex> guard(g_taskbarOccupancy.mutex);
+        changedMask = g_taskbarOccupancy.model.SetWindowMonitors(hWnd, mask);
     }
 
+    if (changedMask) {
+        Wh_Log(L"Occupancy changed by %08X: %llX", (DWORD)(ULONG_PTR)hWnd,
+               changedMask);
+        PostTaskbarUpdates();
+    }
+}
+
+void RequestTaskbarOccupancyRebuild() {
+    // Don't block if the thread is being restarted, it rebuilds the model when
+    // it starts. Also, the thread might be waiting for us in SendMessage.
+    std::unique_lock<std::mutex> lock(g_winEventHookThreadMutex,
+                                      std::try_to_lock);
+
+    if (lock.owns_lock() && g_winEventHookThread) {
+        PostThreadMessage(GetThreadId(g_winEventHookThread),
+                          kRebuildTaskbarOccupancyMessage, 0, 0);
+    }
+}
+
+// Monitor and work area rects in the model are stale after these.
+bool IsMonitorGeometryChangeMessage(UINT Msg, WPARAM wParam) {
+    return Msg == WM_DISPLAYCHANGE || Msg == WM_DPICHANGED ||
+           (Msg == WM_SETTINGCHANGE && wParam == SPI_SETWORKAREA);
+}
+
+// Fallback for monitors which aren't in the model yet, e.g. right after a
+// display change.
+bool ScanCanHideTaskbar(HMONITOR monitor,
+                        const MONITORINFO* monitorInfo,
+                        const RECT* taskbarRect) {
     bool canHideTaskbar = false;
 
     DWORD dwTaskbarThreadId = GetCurrentThreadId();
@@ -466,7 +739,7 @@ bool ShouldKeepTaskbarShown(HMONITOR monitor) {
         }
 
         canHideTaskbar =
-            CanHideTaskbarForWindow(hWnd, monitor, &monitorInfo, &taskbarRect);
+            CanHideTaskbarForWindow(hWnd, monitor, monitorInfo, taskbarRect);
         if (!canHideTaskbar) {
             return TRUE;
         }
@@ -482,7 +755,49 @@ bool ShouldKeepTaskbarShown(HMONITOR monitor) {
         },
         reinterpret_cast<LPARAM>(&enumWindowsProc));
 
-    return !canHideTaskbar;
+    return canHideTaskbar;
+}
+
+bool ShouldKeepTaskbarShown(HMONITOR monitor) {
+    if (g_settings.primaryMonitorOnly &&
+        monitor != MonitorFromPoint({0, 0}, MONITOR_DEFAULTTOPRIMARY)) {
+        return false;
+    }
+
+    if (g_settings.mode == Mode::never) {
+        return true;
+    }
+
+    if (!g_settings.foregroundWindowOnly) {
+        std::lock_guard<std::mutex> guard(g_taskbarOccupancy.mutex);
+        const auto& monitors = g_taskbarOccupancy.monitors;
+        for (size_t i = 0; i < monitors.size(); i++) {
+            if (monitors[i] == monitor) {
+                return !g_taskbarOccupancy.model.IsOccupied(i);
+            }
+        }
+    }
+
+    MONITORINFO monitorInfo{
+        .cbSize = sizeof(MONITORINFO),
+    };
+    GetMonitorInfo(monitor, &monitorInfo);
+
+    RECT taskbarRect{};
+    GetTaskbarRectForMonitor(monitor, &taskbarRect);
+
+    if (g_settings.foregroundWindowOnly) {
+        HWND hForegroundWnd = GetForegroundWindow();
+        return !hForegroundWnd ||
+               !CanHideTaskbarForWindow(hForegroundWnd, monitor, &monitorInfo,
+                                        &taskbarRect);
+    }
+
+    Wh_Log(L"Monitor %p isn't tracked, scanning all windows", monitor);
+
+    RequestTaskbarOccupancyRebuild();
+
+    return !ScanCanHideTaskbar(monitor, &monitorInfo, &taskbarRect);
 }
 
 void* QueryViaVtable(void* object, void* vtable) {
@@ -503,20 +818,22 @@ void* QueryViaVtableBackwards(void* object, void* vtable) {
 
 DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter);
 
-void AdjustTaskbar(HWND hMMTaskbarWnd, bool clearPendingWhenDone = false) {
+void AdjustTaskbar(HWND hMMTaskbarWnd) {
     if (g_settings.mode != Mode::never) {
         if (!g_winEventHookThread) {
             std::lock_guard<std::mutex> guard(g_winEventHookThreadMutex);
 
             if (!g_winEventHookThread) {
+                // The thread builds the occupancy model when it starts.
                 g_winEventHookThread = CreateThread(
                     nullptr, 0, WinEventHookThread, nullptr, 0, nullptr);
             }
+        } else {
+            RequestTaskbarOccupancyRebuild();
         }
     }
 
-    PostMessage(hMMTaskbarWnd, g_updateTaskbarStateRegisteredMsg,
-                clearPendingWhenDone, 0);
+    PostMessage(hMMTaskbarWnd, g_updateTaskbarStateRegisteredMsg, 0, 0);
 }
 
 void AdjustAllTaskbars() {
@@ -531,50 +848,6 @@ void AdjustAllTaskbars() {
     }
 }
 
-bool AdjustAllTaskbarsIfNotPending() {
-    std::unordered_set<HWND> secondaryTaskbarWindows;
-    HWND hWnd = FindTaskbarWindows(&secondaryTaskbarWindows);
-
-    DWORD currentTickCount = GetTickCount();
-    DWORD pendingTickCount = 0;
-
-    if (hWnd) {
-        DWORD tickCount = (DWORD)(DWORD_PTR)GetProp(
-            hWnd, kUpdateTaskbarStatePendingTickCount);
-        if (tickCount > pendingTickCount) {
-            pendingTickCount = tickCount;
-        }
-    }
-
-    for (HWND hSecondaryWnd : secondaryTaskbarWindows) {
-        DWORD tickCount = (DWORD)(DWORD_PTR)GetProp(
-            hSecondaryWnd, kUpdateTaskbarStatePendingTickCount);
-        if (tickCount > pendingTickCount) {
-            pendingTickCount = tickCount;
-        }
-    }
-
-    // Consider times larger than 10 seconds as expired, to prevent having
-    // it stuck in this state.
-    if (pendingTickCount && currentTickCount - pendingTickCount < 1000 * 10) {
-        return false;
-    }
-
-    if (hWnd) {
-        SetProp(hWnd, kUpdateTaskbarStatePendingTickCount,
-                (HANDLE)(DWORD_PTR)currentTickCount);
-        AdjustTaskbar(hWnd, /*clearPendingWhenDone=*/true);
-    }
-
-    for (HWND hSecondaryWnd : secondaryTaskbarWindows) {
-        SetProp(hSecondaryWnd, kUpdateTaskbarStatePendingTickCount,
-                (HANDLE)(DWORD_PTR)currentTickCount);
-        AdjustTaskbar(hSecondaryWnd, /*clearPendingWhenDone=*/true);
-    }
-
-    return true;
-}
-
 void* TrayUI_vftable_IInspectable;
 void* TrayUI_vftable_ITrayComponentHost;
 void* CSecondaryTray_vftable_ISecondaryTray;
@@ -650,6 +923,8 @@ LRESULT WINAPI TrayUI_WndProc_Hook(void* pThis,
     if (Msg == WM_NCCREATE) {
         Wh_Log(L"WM_NCCREATE: %08X", (DWORD)(ULONG_PTR)hWnd);
         AdjustTaskbar(hWnd);
+    } else if (IsMonitorGeometryChangeMessage(Msg, wParam)) {
+        RequestTaskbarOccupancyRebuild();
     } else if (Msg == kHandleTrayPrivateSettingMessage) {
         // Prevent auto-hide from being disabled while the mod is loaded.
         if ((DWORD)wParam == 4) {
@@ -706,9 +981,6 @@ LRESULT WINAPI TrayUI_WndProc_Hook(void* pThis,
             }
         }
 
-        if (wParam) {
-            RemoveProp(hWnd, kUpdateTaskbarStatePendingTickCount);
-        }
     }
 
     LRESULT ret =
@@ -728,6 +1000,8 @@ LRESULT WINAPI CSecondaryTray_v_WndProc_Hook(void* pThis,
     if (Msg == WM_NCCREATE) {
         Wh_Log(L"WM_NCCREATE: %08X", (DWORD)(ULONG_PTR)hWnd);
         AdjustTaskbar(hWnd);
+    } else if (IsMonitorGeometryChangeMessage(Msg, wParam)) {
+        RequestTaskbarOccupancyRebuild();
     } else if (Msg == g_updateTaskbarStateRegisteredMsg) {
         void* pCSecondaryTray_ISecondaryTray =
             QueryViaVtable(pThis, CSecondaryTray_vftable_ISecondaryTray);
@@ -753,9 +1027,6 @@ LRESULT WINAPI CSecondaryTray_v_WndProc_Hook(void* pThis,
             }
         }
 
-        if (wParam) {
-            RemoveProp(hWnd, kUpdateTaskbarStatePendingTickCount);
-        }
     }
 
     LRESULT ret =
@@ -772,7 +1043,18 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
                            DWORD dwEventThread,
                            DWORD dwmsEventTime) {
     if (idObject != OBJID_WINDOW ||
-        (GetWindowLong(hWnd, GWL_STYLE) & WS_CHILD) || IsTaskbarWindow(hWnd)) {
+        (GetWindowLong(hWnd, GWL_STYLE) & WS_CHILD)) {
+        return;
+    }
+
+    if (IsTaskbarWindow(hWnd)) {
+        // The taskbar rects in the model might be stale once a taskbar moves,
+        // but most moves are auto-hide slides which don't affect them. Post to
+        // ourselves to coalesce the events of a single move.
+        if (event == EVENT_OBJECT_LOCATIONCHANGE) {
+            PostThreadMessage(GetCurrentThreadId(), kCheckTaskbarRectsMessage,
+                              0, 0);
+        }
         return;
     }
 
@@ -781,29 +1063,20 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
         return;
     }
 
-    Wh_Log(L"> %08X", (DWORD)(ULONG_PTR)hWnd);
+    bool destroyed = event == EVENT_OBJECT_DESTROY;
+    if (destroyed) {
+        InvalidateWindowExcludedCache(hWnd);
+    }
 
-    if (g_pendingEventsTimer) {
+    if (g_settings.foregroundWindowOnly) {
+        if (event == EVENT_SYSTEM_FOREGROUND ||
+            hWnd == GetForegroundWindow()) {
+            PostTaskbarUpdates();
+        }
         return;
     }
 
-    g_pendingEventsTimer = SetTimer(
-        nullptr, 0, 200,
-        [](HWND hwnd,         // handle of window for timer messages
-           UINT uMsg,         // WM_TIMER message
-           UINT_PTR idEvent,  // timer identifier
-           DWORD dwTime       // current system time
-        ) {
-            Wh_Log(L">");
-
-            if (!AdjustAllTaskbarsIfNotPending()) {
-                Wh_Log(L"Adjustment already pending, will retry later...");
-                return;
-            }
-
-            KillTimer(nullptr, g_pendingEventsTimer);
-            g_pendingEventsTimer = 0;
-        });
+    UpdateTaskbarOccupancyForWindow(hWnd, destroyed);
 }
 
 DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
@@ -838,6 +1111,8 @@ DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
         }
     }
 
+    RebuildTaskbarOccupancy();
+
     BOOL bRet;
     MSG msg;
     while ((bRet = GetMessage(&msg, NULL, 0, 0)) != 0) {
@@ -851,6 +1126,31 @@ DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
             continue;
         }
 
+        if (msg.hwnd == NULL &&
+            msg.message == kRebuildTaskbarOccupancyMessage) {
+            // Coalesce requests, e.g. one per taskbar.
+            MSG pendingMsg;
+            while (PeekMessage(&pendingMsg, NULL,
+                               kRebuildTaskbarOccupancyMessage,
+                               kRebuildTaskbarOccupancyMessage, PM_REMOVE)) {
+            }
+
+            RebuildTaskbarOccupancy();
+            continue;
+        }
+
+        if (msg.hwnd == NULL && msg.message == kCheckTaskbarRectsMessage) {
+            MSG pendingMsg;
+            while (PeekMessage(&pendingMsg, NULL, kCheckTaskbarRectsMessage,
+                               kCheckTaskbarRectsMessage, PM_REMOVE)) {
+            }
+
+            if (HaveTaskbarRectsChanged()) {
+                RebuildTaskbarOccupancy();
+            }
+            continue;
+        }
+
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
@@ -1282,6 +1582,8 @@ BOOL Wh_ModSettingsChanged(BOOL* bReload) {
 
     LoadSettings();
 
+    InvalidateWindowExcludedCache(nullptr);
+
     if (g_settings.oldTaskbarOnWin11 != prevOldTaskbarOnWin11) {
         *bReload = TRUE;
         return TRUE;
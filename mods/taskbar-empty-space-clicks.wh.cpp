@@ -2,11 +2,11 @@
 // @id              taskbar-empty-space-clicks
 // @name            Click on empty taskbar space
 // @description     Trigger custom action when empty space on a taskbar is double/middle clicked
-// @version         1.9
+// @version         1.10
 // @author          m1lhaus
 // @github          https://github.com/m1lhaus
 // @include         explorer.exe
-// @compilerOptions -DWINVER=0x0A00 -lcomctl32 -loleaut32 -lole32 -lversion
+// @compilerOptions -DWINVER=0x0A00 -lcomctl32 -loleaut32 -lole32 -lruntimeobject -lversion
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -153,6 +153,13 @@ If you have request for new functions, suggestions or you are experiencing some
 #include <UIAutomationClient.h>
 #include <UIAutomationCore.h>
 #include <comutil.h>
+
+#undef GetCurrentTime
+
+#include <winrt/Windows.Foundation.Collections.h>
+#include <winrt/Windows.UI.Xaml.Controls.h>
+#include <winrt/Windows.UI.Xaml.Media.h>
+#include <winrt/Windows.UI.Xaml.h>
 #include <winrt/base.h>
 
 #include <string>
@@ -1172,6 +1179,221 @@ static std::unordered_set<HWND> g_secondaryTaskbarWindows;
 static com_ptr<IUIAutomation> g_pUIAutomation;
 static com_ptr<IMMDeviceEnumerator> g_pDeviceEnumerator;
 
+// =====================================================================
+
+#pragma region empty_space_hit_test
+
+// UIAutomation round-trips through the taskbar's own message queue, which is the thread handling the click, so it can
+// take tens of milliseconds on a busy taskbar. The checks below answer the same question directly in-process, UIAutomation
+// is only used if they can't.
+
+static bool g_taskbarXamlSymbolsResolved = false;
+
+static void *CTaskBand_ITaskListWndSite_vftable;
+static void *CSecondaryTaskBand_ITaskListWndSite_vftable;
+
+using CTaskBand_GetTaskbarHost_t = void *(WINAPI *)(void *pThis, void **result);
+static CTaskBand_GetTaskbarHost_t CTaskBand_GetTaskbarHost_Original;
+
+static void *TaskbarHost_FrameHeight_Original;
+
+using CSecondaryTaskBand_GetTaskbarHost_t = void *(WINAPI *)(void *pThis, void **result);
+static CSecondaryTaskBand_GetTaskbarHost_t CSecondaryTaskBand_GetTaskbarHost_Original;
+
+using std__Ref_count_base__Decref_t = void(WINAPI *)(void *pThis);
+static std__Ref_count_base__Decref_t std__Ref_count_base__Decref_Original;
+
+bool ResolveTaskbarXamlSymbols()
+{
+    LOG_TRACE();
+
+    HMODULE module = LoadLibraryEx(L"taskbar.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
+    if (!module)
+    {
+        LOG_ERROR(L"Failed to load taskbar.dll");
+        return false;
+    }
+
+    WindhawkUtils::SYMBOL_HOOK taskbarDllHooks[] = {
+        {
+            {LR"(const CTaskBand::`vftable'{for `ITaskListWndSite'})"},
+            &CTaskBand_ITaskListWndSite_vftable,
+        },
+        {
+            {LR"(const CSecondaryTaskBand::`vftable'{for `ITaskListWndSite'})"},
+            &CSecondaryTaskBand_ITaskListWndSite_vftable,
+        },
+        {
+            {LR"(public: virtual class std::shared_ptr<class TaskbarHost> __cdecl CTaskBand::GetTaskbarHost(void)const )"},
+            &CTaskBand_GetTaskbarHost_Original,
+        },
+        {
+            {LR"(public: int __cdecl TaskbarHost::FrameHeight(void)const )"},
+            &TaskbarHost_FrameHeight_Original,
+        },
+        {
+            {LR"(public: virtual class std::shared_ptr<class TaskbarHost> __cdecl CSecondaryTaskBand::GetTaskbarHost(void)const )"},
+            &CSecondaryTaskBand_GetTaskbarHost_Original,
+        },
+        {
+            {LR"(public: void __cdecl std::_Ref_count_base::_Decref(void))"},
+            &std__Ref_count_base__Decref_Original,
+        },
+    };
+
+    return WindhawkUtils::HookSymbols(module, taskbarDllHooks, ARRAYSIZE(taskbarDllHooks));
+}
+
+winrt::Windows::UI::Xaml::XamlRoot XamlRootFromTaskbarHostSharedPtr(void *taskbarHostSharedPtr[2])
+{
+    if (!taskbarHostSharedPtr[0] && !taskbarHostSharedPtr[1])
+    {
+        return nullptr;
+    }
+
+    size_t taskbarElementIUnknownOffset = 0x48;
+
+#if defined(_M_X64)
+    {
+        // 48:83EC 28 | sub rsp,28
+        // 48:83C1 48 | add rcx,48
+        const BYTE *b = (const BYTE *)TaskbarHost_FrameHeight_Original;
+        if (b[0] == 0x48 && b[1] == 0x83 && b[2] == 0xEC && b[4] == 0x48 && b[5] == 0x83 && b[6] == 0xC1 && b[7] <= 0x7F)
+        {
+            taskbarElementIUnknownOffset = b[7];
+        }
+        else
+        {
+            LOG_ERROR(L"Unsupported TaskbarHost::FrameHeight");
+        }
+    }
+#endif
+
+    auto *taskbarElementIUnknown = *(IUnknown **)((BYTE *)taskbarHostSharedPtr[0] + taskbarElementIUnknownOffset);
+
+    winrt::Windows::UI::Xaml::FrameworkElement taskbarElement = nullptr;
+    taskbarElementIUnknown->QueryInterface(winrt::guid_of<winrt::Windows::UI::Xaml::FrameworkElement>(),
+                                           winrt::put_abi(taskbarElement));
+
+    auto result = taskbarElement ? taskbarElement.XamlRoot() : nullptr;
+
+    std__Ref_count_base__Decref_Original(taskbarHostSharedPtr[1]);
+
+    return result;
+}
+
+winrt::Windows::UI::Xaml::XamlRoot GetTaskbarXamlRoot(HWND hWnd)
+{
+    bool isPrimary = (hWnd == g_hTaskbarWnd);
+    HWND hTaskSwWnd = isPrimary ? (HWND)GetProp(hWnd, L"TaskbandHWND") : FindWindowEx(hWnd, nullptr, L"WorkerW", nullptr);
+    if (!hTaskSwWnd)
+    {
+        return nullptr;
+    }
+
+    void *vftable = isPrimary ? CTaskBand_ITaskListWndSite_vftable : CSecondaryTaskBand_ITaskListWndSite_vftable;
+    void *taskBandForTaskListWndSite = (void *)GetWindowLongPtr(hTaskSwWnd, 0);
+    for (int i = 0; *(void **)taskBandForTaskListWndSite != vftable; i++)
+    {
+        if (i == 20)
+        {
+            return nullptr;
+        }
+
+        taskBandForTaskListWndSite = (void **)taskBandForTaskListWndSite + 1;
+    }
+
+    void *taskbarHostSharedPtr[2]{};
+    if (isPrimary)
+    {
+        CTaskBand_GetTaskbarHost_Original(taskBandForTaskListWndSite, taskbarHostSharedPtr);
+    }
+    else
+    {
+        CSecondaryTaskBand_GetTaskbarHost_Original(taskBandForTaskListWndSite, taskbarHostSharedPtr);
+    }
+
+    return XamlRootFromTaskbarHostSharedPtr(taskbarHostSharedPtr);
+}
+
+// Windows 11 taskbar: hit test the XAML tree directly. The click is on empty space if the topmost control under the
+// pointer is the taskbar frame itself, which is the element UIAutomation reports as Taskbar.TaskbarFrameAutomationPeer.
+bool XamlHitTestEmptySpace(HWND hWnd, POINT position, bool &onEmptySpace)
+{
+    using namespace winrt::Windows::UI::Xaml;
+
+    if (!g_taskbarXamlSymbolsResolved)
+    {
+        return false;
+    }
+
+    HWND hXamlIslandWnd = FindWindowEx(hWnd, nullptr, L"Windows.UI.Composition.DesktopWindowContentBridge", nullptr);
+    if (!hXamlIslandWnd || !ScreenToClient(hXamlIslandWnd, &position))
+    {
+        return false;
+    }
+
+    try
+    {
+        auto xamlRoot = GetTaskbarXamlRoot(hWnd);
+        if (!xamlRoot || !xamlRoot.Content())
+        {
+            return false;
+        }
+
+        double scale = xamlRoot.RasterizationScale();
+        winrt::Windows::Foundation::Point point{static_cast<float>(position.x / scale), static_cast<float>(position.y / scale)};
+
+        onEmptySpace = true;
+        for (const auto &element : Media::VisualTreeHelper::FindElementsInHostCoordinates(point, xamlRoot.Content()))
+        {
+            if (!element.try_as<Controls::Control>())
+            {
+                continue;
+            }
+
+            onEmptySpace = (winrt::get_class_name(element) == L"Taskbar.TaskbarFrame");
+            break;
+        }
+        return true;
+    }
+    catch (winrt::hresult_error const &ex)
+    {
+        LOG_ERROR(L"XAML hit test failed: %08X", ex.code());
+        return false;
+    }
+}
+
+// Windows 10 taskbar: UIAutomation reports the taskbar window itself only if the click isn't over any of its child
+// windows (task list, tray, start button, ...), which can be checked directly.
+bool Win32HitTestEmptySpace(HWND hWnd, POINT position, bool &onEmptySpace)
+{
+    if (!ScreenToClient(hWnd, &position))
+    {
+        return false;
+    }
+
+    HWND hChildWnd = ChildWindowFromPointEx(hWnd, position, CWP_SKIPINVISIBLE | CWP_SKIPTRANSPARENT);
+    if (!hChildWnd)
+    {
+        return false;
+    }
+
+    onEmptySpace = (hChildWnd == hWnd);
+    return true;
+}
+
+bool HitTestEmptySpace(HWND hWnd, POINT position, bool &onEmptySpace)
+{
+    if (g_taskbarVersion == WIN_10_TASKBAR)
+    {
+        return Win32HitTestEmptySpace(hWnd, position, onEmptySpace);
+    }
+    return XamlHitTestEmptySpace(hWnd, position, onEmptySpace);
+}
+
+#pragma endregion // empty_space_hit_test
+
 // object to store information about the mouse click, its position, button, timestamp and whether it was on empty space
 struct MouseClick
 {
@@ -1201,7 +1423,20 @@ struct MouseClick
             return; // without position there is no point to going further, other members are initialized so it's safe to return
         }
 
-        // Note: The reason why UIAutomation interface is used is that it reliably returns a className of the element clicked.
+        LARGE_INTEGER start, end, frequency;
+        QueryPerformanceCounter(&start);
+
+        if (HitTestEmptySpace(hWnd, position, onEmptySpace))
+        {
+            QueryPerformanceCounter(&end);
+            QueryPerformanceFrequency(&frequency);
+            LOG_DEBUG(L"Taskbar clicked at x=%ld, y=%ld, type=%d, btn=%d, isEmptySpace=%d, decided in-process in %.3f ms",
+                      position.x, position.y, static_cast<int>(type), static_cast<int>(button), onEmptySpace,
+                      (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+            return;
+        }
+
+        // Fallback: The reason why UIAutomation interface is used is that it reliably returns a className of the element clicked.
         // If standard Windows API is used, the className returned is always Shell_TrayWnd which is a parrent window wrapping the taskbar.
         // From that we can't really tell reliably whether user clicked on the taskbar empty space or on some UI element on that taskbar, like
         // opened window, icon, start menu, etc.
@@ -1223,8 +1458,11 @@ struct MouseClick
                        (wcscmp(className.GetBSTR(), L"Taskbar.TaskbarFrameAutomationPeer") == 0) ||   // Windows 11 taskbar
                        (wcscmp(className.GetBSTR(), L"Windows.UI.Input.InputSite.WindowClass") == 0); // Windows 11 21H2 taskbar
 
-        LOG_DEBUG(L"Taskbar clicked clicked at x=%ld, y=%ld, type=%d, btn=%d, element=%s, isEmptySpace=%d",
-                  position.x, position.y, static_cast<int>(type), static_cast<int>(button), className.GetBSTR(), onEmptySpace);
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+        LOG_DEBUG(L"Taskbar clicked at x=%ld, y=%ld, type=%d, btn=%d, element=%s, isEmptySpace=%d, decided by UIAutomation in %.3f ms",
+                  position.x, position.y, static_cast<int>(type), static_cast<int>(button), className.GetBSTR(), onEmptySpace,
+                  (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
     }
 
     static MouseClick::Type GetPointerType(WPARAM wParam, LPARAM lParam)
@@ -2780,6 +3018,16 @@ BOOL Wh_ModInit()
         LOG_INFO(L"DeviceEnumerator COM initilized");
     }
 
+    // resolve the taskbar internals needed for the XAML hit test, UIAutomation is used if it's not available
+    if (g_taskbarVersion == WIN_11_TASKBAR)
+    {
+        g_taskbarXamlSymbolsResolved = ResolveTaskbarXamlSymbols();
+        if (!g_taskbarXamlSymbolsResolved)
+        {
+            LOG_ERROR(L"Failed to resolve taskbar symbols, falling back to UIAutomation for hit testing");
+        }
+    }
+
     // hook CreateWindowExW to be able to identify taskbar windows on re-creation
     if (!Wh_SetFunctionHook((void *)CreateWindowExW, (void *)CreateWindowExW_Hook, (void **)&CreateWindowExW_Original))
     {
@@ -2,7 +2,7 @@
 // @id              taskbar-grouping
 // @name            Disable grouping on the taskbar
 // @description     Causes a separate button to be created on the taskbar for each new window
-// @version         1.3.10
+// @version         1.3.11
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -123,6 +123,7 @@ or a similar tool), enable the relevant option in the mod's settings.
 
 #include <atomic>
 #include <functional>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -156,13 +157,19 @@ enum class GroupingMode {
     inverse,
 };
 
+struct ProgramRule {
+    bool excluded = false;
+    int customGroup = 0;
+};
+
 struct {
     PinnedItemsMode pinnedItemsMode;
     PlaceUngroupedItemsTogetherMode placeUngroupedItemsTogether;
     bool useWindowIcons;
-    std::unordered_set<std::wstring> excludedProgramItems;
     std::vector<std::wstring> customGroupNames;
-    std::unordered_map<std::wstring, int> customGroupProgramItems;
+    // Excluded programs and custom group items, keyed by the upper-cased
+    // AppID, path or file name.
+    std::unordered_map<std::wstring, ProgramRule> programRules;
     GroupingMode groupingMode;
     bool oldTaskbarOnWin11;
 } g_settings;
@@ -309,120 +316,157 @@ using CTaskBand__MatchWindow_t = HRESULT(WINAPI*)(PVOID pThis,
                                                   PVOID* taskItem);
 CTaskBand__MatchWindow_t CTaskBand__MatchWindow_Original;
 
-void ProcessResolvedWindow(PVOID pThis, RESOLVEDWINDOW* resolvedWindow) {
-    Wh_Log(L"==========");
-    Wh_Log(L"hButtonWnd=%08X", resolvedWindow->hButtonWnd);
-    Wh_Log(L"szPathStr=%s", resolvedWindow->szPathStr);
-    Wh_Log(L"szAppIdStr=%s", resolvedWindow->szAppIdStr);
-    Wh_Log(L"pAppItemIdList=%p", resolvedWindow->pAppItemIdList);
-    Wh_Log(L"hThumbInsertBeforeWnd=%08X",
-           resolvedWindow->hThumbInsertBeforeWnd);
-    Wh_Log(L"hThumbParentWnd=%08X", resolvedWindow->hThumbParentWnd);
-    Wh_Log(L"bSetPinnableAndLaunchable=%d",
-           resolvedWindow->bSetPinnableAndLaunchable);
-    Wh_Log(L"bSetThumbFlag=%d", resolvedWindow->bSetThumbFlag);
-
-    DWORD resolvedAppIdStrLen = wcslen(resolvedWindow->szAppIdStr);
-    WCHAR resolvedAppIdStrUpper[MAX_PATH];
-    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
-                  resolvedWindow->szAppIdStr, resolvedAppIdStrLen + 1,
-                  resolvedAppIdStrUpper, resolvedAppIdStrLen + 1, nullptr,
-                  nullptr, 0);
+// Merges a rule of a lower precedence: any matching rule excludes, and the
+// first matching custom group wins.
+void MergeProgramRule(ProgramRule* rule, const ProgramRule& other) {
+    rule->excluded = rule->excluded || other.excluded;
+    if (!rule->customGroup) {
+        rule->customGroup = other.customGroup;
+    }
+}
 
-    DWORD resolvedWindowProcessPathLen = 0;
-    WCHAR resolvedWindowProcessPath[MAX_PATH];
-    WCHAR resolvedWindowProcessPathUpper[MAX_PATH];
-    PCWSTR programFileNameUpper = nullptr;
-    if (resolvedWindow->hButtonWnd) {
-        DWORD dwProcessId = 0;
-        if (GetWindowThreadProcessId(resolvedWindow->hButtonWnd,
-                                     &dwProcessId)) {
-            HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION,
-                                          FALSE, dwProcessId);
-            if (hProcess) {
-                DWORD dwSize = ARRAYSIZE(resolvedWindowProcessPath);
-                if (QueryFullProcessImageName(
-                        hProcess, 0, resolvedWindowProcessPath, &dwSize)) {
-                    resolvedWindowProcessPathLen = dwSize;
-                }
+ProgramRule LookupProgramRule(PCWSTR keyUpper) {
+    auto it = g_settings.programRules.find(keyUpper);
+    if (it == g_settings.programRules.end()) {
+        return {};
+    }
 
-                CloseHandle(hProcess);
-            }
-        }
+    return it->second;
+}
 
-        if (resolvedWindowProcessPathLen > 0) {
-            LCMapStringEx(
-                LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
-                resolvedWindowProcessPath, resolvedWindowProcessPathLen + 1,
-                resolvedWindowProcessPathUpper,
-                resolvedWindowProcessPathLen + 1, nullptr, nullptr, 0);
-
-            programFileNameUpper =
-                wcsrchr(resolvedWindowProcessPathUpper, L'\\');
-            if (programFileNameUpper) {
-                programFileNameUpper++;
-                if (!*programFileNameUpper) {
-                    programFileNameUpper = nullptr;
-                }
-            }
-        } else {
-            *resolvedWindowProcessPath = L'\0';
-            *resolvedWindowProcessPathUpper = L'\0';
-        }
-    }
+struct ProcessIdentity {
+    FILETIME creationTime;
+    std::wstring path;
+    std::wstring pathUpper;
+    std::wstring fileNameUpper;
+    // The merged rule of the path and the file name.
+    ProgramRule rule;
+};
 
-    bool excluded = false;
+// Processes with many windows (browsers, IDEs) are resolved once. The creation
+// time is compared to detect a reused process id. Cleared when the settings
+// change, since the rule depends on them.
+constexpr size_t kProcessIdentityCacheMaxSize = 256;
+std::mutex g_processIdentityCacheMutex;
+std::unordered_map<DWORD, ProcessIdentity> g_processIdentityCache;
 
-    if (g_settings.excludedProgramItems.contains(resolvedAppIdStrUpper)) {
-        Wh_Log(L"Excluding %s", resolvedWindow->szAppIdStr);
-        excluded = true;
+bool GetProcessIdentity(HWND hWnd, ProcessIdentity* identity) {
+    DWORD dwProcessId = 0;
+    if (!GetWindowThreadProcessId(hWnd, &dwProcessId)) {
+        return false;
     }
 
-    if (!excluded && resolvedWindowProcessPathLen > 0 &&
-        g_settings.excludedProgramItems.contains(
-            resolvedWindowProcessPathUpper)) {
-        Wh_Log(L"Excluding %s", resolvedWindowProcessPath);
-        excluded = true;
+    HANDLE hProcess =
+        OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, dwProcessId);
+    if (!hProcess) {
+        return false;
     }
 
-    if (!excluded && programFileNameUpper &&
-        g_settings.excludedProgramItems.contains(programFileNameUpper)) {
-        Wh_Log(L"Excluding %s", resolvedWindowProcessPath);
-        excluded = true;
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(hProcess, &creationTime, &exitTime, &kernelTime,
+                         &userTime)) {
+        CloseHandle(hProcess);
+        return false;
     }
 
-    if (g_settings.groupingMode == GroupingMode::inverse) {
-        excluded = !excluded;
+    {
+        std::lock_guard<std::mutex> guard(g_processIdentityCacheMutex);
+        auto it = g_processIdentityCache.find(dwProcessId);
+        if (it != g_processIdentityCache.end() &&
+            CompareFileTime(&it->second.creationTime, &creationTime) == 0) {
+            *identity = it->second;
+            CloseHandle(hProcess);
+            return true;
+        }
     }
 
-    if (excluded) {
-        return;
+    WCHAR processPath[MAX_PATH];
+    DWORD dwSize = ARRAYSIZE(processPath);
+    BOOL querySucceeded =
+        QueryFullProcessImageName(hProcess, 0, processPath, &dwSize);
+
+    CloseHandle(hProcess);
+
+    if (!querySucceeded || dwSize == 0) {
+        return false;
     }
 
-    int customGroup = 0;
+    identity->creationTime = creationTime;
+    identity->path.assign(processPath, dwSize);
+
+    identity->pathUpper = identity->path;
+    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
+                  &identity->pathUpper[0],
+                  static_cast<int>(identity->pathUpper.length()),
+                  &identity->pathUpper[0],
+                  static_cast<int>(identity->pathUpper.length()), nullptr,
+                  nullptr, 0);
 
-    if (auto it =
-            g_settings.customGroupProgramItems.find(resolvedAppIdStrUpper);
-        it != g_settings.customGroupProgramItems.end()) {
-        customGroup = it->second;
+    identity->fileNameUpper.clear();
+    if (size_t pos = identity->pathUpper.rfind(L'\\');
+        pos != std::wstring::npos) {
+        identity->fileNameUpper = identity->pathUpper.substr(pos + 1);
     }
 
-    if (!customGroup && resolvedWindowProcessPathLen > 0) {
-        if (auto it = g_settings.customGroupProgramItems.find(
-                resolvedWindowProcessPathUpper);
-            it != g_settings.customGroupProgramItems.end()) {
-            customGroup = it->second;
-        }
+    identity->rule = LookupProgramRule(identity->pathUpper.c_str());
+    if (!identity->fileNameUpper.empty()) {
+        MergeProgramRule(&identity->rule,
+                         LookupProgramRule(identity->fileNameUpper.c_str()));
     }
 
-    if (!customGroup && programFileNameUpper) {
-        if (auto it =
-                g_settings.customGroupProgramItems.find(programFileNameUpper);
-            it != g_settings.customGroupProgramItems.end()) {
-            customGroup = it->second;
+    std::lock_guard<std::mutex> guard(g_processIdentityCacheMutex);
+    if (g_processIdentityCache.size() >= kProcessIdentityCacheMaxSize) {
+        g_processIdentityCache.clear();
+    }
+
+    g_processIdentityCache[dwProcessId] = *identity;
+
+    return true;
+}
+
+void ProcessResolvedWindow(PVOID pThis, RESOLVEDWINDOW* resolvedWindow) {
+    Wh_Log(L"hButtonWnd=%08X, szPathStr=%s, szAppIdStr=%s",
+           resolvedWindow->hButtonWnd, resolvedWindow->szPathStr,
+           resolvedWindow->szAppIdStr);
+
+    ProgramRule rule;
+
+    if (!g_settings.programRules.empty()) {
+        DWORD resolvedAppIdStrLen = wcslen(resolvedWindow->szAppIdStr);
+        WCHAR resolvedAppIdStrUpper[MAX_PATH];
+        LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
+                      resolvedWindow->szAppIdStr, resolvedAppIdStrLen + 1,
+                      resolvedAppIdStrUpper, resolvedAppIdStrLen + 1, nullptr,
+                      nullptr, 0);
+
+        rule = LookupProgramRule(resolvedAppIdStrUpper);
+        if (rule.excluded) {
+            Wh_Log(L"Excluding %s", resolvedWindow->szAppIdStr);
+        }
+
+        ProcessIdentity processIdentity;
+        if (resolvedWindow->hButtonWnd &&
+            GetProcessIdentity(resolvedWindow->hButtonWnd, &processIdentity)) {
+            if (!rule.excluded && processIdentity.rule.excluded) {
+                Wh_Log(L"Excluding %s", processIdentity.path.c_str());
+            }
+
+            MergeProgramRule(&rule, processIdentity.rule);
         }
     }
 
+    bool excluded = rule.excluded;
+
+    if (g_settings.groupingMode == GroupingMode::inverse) {
+        excluded = !excluded;
+    }
+
+    if (excluded) {
+        return;
+    }
+
+    int customGroup = rule.customGroup;
+
     if (!customGroup) {
         winrt::com_ptr<IUnknown> taskGroupMatched;
         winrt::com_ptr<IUnknown> taskItemMatched;
@@ -1842,7 +1886,7 @@ void LoadSettings() {
 
     g_settings.useWindowIcons = Wh_GetIntSetting(L"useWindowIcons");
 
-    g_settings.excludedProgramItems.clear();
+    g_settings.programRules.clear();
 
     for (int i = 0;; i++) {
         PCWSTR program = Wh_GetStringSetting(L"excludedPrograms[%d]", i);
@@ -1855,7 +1899,7 @@ void LoadSettings() {
                 static_cast<int>(programUpper.length()), &programUpper[0],
                 static_cast<int>(programUpper.length()), nullptr, nullptr, 0);
 
-            g_settings.excludedProgramItems.insert(std::move(programUpper));
+            g_settings.programRules[std::move(programUpper)].excluded = true;
         }
 
         Wh_FreeStringSetting(program);
@@ -1866,7 +1910,6 @@ void LoadSettings() {
     }
 
     g_settings.customGroupNames.clear();
-    g_settings.customGroupProgramItems.clear();
 
     for (int groupIndex = 0;; groupIndex++) {
         PCWSTR name = Wh_GetStringSetting(L"customGroups[%d].name", groupIndex);
@@ -1895,8 +1938,11 @@ void LoadSettings() {
                     static_cast<int>(programUpper.length()), nullptr, nullptr,
                     0);
 
-                g_settings.customGroupProgramItems.insert(
-                    {std::move(programUpper), groupIndex + 1});
+                // Keep the first group if an item is listed in several.
+                auto& rule = g_settings.programRules[std::move(programUpper)];
+                if (!rule.customGroup) {
+                    rule.customGroup = groupIndex + 1;
+                }
             }
 
             Wh_FreeStringSetting(program);
@@ -1915,6 +1961,9 @@ void LoadSettings() {
     Wh_FreeStringSetting(groupingMode);
 
     g_settings.oldTaskbarOnWin11 = Wh_GetIntSetting(L"oldTaskbarOnWin11");
+
+    std::lock_guard<std::mutex> guard(g_processIdentityCacheMutex);
+    g_processIdentityCache.clear();
 }
 
 BOOL Wh_ModInit() {
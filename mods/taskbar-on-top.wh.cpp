@@ -2,7 +2,7 @@
 // @id              taskbar-on-top
 // @name            Taskbar on top for Windows 11
 // @description     Moves the Windows 11 taskbar to the top of the screen
-// @version         1.1.4
+// @version         1.1.5
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -79,6 +79,9 @@ versions weren't tested and are probably not compatible.
 #include <atomic>
 #include <functional>
 #include <list>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 
 #ifdef _M_ARM64
 #include <regex>
@@ -260,17 +263,179 @@ bool GetMonitorRect(HMONITOR monitor, RECT* rc) {
            CopyRect(rc, &monitorInfo.rcMonitor);
 }
 
+enum class WindowClass : BYTE {
+    other,
+    primaryTaskbar,
+    taskListThumbnail,
+    overflowXamlIsland,
+    coreWindow,
+    xamlWindowedPopup,
+    xamlExplorerHostIsland,
+};
+
+WindowClass WindowClassFromName(PCWSTR className) {
+    if (_wcsicmp(className, L"Shell_TrayWnd") == 0) {
+        return WindowClass::primaryTaskbar;
+    }
+
+    if (_wcsicmp(className, L"TaskListThumbnailWnd") == 0) {
+        return WindowClass::taskListThumbnail;
+    }
+
+    if (_wcsicmp(className, L"TopLevelWindowForOverflowXamlIsland") == 0) {
+        return WindowClass::overflowXamlIsland;
+    }
+
+    if (_wcsicmp(className, L"Windows.UI.Core.CoreWindow") == 0) {
+        return WindowClass::coreWindow;
+    }
+
+    if (_wcsicmp(className, L"Xaml_WindowedPopupClass") == 0) {
+        return WindowClass::xamlWindowedPopup;
+    }
+
+    if (_wcsicmp(className, L"XamlExplorerHostIslandWindow") == 0) {
+        return WindowClass::xamlExplorerHostIsland;
+    }
+
+    return WindowClass::other;
+}
+
+// Hooks such as SetWindowPos are called very frequently, so instead of
+// GetClassName and string comparisons on each call, windows of this process
+// are classified once and cached by HWND. Entries are removed when the window
+// is destroyed, which is reported by EVENT_OBJECT_DESTROY on a dedicated
+// thread. Since that's asynchronous, an entry also holds the class atom, and
+// is only used while the window still has it. Class atoms can't be cached on
+// their own, they're reused for other classes once a class is unregistered.
+struct CachedWindowClass {
+    ATOM atom;
+    WindowClass windowClass;
+};
+
+std::shared_mutex g_windowClassCacheMutex;
+std::unordered_map<HWND, CachedWindowClass> g_windowClassCache;
+std::atomic<bool> g_windowClassCacheEnabled;
+HANDLE g_windowClassCacheThread;
+
+// Atoms of registered classes are in the 0xC000-0xFFFF range, all of the
+// classes of interest are registered ones.
+constexpr ATOM kFirstRegisteredClassAtom = 0xC000;
+
+WindowClass GetWindowClass(HWND hWnd) {
+    ATOM atom = (ATOM)GetClassLongPtr(hWnd, GCW_ATOM);
+    if (atom < kFirstRegisteredClassAtom) {
+        return WindowClass::other;
+    }
+
+    {
+        std::shared_lock lock(g_windowClassCacheMutex);
+        auto it = g_windowClassCache.find(hWnd);
+        if (it != g_windowClassCache.end() && it->second.atom == atom) {
+            return it->second.windowClass;
+        }
+    }
+
+    WCHAR szClassName[64];
+    if (!GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName))) {
+        return WindowClass::other;
+    }
+
+    WindowClass windowClass = WindowClassFromName(szClassName);
+
+    // Destruction is only reported for windows of this process.
+    DWORD dwProcessId;
+    if (g_windowClassCacheEnabled &&
+        GetWindowThreadProcessId(hWnd, &dwProcessId) &&
+        dwProcessId == GetCurrentProcessId()) {
+        std::unique_lock lock(g_windowClassCacheMutex);
+        g_windowClassCache[hWnd] = {atom, windowClass};
+    }
+
+    return windowClass;
+}
+
+void CALLBACK WindowClassCacheWinEventProc(HWINEVENTHOOK hWinEventHook,
+                                           DWORD event,
+                                           HWND hWnd,
+                                           LONG idObject,
+                                           LONG idChild,
+                                           DWORD dwEventThread,
+                                           DWORD dwmsEventTime) {
+    if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
+        return;
+    }
+
+    std::unique_lock lock(g_windowClassCacheMutex);
+    g_windowClassCache.erase(hWnd);
+}
+
+DWORD WINAPI WindowClassCacheThread(LPVOID lpThreadParameter) {
+    HWINEVENTHOOK winEventHook = SetWinEventHook(
+        EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, nullptr,
+        WindowClassCacheWinEventProc, GetCurrentProcessId(), 0,
+        WINEVENT_OUTOFCONTEXT);
+    if (!winEventHook) {
+        Wh_Log(L"Error: SetWinEventHook");
+        return 0;
+    }
+
+    g_windowClassCacheEnabled = true;
+
+    MSG msg;
+    while (GetMessage(&msg, nullptr, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    g_windowClassCacheEnabled = false;
+    UnhookWinEvent(winEventHook);
+
+    std::unique_lock lock(g_windowClassCacheMutex);
+    g_windowClassCache.clear();
+    return 0;
+}
+
+void StartWindowClassCache() {
+    g_windowClassCacheThread = CreateThread(nullptr, 0, WindowClassCacheThread,
+                                            nullptr, 0, nullptr);
+}
+
+void StopWindowClassCache() {
+    if (!g_windowClassCacheThread) {
+        return;
+    }
+
+    // Posting fails until the thread has a message queue.
+    while (!PostThreadMessage(GetThreadId(g_windowClassCacheThread), WM_QUIT,
+                              0, 0) &&
+           WaitForSingleObject(g_windowClassCacheThread, 10) == WAIT_TIMEOUT) {
+    }
+
+    WaitForSingleObject(g_windowClassCacheThread, INFINITE);
+    CloseHandle(g_windowClassCacheThread);
+    g_windowClassCacheThread = nullptr;
+}
+
+// Only used for logging, so not cached.
+std::wstring GetWindowClassName(HWND hWnd) {
+    WCHAR szClassName[64];
+    if (!GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName))) {
+        return std::wstring();
+    }
+
+    return szClassName;
+}
+
 HWND FindCurrentProcessTaskbarWnd() {
     HWND hTaskbarWnd = nullptr;
 
     EnumWindows(
         [](HWND hWnd, LPARAM lParam) -> BOOL {
             DWORD dwProcessId;
-            WCHAR className[32];
             if (GetWindowThreadProcessId(hWnd, &dwProcessId) &&
                 dwProcessId == GetCurrentProcessId() &&
-                GetClassName(hWnd, className, ARRAYSIZE(className)) &&
-                _wcsicmp(className, L"Shell_TrayWnd") == 0) {
+                GetWindowClass(hWnd) == WindowClass::primaryTaskbar) {
                 *reinterpret_cast<HWND*>(lParam) = hWnd;
                 return FALSE;
             }
@@ -1255,12 +1420,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                                      uFlags);
     };
 
-    WCHAR szClassName[64];
-    if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-        return original();
-    }
-
-    if (_wcsicmp(szClassName, L"TaskListThumbnailWnd") == 0) {
+    WindowClass windowClass = GetWindowClass(hWnd);
+    if (windowClass == WindowClass::taskListThumbnail) {
         if (uFlags & SWP_NOMOVE) {
             return original();
         }
@@ -1298,9 +1459,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
             GetWindowRect(hWnd, &rc);
             Y = rc.top;
         }
-    } else if (_wcsicmp(szClassName, L"TopLevelWindowForOverflowXamlIsland") ==
-                   0 ||
-               _wcsicmp(szClassName, L"Xaml_WindowedPopupClass") == 0) {
+    } else if (windowClass == WindowClass::overflowXamlIsland ||
+               windowClass == WindowClass::xamlWindowedPopup) {
         if (uFlags & (SWP_NOMOVE | SWP_NOSIZE)) {
             return original();
         }
@@ -1327,23 +1487,20 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
 
         bool adjusted = false;
 
-        WCHAR rootOwnerClassName[64];
-        if (_wcsicmp(szClassName, L"Xaml_WindowedPopupClass") == 0 &&
+        if (windowClass == WindowClass::xamlWindowedPopup &&
             GetWindowThreadProcessId(hWnd, nullptr) ==
                 GetWindowThreadProcessId(FindCurrentProcessTaskbarWnd(),
-                                         nullptr) &&
-            GetClassName(GetAncestor(hWnd, GA_ROOTOWNER), rootOwnerClassName,
-                         ARRAYSIZE(rootOwnerClassName))) {
-            if (_wcsicmp(rootOwnerClassName, L"XamlExplorerHostIslandWindow") ==
-                0) {
+                                         nullptr)) {
+            WindowClass rootOwnerClass =
+                GetWindowClass(GetAncestor(hWnd, GA_ROOTOWNER));
+            if (rootOwnerClass == WindowClass::xamlExplorerHostIsland) {
                 // Probably hovering a XAML thumbnail preview, make it so that
                 // the tooltip doesn't cover the thumbnail preview.
                 Y = monitorInfo.rcWork.top +
                     MulDiv(10 + g_lastFlyoutPositionSize.Height, monitorDpiY,
                            96);
                 adjusted = true;
-            } else if (_wcsicmp(rootOwnerClassName,
-                                L"TopLevelWindowForOverflowXamlIsland") == 0) {
+            } else if (rootOwnerClass == WindowClass::overflowXamlIsland) {
                 // Don't adjust to prevent tooltips from covering the overflow
                 // flyout.
                 adjusted = true;
@@ -1357,7 +1514,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                 Y = monitorInfo.rcWork.bottom - cy;
             }
         }
-    } else if (_wcsicmp(szClassName, L"Windows.UI.Core.CoreWindow") == 0) {
+    } else if (windowClass == WindowClass::coreWindow) {
         if (uFlags & SWP_NOMOVE) {
             return original();
         }
@@ -1411,11 +1568,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
             GetWindowThreadProcessId(windowFromPoint, nullptr) ==
                 GetWindowThreadProcessId(FindCurrentProcessTaskbarWnd(),
                                          nullptr)) {
-            WCHAR szClassNameFromPoint[64];
-            if (GetClassName(windowFromPoint, szClassNameFromPoint,
-                             ARRAYSIZE(szClassNameFromPoint)) &&
-                _wcsicmp(szClassNameFromPoint,
-                         L"XamlExplorerHostIslandWindow") == 0) {
+            if (GetWindowClass(windowFromPoint) ==
+                WindowClass::xamlExplorerHostIsland) {
                 UINT monitorDpiX = 96;
                 UINT monitorDpiY = 96;
                 GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
@@ -1430,8 +1584,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         return original();
     }
 
-    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d", szClassName, X, Y, X + cx,
-           Y + cy);
+    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d",
+           GetWindowClassName(hWnd).c_str(), X, Y, X + cx, Y + cy);
 
     return SetWindowPos_Original(hWnd, hWndInsertAfter, X, Y, cx, cy, uFlags);
 }
@@ -1448,12 +1602,7 @@ BOOL WINAPI MoveWindow_Hook(HWND hWnd,
         return MoveWindow_Original(hWnd, X, Y, nWidth, nHeight, bRepaint);
     };
 
-    WCHAR szClassName[64];
-    if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-        return original();
-    }
-
-    if (_wcsicmp(szClassName, L"XamlExplorerHostIslandWindow") == 0) {
+    if (GetWindowClass(hWnd) == WindowClass::xamlExplorerHostIsland) {
         DWORD threadId = GetWindowThreadProcessId(hWnd, nullptr);
         if (!threadId) {
             return original();
@@ -1505,8 +1654,8 @@ BOOL WINAPI MoveWindow_Hook(HWND hWnd,
         return original();
     }
 
-    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d", szClassName, X, Y, X + nWidth,
-           Y + nHeight);
+    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d",
+           GetWindowClassName(hWnd).c_str(), X, Y, X + nWidth, Y + nHeight);
 
     return MoveWindow_Original(hWnd, X, Y, nWidth, nHeight, bRepaint);
 }
@@ -2012,6 +2161,8 @@ BOOL Wh_ModInit() {
         }
     }
 
+    StartWindowClassCache();
+
     return TRUE;
 }
 
@@ -2047,6 +2198,8 @@ void Wh_ModUninit() {
     while (g_hookCallCounter > 0) {
         Sleep(100);
     }
+
+    StopWindowClassCache();
 }
 
 void Wh_ModSettingsChanged() {
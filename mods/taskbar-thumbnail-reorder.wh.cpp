@@ -2,7 +2,7 @@
 // @id              taskbar-thumbnail-reorder
 // @name            Taskbar Thumbnail Reorder
 // @description     Reorder taskbar thumbnails with the left mouse button
-// @version         1.1.3
+// @version         1.1.4
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -59,8 +59,10 @@ or a similar tool), enable the relevant option in the mod's settings.
 #include <commctrl.h>
 #include <psapi.h>
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
+#include <optional>
 #include <vector>
 
 #undef GetCurrentTime
@@ -124,6 +126,34 @@ winrt::weak_ref<winrt::Windows::Foundation::IInspectable>
 
 bool g_reorderingXamlThumbnails;
 
+struct ThumbnailBounds {
+    // Along the direction in which the thumbnails are laid out.
+    float start;
+    float end;
+    // Along the other direction.
+    float crossStart;
+    float crossEnd;
+    int position;
+};
+
+// Captured when a thumbnail drag starts, so that pointer moves don't have to
+// walk the visual tree. Bounds are relative to the repeater, so they stay valid
+// while the list scrolls.
+struct ThumbnailDragSnapshot {
+    // Only compared by identity.
+    void* thumbnailList;
+    winrt::weak_ref<FrameworkElement> repeater;
+    int childrenCount;
+    double repeaterWidth;
+    double repeaterHeight;
+    bool horizontal;
+    int positionPressed;
+    // Sorted by start.
+    std::vector<ThumbnailBounds> thumbnails;
+};
+
+std::optional<ThumbnailDragSnapshot> g_thumbDragSnapshot;
+
 FrameworkElement EnumChildElements(
     FrameworkElement element,
     std::function<bool(FrameworkElement)> enumCallback) {
@@ -695,15 +725,182 @@ void WINAPI HoverFlyoutModel_TargetItemKey_Hook(void* pThis, void* param1) {
     g_inHoverFlyoutModel_TargetItemKey = false;
 }
 
-bool IsPointerInsideElement(const UIElement& element,
-                            const Input::PointerRoutedEventArgs& args) {
-    auto pointerPos = args.GetCurrentPoint(element).Position();
+FrameworkElement FindThumbnailListRepeater(FrameworkElement element) {
+    auto className = winrt::get_class_name(element);
+    Wh_Log(L"%s", className.c_str());
 
-    float width = element.RenderSize().Width;
-    float height = element.RenderSize().Height;
+    if (className == L"Taskbar.TaskItemThumbnailList") {
+        return FindChildByName(element, L"TaskItemThumbnailListRepeater");
+    }
 
-    return pointerPos.X >= 0 && pointerPos.X < width && pointerPos.Y >= 0 &&
-           pointerPos.Y < height;
+    if (className == L"Taskbar.TaskItemThumbnailScrollableList") {
+        FrameworkElement child = element;
+        if ((child = FindChildByName(
+                 child, L"TaskItemThumbnailScrollableListScrollViewer")) &&
+            (child = FindChildByName(child, L"Root")) &&
+            (child = FindChildByClassName(child,
+                                          L"Windows.UI.Xaml.Controls.Grid")) &&
+            (child = FindChildByName(child, L"ScrollContentPresenter")) &&
+            (child =
+                 FindChildByName(child, L"TaskItemThumbnailListRepeater"))) {
+            return child;
+        }
+    }
+
+    return nullptr;
+}
+
+bool IsThumbnailPressed(FrameworkElement thumbnail) {
+    auto grid =
+        FindChildByClassName(thumbnail, L"Windows.UI.Xaml.Controls.Grid");
+    if (!grid) {
+        Wh_Log(L"Element has no grid child");
+        return false;
+    }
+
+    for (const auto& v : VisualStateManager::GetVisualStateGroups(grid)) {
+        if (v.Name() == L"CommonStates") {
+            auto currentState = v.CurrentState();
+            if (!currentState) {
+                return false;
+            }
+
+            auto currentStateName = currentState.Name();
+            return currentStateName == L"Pressed" ||
+                   currentStateName == L"RequestingAttentionPressed";
+        }
+    }
+
+    return false;
+}
+
+bool CaptureThumbnailDragSnapshot(void* thumbnailList,
+                                  FrameworkElement repeater,
+                                  ThumbnailDragSnapshot& snapshot) {
+    snapshot.thumbnailList = thumbnailList;
+    snapshot.repeater = repeater;
+    snapshot.childrenCount = Media::VisualTreeHelper::GetChildrenCount(repeater);
+    snapshot.repeaterWidth = repeater.ActualWidth();
+    snapshot.repeaterHeight = repeater.ActualHeight();
+    snapshot.positionPressed = 0;
+    snapshot.thumbnails.clear();
+
+    struct ThumbnailRect {
+        winrt::Windows::Foundation::Point origin;
+        winrt::Windows::Foundation::Size size;
+        int position;
+    };
+
+    std::vector<ThumbnailRect> rects;
+    rects.reserve(snapshot.childrenCount);
+
+    EnumChildElements(repeater, [&](FrameworkElement child) {
+        auto className = winrt::get_class_name(child);
+        if (className != L"Taskbar.TaskItemThumbnailView") {
+            Wh_Log(L"Unexpected element of class %s", className.c_str());
+            return true;
+        }
+
+        int position =
+            Automation::AutomationProperties::GetPositionInSet(child);
+
+        if (snapshot.positionPressed == 0 && IsThumbnailPressed(child)) {
+            snapshot.positionPressed = position;
+        }
+
+        rects.push_back({
+            child.TransformToVisual(repeater).TransformPoint({0, 0}),
+            child.RenderSize(),
+            position,
+        });
+
+        return false;
+    });
+
+    if (snapshot.positionPressed == 0 || rects.empty()) {
+        return false;
+    }
+
+    float minX = rects[0].origin.X, maxX = minX;
+    float minY = rects[0].origin.Y, maxY = minY;
+    for (const auto& rect : rects) {
+        minX = std::min(minX, rect.origin.X);
+        maxX = std::max(maxX, rect.origin.X);
+        minY = std::min(minY, rect.origin.Y);
+        maxY = std::max(maxY, rect.origin.Y);
+    }
+
+    snapshot.horizontal = maxX - minX >= maxY - minY;
+
+    snapshot.thumbnails.reserve(rects.size());
+    for (const auto& rect : rects) {
+        if (snapshot.horizontal) {
+            snapshot.thumbnails.push_back({
+                rect.origin.X,
+                rect.origin.X + rect.size.Width,
+                rect.origin.Y,
+                rect.origin.Y + rect.size.Height,
+                rect.position,
+            });
+        } else {
+            snapshot.thumbnails.push_back({
+                rect.origin.Y,
+                rect.origin.Y + rect.size.Height,
+                rect.origin.X,
+                rect.origin.X + rect.size.Width,
+                rect.position,
+            });
+        }
+    }
+
+    std::sort(snapshot.thumbnails.begin(), snapshot.thumbnails.end(),
+              [](const ThumbnailBounds& a, const ThumbnailBounds& b) {
+                  return a.start < b.start;
+              });
+
+    return true;
+}
+
+// Returns the repeater if the snapshot still matches its layout.
+FrameworkElement GetThumbnailDragSnapshotRepeater(
+    const ThumbnailDragSnapshot& snapshot,
+    void* thumbnailList) {
+    if (snapshot.thumbnailList != thumbnailList) {
+        return nullptr;
+    }
+
+    auto repeater = snapshot.repeater.get();
+    if (!repeater ||
+        Media::VisualTreeHelper::GetChildrenCount(repeater) !=
+            snapshot.childrenCount ||
+        repeater.ActualWidth() != snapshot.repeaterWidth ||
+        repeater.ActualHeight() != snapshot.repeaterHeight) {
+        return nullptr;
+    }
+
+    return repeater;
+}
+
+int HitTestThumbnailDragSnapshot(const ThumbnailDragSnapshot& snapshot,
+                                 winrt::Windows::Foundation::Point point) {
+    float main = snapshot.horizontal ? point.X : point.Y;
+    float cross = snapshot.horizontal ? point.Y : point.X;
+
+    auto it = std::upper_bound(
+        snapshot.thumbnails.begin(), snapshot.thumbnails.end(), main,
+        [](float value, const ThumbnailBounds& bounds) {
+            return value < bounds.start;
+        });
+    if (it == snapshot.thumbnails.begin()) {
+        return 0;
+    }
+
+    --it;
+    if (main >= it->end || cross < it->crossStart || cross >= it->crossEnd) {
+        return 0;
+    }
+
+    return it->position;
 }
 
 void MoveItemsFromXAMLThumbnail(int indexFrom, int indexTo) {
@@ -787,6 +984,7 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
 
     if (!GetCapture()) {
         g_reorderingXamlThumbnails = false;
+        g_thumbDragSnapshot.reset();
         return original();
     }
 
@@ -794,44 +992,39 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
         return original();
     }
 
-    Wh_Log(L">");
+    FrameworkElement taskItemThumbnailListRepeater = nullptr;
+    if (g_thumbDragSnapshot) {
+        taskItemThumbnailListRepeater =
+            GetThumbnailDragSnapshotRepeater(*g_thumbDragSnapshot, pThis);
+    }
 
-    FrameworkElement element = nullptr;
-    ((IUnknown*)pThis)
-        ->QueryInterface(winrt::guid_of<FrameworkElement>(),
-                         winrt::put_abi(element));
+    if (!taskItemThumbnailListRepeater) {
+        Wh_Log(L">");
 
-    if (!element) {
-        return original();
-    }
+        g_thumbDragSnapshot.reset();
 
-    auto className = winrt::get_class_name(element);
-    Wh_Log(L"%s", className.c_str());
+        FrameworkElement element = nullptr;
+        ((IUnknown*)pThis)
+            ->QueryInterface(winrt::guid_of<FrameworkElement>(),
+                             winrt::put_abi(element));
 
-    FrameworkElement taskItemThumbnailListRepeater = nullptr;
+        if (!element) {
+            return original();
+        }
 
-    if (className == L"Taskbar.TaskItemThumbnailList") {
-        taskItemThumbnailListRepeater =
-            FindChildByName(element, L"TaskItemThumbnailListRepeater");
-    } else if (className == L"Taskbar.TaskItemThumbnailScrollableList") {
-        FrameworkElement child = element;
-        if ((child = FindChildByName(
-                 child, L"TaskItemThumbnailScrollableListScrollViewer")) &&
-            (child = FindChildByName(child, L"Root")) &&
-            (child = FindChildByClassName(child,
-                                          L"Windows.UI.Xaml.Controls.Grid")) &&
-            (child = FindChildByName(child, L"ScrollContentPresenter")) &&
-            (child =
-                 FindChildByName(child, L"TaskItemThumbnailListRepeater"))) {
-            taskItemThumbnailListRepeater = child;
+        taskItemThumbnailListRepeater = FindThumbnailListRepeater(element);
+        if (!taskItemThumbnailListRepeater) {
+            Wh_Log(L"TaskItemThumbnailListRepeater not found");
+            return original();
         }
-    } else {
-        return original();
-    }
 
-    if (!taskItemThumbnailListRepeater) {
-        Wh_Log(L"TaskItemThumbnailListRepeater not found");
-        return original();
+        ThumbnailDragSnapshot snapshot;
+        if (!CaptureThumbnailDragSnapshot(pThis, taskItemThumbnailListRepeater,
+                                          snapshot)) {
+            return original();
+        }
+
+        g_thumbDragSnapshot = std::move(snapshot);
     }
 
     Input::PointerRoutedEventArgs args = nullptr;
@@ -842,59 +1035,17 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
         return original();
     }
 
-    int positionPressed = 0;
-    int positionHovered = 0;
+    int positionPressed = g_thumbDragSnapshot->positionPressed;
+    int positionHovered = HitTestThumbnailDragSnapshot(
+        *g_thumbDragSnapshot,
+        args.GetCurrentPoint(taskItemThumbnailListRepeater).Position());
 
-    EnumChildElements(
-        taskItemThumbnailListRepeater,
-        [&args, &positionPressed, &positionHovered](FrameworkElement child) {
-            auto className = winrt::get_class_name(child);
-            if (className != L"Taskbar.TaskItemThumbnailView") {
-                Wh_Log(L"Unexpected element of class %s", className.c_str());
-                return true;
-            }
-
-            auto grid =
-                FindChildByClassName(child, L"Windows.UI.Xaml.Controls.Grid");
-            if (!grid) {
-                Wh_Log(L"Element has no grid child");
-                return true;
-            }
-
-            if (positionPressed == 0) {
-                VisualState currentState = nullptr;
-
-                for (const auto& v :
-                     VisualStateManager::GetVisualStateGroups(grid)) {
-                    if (v.Name() == L"CommonStates") {
-                        currentState = v.CurrentState();
-                        break;
-                    }
-                }
-
-                if (currentState) {
-                    auto currentStateName = currentState.Name();
-                    if (currentStateName == L"Pressed" ||
-                        currentStateName == L"RequestingAttentionPressed") {
-                        positionPressed =
-                            Automation::AutomationProperties::GetPositionInSet(
-                                child);
-                    }
-                }
-            }
-
-            if (positionHovered == 0 && IsPointerInsideElement(child, args)) {
-                positionHovered =
-                    Automation::AutomationProperties::GetPositionInSet(child);
-            }
-
-            return positionPressed != 0 && positionHovered != 0;
-        });
-
-    if (positionPressed != 0 && positionHovered != 0 &&
-        positionPressed != positionHovered) {
+    if (positionHovered != 0 && positionPressed != positionHovered) {
         g_reorderingXamlThumbnails = true;
         MoveItemsFromXAMLThumbnail(positionPressed - 1, positionHovered - 1);
+
+        // The thumbnails are rearranged, capture them again on the next move.
+        g_thumbDragSnapshot.reset();
     }
 
     return original();
@@ -2,7 +2,7 @@
 // @id              taskbar-vertical
 // @name            Vertical Taskbar for Windows 11
 // @description     Finally, the missing vertical taskbar option for Windows 11! Move the taskbar to the left or right side of the screen.
-// @version         1.3.5
+// @version         1.3.6
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -132,6 +132,9 @@ With labels:
 #include <functional>
 #include <limits>
 #include <list>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _M_ARM64
@@ -611,14 +614,190 @@ void TaskbarWndProcPreProcess(HWND hWnd,
 using GetWindowRect_t = decltype(&GetWindowRect);
 GetWindowRect_t GetWindowRect_Original;
 
-bool IsTaskbarWindow(HWND hWnd) {
-    WCHAR szClassName[32];
+enum class WindowClass : BYTE {
+    other,
+    primaryTaskbar,
+    secondaryTaskbar,
+    taskListThumbnail,
+    overflowXamlIsland,
+    coreWindow,
+    xamlWindowedPopup,
+    xamlExplorerHostIsland,
+    desktopWindowContentBridge,
+    controlCenter,
+};
+
+WindowClass WindowClassFromName(PCWSTR className) {
+    if (_wcsicmp(className, L"Shell_TrayWnd") == 0) {
+        return WindowClass::primaryTaskbar;
+    }
+
+    if (_wcsicmp(className, L"Shell_SecondaryTrayWnd") == 0) {
+        return WindowClass::secondaryTaskbar;
+    }
+
+    if (_wcsicmp(className, L"TaskListThumbnailWnd") == 0) {
+        return WindowClass::taskListThumbnail;
+    }
+
+    if (_wcsicmp(className, L"TopLevelWindowForOverflowXamlIsland") == 0) {
+        return WindowClass::overflowXamlIsland;
+    }
+
+    if (_wcsicmp(className, L"Windows.UI.Core.CoreWindow") == 0) {
+        return WindowClass::coreWindow;
+    }
+
+    if (_wcsicmp(className, L"Xaml_WindowedPopupClass") == 0) {
+        return WindowClass::xamlWindowedPopup;
+    }
+
+    if (_wcsicmp(className, L"XamlExplorerHostIslandWindow") == 0) {
+        return WindowClass::xamlExplorerHostIsland;
+    }
+
+    if (_wcsicmp(className,
+                 L"Windows.UI.Composition.DesktopWindowContentBridge") == 0) {
+        return WindowClass::desktopWindowContentBridge;
+    }
+
+    if (_wcsicmp(className, L"ControlCenterWindow") == 0) {
+        return WindowClass::controlCenter;
+    }
+
+    return WindowClass::other;
+}
+
+// Hooks such as SetWindowPos are called very frequently, so instead of
+// GetClassName and string comparisons on each call, windows of this process
+// are classified once and cached by HWND. Entries are removed when the window
+// is destroyed, which is reported by EVENT_OBJECT_DESTROY on a dedicated
+// thread. Since that's asynchronous, an entry also holds the class atom, and
+// is only used while the window still has it. Class atoms can't be cached on
+// their own, they're reused for other classes once a class is unregistered.
+struct CachedWindowClass {
+    ATOM atom;
+    WindowClass windowClass;
+};
+
+std::shared_mutex g_windowClassCacheMutex;
+std::unordered_map<HWND, CachedWindowClass> g_windowClassCache;
+std::atomic<bool> g_windowClassCacheEnabled;
+HANDLE g_windowClassCacheThread;
+
+// Atoms of registered classes are in the 0xC000-0xFFFF range, all of the
+// classes of interest are registered ones.
+constexpr ATOM kFirstRegisteredClassAtom = 0xC000;
+
+WindowClass GetWindowClass(HWND hWnd) {
+    ATOM atom = (ATOM)GetClassLongPtr(hWnd, GCW_ATOM);
+    if (atom < kFirstRegisteredClassAtom) {
+        return WindowClass::other;
+    }
+
+    {
+        std::shared_lock lock(g_windowClassCacheMutex);
+        auto it = g_windowClassCache.find(hWnd);
+        if (it != g_windowClassCache.end() && it->second.atom == atom) {
+            return it->second.windowClass;
+        }
+    }
+
+    WCHAR szClassName[64];
     if (!GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName))) {
-        return false;
+        return WindowClass::other;
+    }
+
+    WindowClass windowClass = WindowClassFromName(szClassName);
+
+    // Destruction is only reported for windows of this process.
+    DWORD dwProcessId;
+    if (g_windowClassCacheEnabled &&
+        GetWindowThreadProcessId(hWnd, &dwProcessId) &&
+        dwProcessId == GetCurrentProcessId()) {
+        std::unique_lock lock(g_windowClassCacheMutex);
+        g_windowClassCache[hWnd] = {atom, windowClass};
+    }
+
+    return windowClass;
+}
+
+void CALLBACK WindowClassCacheWinEventProc(HWINEVENTHOOK hWinEventHook,
+                                           DWORD event,
+                                           HWND hWnd,
+                                           LONG idObject,
+                                           LONG idChild,
+                                           DWORD dwEventThread,
+                                           DWORD dwmsEventTime) {
+    if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF) {
+        return;
+    }
+
+    std::unique_lock lock(g_windowClassCacheMutex);
+    g_windowClassCache.erase(hWnd);
+}
+
+DWORD WINAPI WindowClassCacheThread(LPVOID lpThreadParameter) {
+    HWINEVENTHOOK winEventHook = SetWinEventHook(
+        EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, nullptr,
+        WindowClassCacheWinEventProc, GetCurrentProcessId(), 0,
+        WINEVENT_OUTOFCONTEXT);
+    if (!winEventHook) {
+        Wh_Log(L"Error: SetWinEventHook");
+        return 0;
+    }
+
+    g_windowClassCacheEnabled = true;
+
+    MSG msg;
+    while (GetMessage(&msg, nullptr, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    g_windowClassCacheEnabled = false;
+    UnhookWinEvent(winEventHook);
+
+    std::unique_lock lock(g_windowClassCacheMutex);
+    g_windowClassCache.clear();
+    return 0;
+}
+
+void StartWindowClassCache() {
+    g_windowClassCacheThread = CreateThread(nullptr, 0, WindowClassCacheThread,
+                                            nullptr, 0, nullptr);
+}
+
+void StopWindowClassCache() {
+    if (!g_windowClassCacheThread) {
+        return;
+    }
+
+    // Posting fails until the thread has a message queue.
+    while (!PostThreadMessage(GetThreadId(g_windowClassCacheThread), WM_QUIT,
+                              0, 0) &&
+           WaitForSingleObject(g_windowClassCacheThread, 10) == WAIT_TIMEOUT) {
+    }
+
+    WaitForSingleObject(g_windowClassCacheThread, INFINITE);
+    CloseHandle(g_windowClassCacheThread);
+    g_windowClassCacheThread = nullptr;
+}
+
+// Only used for logging, so not cached.
+std::wstring GetWindowClassName(HWND hWnd) {
+    WCHAR szClassName[64];
+    if (!GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName))) {
+        return std::wstring();
     }
 
-    return _wcsicmp(szClassName, L"Shell_TrayWnd") == 0 ||
-           _wcsicmp(szClassName, L"Shell_SecondaryTrayWnd") == 0;
+    return szClassName;
+}
+
+bool IsTaskbarWindow(HWND hWnd) {
+    WindowClass windowClass = GetWindowClass(hWnd);
+    return windowClass == WindowClass::primaryTaskbar ||
+           windowClass == WindowClass::secondaryTaskbar;
 }
 
 HWND FindCurrentProcessTaskbarWnd() {
@@ -627,11 +806,9 @@ HWND FindCurrentProcessTaskbarWnd() {
     EnumWindows(
         [](HWND hWnd, LPARAM lParam) -> BOOL {
             DWORD dwProcessId;
-            WCHAR className[32];
             if (GetWindowThreadProcessId(hWnd, &dwProcessId) &&
                 dwProcessId == GetCurrentProcessId() &&
-                GetClassName(hWnd, className, ARRAYSIZE(className)) &&
-                _wcsicmp(className, L"Shell_TrayWnd") == 0) {
+                GetWindowClass(hWnd) == WindowClass::primaryTaskbar) {
                 *reinterpret_cast<HWND*>(lParam) = hWnd;
                 return FALSE;
             }
@@ -2702,12 +2879,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                                      uFlags);
     };
 
-    WCHAR szClassName[64];
-    if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-        return original();
-    }
-
-    if (_wcsicmp(szClassName, L"TaskListThumbnailWnd") == 0) {
+    WindowClass windowClass = GetWindowClass(hWnd);
+    if (windowClass == WindowClass::taskListThumbnail) {
         if (uFlags & (SWP_NOSIZE | SWP_NOMOVE)) {
             return original();
         }
@@ -2773,8 +2946,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         Y = rc.top;
         cx = rc.right - rc.left;
         cy = rc.bottom - rc.top;
-    } else if (_wcsicmp(szClassName, L"TopLevelWindowForOverflowXamlIsland") ==
-               0) {
+    } else if (windowClass == WindowClass::overflowXamlIsland) {
         if (uFlags & (SWP_NOMOVE | SWP_NOSIZE)) {
             return original();
         }
@@ -2817,7 +2989,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         } else if (Y > monitorInfo.rcWork.bottom - cy) {
             Y = monitorInfo.rcWork.bottom - cy;
         }
-    } else if (_wcsicmp(szClassName, L"Windows.UI.Core.CoreWindow") == 0) {
+    } else if (windowClass == WindowClass::coreWindow) {
         if (uFlags & SWP_NOMOVE) {
             return original();
         }
@@ -2877,11 +3049,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                 GetWindowThreadProcessId(windowFromPoint, nullptr) ==
                     GetWindowThreadProcessId(FindCurrentProcessTaskbarWnd(),
                                              nullptr)) {
-                WCHAR szClassNameFromPoint[64];
-                if (GetClassName(windowFromPoint, szClassNameFromPoint,
-                                 ARRAYSIZE(szClassNameFromPoint)) &&
-                    _wcsicmp(szClassNameFromPoint,
-                             L"XamlExplorerHostIslandWindow") == 0) {
+                if (GetWindowClass(windowFromPoint) ==
+                    WindowClass::xamlExplorerHostIsland) {
                     UINT monitorDpiX = 96;
                     UINT monitorDpiY = 96;
                     GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
@@ -2922,7 +3091,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         } else {
             return original();
         }
-    } else if (_wcsicmp(szClassName, L"Xaml_WindowedPopupClass") == 0) {
+    } else if (windowClass == WindowClass::xamlWindowedPopup) {
         if (uFlags & (SWP_NOMOVE | SWP_NOSIZE)) {
             return original();
         }
@@ -2988,7 +3157,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         } else if (Y > monitorInfo.rcWork.bottom - cy) {
             Y = monitorInfo.rcWork.bottom - cy;
         }
-    } else if (_wcsicmp(szClassName, L"XamlExplorerHostIslandWindow") == 0 &&
+    } else if (windowClass == WindowClass::xamlExplorerHostIsland &&
                g_inHoverFlyoutController_UpdateFlyoutWindowPosition) {
         if (uFlags & (SWP_NOMOVE | SWP_NOSIZE)) {
             return original();
@@ -3015,11 +3184,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         if (windowFromPoint &&
             GetWindowThreadProcessId(windowFromPoint, nullptr) ==
                 GetWindowThreadProcessId(hWnd, nullptr)) {
-            WCHAR szClassNameFromPoint[64];
-            if (GetClassName(windowFromPoint, szClassNameFromPoint,
-                             ARRAYSIZE(szClassNameFromPoint)) &&
-                _wcsicmp(szClassNameFromPoint,
-                         L"XamlExplorerHostIslandWindow") == 0) {
+            if (GetWindowClass(windowFromPoint) ==
+                WindowClass::xamlExplorerHostIsland) {
                 UINT monitorDpiX = 96;
                 UINT monitorDpiY = 96;
                 GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
@@ -3043,7 +3209,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                 }
             }
         }
-    } else if (_wcsicmp(szClassName, L"XamlExplorerHostIslandWindow") == 0 &&
+    } else if (windowClass == WindowClass::xamlExplorerHostIsland &&
                g_inOverflowFlyoutModel_Show) {
         // This flow is only called with XAML refresh. For code that took care
         // of it before XAML refresh, see the other code that checks for
@@ -3074,8 +3240,8 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
         return original();
     }
 
-    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d", szClassName, X, Y, X + cx,
-           Y + cy);
+    Wh_Log(L"Adjusting pos for %s: %dx%d, %dx%d",
+           GetWindowClassName(hWnd).c_str(), X, Y, X + cx, Y + cy);
 
     return SetWindowPos_Original(hWnd, hWndInsertAfter, X, Y, cx, cy, uFlags);
 }
@@ -3096,13 +3262,7 @@ BOOL WINAPI MoveWindow_Hook(HWND hWnd,
         return original();
     }
 
-    WCHAR szClassName[64];
-    if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-        return original();
-    }
-
-    if (_wcsicmp(szClassName,
-                 L"Windows.UI.Composition.DesktopWindowContentBridge") != 0) {
+    if (GetWindowClass(hWnd) != WindowClass::desktopWindowContentBridge) {
         return original();
     }
 
@@ -3410,17 +3570,13 @@ bool IsTargetCoreWindow(HWND hWnd, int* extraXAdjustment) {
         return false;
     }
 
-    WCHAR szClassName[32];
-    if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-        return false;
-    }
-
+    WindowClass windowClass = GetWindowClass(hWnd);
     if (g_target == Target::ShellHost) {
-        if (_wcsicmp(szClassName, L"ControlCenterWindow") != 0) {
+        if (windowClass != WindowClass::controlCenter) {
             return false;
         }
     } else {
-        if (_wcsicmp(szClassName, L"Windows.UI.Core.CoreWindow") != 0) {
+        if (windowClass != WindowClass::coreWindow) {
             return false;
         }
     }
@@ -4058,6 +4214,8 @@ BOOL Wh_ModInit() {
         }
     }
 
+    StartWindowClassCache();
+
     return TRUE;
 }
 
@@ -4153,6 +4311,8 @@ void Wh_ModUninit() {
     while (g_hookCallCounter > 0) {
         Sleep(100);
     }
+
+    StopWindowClassCache();
 }
 
 void Wh_ModSettingsChanged() {
@@ -2,7 +2,7 @@
 // @id              taskbar-wheel-cycle
 // @name            Cycle taskbar buttons with mouse wheel
 // @description     Use the mouse wheel and/or keyboard shortcuts to cycle between taskbar buttons
-// @version         1.1.9
+// @version         1.2.0
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -229,28 +229,32 @@ BOOL IsMinimizedTaskItem(LONG_PTR* task_item) {
     return IsIconic(GetTaskItemWnd(task_item));
 }
 
-BOOL TaskbarScrollRight(int button_groups_count,
-                        LONG_PTR** button_groups,
+// The scroll logic below only depends on the layout of the taskbar buttons,
+// which is provided by a type with the following members, so that it can be
+// exercised with a synthetic layout:
+//
+// int GetGroupCount() const;
+// bool IsButtonGroup(int group) const;
+// int GetButtonCount(int group) const;
+// bool IsMinimized(int group, int button) const;
+
+template <typename Layout>
+BOOL TaskbarScrollRight(const Layout& layout,
                         int* p_button_group_index,
                         int* p_button_index) {
     int button_group_index = *p_button_group_index;
     int button_index = *p_button_index;
-    int button_group_type;
 
-    int buttons_count =
-        button_group_index == -1
-            ? 0
-            : CTaskBtnGroup_GetNumItems(button_groups[button_group_index]);
+    int buttons_count = button_group_index == -1
+                            ? 0
+                            : layout.GetButtonCount(button_group_index);
     if (++button_index >= buttons_count) {
         do {
             button_group_index++;
-            if (button_group_index >= button_groups_count) {
+            if (button_group_index >= layout.GetGroupCount()) {
                 return FALSE;
             }
-
-            button_group_type =
-                CTaskBtnGroup_GetGroupType(button_groups[button_group_index]);
-        } while (button_group_type != 1 && button_group_type != 3);
+        } while (!layout.IsButtonGroup(button_group_index));
 
         button_index = 0;
     }
@@ -261,17 +265,16 @@ BOOL TaskbarScrollRight(int button_groups_count,
     return TRUE;
 }
 
-BOOL TaskbarScrollLeft(int button_groups_count,
-                       LONG_PTR** button_groups,
+template <typename Layout>
+BOOL TaskbarScrollLeft(const Layout& layout,
                        int* p_button_group_index,
                        int* p_button_index) {
     int button_group_index = *p_button_group_index;
     int button_index = *p_button_index;
-    int button_group_type;
 
     if (button_group_index == -1 || --button_index < 0) {
         if (button_group_index == -1) {
-            button_group_index = button_groups_count;
+            button_group_index = layout.GetGroupCount();
         }
 
         do {
@@ -279,14 +282,9 @@ BOOL TaskbarScrollLeft(int button_groups_count,
             if (button_group_index < 0) {
                 return FALSE;
             }
+        } while (!layout.IsButtonGroup(button_group_index));
 
-            button_group_type =
-                CTaskBtnGroup_GetGroupType(button_groups[button_group_index]);
-        } while (button_group_type != 1 && button_group_type != 3);
-
-        int buttons_count =
-            CTaskBtnGroup_GetNumItems(button_groups[button_group_index]);
-        button_index = buttons_count - 1;
+        button_index = layout.GetButtonCount(button_group_index) - 1;
     }
 
     *p_button_group_index = button_group_index;
@@ -295,13 +293,15 @@ BOOL TaskbarScrollLeft(int button_groups_count,
     return TRUE;
 }
 
-LONG_PTR* TaskbarScrollHelper(int button_groups_count,
-                              LONG_PTR** button_groups,
-                              int button_group_index_active,
-                              int button_index_active,
-                              int nRotates,
-                              BOOL bSkipMinimized,
-                              BOOL bWarpAround) {
+template <typename Layout>
+BOOL TaskbarScrollHelper(const Layout& layout,
+                         int button_group_index_active,
+                         int button_index_active,
+                         int nRotates,
+                         BOOL bSkipMinimized,
+                         BOOL bWarpAround,
+                         int* p_button_group_index,
+                         int* p_button_index) {
     int button_group_index, button_index;
     BOOL bRotateRight;
     int prev_button_group_index, prev_button_index;
@@ -319,35 +319,25 @@ LONG_PTR* TaskbarScrollHelper(int button_groups_count,
     prev_button_group_index = button_group_index;
     prev_button_index = button_index;
 
+    auto scroll = [&layout, bRotateRight](int* p_button_group_index,
+                                          int* p_button_index) {
+        return bRotateRight ? TaskbarScrollRight(layout, p_button_group_index,
+                                                 p_button_index)
+                            : TaskbarScrollLeft(layout, p_button_group_index,
+                                                p_button_index);
+    };
+
     while (nRotates--) {
-        if (bRotateRight) {
-            bScrollSucceeded =
-                TaskbarScrollRight(button_groups_count, button_groups,
-                                   &button_group_index, &button_index);
-            while (bScrollSucceeded && bSkipMinimized &&
-                   IsMinimizedTaskItem((LONG_PTR*)CTaskBtnGroup_GetTaskItem(
-                       button_groups[button_group_index], button_index))) {
-                bScrollSucceeded =
-                    TaskbarScrollRight(button_groups_count, button_groups,
-                                       &button_group_index, &button_index);
-            }
-        } else {
-            bScrollSucceeded =
-                TaskbarScrollLeft(button_groups_count, button_groups,
-                                  &button_group_index, &button_index);
-            while (bScrollSucceeded && bSkipMinimized &&
-                   IsMinimizedTaskItem((LONG_PTR*)CTaskBtnGroup_GetTaskItem(
-                       button_groups[button_group_index], button_index))) {
-                bScrollSucceeded =
-                    TaskbarScrollLeft(button_groups_count, button_groups,
-                                      &button_group_index, &button_index);
-            }
+        bScrollSucceeded = scroll(&button_group_index, &button_index);
+        while (bScrollSucceeded && bSkipMinimized &&
+               layout.IsMinimized(button_group_index, button_index)) {
+            bScrollSucceeded = scroll(&button_group_index, &button_index);
         }
 
         if (!bScrollSucceeded) {
             // If no results were found in the whole taskbar
             if (prev_button_group_index == -1) {
-                return nullptr;
+                return FALSE;
             }
 
             if (bWarpAround) {
@@ -370,11 +360,153 @@ LONG_PTR* TaskbarScrollHelper(int button_groups_count,
 
     if (button_group_index == button_group_index_active &&
         button_index == button_index_active) {
-        return nullptr;
+        return FALSE;
     }
 
-    return (LONG_PTR*)CTaskBtnGroup_GetTaskItem(
-        button_groups[button_group_index], button_index);
+    *p_button_group_index = button_group_index;
+    *p_button_index = button_index;
+
+    return TRUE;
+}
+
+struct TaskBtnGroupsLayout {
+    int button_groups_count;
+    LONG_PTR** button_groups;
+
+    int GetGroupCount() const { return button_groups_count; }
+
+    bool IsButtonGroup(int group) const {
+        int button_group_type =
+            CTaskBtnGroup_GetGroupType(button_groups[group]);
+        return button_group_type == 1 || button_group_type == 3;
+    }
+
+    int GetButtonCount(int group) const {
+        return CTaskBtnGroup_GetNumItems(button_groups[group]);
+    }
+
+    bool IsMinimized(int group, int button) const {
+        return IsMinimizedTaskItem((LONG_PTR*)CTaskBtnGroup_GetTaskItem(
+            button_groups[group], button));
+    }
+};
+
+// An index of the buttons of a task list, which allows to find the position of
+// the active button without scanning all of them on every wheel notch. It's
+// invalidated by the DPA hooks whenever an array is modified on the taskbar
+// thread, and each lookup is verified against the live array, so a stale index
+// is never trusted.
+struct TaskItemPosition {
+    int button_group_index;
+    int button_index;
+};
+
+struct TaskListIndex {
+    HDPA buttonGroupsArray;
+    DWORD generation;
+    std::unordered_map<LONG_PTR*, int> buttonGroups;
+    std::unordered_map<LONG_PTR*, TaskItemPosition> taskItems;
+};
+
+TaskListIndex g_taskListIndex;
+DWORD g_taskListIndexThreadId;
+DWORD g_taskListIndexGeneration = 1;
+
+void OnTaskbarArrayModified() {
+    if (GetCurrentThreadId() == g_taskListIndexThreadId) {
+        g_taskListIndexGeneration++;
+    }
+}
+
+void RebuildTaskListIndex(HDPA buttonGroupsArray,
+                          const TaskBtnGroupsLayout& layout) {
+    TaskListIndex& index = g_taskListIndex;
+
+    index.buttonGroups.clear();
+    index.taskItems.clear();
+
+    for (int i = 0; i < layout.button_groups_count; i++) {
+        LONG_PTR* button_group = layout.button_groups[i];
+        index.buttonGroups.try_emplace(button_group, i);
+
+        if (!layout.IsButtonGroup(i)) {
+            continue;
+        }
+
+        int buttons_count = layout.GetButtonCount(i);
+        for (int j = 0; j < buttons_count; j++) {
+            LONG_PTR* task_item =
+                (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, j);
+            index.taskItems.try_emplace(task_item, TaskItemPosition{i, j});
+        }
+    }
+
+    index.buttonGroupsArray = buttonGroupsArray;
+    index.generation = g_taskListIndexGeneration;
+    g_taskListIndexThreadId = GetCurrentThreadId();
+}
+
+const TaskListIndex& GetTaskListIndex(HDPA buttonGroupsArray,
+                                      const TaskBtnGroupsLayout& layout,
+                                      bool forceRebuild) {
+    if (forceRebuild ||
+        g_taskListIndex.buttonGroupsArray != buttonGroupsArray ||
+        g_taskListIndex.generation != g_taskListIndexGeneration ||
+        g_taskListIndexThreadId != GetCurrentThreadId()) {
+        RebuildTaskListIndex(buttonGroupsArray, layout);
+    }
+
+    return g_taskListIndex;
+}
+
+bool FindButtonGroupIndex(HDPA buttonGroupsArray,
+                          const TaskBtnGroupsLayout& layout,
+                          LONG_PTR* button_group,
+                          int* p_button_group_index) {
+    for (bool forceRebuild : {false, true}) {
+        const TaskListIndex& index =
+            GetTaskListIndex(buttonGroupsArray, layout, forceRebuild);
+
+        auto it = index.buttonGroups.find(button_group);
+        if (it == index.buttonGroups.end()) {
+            continue;
+        }
+
+        int i = it->second;
+        if (i < layout.button_groups_count &&
+            layout.button_groups[i] == button_group) {
+            *p_button_group_index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FindTaskItemPosition(HDPA buttonGroupsArray,
+                          const TaskBtnGroupsLayout& layout,
+                          LONG_PTR* task_item,
+                          TaskItemPosition* position) {
+    for (bool forceRebuild : {false, true}) {
+        const TaskListIndex& index =
+            GetTaskListIndex(buttonGroupsArray, layout, forceRebuild);
+
+        auto it = index.taskItems.find(task_item);
+        if (it == index.taskItems.end()) {
+            continue;
+        }
+
+        int i = it->second.button_group_index;
+        int j = it->second.button_index;
+        if (i < layout.button_groups_count && j < layout.GetButtonCount(i) &&
+            (LONG_PTR*)CTaskBtnGroup_GetTaskItem(layout.button_groups[i], j) ==
+                task_item) {
+            *position = it->second;
+            return true;
+        }
+    }
+
+    return false;
 }
 
 HDPA GetTaskBtnGroupsArray(void* taskList_ITaskListUI) {
@@ -419,41 +551,26 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
     void* taskList_ITaskListUI = QueryViaVtable(
         (void*)lpMMTaskListLongPtr, CTaskListWnd_vftable_ITaskListUI);
 
-    LONG_PTR* plp = (LONG_PTR*)GetTaskBtnGroupsArray(taskList_ITaskListUI);
+    HDPA buttonGroupsArray = GetTaskBtnGroupsArray(taskList_ITaskListUI);
+    LONG_PTR* plp = (LONG_PTR*)buttonGroupsArray;
     if (!plp) {
         return nullptr;
     }
 
-    int button_groups_count = (int)plp[0];
-    LONG_PTR** button_groups = (LONG_PTR**)plp[1];
+    TaskBtnGroupsLayout layout{
+        .button_groups_count = (int)plp[0],
+        .button_groups = (LONG_PTR**)plp[1],
+    };
 
     int button_group_index_active, button_index_active;
 
     if (src_task_item) {
-        int i;
-        for (i = 0; i < button_groups_count; i++) {
-            int button_group_type =
-                CTaskBtnGroup_GetGroupType(button_groups[i]);
-            if (button_group_type == 1 || button_group_type == 3) {
-                int buttons_count = CTaskBtnGroup_GetNumItems(button_groups[i]);
-
-                int j;
-                for (j = 0; j < buttons_count; j++) {
-                    if ((LONG_PTR*)CTaskBtnGroup_GetTaskItem(
-                            button_groups[i], j) == src_task_item) {
-                        button_group_index_active = i;
-                        button_index_active = j;
-                        break;
-                    }
-                }
-
-                if (j < buttons_count) {
-                    break;
-                }
-            }
-        }
-
-        if (i == button_groups_count) {
+        TaskItemPosition position;
+        if (FindTaskItemPosition(buttonGroupsArray, layout, src_task_item,
+                                 &position)) {
+            button_group_index_active = position.button_group_index;
+            button_index_active = position.button_index;
+        } else {
             button_group_index_active = -1;
             button_index_active = -1;
         }
@@ -473,15 +590,9 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
                               : nullptr;
 
         if (button_group_active && button_index_active >= 0) {
-            int i;
-            for (i = 0; i < button_groups_count; i++) {
-                if (button_groups[i] == button_group_active) {
-                    button_group_index_active = i;
-                    break;
-                }
-            }
-
-            if (i == button_groups_count) {
+            if (!FindButtonGroupIndex(buttonGroupsArray, layout,
+                                      button_group_active,
+                                      &button_group_index_active)) {
                 return nullptr;
             }
         } else {
@@ -490,13 +601,69 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
         }
     }
 
-    return TaskbarScrollHelper(button_groups_count, button_groups,
-                               button_group_index_active, button_index_active,
-                               nRotates, bSkipMinimized, bWarpAround);
+    int button_group_index, button_index;
+    if (!TaskbarScrollHelper(layout, button_group_index_active,
+                             button_index_active, nRotates, bSkipMinimized,
+                             bWarpAround, &button_group_index,
+                             &button_index)) {
+        return nullptr;
+    }
+
+    return (LONG_PTR*)CTaskBtnGroup_GetTaskItem(
+        layout.button_groups[button_group_index], button_index);
 }
 
 #pragma endregion  // scroll
 
+// Wheel notches are accumulated while the wheel keeps spinning, and only the
+// final target is activated once no notch arrived for about a frame. This
+// avoids activating windows which are left right away, which is common with
+// free-spinning wheels and precision touchpads.
+constexpr UINT_PTR kPendingScrollTimerId = 1682530410;
+constexpr UINT kPendingScrollDelay = 16;
+
+HWND g_pendingScrollTaskList;
+int g_pendingScrollClicks;
+
+void ApplyPendingScroll() {
+    HWND hMMTaskListWnd = g_pendingScrollTaskList;
+    int clicks = g_pendingScrollClicks;
+
+    g_pendingScrollTaskList = nullptr;
+    g_pendingScrollClicks = 0;
+
+    if (!hMMTaskListWnd || clicks == 0 || !IsWindow(hMMTaskListWnd)) {
+        return;
+    }
+
+    Wh_Log(L"Applying %d clicks", clicks);
+
+    LONG_PTR lpMMTaskListLongPtr = GetWindowLongPtr(hMMTaskListWnd, 0);
+    PVOID targetTaskItem =
+        TaskbarScroll(lpMMTaskListLongPtr, clicks,
+                      g_settings.skipMinimizedWindows, g_settings.wrapAround,
+                      nullptr);
+    if (targetTaskItem) {
+        SwitchToTaskItem(lpMMTaskListLongPtr, targetTaskItem);
+    }
+}
+
+void CALLBACK PendingScrollTimerProc(HWND hWnd,
+                                     UINT uMsg,
+                                     UINT_PTR idEvent,
+                                     DWORD dwTime) {
+    KillTimer(hWnd, idEvent);
+    ApplyPendingScroll();
+}
+
+void CancelPendingScroll() {
+    if (g_pendingScrollTaskList) {
+        KillTimer(g_pendingScrollTaskList, kPendingScrollTimerId);
+        g_pendingScrollTaskList = nullptr;
+        g_pendingScrollClicks = 0;
+    }
+}
+
 void OnTaskListScroll(HWND hMMTaskListWnd, short delta) {
     if (g_lastScrollTarget == hMMTaskListWnd &&
         GetTickCount() - g_lastScrollTime < 1000 * 5) {
@@ -511,12 +678,19 @@ void OnTaskListScroll(HWND hMMTaskListWnd, short delta) {
             clicks = -clicks;
         }
 
-        LONG_PTR lpMMTaskListLongPtr = GetWindowLongPtr(hMMTaskListWnd, 0);
-        PVOID targetTaskItem = TaskbarScroll(lpMMTaskListLongPtr, clicks,
-                                             g_settings.skipMinimizedWindows,
-                                             g_settings.wrapAround, nullptr);
-        if (targetTaskItem) {
-            SwitchToTaskItem(lpMMTaskListLongPtr, targetTaskItem);
+        if (g_pendingScrollTaskList &&
+            g_pendingScrollTaskList != hMMTaskListWnd) {
+            KillTimer(g_pendingScrollTaskList, kPendingScrollTimerId);
+            ApplyPendingScroll();
+        }
+
+        g_pendingScrollTaskList = hMMTaskListWnd;
+        g_pendingScrollClicks += clicks;
+
+        // Setting the timer again restarts it.
+        if (!SetTimer(hMMTaskListWnd, kPendingScrollTimerId,
+                      kPendingScrollDelay, PendingScrollTimerProc)) {
+            ApplyPendingScroll();
         }
     }
 
@@ -971,6 +1145,7 @@ enum {
     HOTKEY_REGISTER,
     HOTKEY_UNREGISTER,
     HOTKEY_UPDATE,
+    PENDING_SCROLL_CANCEL,
 };
 
 using CTaskBand_v_WndProc_t = LRESULT(
@@ -1028,6 +1203,10 @@ LRESULT WINAPI CTaskBand_v_WndProc_Hook(void* pThis,
                         UnregisterHotkeys(hWnd);
                         RegisterHotkeys(hWnd);
                         break;
+
+                    case PENDING_SCROLL_CANCEL:
+                        CancelPendingScroll();
+                        break;
                 }
             } else {
                 result = originalProc(hWnd, Msg, wParam, lParam);
@@ -1525,6 +1704,30 @@ void HandleLoadedModuleIfExplorerPatcher(HMODULE module) {
     }
 }
 
+using DPA_InsertPtr_t = decltype(&DPA_InsertPtr);
+DPA_InsertPtr_t DPA_InsertPtr_Original;
+int WINAPI DPA_InsertPtr_Hook(HDPA hdpa, int i, void* p) {
+    int ret = DPA_InsertPtr_Original(hdpa, i, p);
+    OnTaskbarArrayModified();
+    return ret;
+}
+
+using DPA_DeletePtr_t = decltype(&DPA_DeletePtr);
+DPA_DeletePtr_t DPA_DeletePtr_Original;
+void* WINAPI DPA_DeletePtr_Hook(HDPA hdpa, int i) {
+    void* ret = DPA_DeletePtr_Original(hdpa, i);
+    OnTaskbarArrayModified();
+    return ret;
+}
+
+using DPA_DeleteAllPtrs_t = decltype(&DPA_DeleteAllPtrs);
+DPA_DeleteAllPtrs_t DPA_DeleteAllPtrs_Original;
+BOOL WINAPI DPA_DeleteAllPtrs_Hook(HDPA hdpa) {
+    BOOL ret = DPA_DeleteAllPtrs_Original(hdpa);
+    OnTaskbarArrayModified();
+    return ret;
+}
+
 using LoadLibraryExW_t = decltype(&LoadLibraryExW);
 LoadLibraryExW_t LoadLibraryExW_Original;
 HMODULE WINAPI LoadLibraryExW_Hook(LPCWSTR lpLibFileName,
@@ -1584,6 +1787,14 @@ BOOL Wh_ModInit() {
         return FALSE;
     }
 
+    WindhawkUtils::Wh_SetFunctionHookT(DPA_InsertPtr, DPA_InsertPtr_Hook,
+                                       &DPA_InsertPtr_Original);
+    WindhawkUtils::Wh_SetFunctionHookT(DPA_DeletePtr, DPA_DeletePtr_Hook,
+                                       &DPA_DeletePtr_Original);
+    WindhawkUtils::Wh_SetFunctionHookT(DPA_DeleteAllPtrs,
+                                       DPA_DeleteAllPtrs_Hook,
+                                       &DPA_DeleteAllPtrs_Original);
+
     HMODULE kernelBaseModule = GetModuleHandle(L"kernelbase.dll");
     auto pKernelBaseLoadLibraryExW = (decltype(&LoadLibraryExW))GetProcAddress(
         kernelBaseModule, "LoadLibraryExW");
@@ -1627,6 +1838,8 @@ void Wh_ModBeforeUninit() {
 
     if (HWND hTaskBandWnd = GetTaskBandWnd()) {
         SendMessage(hTaskBandWnd, g_hotkeyRegisteredMsg, HOTKEY_UNREGISTER, 0);
+        SendMessage(hTaskBandWnd, g_hotkeyRegisteredMsg, PENDING_SCROLL_CANCEL,
+                    0);
     }
 }
 
@@ -2,7 +2,7 @@
 // @id              uifile-override
 // @name            UIFILE Override
 // @description     Override UIFILE resources
-// @version         1.0.3
+// @version         1.0.4
 // @author          xalejandro
 // @github          https://github.com/tetawaves
 // @include         *
@@ -28,6 +28,12 @@ This will override the original UIFILE resource from shell32 to the one in shell
 #include <windhawk_api.h>
 #include <windhawk_utils.h>
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #ifdef _WIN64
 #   define THISCALL  __cdecl
 #   define STHISCALL L"__cdecl"
@@ -39,9 +45,161 @@ This will override the original UIFILE resource from shell32 to the one in shell
 WCHAR g_szCurrentThemePath[MAX_PATH + 4];
 HMODULE g_hShellStyle = nullptr;
 
+// The shellstyle module is resolved once and re-resolved after the theme
+// changes, which is detected by a hidden window on a dedicated thread. Until
+// that window exists, the module is resolved on each call.
+std::mutex g_shellStyleMutex;
+bool g_shellStyleResolved = false;
+// Incremented when the theme or the shellstyle module changes. Written with
+// both g_shellStyleMutex and g_uiFileCacheMutex held, so that it can be read
+// with either one.
+UINT g_shellStyleGeneration = 0;
+
+std::mutex g_themeWatcherMutex;
+HANDLE g_hThemeWatcherThread = nullptr;
+HWND g_hThemeWatcherWnd = nullptr;
+std::atomic<bool> g_themeWatcherRunning;
+
+// Decoded markup, keyed by the module and the resource id it was requested
+// from. Cleared when the theme changes, since overrides depend on it.
+struct UIFileCacheKey
+{
+    HINSTANCE hInstance;
+    UINT uResId;
+
+    bool operator==(const UIFileCacheKey&) const = default;
+};
+
+struct UIFileCacheKeyHash
+{
+    size_t operator()(const UIFileCacheKey& key) const noexcept
+    {
+        return std::hash<void*>{}(key.hInstance) ^ (std::hash<UINT>{}(key.uResId) << 1);
+    }
+};
+
+// Only holds markup decoded with the shellstyle of g_shellStyleGeneration.
+std::mutex g_uiFileCacheMutex;
+std::unordered_map<UIFileCacheKey, std::vector<WCHAR>, UIFileCacheKeyHash> g_uiFileCache;
+
+// Override resource type names, e.g. SHELL32_UIFILE, per module.
+std::mutex g_overrideTypeNamesMutex;
+std::unordered_map<HMODULE, std::wstring> g_overrideTypeNames;
+
 HRESULT (THISCALL *_AllocArray)(void *, UINT, int, LPWSTR *);
 
-HMODULE getShellStyleModule()
+LRESULT CALLBACK ThemeWatcherWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    switch (uMsg)
+    {
+        case WM_THEMECHANGED:
+        {
+            Wh_Log(L"Theme changed");
+
+            std::lock_guard<std::mutex> shellStyleGuard(g_shellStyleMutex);
+            g_shellStyleResolved = false;
+
+            std::lock_guard<std::mutex> cacheGuard(g_uiFileCacheMutex);
+            g_uiFileCache.clear();
+            g_shellStyleGeneration++;
+            break;
+        }
+
+        case WM_CLOSE:
+            DestroyWindow(hWnd);
+            return 0;
+
+        case WM_DESTROY:
+            PostQuitMessage(0);
+            return 0;
+    }
+
+    return DefWindowProcW(hWnd, uMsg, wParam, lParam);
+}
+
+DWORD WINAPI ThemeWatcherThread(LPVOID lpParameter)
+{
+    HANDLE hReadyEvent = (HANDLE)lpParameter;
+
+    WNDCLASSW wc = {};
+    wc.lpfnWndProc = ThemeWatcherWndProc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = L"Windhawk_UIFileOverride_ThemeWatcher";
+    RegisterClassW(&wc);
+
+    // Not a message-only window, those don't receive WM_THEMECHANGED.
+    g_hThemeWatcherWnd = CreateWindowExW(0, wc.lpszClassName, nullptr, WS_POPUP,
+                                         0, 0, 0, 0, nullptr, nullptr, wc.hInstance, nullptr);
+    SetEvent(hReadyEvent);
+
+    if (!g_hThemeWatcherWnd)
+    {
+        Wh_Log(L"Failed to create the theme watcher window");
+        UnregisterClassW(wc.lpszClassName, wc.hInstance);
+        return 0;
+    }
+
+    MSG msg;
+    while (GetMessageW(&msg, nullptr, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+
+    g_hThemeWatcherWnd = nullptr;
+    UnregisterClassW(wc.lpszClassName, wc.hInstance);
+    return 0;
+}
+
+// Must not be called with g_shellStyleMutex held, the watcher window takes it.
+void startThemeWatcher()
+{
+    std::lock_guard<std::mutex> guard(g_themeWatcherMutex);
+
+    if (g_hThemeWatcherThread)
+    {
+        return;
+    }
+
+    HANDLE hReadyEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!hReadyEvent)
+    {
+        return;
+    }
+
+    g_hThemeWatcherThread = CreateThread(nullptr, 0, ThemeWatcherThread, hReadyEvent, 0, nullptr);
+    if (g_hThemeWatcherThread)
+    {
+        WaitForSingleObject(hReadyEvent, INFINITE);
+        g_themeWatcherRunning = g_hThemeWatcherWnd != nullptr;
+    }
+
+    CloseHandle(hReadyEvent);
+}
+
+void stopThemeWatcher()
+{
+    std::lock_guard<std::mutex> guard(g_themeWatcherMutex);
+
+    if (!g_hThemeWatcherThread)
+    {
+        return;
+    }
+
+    g_themeWatcherRunning = false;
+
+    if (g_hThemeWatcherWnd)
+    {
+        PostMessageW(g_hThemeWatcherWnd, WM_CLOSE, 0, 0);
+    }
+
+    WaitForSingleObject(g_hThemeWatcherThread, INFINITE);
+    CloseHandle(g_hThemeWatcherThread);
+    g_hThemeWatcherThread = nullptr;
+}
+
+// Must be called with g_shellStyleMutex held.
+void resolveShellStyleModule()
 {
     WCHAR szThemeFileName[MAX_PATH + 4];
     WCHAR szColorBuff[MAX_PATH];
@@ -57,12 +215,52 @@ HMODULE getShellStyleModule()
         if (lstrcmpiW(g_szCurrentThemePath, szThemeFileName)) 
         {
             lstrcpyW(g_szCurrentThemePath, szThemeFileName);
-            g_hShellStyle = LoadLibraryExW(szThemeFileName, nullptr, LOAD_LIBRARY_AS_DATAFILE);
-            Wh_Log(L"shellstyle changed to %s = %p", szThemeFileName, g_hShellStyle);
+            HMODULE hShellStyle = LoadLibraryExW(szThemeFileName, nullptr, LOAD_LIBRARY_AS_DATAFILE);
+            Wh_Log(L"shellstyle changed to %s = %p", szThemeFileName, hShellStyle);
+
+            if (hShellStyle != g_hShellStyle)
+            {
+                // Without a watcher, this is how a theme change is noticed.
+                std::lock_guard<std::mutex> guard(g_uiFileCacheMutex);
+                g_hShellStyle = hShellStyle;
+                g_uiFileCache.clear();
+                g_shellStyleGeneration++;
+            }
         }
     }
+}
+
+// Returns the shellstyle module, and optionally the generation it belongs to.
+HMODULE getShellStyleModule(UINT* pGeneration = nullptr)
+{
+    HMODULE hShellStyle;
+
+    {
+        std::lock_guard<std::mutex> guard(g_shellStyleMutex);
+
+        if (!g_shellStyleResolved)
+        {
+            resolveShellStyleModule();
+            // Keep resolving on each call until the watcher runs, otherwise
+            // a theme change would go unnoticed.
+            g_shellStyleResolved = g_themeWatcherRunning;
+        }
+
+        hShellStyle = g_hShellStyle;
+        if (pGeneration)
+        {
+            *pGeneration = g_shellStyleGeneration;
+        }
+    }
+
+    // Only processes which actually use a shellstyle need to watch for theme
+    // changes.
+    if (hShellStyle && !g_themeWatcherRunning)
+    {
+        startThemeWatcher();
+    }
 
-    return g_hShellStyle;
+    return hShellStyle;
 }
 
 HRESULT (THISCALL *DUILoadUIFileFromResources_orig)(HINSTANCE, UINT, LPWSTR *);
@@ -73,7 +271,27 @@ HRESULT THISCALL DUILoadUIFileFromResources_hook(HINSTANCE hInstance, UINT uResI
     LPVOID lpData = nullptr;
     HRESULT hr = S_OK;
 
-    HMODULE hShellStyle = getShellStyleModule();
+    UINT generation;
+    HMODULE hShellStyle = getShellStyleModule(&generation);
+
+    const UIFileCacheKey cacheKey{hInstance, uResId};
+    {
+        std::lock_guard<std::mutex> guard(g_uiFileCacheMutex);
+        // Skip the cache if the theme changed since the module was resolved.
+        if (generation == g_shellStyleGeneration)
+        {
+            if (auto it = g_uiFileCache.find(cacheKey); it != g_uiFileCache.end())
+            {
+                const std::vector<WCHAR>& markup = it->second;
+                hr = _AllocArray(nullptr, 64, (int)markup.size(), ppszOut);
+                if (SUCCEEDED(hr))
+                {
+                    memcpy(*ppszOut, markup.data(), markup.size() * sizeof(WCHAR));
+                }
+                return hr;
+            }
+        }
+    }
 
     if (HRSRC hResInfoOverride = FindResourceW(hShellStyle, MAKEINTRESOURCEW(uResId), L"SHELL32_UIFILE"); hResInfoOverride)
     {
@@ -93,6 +311,12 @@ HRESULT THISCALL DUILoadUIFileFromResources_hook(HINSTANCE hInstance, UINT uResI
         if (SUCCEEDED(hr))
         {
             SHAnsiToUnicode((const CHAR *)lpData, *ppszOut, cwchBuf);
+
+            std::lock_guard<std::mutex> guard(g_uiFileCacheMutex);
+            if (generation == g_shellStyleGeneration)
+            {
+                g_uiFileCache.try_emplace(cacheKey, *ppszOut, *ppszOut + cwchBuf);
+            }
         }
     } 
     else 
@@ -107,26 +331,45 @@ HRESULT THISCALL DUILoadUIFileFromResources_hook(HINSTANCE hInstance, UINT uResI
     return hr;
 }
 
-HRESULT (__thiscall *SetXMLFromResource_orig)(void* pThis, PCWSTR lpName, PCWSTR lpType, HMODULE hModule, HINSTANCE param4, HINSTANCE param5);
-HRESULT __thiscall SetXMLFromResource_hook(void* pThis, PCWSTR lpName, PCWSTR lpType, HMODULE hModule, HINSTANCE param4, HINSTANCE param5) 
+// Returns the override resource type name for a module, e.g. SHELL32_UIFILE
+// for shell32.dll.
+std::wstring getOverrideTypeName(HMODULE hModule)
 {
+    std::lock_guard<std::mutex> guard(g_overrideTypeNamesMutex);
+
+    if (auto it = g_overrideTypeNames.find(hModule); it != g_overrideTypeNames.end())
+    {
+        return it->second;
+    }
+
+    std::wstring typeName;
+
     WCHAR szModuleName[MAX_PATH];
-    LPWSTR pszFilePath = nullptr;
-    HMODULE hShellStyle = getShellStyleModule();
+    if (GetModuleFileNameW(hModule, szModuleName, MAX_PATH))
+    {
+        LPWSTR pszFileName = PathFindFileNameW(szModuleName);
+        PathRemoveExtensionW(pszFileName);
+        CharUpperW(pszFileName);
+        typeName = pszFileName;
+        typeName += L"_UIFILE";
+    }
 
+    g_overrideTypeNames.try_emplace(hModule, typeName);
+    return typeName;
+}
+
+HRESULT (__thiscall *SetXMLFromResource_orig)(void* pThis, PCWSTR lpName, PCWSTR lpType, HMODULE hModule, HINSTANCE param4, HINSTANCE param5);
+HRESULT __thiscall SetXMLFromResource_hook(void* pThis, PCWSTR lpName, PCWSTR lpType, HMODULE hModule, HINSTANCE param4, HINSTANCE param5) 
+{
     if (!lstrcmpW(lpType, L"UIFILE"))
     {
-        GetModuleFileNameW(hModule, szModuleName, MAX_PATH);
-        pszFilePath = PathFindFileNameW(szModuleName);
-        if (pszFilePath)
+        HMODULE hShellStyle = getShellStyleModule();
+        std::wstring typeName = getOverrideTypeName(hModule);
+        if (!typeName.empty())
         {
-            PathRemoveExtensionW(pszFilePath);
-            CharUpperW(pszFilePath);
-            lstrcatW(pszFilePath, L"_");
-            StrNCatW(pszFilePath, lpType, MAX_PATH);
-            if (HRESULT hr = SetXMLFromResource_orig(pThis, lpName, pszFilePath, hShellStyle, param4, param5); SUCCEEDED(hr))
+            if (HRESULT hr = SetXMLFromResource_orig(pThis, lpName, typeName.c_str(), hShellStyle, param4, param5); SUCCEEDED(hr))
             {
-                Wh_Log(L"found %d from %s", lpName, pszFilePath);
+                Wh_Log(L"found %d from %s", lpName, typeName.c_str());
                 // Fix for strings
                 *((HMODULE*)pThis + 3) = hModule;
                 return hr;
@@ -220,6 +463,8 @@ BOOL Wh_ModInit()
 
 void Wh_ModUninit(void) 
 {
+    stopThemeWatcher();
+
     if (g_hShellStyle) 
     {
         FreeLibrary(g_hShellStyle);
@@ -2,7 +2,7 @@
 // @id              uwp-clean
 // @name            Clean up UWP processes
 // @description     Automatically end UWP processes when no UWP apps are open.
-// @version         0.1
+// @version         0.2
 // @author          Alcatel
 // @github          https://github.com/arukateru
 // @include         ApplicationFrameHost.exe
@@ -24,64 +24,149 @@ The Universal Windows Platform (UWP), in the spirit of being unoptimized, keep a
 // ==/WindhawkModReadme==
 
 #include <Windows.h>
-#include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 #include <TlHelp32.h>
 
-bool IsProcessRunning(const std::wstring& processName) {
-    HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (hSnap == INVALID_HANDLE_VALUE) {
-        return false;
-    }
+// Processes which keep the current process alive while any of them is running.
+const std::wstring keepAliveProcesses[] = {
+    L"SystemSettings.exe",
+    L"SecHealthUI.exe",
+    L"WinStore.App.exe",
+};
+
+// If a running process can't be opened for waiting, fall back to polling.
+const DWORD fallbackPollIntervalMs = 15000;
+
+struct WatchedProcesses {
+    bool anyRunning = false;
+    bool allWaitable = true;
+    std::vector<HANDLE> handles;  // Signaled when the process exits.
+};
+
+// Where the watched processes come from. Kept separate from the waiting logic
+// so that the exit decision can be driven by a simulated process table.
+class ProcessSource {
+public:
+    virtual ~ProcessSource() = default;
+    virtual WatchedProcesses Snapshot() = 0;
+};
+
+class ToolhelpProcessSource : public ProcessSource {
+public:
+    WatchedProcesses Snapshot() override {
+        WatchedProcesses result;
+
+        HANDLE hSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        if (hSnap == INVALID_HANDLE_VALUE) {
+            // Can't tell, assume that something is running and poll again.
+            result.anyRunning = true;
+            result.allWaitable = false;
+            return result;
+        }
+
+        PROCESSENTRY32W pe32;
+        pe32.dwSize = sizeof(PROCESSENTRY32W);
+        if (Process32FirstW(hSnap, &pe32)) {
+            do {
+                if (!IsKeepAliveProcess(pe32.szExeFile)) {
+                    continue;
+                }
+
+                result.anyRunning = true;
+
+                HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, pe32.th32ProcessID);
+                if (hProcess && result.handles.size() < MAXIMUM_WAIT_OBJECTS - 1) {
+                    result.handles.push_back(hProcess);
+                }
+                else {
+                    if (hProcess) {
+                        CloseHandle(hProcess);
+                    }
+                    result.allWaitable = false;
+                }
+            } while (Process32NextW(hSnap, &pe32));
+        }
 
-    PROCESSENTRY32W pe32;
-    pe32.dwSize = sizeof(PROCESSENTRY32W);
-    if (!Process32FirstW(hSnap, &pe32)) {
         CloseHandle(hSnap);
+        return result;
+    }
+
+private:
+    static bool IsKeepAliveProcess(const WCHAR* exeFile) {
+        for (const auto& processName : keepAliveProcesses) {
+            if (exeFile == processName) {
+                return true;
+            }
+        }
+
         return false;
     }
+};
 
-    do {
-        if (pe32.szExeFile == processName) {
-            CloseHandle(hSnap);
+// Waits on the watched processes and re-enumerates only when one of them
+// exits. Returns true as soon as none of them is running, or false if
+// stopEvent was signaled.
+bool WaitForKeepAliveProcessesToExit(ProcessSource& processSource, HANDLE stopEvent) {
+    while (true) {
+        WatchedProcesses watched = processSource.Snapshot();
+        if (!watched.anyRunning) {
             return true;
         }
-    } while (Process32NextW(hSnap, &pe32));
 
-    CloseHandle(hSnap);
-    return false;
-}
+        std::vector<HANDLE> waitHandles;
+        waitHandles.push_back(stopEvent);
+        waitHandles.insert(waitHandles.end(), watched.handles.begin(), watched.handles.end());
 
-void CheckProcesses() {
-    while (true) {
-        bool systemSettingsRunning = IsProcessRunning(L"SystemSettings.exe");
-        bool wduiRunning = IsProcessRunning(L"SecHealthUI.exe");
-        bool storeRunning = IsProcessRunning(L"WinStore.App.exe");
+        DWORD timeout = watched.allWaitable ? INFINITE : fallbackPollIntervalMs;
+        DWORD waitResult = WaitForMultipleObjects((DWORD)waitHandles.size(),
+                                                  waitHandles.data(), FALSE, timeout);
 
+        for (HANDLE hProcess : watched.handles) {
+            CloseHandle(hProcess);
+        }
 
-        if (!systemSettingsRunning && !wduiRunning && !storeRunning) {
+        if (waitResult == WAIT_OBJECT_0) {
+            return false;
+        }
 
-            ExitProcess(0);
+        if (waitResult == WAIT_FAILED &&
+            WaitForSingleObject(stopEvent, fallbackPollIntervalMs) == WAIT_OBJECT_0) {
+            return false;
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(15));
+        // A watched process exited, or it's time to poll, check again. A
+        // process which started in the meantime is found by the new snapshot,
+        // so process start notifications aren't needed.
+    }
+}
+
+HANDLE g_stopEvent;
+std::thread g_checkProcessesThread;
+
+void CheckProcesses() {
+    ToolhelpProcessSource processSource;
+    if (WaitForKeepAliveProcessesToExit(processSource, g_stopEvent)) {
+        ExitProcess(0);
     }
 }
 
-BOOL APIENTRY DllMain(HMODULE hModule,
-    DWORD  ul_reason_for_call,
-    LPVOID lpReserved
-) {
-    switch (ul_reason_for_call)
-    {
-    case DLL_PROCESS_ATTACH:
-        std::thread(CheckProcesses).detach();
-        break;
-    case DLL_THREAD_ATTACH:
-    case DLL_THREAD_DETACH:
-    case DLL_PROCESS_DETACH:
-        break;
+BOOL Wh_ModInit() {
+    g_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!g_stopEvent) {
+        return FALSE;
     }
+
+    g_checkProcessesThread = std::thread(CheckProcesses);
     return TRUE;
 }
+
+void Wh_ModUninit() {
+    SetEvent(g_stopEvent);
+    if (g_checkProcessesThread.joinable()) {
+        g_checkProcessesThread.join();
+    }
+
+    CloseHandle(g_stopEvent);
+}
@@ -2,7 +2,7 @@
 // @id              virtual-desktop-taskbar-order
 // @name            Virtual Desktop Preserve Taskbar Order
 // @description     The order on the taskbar isn't preserved between virtual desktop switches, this mod fixes it
-// @version         1.0.4
+// @version         1.0.6
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -38,6 +38,7 @@ Taskbar Tweaker](https://tweaker.ramensoftware.com/).
 #include <regex>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <commctrl.h>
@@ -284,36 +285,159 @@ ULONG WINAPI TaskItemReleaseHook(LONG_PTR this_ptr) {
     return ulRet;
 }
 
-void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
-                           HDPA hButtonGroupsDpa,
-                           int nButtonGroupIndex) {
+#pragma region app_array_order
+
+// The app array is reordered in a single pass for all button groups inserted
+// during a virtual desktop switch. The code in this region only depends on the
+// standard library, so that it can be exercised on synthetic arrays.
+
+struct AppArrayEntryOrder {
+    // Index of the entry's button group on the taskbar, or -1 if the entry
+    // doesn't belong to a button group of interest.
+    int position;
+    // Whether the entry is one of the buttons of an inserted button group.
+    bool inserted;
+};
+
+struct AppArrayReorderScratch {
+    std::vector<size_t> insertedIndices;
+    std::vector<LONG_PTR> result;
+};
+
+// Moves each inserted entry right before the first non-inserted entry which
+// belongs to a button group to its right, or to the end if there's none.
+// Inserted entries are ordered by their button group position, and all other
+// entries keep their relative order. The scratch buffers are reused between
+// calls to avoid allocating on every pass.
+void ReorderAppArray(LONG_PTR* entries,
+                     const AppArrayEntryOrder* order,
+                     size_t count,
+                     AppArrayReorderScratch* scratch) {
+    std::vector<size_t>& insertedIndices = scratch->insertedIndices;
+    insertedIndices.clear();
+    for (size_t i = 0; i < count; i++) {
+        if (order[i].inserted) {
+            insertedIndices.push_back(i);
+        }
+    }
+
+    if (insertedIndices.empty()) {
+        return;
+    }
+
+    // The index is used as a tie breaker, which keeps the sort stable without
+    // the temporary buffer of std::stable_sort.
+    std::sort(insertedIndices.begin(), insertedIndices.end(),
+              [order](size_t a, size_t b) {
+                  if (order[a].position != order[b].position) {
+                      return order[a].position < order[b].position;
+                  }
+                  return a < b;
+              });
+
+    std::vector<LONG_PTR>& result = scratch->result;
+    result.clear();
+    result.reserve(count);
+
+    auto nextInserted = insertedIndices.begin();
+    for (size_t i = 0; i < count; i++) {
+        if (order[i].inserted) {
+            continue;
+        }
+
+        int position = order[i].position;
+        while (nextInserted != insertedIndices.end() &&
+               order[*nextInserted].position < position) {
+            result.push_back(entries[*nextInserted]);
+            ++nextInserted;
+        }
+
+        result.push_back(entries[i]);
+    }
+
+    for (; nextInserted != insertedIndices.end(); ++nextInserted) {
+        result.push_back(entries[*nextInserted]);
+    }
+
+    std::copy(result.begin(), result.end(), entries);
+}
+
+#pragma endregion  // app_array_order
+
+struct ButtonGroupOrder {
+    int position;
+    bool inserted;
+};
+
+LONG_PTR g_pendingTaskListLongPtr;
+std::vector<LONG_PTR*> g_pendingInsertedTaskGroups;
+UINT_PTR g_pendingInsertionsTimer;
+bool g_applyingPendingInsertions;
+
+std::unordered_map<LONG_PTR*, ButtonGroupOrder> g_buttonGroupOrder;
+std::unordered_map<LONG_PTR*, int> g_insertedTaskItemPositions;
+std::vector<AppArrayEntryOrder> g_appArrayOrder;
+AppArrayReorderScratch g_appArrayReorderScratch;
+
+void ApplyButtonGroupInsertions(LONG_PTR lpTaskSwLongPtr,
+                                HDPA hButtonGroupsDpa,
+                                const std::vector<LONG_PTR*>& taskGroups) {
     LONG_PTR* plp = (LONG_PTR*)hButtonGroupsDpa;
     int button_groups_count = (int)plp[0];
     LONG_PTR** button_groups = (LONG_PTR**)plp[1];
-    LONG_PTR* button_group = button_groups[nButtonGroupIndex];
 
-    int buttons_count = CTaskBtnGroup_GetNumItems(button_group);
-    if (buttons_count == 0) {
-        return;
+    g_buttonGroupOrder.clear();
+    g_insertedTaskItemPositions.clear();
+
+    for (int i = 0; i < button_groups_count; i++) {
+        LONG_PTR* task_group =
+            (LONG_PTR*)CTaskBtnGroup_GetGroup(button_groups[i]);
+        if (task_group) {
+            g_buttonGroupOrder.try_emplace(task_group,
+                                           ButtonGroupOrder{i, false});
+        }
     }
 
-    LONG_PTR* task_group = (LONG_PTR*)CTaskBtnGroup_GetGroup(button_group);
-    if (!task_group) {
-        return;
+    LONG_PTR* sample_task_group = nullptr;
+    LONG_PTR* sample_task_item = nullptr;
+
+    for (LONG_PTR* task_group : taskGroups) {
+        auto it = g_buttonGroupOrder.find(task_group);
+        if (it == g_buttonGroupOrder.end() || it->second.inserted) {
+            continue;
+        }
+
+        it->second.inserted = true;
+
+        int position = it->second.position;
+        LONG_PTR* button_group = button_groups[position];
+        int buttons_count = CTaskBtnGroup_GetNumItems(button_group);
+        for (int j = 0; j < buttons_count; j++) {
+            LONG_PTR* task_item =
+                (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, j);
+            if (!task_item) {
+                continue;
+            }
+
+            g_insertedTaskItemPositions.try_emplace(task_item, position);
+
+            if (!sample_task_item) {
+                sample_task_group = task_group;
+                sample_task_item = task_item;
+            }
+        }
     }
 
-    LONG_PTR* first_task_item =
-        (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, 0);
-    if (!first_task_item) {
+    if (!sample_task_item) {
         return;
     }
 
-    plp = *(LONG_PTR**)task_group;
+    plp = *(LONG_PTR**)sample_task_group;
     void** ppTaskGroupRelease = (void**)&plp[2];
     PointerRedirectionAdd(ppTaskGroupRelease, (void*)TaskGroupReleaseHook,
                           &prTaskGroupRelease);
 
-    plp = *(LONG_PTR**)first_task_item;
+    plp = *(LONG_PTR**)sample_task_item;
     void** ppTaskItemRelease = (void**)&plp[2];
     PointerRedirectionAdd(ppTaskItemRelease, (void*)TaskItemReleaseHook,
                           &prTaskItemRelease);
@@ -326,22 +450,18 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
     LONG_PTR* lpArray = *EV_APP_VIEW_MGR_APP_ARRAY(lpAppViewMgr);
     size_t nArraySize = *EV_APP_VIEW_MGR_APP_ARRAY_SIZE(lpAppViewMgr);
 
-    int nMatchCount = 0;
-    size_t nRightNeighbourItemIndex = nArraySize;
+    g_appArrayOrder.assign(nArraySize, AppArrayEntryOrder{-1, false});
+
+    // Stage one: find the task group and task item of each item in lpArray,
+    // and look up the position of its button group on the taskbar.
 
-    // Stage one: move all items in lpArray matching the items
-    // in the newly inserted group to the beginning of the array.
-    // Their amount is maintained in nMatchCount.
-    // Also, find nRightNeighbourItemIndex, which is the index of
-    // the item in lpArray which will be the first one before the
-    // found matching items.
+    bool bAborted = false;
 
     for (size_t i = 0; i < nArraySize; i++) {
         g_taskGroupVirtualDesktopReleased = NULL;
         g_taskItemVirtualDesktopReleased = NULL;
 
         LONG_PTR this_ptr = (LONG_PTR)(lpTaskSwLongPtr + 0x70);
-        plp = *(LONG_PTR**)this_ptr;
 
         ReleaseSRWLockExclusive(pArrayLock);
 
@@ -353,7 +473,7 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
         if (lpArray != *EV_APP_VIEW_MGR_APP_ARRAY(lpAppViewMgr) ||
             nArraySize != *EV_APP_VIEW_MGR_APP_ARRAY_SIZE(lpAppViewMgr)) {
             // Something went wrong, abort.
-            nMatchCount = 0;
+            bAborted = true;
             break;
         }
 
@@ -361,76 +481,78 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
             continue;
         }
 
-        if (g_taskGroupVirtualDesktopReleased != task_group) {
-            if (nRightNeighbourItemIndex == nArraySize) {
-                for (int j = nButtonGroupIndex + 1; j < button_groups_count;
-                     j++) {
-                    LONG_PTR* check_button_group = button_groups[j];
-                    LONG_PTR* check_task_group =
-                        (LONG_PTR*)CTaskBtnGroup_GetGroup(check_button_group);
-                    if (g_taskGroupVirtualDesktopReleased == check_task_group) {
-                        // The current item in lpArray is from the same group
-                        // of at least one of the items in button_groups to the
-                        // right of the newly added item.
-                        nRightNeighbourItemIndex = i - nMatchCount;
-                        break;
-                    }
-                }
-            }
-
+        auto groupIt =
+            g_buttonGroupOrder.find(g_taskGroupVirtualDesktopReleased);
+        if (groupIt == g_buttonGroupOrder.end()) {
             continue;
         }
 
-        if (!g_taskItemVirtualDesktopReleased) {
+        if (!groupIt->second.inserted) {
+            g_appArrayOrder[i].position = groupIt->second.position;
             continue;
         }
 
-        for (int j = 0; j < buttons_count; j++) {
-            LONG_PTR* task_item =
-                (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, j);
-
-            if (g_taskItemVirtualDesktopReleased == task_item) {
-                // The current item in lpArray matches one of the
-                // buttons in the newly added item.
-                if (i > (size_t)nMatchCount) {
-                    LONG_PTR lpTemp = lpArray[i];
-                    memmove(&lpArray[nMatchCount + 1], &lpArray[nMatchCount],
-                            (i - nMatchCount) * sizeof(LONG_PTR));
-                    lpArray[nMatchCount] = lpTemp;
-                }
-
-                nMatchCount++;
-                break;
-            }
+        // Items of an inserted group which don't match one of its buttons are
+        // left in place.
+        auto itemIt =
+            g_insertedTaskItemPositions.find(g_taskItemVirtualDesktopReleased);
+        if (itemIt != g_insertedTaskItemPositions.end()) {
+            g_appArrayOrder[i] = AppArrayEntryOrder{itemIt->second, true};
         }
     }
 
     PointerRedirectionRemove(ppTaskGroupRelease, &prTaskGroupRelease);
     PointerRedirectionRemove(ppTaskItemRelease, &prTaskItemRelease);
 
-    // Stage two: move the found items before the item in
-    // nRightNeighbourItemIndex.
+    // Stage two: move the matching items of all inserted groups in one pass.
 
-    if (nRightNeighbourItemIndex == nArraySize) {
-        // By default, move to the right end.
-        nRightNeighbourItemIndex = nArraySize - nMatchCount;
+    if (!bAborted) {
+        ReorderAppArray(lpArray, g_appArrayOrder.data(), nArraySize,
+                        &g_appArrayReorderScratch);
     }
 
-    if (nMatchCount > 0 && nRightNeighbourItemIndex > 0) {
-        LONG_PTR* lpBuffer = (LONG_PTR*)HeapAlloc(
-            GetProcessHeap(), 0, nMatchCount * sizeof(LONG_PTR));
-        if (lpBuffer) {
-            memcpy(lpBuffer, lpArray, nMatchCount * sizeof(LONG_PTR));
-            memmove(&lpArray[0], &lpArray[nMatchCount],
-                    nRightNeighbourItemIndex * sizeof(LONG_PTR));
-            memcpy(&lpArray[nRightNeighbourItemIndex], lpBuffer,
-                   nMatchCount * sizeof(LONG_PTR));
+    ReleaseSRWLockExclusive(pArrayLock);
+}
 
-            HeapFree(GetProcessHeap(), 0, lpBuffer);
-        }
+void ApplyPendingInsertions() {
+    LONG_PTR taskListLongPtr = g_pendingTaskListLongPtr;
+    g_pendingTaskListLongPtr = 0;
+
+    if (!taskListLongPtr || g_pendingInsertedTaskGroups.empty()) {
+        g_pendingInsertedTaskGroups.clear();
+        return;
     }
 
-    ReleaseSRWLockExclusive(pArrayLock);
+    HDPA hButtonGroupsDpa = *EV_MM_TASKLIST_BUTTON_GROUPS_HDPA(taskListLongPtr);
+    HWND hTaskSwWnd = (HWND)GetProp(g_hTaskbarWnd, L"TaskbandHWND");
+    LONG_PTR lpTaskSwLongPtr =
+        hTaskSwWnd ? GetWindowLongPtr(hTaskSwWnd, 0) : 0;
+
+    if (hButtonGroupsDpa && lpTaskSwLongPtr) {
+        Wh_Log(L"Applying %zu inserted groups",
+               g_pendingInsertedTaskGroups.size());
+
+        // Calling the original ViewVirtualDesktopChanged might insert groups
+        // by itself, these are already in their final place.
+        g_applyingPendingInsertions = true;
+        ApplyButtonGroupInsertions(lpTaskSwLongPtr, hButtonGroupsDpa,
+                                   g_pendingInsertedTaskGroups);
+        g_applyingPendingInsertions = false;
+    }
+
+    g_pendingInsertedTaskGroups.clear();
+}
+
+void CALLBACK PendingInsertionsTimerProc(HWND hwnd,
+                                         UINT uMsg,
+                                         UINT_PTR idEvent,
+                                         DWORD dwTime) {
+    KillTimer(nullptr, idEvent);
+    if (idEvent == g_pendingInsertionsTimer) {
+        g_pendingInsertionsTimer = 0;
+    }
+
+    ApplyPendingInsertions();
 }
 
 void ComFuncVirtualDesktopFixAfterDPA_InsertPtr(HDPA pdpa, int index, void* p) {
@@ -438,7 +560,7 @@ void ComFuncVirtualDesktopFixAfterDPA_InsertPtr(HDPA pdpa, int index, void* p) {
         return;
     }
 
-    if (!g_tryMoveGroup_taskListLongPtr) {
+    if (!g_tryMoveGroup_taskListLongPtr || g_applyingPendingInsertions) {
         return;
     }
 
@@ -448,17 +570,29 @@ void ComFuncVirtualDesktopFixAfterDPA_InsertPtr(HDPA pdpa, int index, void* p) {
         return;
     }
 
-    HWND hTaskSwWnd = (HWND)GetProp(g_hTaskbarWnd, L"TaskbandHWND");
-    if (!hTaskSwWnd) {
+    LONG_PTR* task_group = (LONG_PTR*)CTaskBtnGroup_GetGroup(p);
+    if (!task_group) {
         return;
     }
 
-    LONG_PTR lpTaskSwLongPtr = GetWindowLongPtr(hTaskSwWnd, 0);
-    if (!lpTaskSwLongPtr) {
-        return;
+    // A desktop switch re-inserts many groups in a row. Queue them and reorder
+    // the app array once, from a zero-delay timer which fires after the
+    // pending messages of the switch are handled.
+    if (g_pendingTaskListLongPtr != g_tryMoveGroup_taskListLongPtr) {
+        g_pendingInsertedTaskGroups.clear();
+        g_pendingTaskListLongPtr = g_tryMoveGroup_taskListLongPtr;
     }
 
-    OnButtonGroupInserted(lpTaskSwLongPtr, pdpa, index);
+    g_pendingInsertedTaskGroups.push_back(task_group);
+
+    if (!g_pendingInsertionsTimer) {
+        g_pendingInsertionsTimer =
+            SetTimer(nullptr, 0, 0, PendingInsertionsTimerProc);
+        if (!g_pendingInsertionsTimer) {
+            Wh_Log(L"SetTimer failed, applying immediately");
+            ApplyPendingInsertions();
+        }
+    }
 }
 
 bool InitializeTaskbarVariables(HWND hTaskbarWnd) {
@@ -484,6 +618,58 @@ bool InitializeTaskbarVariables(HWND hTaskbarWnd) {
     return true;
 }
 
+using RunFromWindowThreadProc_t = void(WINAPI*)(void* parameter);
+
+bool RunFromWindowThread(HWND hWnd,
+                         RunFromWindowThreadProc_t proc,
+                         void* procParam) {
+    static const UINT runFromWindowThreadRegisteredMsg =
+        RegisterWindowMessage(L"Windhawk_RunFromWindowThread_" WH_MOD_ID);
+
+    struct RUN_FROM_WINDOW_THREAD_PARAM {
+        RunFromWindowThreadProc_t proc;
+        void* procParam;
+    };
+
+    DWORD dwThreadId = GetWindowThreadProcessId(hWnd, nullptr);
+    if (dwThreadId == 0) {
+        return false;
+    }
+
+    if (dwThreadId == GetCurrentThreadId()) {
+        proc(procParam);
+        return true;
+    }
+
+    HHOOK hook = SetWindowsHookEx(
+        WH_CALLWNDPROC,
+        [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
+            if (nCode == HC_ACTION) {
+                const CWPSTRUCT* cwp = (const CWPSTRUCT*)lParam;
+                if (cwp->message == runFromWindowThreadRegisteredMsg) {
+                    RUN_FROM_WINDOW_THREAD_PARAM* param =
+                        (RUN_FROM_WINDOW_THREAD_PARAM*)cwp->lParam;
+                    param->proc(param->procParam);
+                }
+            }
+
+            return CallNextHookEx(nullptr, nCode, wParam, lParam);
+        },
+        nullptr, dwThreadId);
+    if (!hook) {
+        return false;
+    }
+
+    RUN_FROM_WINDOW_THREAD_PARAM param;
+    param.proc = proc;
+    param.procParam = procParam;
+    SendMessage(hWnd, runFromWindowThreadRegisteredMsg, 0, (LPARAM)&param);
+
+    UnhookWindowsHookEx(hook);
+
+    return true;
+}
+
 using DPA_InsertPtr_t = decltype(&DPA_InsertPtr);
 DPA_InsertPtr_t DPA_InsertPtr_Original;
 auto WINAPI DPA_InsertPtr_Hook(HDPA hdpa, int i, void* p) {
@@ -586,174 +772,247 @@ struct SYMBOL_HOOK {
     bool optional = false;
 };
 
-bool HookSymbols(HMODULE module,
-                 const SYMBOL_HOOK* symbolHooks,
-                 size_t symbolHooksCount,
-                 bool cacheOnly = false) {
-    const WCHAR cacheVer = L'1';
-    const WCHAR cacheSep = L'@';
-    constexpr size_t cacheMaxSize = 10240;
+// The symbol cache is stored as a binary value: a header identifying the
+// module, followed by entries sorted by the hash of the symbol name, so that it
+// can be loaded with a single read and each symbol can be found with a binary
+// search. An entry with a zero RVA records a symbol which doesn't exist in the
+// module.
+constexpr DWORD kSymbolCacheMagic = 0x43534857;  // "WHSC"
+constexpr DWORD kSymbolCacheVersion = 1;
+constexpr size_t kSymbolCacheMaxEntries = 4096;
+constexpr DWORD kSymbolCacheMissingRva = 0;
+
+struct SymbolCacheHeader {
+    DWORD magic;
+    DWORD version;
+    DWORD timeDateStamp;
+    DWORD sizeOfImage;
+    WORD machine;
+    WORD reserved;
+    DWORD entryCount;
+};
 
-    WCHAR moduleFilePath[MAX_PATH];
-    if (!GetModuleFileName(module, moduleFilePath, ARRAYSIZE(moduleFilePath))) {
-        Wh_Log(L"GetModuleFileName failed");
-        return false;
-    }
+struct SymbolCacheEntry {
+    ULONGLONG symbolHash;
+    DWORD rva;
+    DWORD reserved;
+};
 
-    PCWSTR moduleFileName = wcsrchr(moduleFilePath, L'\\');
-    if (!moduleFileName) {
-        Wh_Log(L"GetModuleFileName returned unsupported path");
-        return false;
+// 64-bit FNV-1a.
+ULONGLONG HashSymbolName(std::wstring_view symbol) {
+    ULONGLONG hash = 0xCBF29CE484222325;
+    for (WCHAR c : symbol) {
+        hash ^= c;
+        hash *= 0x100000001B3;
     }
+    return hash;
+}
 
-    moduleFileName++;
+SymbolCacheHeader SymbolCacheHeaderForModule(HMODULE module) {
+    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
+    IMAGE_NT_HEADERS* header =
+        (IMAGE_NT_HEADERS*)((BYTE*)dosHeader + dosHeader->e_lfanew);
 
-    WCHAR cacheBuffer[cacheMaxSize + 1];
-    std::wstring cacheStrKey = std::wstring(L"symbol-cache-") + moduleFileName;
-    Wh_GetStringValue(cacheStrKey.c_str(), cacheBuffer, ARRAYSIZE(cacheBuffer));
+    return SymbolCacheHeader{
+        .magic = kSymbolCacheMagic,
+        .version = kSymbolCacheVersion,
+        .timeDateStamp = header->FileHeader.TimeDateStamp,
+        .sizeOfImage = header->OptionalHeader.SizeOfImage,
+        .machine = header->FileHeader.Machine,
+    };
+}
 
-    std::wstring_view cacheBufferView(cacheBuffer);
+bool SymbolCacheEntryLess(const SymbolCacheEntry& a,
+                          const SymbolCacheEntry& b) {
+    return a.symbolHash < b.symbolHash;
+}
 
-    // https://stackoverflow.com/a/46931770
-    auto splitStringView = [](std::wstring_view s, WCHAR delimiter) {
-        size_t pos_start = 0, pos_end;
-        std::wstring_view token;
-        std::vector<std::wstring_view> res;
+std::vector<SymbolCacheEntry> LoadSymbolCache(
+    PCWSTR cacheKey,
+    const SymbolCacheHeader& moduleHeader) {
+    std::vector<BYTE> buffer(sizeof(SymbolCacheHeader) +
+                             kSymbolCacheMaxEntries * sizeof(SymbolCacheEntry));
+    size_t size = Wh_GetBinaryValue(cacheKey, buffer.data(), buffer.size());
+    if (size < sizeof(SymbolCacheHeader)) {
+        return {};
+    }
 
-        while ((pos_end = s.find(delimiter, pos_start)) !=
-               std::wstring_view::npos) {
-            token = s.substr(pos_start, pos_end - pos_start);
-            pos_start = pos_end + 1;
-            res.push_back(token);
-        }
+    const auto* header = (const SymbolCacheHeader*)buffer.data();
+    if (header->magic != moduleHeader.magic ||
+        header->version != moduleHeader.version ||
+        header->timeDateStamp != moduleHeader.timeDateStamp ||
+        header->sizeOfImage != moduleHeader.sizeOfImage ||
+        header->machine != moduleHeader.machine ||
+        header->entryCount > kSymbolCacheMaxEntries ||
+        size != sizeof(SymbolCacheHeader) +
+                    header->entryCount * sizeof(SymbolCacheEntry)) {
+        return {};
+    }
 
-        res.push_back(s.substr(pos_start));
-        return res;
-    };
+    const auto* entries =
+        (const SymbolCacheEntry*)(buffer.data() + sizeof(SymbolCacheHeader));
+    std::vector<SymbolCacheEntry> cache(entries, entries + header->entryCount);
+    if (!std::is_sorted(cache.begin(), cache.end(), SymbolCacheEntryLess)) {
+        return {};
+    }
 
-    auto cacheParts = splitStringView(cacheBufferView, cacheSep);
+    return cache;
+}
 
-    std::vector<bool> symbolResolved(symbolHooksCount, false);
-    std::wstring newSystemCacheStr;
+bool SaveSymbolCache(PCWSTR cacheKey,
+                     const SymbolCacheHeader& moduleHeader,
+                     const std::vector<SymbolCacheEntry>& cache) {
+    if (cache.size() > kSymbolCacheMaxEntries) {
+        Wh_Log(L"Cache is too large (%zu)", cache.size());
+        return false;
+    }
 
-    auto onSymbolResolved = [symbolHooks, symbolHooksCount, &symbolResolved,
-                             &newSystemCacheStr,
-                             module](std::wstring_view symbol, void* address) {
-        for (size_t i = 0; i < symbolHooksCount; i++) {
-            if (symbolResolved[i]) {
-                continue;
-            }
+    SymbolCacheHeader header = moduleHeader;
+    header.entryCount = (DWORD)cache.size();
 
-            bool match = false;
-            for (auto hookSymbol : symbolHooks[i].symbols) {
-                if (hookSymbol == symbol) {
-                    match = true;
-                    break;
-                }
-            }
+    std::vector<BYTE> buffer(sizeof(header) +
+                             cache.size() * sizeof(SymbolCacheEntry));
+    memcpy(buffer.data(), &header, sizeof(header));
+    if (!cache.empty()) {
+        memcpy(buffer.data() + sizeof(header), cache.data(),
+               cache.size() * sizeof(SymbolCacheEntry));
+    }
 
-            if (!match) {
-                continue;
-            }
+    return Wh_SetBinaryValue(cacheKey, buffer.data(), buffer.size());
+}
 
-            if (symbolHooks[i].hookFunction) {
-                Wh_SetFunctionHook(address, symbolHooks[i].hookFunction,
-                                   symbolHooks[i].pOriginalFunction);
-                Wh_Log(L"Hooked %p: %.*s", address, symbol.length(),
-                       symbol.data());
-            } else {
-                *symbolHooks[i].pOriginalFunction = address;
-                Wh_Log(L"Found %p: %.*s", address, symbol.length(),
-                       symbol.data());
-            }
+const SymbolCacheEntry* FindSymbolCacheEntry(
+    const std::vector<SymbolCacheEntry>& cache,
+    ULONGLONG symbolHash) {
+    SymbolCacheEntry key{.symbolHash = symbolHash};
+    auto it =
+        std::lower_bound(cache.begin(), cache.end(), key, SymbolCacheEntryLess);
+    if (it == cache.end() || it->symbolHash != symbolHash) {
+        return nullptr;
+    }
 
-            symbolResolved[i] = true;
+    return &*it;
+}
 
-            newSystemCacheStr += cacheSep;
-            newSystemCacheStr += symbol;
-            newSystemCacheStr += cacheSep;
-            newSystemCacheStr +=
-                std::to_wstring((ULONG_PTR)address - (ULONG_PTR)module);
+// Adds the new entries to the cache. For a symbol which is in both, the new
+// entry wins.
+void MergeSymbolCache(std::vector<SymbolCacheEntry>* cache,
+                      std::vector<SymbolCacheEntry> newEntries) {
+    newEntries.insert(newEntries.end(), cache->begin(), cache->end());
+    std::stable_sort(newEntries.begin(), newEntries.end(),
+                     SymbolCacheEntryLess);
+    newEntries.erase(
+        std::unique(newEntries.begin(), newEntries.end(),
+                    [](const SymbolCacheEntry& a, const SymbolCacheEntry& b) {
+                        return a.symbolHash == b.symbolHash;
+                    }),
+        newEntries.end());
+    *cache = std::move(newEntries);
+}
 
-            break;
-        }
-    };
+PCWSTR GetModuleFileNameForCache(HMODULE module,
+                                 WCHAR (&moduleFilePath)[MAX_PATH]) {
+    if (!GetModuleFileName(module, moduleFilePath, ARRAYSIZE(moduleFilePath))) {
+        Wh_Log(L"GetModuleFileName failed");
+        return nullptr;
+    }
 
-    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
-    IMAGE_NT_HEADERS* header =
-        (IMAGE_NT_HEADERS*)((BYTE*)dosHeader + dosHeader->e_lfanew);
-    auto timeStamp = std::to_wstring(header->FileHeader.TimeDateStamp);
-    auto imageSize = std::to_wstring(header->OptionalHeader.SizeOfImage);
-
-    newSystemCacheStr += cacheVer;
-    newSystemCacheStr += cacheSep;
-    newSystemCacheStr += timeStamp;
-    newSystemCacheStr += cacheSep;
-    newSystemCacheStr += imageSize;
-
-    if (cacheParts.size() >= 3 &&
-        cacheParts[0] == std::wstring_view(&cacheVer, 1) &&
-        cacheParts[1] == timeStamp && cacheParts[2] == imageSize) {
-        for (size_t i = 3; i + 1 < cacheParts.size(); i += 2) {
-            auto symbol = cacheParts[i];
-            auto address = cacheParts[i + 1];
-            if (address.length() == 0) {
-                continue;
-            }
+    PCWSTR moduleFileName = wcsrchr(moduleFilePath, L'\\');
+    if (!moduleFileName) {
+        Wh_Log(L"GetModuleFileName returned unsupported path");
+        return nullptr;
+    }
 
-            void* addressPtr =
-                (void*)(std::stoull(std::wstring(address), nullptr, 10) +
-                        (ULONG_PTR)module);
+    return moduleFileName + 1;
+}
 
-            onSymbolResolved(symbol, addressPtr);
-        }
+bool HookSymbols(HMODULE module,
+                 const SYMBOL_HOOK* symbolHooks,
+                 size_t symbolHooksCount,
+                 bool cacheOnly = false) {
+    WCHAR moduleFilePath[MAX_PATH];
+    PCWSTR moduleFileName = GetModuleFileNameForCache(module, moduleFilePath);
+    if (!moduleFileName) {
+        return false;
+    }
 
-        for (size_t i = 0; i < symbolHooksCount; i++) {
-            if (symbolResolved[i] || !symbolHooks[i].optional) {
-                continue;
-            }
+    std::wstring cacheKey = std::wstring(L"symbol-cache-") + moduleFileName;
+    SymbolCacheHeader moduleHeader = SymbolCacheHeaderForModule(module);
+    std::vector<SymbolCacheEntry> cache =
+        LoadSymbolCache(cacheKey.c_str(), moduleHeader);
 
-            size_t noAddressMatchCount = 0;
-            for (size_t j = 3; j + 1 < cacheParts.size(); j += 2) {
-                auto symbol = cacheParts[j];
-                auto address = cacheParts[j + 1];
-                if (address.length() != 0) {
-                    continue;
-                }
+    std::vector<bool> symbolResolved(symbolHooksCount, false);
 
-                for (auto hookSymbol : symbolHooks[i].symbols) {
-                    if (hookSymbol == symbol) {
-                        noAddressMatchCount++;
-                        break;
-                    }
-                }
-            }
+    auto onSymbolResolved = [symbolHooks, &symbolResolved](
+                                size_t i, std::wstring_view symbol,
+                                void* address) {
+        if (symbolHooks[i].hookFunction) {
+            Wh_SetFunctionHook(address, symbolHooks[i].hookFunction,
+                               symbolHooks[i].pOriginalFunction);
+            Wh_Log(L"Hooked %p: %.*s", address, symbol.length(),
+                   symbol.data());
+        } else {
+            *symbolHooks[i].pOriginalFunction = address;
+            Wh_Log(L"Found %p: %.*s", address, symbol.length(),
+                   symbol.data());
+        }
 
-            if (noAddressMatchCount == symbolHooks[i].symbols.size()) {
-                Wh_Log(L"Optional symbol %d doesn't exist (from cache)", i);
+        symbolResolved[i] = true;
+    };
 
-                symbolResolved[i] = true;
+    for (size_t i = 0; i < symbolHooksCount; i++) {
+        size_t noAddressMatchCount = 0;
+        for (auto hookSymbol : symbolHooks[i].symbols) {
+            const SymbolCacheEntry* entry =
+                FindSymbolCacheEntry(cache, HashSymbolName(hookSymbol));
+            if (!entry) {
+                continue;
+            }
 
-                for (auto hookSymbol : symbolHooks[i].symbols) {
-                    newSystemCacheStr += cacheSep;
-                    newSystemCacheStr += hookSymbol;
-                    newSystemCacheStr += cacheSep;
-                }
+            if (entry->rva == kSymbolCacheMissingRva) {
+                noAddressMatchCount++;
+                continue;
             }
+
+            onSymbolResolved(i, hookSymbol, (BYTE*)module + entry->rva);
+            break;
         }
 
-        if (std::all_of(symbolResolved.begin(), symbolResolved.end(),
-                        [](bool b) { return b; })) {
-            return true;
+        if (!symbolResolved[i] && symbolHooks[i].optional &&
+            noAddressMatchCount == symbolHooks[i].symbols.size()) {
+            Wh_Log(L"Optional symbol %d doesn't exist (from cache)", i);
+            symbolResolved[i] = true;
         }
     }
 
+    if (std::all_of(symbolResolved.begin(), symbolResolved.end(),
+                    [](bool b) { return b; })) {
+        return true;
+    }
+
     Wh_Log(L"Couldn't resolve all symbols from cache");
 
     if (cacheOnly) {
         return false;
     }
 
+    // The unresolved symbols by hash, to match each enumerated symbol with a
+    // binary search.
+    std::vector<std::pair<ULONGLONG, size_t>> pendingSymbols;
+    for (size_t i = 0; i < symbolHooksCount; i++) {
+        if (symbolResolved[i]) {
+            continue;
+        }
+
+        for (auto hookSymbol : symbolHooks[i].symbols) {
+            pendingSymbols.push_back({HashSymbolName(hookSymbol), i});
+        }
+    }
+
+    std::sort(pendingSymbols.begin(), pendingSymbols.end());
+
+    std::vector<SymbolCacheEntry> newEntries;
+
     WH_FIND_SYMBOL findSymbol;
     HANDLE findSymbolHandle = Wh_FindFirstSymbol(module, nullptr, &findSymbol);
     if (!findSymbolHandle) {
@@ -762,7 +1021,33 @@ bool HookSymbols(HMODULE module,
     }
 
     do {
-        onSymbolResolved(findSymbol.symbol, findSymbol.address);
+        std::wstring_view symbol = findSymbol.symbol;
+        ULONGLONG symbolHash = HashSymbolName(symbol);
+        auto it = std::lower_bound(
+            pendingSymbols.begin(), pendingSymbols.end(),
+            std::pair<ULONGLONG, size_t>{symbolHash, 0});
+        for (; it != pendingSymbols.end() && it->first == symbolHash; ++it) {
+            size_t i = it->second;
+            if (symbolResolved[i]) {
+                continue;
+            }
+
+            bool match = std::find(symbolHooks[i].symbols.begin(),
+                                   symbolHooks[i].symbols.end(),
+                                   symbol) != symbolHooks[i].symbols.end();
+            if (!match) {
+                continue;
+            }
+
+            onSymbolResolved(i, symbol, findSymbol.address);
+
+            newEntries.push_back({
+                .symbolHash = symbolHash,
+                .rva = (DWORD)((ULONG_PTR)findSymbol.address -
+                               (ULONG_PTR)module),
+            });
+            break;
+        }
     } while (Wh_FindNextSymbol(findSymbolHandle, &findSymbol));
 
     Wh_FindCloseSymbol(findSymbolHandle);
@@ -780,21 +1065,65 @@ bool HookSymbols(HMODULE module,
         Wh_Log(L"Optional symbol %d doesn't exist", i);
 
         for (auto hookSymbol : symbolHooks[i].symbols) {
-            newSystemCacheStr += cacheSep;
-            newSystemCacheStr += hookSymbol;
-            newSystemCacheStr += cacheSep;
+            newEntries.push_back({
+                .symbolHash = HashSymbolName(hookSymbol),
+                .rva = kSymbolCacheMissingRva,
+            });
         }
     }
 
-    if (newSystemCacheStr.length() <= cacheMaxSize) {
-        Wh_SetStringValue(cacheStrKey.c_str(), newSystemCacheStr.c_str());
-    } else {
-        Wh_Log(L"Cache is too large (%zu)", newSystemCacheStr.length());
-    }
+    MergeSymbolCache(&cache, std::move(newEntries));
+    SaveSymbolCache(cacheKey.c_str(), moduleHeader, cache);
 
     return true;
 }
 
+// Parses the text format of the online symbol cache:
+// "1@<timestamp>@<image size>[@<symbol>@<rva>]...", where an empty RVA marks
+// a symbol which doesn't exist in the module.
+std::vector<SymbolCacheEntry> ParseTextSymbolCache(
+    std::wstring_view cacheText,
+    const SymbolCacheHeader& moduleHeader) {
+    // https://stackoverflow.com/a/46931770
+    auto splitStringView = [](std::wstring_view s, WCHAR delimiter) {
+        size_t pos_start = 0, pos_end;
+        std::wstring_view token;
+        std::vector<std::wstring_view> res;
+
+        while ((pos_end = s.find(delimiter, pos_start)) !=
+               std::wstring_view::npos) {
+            token = s.substr(pos_start, pos_end - pos_start);
+            pos_start = pos_end + 1;
+            res.push_back(token);
+        }
+
+        res.push_back(s.substr(pos_start));
+        return res;
+    };
+
+    auto cacheParts = splitStringView(cacheText, L'@');
+    if (cacheParts.size() < 3 || cacheParts[0] != L"1" ||
+        cacheParts[1] != std::to_wstring(moduleHeader.timeDateStamp) ||
+        cacheParts[2] != std::to_wstring(moduleHeader.sizeOfImage)) {
+        return {};
+    }
+
+    std::vector<SymbolCacheEntry> entries;
+    for (size_t i = 3; i + 1 < cacheParts.size(); i += 2) {
+        auto symbol = cacheParts[i];
+        auto address = cacheParts[i + 1];
+
+        entries.push_back({
+            .symbolHash = HashSymbolName(symbol),
+            .rva = address.length() == 0
+                       ? kSymbolCacheMissingRva
+                       : (DWORD)std::stoul(std::wstring(address), nullptr, 10),
+        });
+    }
+
+    return entries;
+}
+
 std::optional<std::wstring> GetUrlContent(PCWSTR lpUrl) {
     HINTERNET hOpenHandle = InternetOpen(
         L"WindhawkMod", INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
@@ -901,11 +1230,9 @@ bool HookSymbolsWithOnlineCacheFallback(HMODULE module,
                   moduleFileNameLen, moduleFileName, moduleFileNameLen, nullptr,
                   nullptr, 0);
 
-    IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
-    IMAGE_NT_HEADERS* header =
-        (IMAGE_NT_HEADERS*)((BYTE*)dosHeader + dosHeader->e_lfanew);
-    auto timeStamp = std::to_wstring(header->FileHeader.TimeDateStamp);
-    auto imageSize = std::to_wstring(header->OptionalHeader.SizeOfImage);
+    SymbolCacheHeader moduleHeader = SymbolCacheHeaderForModule(module);
+    auto timeStamp = std::to_wstring(moduleHeader.timeDateStamp);
+    auto imageSize = std::to_wstring(moduleHeader.sizeOfImage);
 
     std::wstring cacheStrKey =
 #if defined(_M_IX86)
@@ -932,7 +1259,14 @@ bool HookSymbolsWithOnlineCacheFallback(HMODULE module,
 
     auto onlineCache = GetUrlContent(onlineCacheUrl.c_str());
     if (onlineCache) {
-        Wh_SetStringValue(cacheStrKey.c_str(), onlineCache->c_str());
+        // Merge the online cache into the local binary one. The local cache
+        // key doesn't depend on the architecture, see HookSymbols.
+        std::wstring cacheKey = std::wstring(L"symbol-cache-") + moduleFileName;
+        std::vector<SymbolCacheEntry> cache =
+            LoadSymbolCache(cacheKey.c_str(), moduleHeader);
+        MergeSymbolCache(&cache,
+                         ParseTextSymbolCache(*onlineCache, moduleHeader));
+        SaveSymbolCache(cacheKey.c_str(), moduleHeader, cache);
     } else {
         Wh_Log(L"Failed to get online cache");
     }
@@ -1019,6 +1353,8 @@ BOOL Wh_ModInit() {
         return FALSE;
     }
 
+    g_pendingInsertedTaskGroups.reserve(64);
+
     Wh_SetFunctionHook((void*)DPA_InsertPtr, (void*)DPA_InsertPtr_Hook,
                        (void**)&DPA_InsertPtr_Original);
 
@@ -1032,3 +1368,24 @@ BOOL Wh_ModInit() {
 
     return TRUE;
 }
+
+void Wh_ModUninit() {
+    Wh_Log(L">");
+
+    // The timer is a thread timer of the taskbar thread, it must be killed
+    // there before the mod is unloaded.
+    if (g_hTaskbarWnd) {
+        RunFromWindowThread(
+            g_hTaskbarWnd,
+            [](void* pParam) -> void {
+                if (g_pendingInsertionsTimer) {
+                    KillTimer(nullptr, g_pendingInsertionsTimer);
+                    g_pendingInsertionsTimer = 0;
+                }
+
+                g_pendingInsertedTaskGroups.clear();
+                g_pendingTaskListLongPtr = 0;
+            },
+            nullptr);
+    }
+}
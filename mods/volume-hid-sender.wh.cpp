@@ -2,34 +2,29 @@
 // @id              volume-hid-sender
 // @name            Volume HID Sendeer
 // @description     HID Mod For Volume (Mountain Everest Max Only)
-// @version         0.1
+// @version         0.2
 // @author          rom4ster
 // @github          https://github.com/rom4ster
 // @include         explorer.exe
-// @include         ShellHost.exe
-// @compilerOptions -lcomctl32 -lole32 -loleaut32 -lurlmon -lruntimeobject
+// @compilerOptions -lole32 -lhid -lsetupapi -lcfgmgr32
 // ==/WindhawkMod==
 // ==WindhawkModReadme==
 /*
 # Volume HID Sender
-This mod allows you to send HID input for the MOUNTAIN EVEREST MAX keyboard everytime 
-the volume is changed. This solution is not perfect. The volume will frequently be off by one. 
-It is also possible to desync the volume temporarily (until next volume update) by taking
-a very long time to decide which volume you want. 
-
-Custom timeouts may be supported in the future
+This mod allows you to send HID input for the MOUNTAIN EVEREST MAX keyboard everytime
+the volume is changed. The device is opened once and kept open, and the report is
+written to it directly as soon as the volume changes. When the volume changes
+quickly, only the latest value is sent. If the keyboard is unplugged, it's opened
+again once it's plugged back in. If a write fails for another reason, the device
+is reopened after a delay which grows with each failure.
 
 Arbritary HID output will be supported in the future
 
-Requires HID HIDApiTester. 
-
 # Getting started
-First get HIDAPITester
-[here](https://github.com/todbot/hidapitester/releases).
-
-Next set the HIDApiTesterPath variable in settings to where you downloaded HIDAPITester to
+The defaults match the MOUNTAIN EVEREST MAX. The device is selected by the vendor
+id, product id, usage page and usage in the settings.
 
-Finally, Profit 
+Finally, Profit
 
 
 # Special Thanks
@@ -41,317 +36,581 @@ https://github.com/todbot/hidapitester
 
 // ==WindhawkModSettings==
 /*
-# Here you can define settings, in YAML format, that the mod users will be able
-# to configure. Metadata values such as $name and $description are optional.
-# Check out the documentation for more information:
-# https://github.com/ramensoftware/windhawk/wiki/Creating-a-new-mod#settings
-- HIDApiTesterPath: I:\\hidapitest\\hidapitester.exe
+- vendorId: "3282"
+  $name: Vendor ID
+  $description: Hexadecimal
+- productId: "0001"
+  $name: Product ID
+  $description: Hexadecimal
+- usagePage: 65280
+  $name: Usage page
+- usage: 1
+  $name: Usage
 */
 // ==/WindhawkModSettings==
 
-// The source code of the mod starts here. This sample was inspired by the great
-// article of Kyle Halladay, X64 Function Hooking by Example:
-// http://kylehalladay.com/blog/2020/11/13/Hooking-By-Example.html
-// If you're new to terms such as code injection and function hooking, the
-// article is great to get started.
-
-#include <gdiplus.h>
-#include <string.h>
 #include <windows.h>
-#include <mmdeviceapi.h>
+#include <cfgmgr32.h>
 #include <endpointvolume.h>
-#include <stdio.h>
-#include <string>
-#include <sstream>
-#include <Urlmon.h>
+#include <hidsdi.h>
+#include <mmdeviceapi.h>
+#include <setupapi.h>
 #include <windhawk_utils.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <vector>
+
 
-#define WLog(X) Wh_Log( L"%s", X)
 #define WhL(X) Wh_Log(L##X);
-#define InitLog(X, ...) do {                                                 \
-     char * ptr = Specialized_LogBuffer( (char *) "HELLO: ", (char *) X);    \
-     Wh_Log(ptr , __VA_ARGS__);                 \
-     free(ptr);                                     \
-     } while(0);                      
 
-#define DLLExport __declspec(dllexport)
 
-#define SECONDS * 1000
+struct HidDeviceSettings {
+    USHORT vendorId;
+    USHORT productId;
+    USHORT usagePage;
+    USHORT usage;
+};
+
+std::mutex g_settingsMutex;
+HidDeviceSettings g_settings;
+
 
-#define SPACE + L" " +
+// The report previously sent through hidapitester:
+// 64,0x11,0x83,00,00,<volume>,00,...
+// The first byte is the report id. The report is padded or truncated to the
+// device's output report length, like hidapi does.
+std::vector<BYTE> EncodeVolumeReport(int volume, size_t reportLength) {
+    static constexpr BYTE kHeader[] = {0x40, 0x11, 0x83, 0x00, 0x00};
+    constexpr size_t kVolumeOffset = sizeof(kHeader);
 
-#define HIDTesterSetting L"HIDApiTesterPath"
+    std::vector<BYTE> report(reportLength, 0);
+    std::copy_n(kHeader, std::min(reportLength, sizeof(kHeader)),
+                report.begin());
+    if (reportLength > kVolumeOffset) {
+        report[kVolumeOffset] = (BYTE)std::clamp(volume, 0, 100);
+    }
 
+    return report;
+}
 
+int VolumeScalarToPercent(float volume) {
+    // Round rather than truncate, truncating made the device show one less
+    // than the volume flyout for some levels.
+    return (int)std::lround(volume * 100);
+}
 
 
+// Keeps only the latest volume. A volume is pending until it's sent, so a
+// failed write is retried on the next attempt, and a volume that was already
+// sent isn't sent again until the device is reopened.
+class VolumeReportCoalescer {
+public:
+    void Submit(int volume) {
+        std::lock_guard<std::mutex> guard(mutex);
+        latest = volume;
+    }
 
-// #define APPCOMMAND_VOLUME_MUTE 0x80000
-// #define APPCOMMAND_VOLUME_UP 0xA0000
-// #define APPCOMMAND_VOLUME_DOWN 0x90000               
-// #define WM_APPCOMMAND 0x319                                          
+    std::optional<int> TakePending() {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!latest || latest == sent) {
+            return std::nullopt;
+        }
+        return latest;
+    }
 
+    void MarkSent(int volume) {
+        std::lock_guard<std::mutex> guard(mutex);
+        sent = volume;
+    }
 
-const char * Specialized_LogBuffer(char * dest, char * src) {
-    int len = (strlen(dest) + strlen(src));
-    char * buf = (char *) malloc(sizeof(char) * len);
-    strcpy(buf, dest);
-    strcat(buf, src);
-    return buf;
-}
+    // The new device doesn't show anything yet.
+    void DeviceReset() {
+        std::lock_guard<std::mutex> guard(mutex);
+        sent.reset();
+    }
 
-enum class VolumeUnit {
-    Decibel,
-    Scalar
+private:
+    std::mutex mutex;
+    std::optional<int> latest;
+    std::optional<int> sent;
 };
 
 
- PCWSTR HID_PATH = nullptr;
-
+// Only used from the sender thread.
+class HidDeviceSession {
+public:
+    ~HidDeviceSession() { Close(); }
 
-DLLExport float GetSystemVolume(VolumeUnit vUnit) {
-        HRESULT hr;
+    bool IsOpen() const { return device != INVALID_HANDLE_VALUE; }
 
-        // -------------------------
-        CoInitialize(NULL);
-        IMMDeviceEnumerator *deviceEnumerator = NULL;
-        hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_INPROC_SERVER, __uuidof(IMMDeviceEnumerator), (LPVOID *)&deviceEnumerator);
-        IMMDevice *defaultDevice = NULL;
+    size_t OutputReportLength() const { return outputReportLength; }
 
-        hr = deviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole, &defaultDevice);
-        deviceEnumerator->Release();
-        deviceEnumerator = NULL;
+    bool Open(const HidDeviceSettings& settings) {
+        Close();
 
-        IAudioEndpointVolume *endpointVolume = NULL;
-        hr = defaultDevice->Activate(__uuidof(IAudioEndpointVolume), CLSCTX_INPROC_SERVER, NULL, (LPVOID *)&endpointVolume);
-        defaultDevice->Release();
-        defaultDevice = NULL;
+        GUID hidGuid;
+        HidD_GetHidGuid(&hidGuid);
 
-        float currentVolume = 0;
-        if (vUnit == VolumeUnit::Decibel) {
-            //Current volume in dB
-            hr = endpointVolume->GetMasterVolumeLevel(&currentVolume);
+        HDEVINFO deviceInfoSet = SetupDiGetClassDevsW(
+            &hidGuid, nullptr, nullptr, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+        if (deviceInfoSet == INVALID_HANDLE_VALUE) {
+            return false;
         }
 
-        else if (vUnit == VolumeUnit::Scalar) {
-            //Current volume as a scalar
-            hr = endpointVolume->GetMasterVolumeLevelScalar(&currentVolume);
+        SP_DEVICE_INTERFACE_DATA interfaceData{
+            .cbSize = sizeof(SP_DEVICE_INTERFACE_DATA),
+        };
+        for (DWORD i = 0; SetupDiEnumDeviceInterfaces(
+                 deviceInfoSet, nullptr, &hidGuid, i, &interfaceData);
+             i++) {
+            DWORD requiredSize = 0;
+            SetupDiGetDeviceInterfaceDetailW(deviceInfoSet, &interfaceData,
+                                             nullptr, 0, &requiredSize,
+                                             nullptr);
+            if (!requiredSize) {
+                continue;
+            }
+
+            std::vector<BYTE> detailBuffer(requiredSize);
+            auto* detail = reinterpret_cast<SP_DEVICE_INTERFACE_DETAIL_DATA_W*>(
+                detailBuffer.data());
+            detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
+            if (!SetupDiGetDeviceInterfaceDetailW(deviceInfoSet, &interfaceData,
+                                                  detail, requiredSize,
+                                                  nullptr, nullptr)) {
+                continue;
+            }
+
+            if (TryOpen(detail->DevicePath, settings)) {
+                Wh_Log(L"Opened %s", detail->DevicePath);
+                break;
+            }
         }
-        endpointVolume->Release();
-        CoUninitialize();
 
-        return currentVolume;
+        SetupDiDestroyDeviceInfoList(deviceInfoSet);
+
+        return IsOpen();
     }
 
+    void Close() {
+        if (IsOpen()) {
+            CloseHandle(device);
+            device = INVALID_HANDLE_VALUE;
+        }
+        if (writeEvent) {
+            CloseHandle(writeEvent);
+            writeEvent = nullptr;
+        }
+        outputReportLength = 0;
+    }
 
+    // Gives up after kWriteTimeout, or as soon as stopEvent is signaled, so
+    // that a device which stopped reading can't stall the thread.
+    bool Write(std::vector<BYTE>& report, HANDLE stopEvent) {
+        OVERLAPPED overlapped{
+            .hEvent = writeEvent,
+        };
+        ResetEvent(writeEvent);
+
+        if (!WriteFile(device, report.data(), (DWORD)report.size(), nullptr,
+                       &overlapped)) {
+            DWORD error = GetLastError();
+            if (error != ERROR_IO_PENDING) {
+                // Devices without an interrupt OUT endpoint only accept the
+                // report through a control transfer. It's synchronous, but
+                // bounded by the HID class driver's own timeout.
+                return HidD_SetOutputReport(device, report.data(),
+                                            (ULONG)report.size());
+            }
+
+            HANDLE waitHandles[] = {writeEvent, stopEvent};
+            DWORD wait = WaitForMultipleObjects(
+                ARRAYSIZE(waitHandles), waitHandles, FALSE, kWriteTimeout);
+            if (wait != WAIT_OBJECT_0) {
+                // The buffer and the OVERLAPPED must outlive the request.
+                CancelIoEx(device, &overlapped);
+                DWORD written;
+                GetOverlappedResult(device, &overlapped, &written, TRUE);
+                SetLastError(wait == WAIT_TIMEOUT ? ERROR_TIMEOUT
+                                                  : ERROR_OPERATION_ABORTED);
+                return false;
+            }
+        }
 
+        DWORD written = 0;
+        return GetOverlappedResult(device, &overlapped, &written, FALSE) &&
+               written == report.size();
+    }
 
-using SendMessageW_t = decltype(&SendMessageW);
-SendMessageW_t  SendMessageW_Original;
+private:
+    // Same as hidapi's hid_write.
+    static constexpr DWORD kWriteTimeout = 1000;
+
+    bool TryOpen(PCWSTR devicePath, const HidDeviceSettings& settings) {
+        HANDLE handle = CreateFileW(devicePath, GENERIC_WRITE,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                                    OPEN_EXISTING, FILE_FLAG_OVERLAPPED,
+                                    nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
 
+        HIDD_ATTRIBUTES attributes{
+            .Size = sizeof(HIDD_ATTRIBUTES),
+        };
+        PHIDP_PREPARSED_DATA preparsedData = nullptr;
+        HIDP_CAPS caps{};
+        bool matches =
+            HidD_GetAttributes(handle, &attributes) &&
+            attributes.VendorID == settings.vendorId &&
+            attributes.ProductID == settings.productId &&
+            HidD_GetPreparsedData(handle, &preparsedData) &&
+            HidP_GetCaps(preparsedData, &caps) == HIDP_STATUS_SUCCESS &&
+            caps.UsagePage == settings.usagePage &&
+            caps.Usage == settings.usage && caps.OutputReportByteLength > 0;
+
+        if (preparsedData) {
+            HidD_FreePreparsedData(preparsedData);
+        }
 
-VOID startup(LPCTSTR lpApplicationName, LPWSTR cmdLine )
-{
-   // additional information
-   STARTUPINFO si;     
-   PROCESS_INFORMATION pi;
+        if (!matches) {
+            CloseHandle(handle);
+            return false;
+        }
 
-   // set the size of the structures
-   ZeroMemory( &si, sizeof(si) );
-   si.cb = sizeof(si);
-   ZeroMemory( &pi, sizeof(pi) );
+        HANDLE event = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (!event) {
+            CloseHandle(handle);
+            return false;
+        }
 
-  // start the program up
-  CreateProcess( lpApplicationName,   // the path
-    cmdLine,        // Command line
-    NULL,           // Process handle not inheritable
-    NULL,           // Thread handle not inheritable
-    FALSE,          // Set handle inheritance to FALSE
-    CREATE_NO_WINDOW,              // No window creation flags
-    NULL,           // Use parent's environment block
-    NULL,           // Use parent's starting directory 
-    &si,            // Pointer to STARTUPINFO structure
-    &pi             // Pointer to PROCESS_INFORMATION structure (removed extra parentheses)
-    );
-    // Close process and thread handles. 
-    CloseHandle( pi.hProcess );
-    CloseHandle( pi.hThread );
-}
+        device = handle;
+        writeEvent = event;
+        outputReportLength = caps.OutputReportByteLength;
+        return true;
+    }
 
+    HANDLE device = INVALID_HANDLE_VALUE;
+    // Manual-reset, signaled when an overlapped write completes.
+    HANDLE writeEvent = nullptr;
+    size_t outputReportLength = 0;
+};
 
-std::wstring  FormCommand(float vol) {
-    LPWSTR vid = (LPWSTR) L"3282"; //setting
-    LPWSTR pid = (LPWSTR) L"0001"; //setting
-    LPWSTR usage_page = (LPWSTR) L"65280"; //setting
-    LPWSTR usage = (LPWSTR) L"1";          //setting
-    // LPWSTR length = (LPWSTR) L"64";        //setting
 
-    int voll = (int) (vol*100);
+VolumeReportCoalescer g_volumeReportCoalescer;
 
-    std::wstringstream ss;
-    ss << voll;
-    std::wstring volstring = ss.str();
+HANDLE g_senderThread;
+HANDLE g_stopEvent;
+// Auto-reset, set whenever the sender thread has something to do.
+HANDLE g_wakeEvent;
 
-    std::wstring commandp1(L"64,0x11,0x83,00,00,");
-    std::wstring commandp2(L",00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00"); //Setting
-    std::wstring command = commandp1 + volstring + commandp2;
-    std::wstring q1 = std::wstring(L"\"");
-    std::wstring fullstr(q1 + HID_PATH + q1);
+std::atomic<bool> g_openDeviceRequested;
+std::atomic<bool> g_defaultEndpointChanged;
 
-    std::wstring completestr =  std::wstring(fullstr SPACE L"--vidpid" SPACE vid + L":" + pid SPACE L"--usagePage" SPACE usage_page SPACE L"--usage" SPACE usage SPACE L"--open" SPACE L"--send-output" SPACE command);     
-    Wh_Log( L"%s", ( PCWSTR) completestr.c_str());
+void SubmitVolume(float volume) {
+    g_volumeReportCoalescer.Submit(VolumeScalarToPercent(volume));
+    SetEvent(g_wakeEvent);
+}
 
-    
 
+// Registered both for the default endpoint's volume and for default endpoint
+// changes. A single static instance, so the reference count is irrelevant.
+class VolumeNotifier : public IAudioEndpointVolumeCallback,
+                       public IMMNotificationClient {
+public:
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == __uuidof(IUnknown) ||
+            riid == __uuidof(IAudioEndpointVolumeCallback)) {
+            *ppv = static_cast<IAudioEndpointVolumeCallback*>(this);
+        } else if (riid == __uuidof(IMMNotificationClient)) {
+            *ppv = static_cast<IMMNotificationClient*>(this);
+        } else {
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+        return S_OK;
+    }
+    STDMETHODIMP_(ULONG) AddRef() override { return 1; }
+    STDMETHODIMP_(ULONG) Release() override { return 1; }
 
+    // IAudioEndpointVolumeCallback
+    STDMETHODIMP OnNotify(PAUDIO_VOLUME_NOTIFICATION_DATA pNotify) override {
+        SubmitVolume(pNotify->fMasterVolume);
+        return S_OK;
+    }
 
+    // IMMNotificationClient
+    STDMETHODIMP OnDefaultDeviceChanged(EDataFlow flow,
+                                        ERole role,
+                                        LPCWSTR pwstrDefaultDeviceId) override {
+        if (flow == eRender && role == eConsole) {
+            g_defaultEndpointChanged = true;
+            SetEvent(g_wakeEvent);
+        }
+        return S_OK;
+    }
+    STDMETHODIMP OnDeviceStateChanged(LPCWSTR, DWORD) override { return S_OK; }
+    STDMETHODIMP OnDeviceAdded(LPCWSTR) override { return S_OK; }
+    STDMETHODIMP OnDeviceRemoved(LPCWSTR) override { return S_OK; }
+    STDMETHODIMP OnPropertyValueChanged(LPCWSTR,
+                                        const PROPERTYKEY) override {
+        return S_OK;
+    }
+};
 
+VolumeNotifier g_volumeNotifier;
 
-    return completestr;
 
+DWORD CALLBACK HidInterfaceNotificationCallback(
+    HCMNOTIFICATION hNotify,
+    PVOID context,
+    CM_NOTIFY_ACTION action,
+    PCM_NOTIFY_EVENT_DATA eventData,
+    DWORD eventDataSize) {
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL) {
+        g_openDeviceRequested = true;
+        SetEvent(g_wakeEvent);
+    }
+    return ERROR_SUCCESS;
 }
 
 
-DWORD WINAPI ThreadFunc(void * data) {
-        Sleep(2 SECONDS);
-        float vol = GetSystemVolume(VolumeUnit::Scalar);
-
-        Wh_Log(L"Volume Info: %f", vol);
-        startup(HID_PATH, ((LPWSTR) FormCommand(vol).c_str()));
-        Sleep(5 SECONDS);
-        vol = GetSystemVolume(VolumeUnit::Scalar);
-        Wh_Log(L"Volume Info: %f", vol);
-        startup(HID_PATH, ((LPWSTR) FormCommand(vol).c_str()));
-        Sleep(2 SECONDS);
-        //Sleep(15 SECONDS);
-        //vol = GetSystemVolume(VolumeUnit::Scalar);
-        //Wh_Log(L"Volume Info: %f", vol);
-        //startup(L"hidapitester.exe", FormCommand(vol));
-        return 0;
-}
+IAudioEndpointVolume* RegisterDefaultEndpointVolume(
+    IMMDeviceEnumerator* deviceEnumerator) {
+    IMMDevice* defaultDevice = nullptr;
+    HRESULT hr = deviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole,
+                                                           &defaultDevice);
+    if (FAILED(hr)) {
+        Wh_Log(L"GetDefaultAudioEndpoint failed: %08X", hr);
+        return nullptr;
+    }
 
+    IAudioEndpointVolume* endpointVolume = nullptr;
+    hr = defaultDevice->Activate(__uuidof(IAudioEndpointVolume),
+                                 CLSCTX_INPROC_SERVER, nullptr,
+                                 (LPVOID*)&endpointVolume);
+    defaultDevice->Release();
+    if (FAILED(hr)) {
+        Wh_Log(L"Activate failed: %08X", hr);
+        return nullptr;
+    }
 
- LRESULT WINAPI SendMessage_Hook(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam) {
-  
-  
-  // Check for correct message 
-  if (Msg == WM_APPCOMMAND) {
-    WhL("HOOOKED ON LIFE")
-  } else if (Msg  == 1046) {
-    Wh_Log(L"Message: %u Sent", Msg);
-    if (Msg == 1046) {
-        Wh_Log(L" PTR FOUND %i",  (unsigned short ) lParam );
-        if ((unsigned short) lParam >= 0) {
-            CreateThread(nullptr, 0, ThreadFunc, nullptr, 0, nullptr);
-        }
-        
+    endpointVolume->RegisterControlChangeNotify(&g_volumeNotifier);
+
+    float volume;
+    if (SUCCEEDED(endpointVolume->GetMasterVolumeLevelScalar(&volume))) {
+        SubmitVolume(volume);
     }
-  } else {
-    //if (Msg != 78 && Msg != 20 )
-      //Wh_Log(L"Message: %u Sent", Msg);
 
-  }
+    return endpointVolume;
+}
 
-  
-  return SendMessageW_Original(hWnd, Msg, wParam, lParam);
+void UnregisterEndpointVolume(IAudioEndpointVolume* endpointVolume) {
+    if (endpointVolume) {
+        endpointVolume->UnregisterControlChangeNotify(&g_volumeNotifier);
+        endpointVolume->Release();
+    }
 }
 
 
+// Delays between attempts to reopen the device after a write failure.
+constexpr DWORD kReopenMinDelay = 500;
+constexpr DWORD kReopenMaxDelay = 30000;
 
-void Set_Hooks() {
-        HMODULE user32Module = LoadLibrary(L"user32.dll");
-    if (user32Module) {
-        // SendMessageW_t * pSendMessageW =
-        //     GetProcAddress(user32Module, "SendMessageW");
+DWORD WINAPI SenderThread(void* data) {
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
 
-            WindhawkUtils::SetFunctionHook(SendMessageW,
-                               SendMessage_Hook,
-                               &SendMessageW_Original);
-        
+    IMMDeviceEnumerator* deviceEnumerator = nullptr;
+    HRESULT hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr,
+                                  CLSCTX_INPROC_SERVER,
+                                  __uuidof(IMMDeviceEnumerator),
+                                  (LPVOID*)&deviceEnumerator);
+    if (FAILED(hr)) {
+        Wh_Log(L"CoCreateInstance failed: %08X", hr);
+        CoUninitialize();
+        return 0;
     }
 
-}
-
-void Download_EXE() {
-    const wchar_t * download_url = L"https://github.com/todbot/hidapitester/releases";
-    wchar_t message [3000];
-    wcscpy(message, L"Use the following URL to download HIDAPITester, or set the path: ");
-    wcscat(message, download_url);
-    MessageBox(NULL, message, L"HIDApiTester Not Found", MB_OK);
+    deviceEnumerator->RegisterEndpointNotificationCallback(&g_volumeNotifier);
+    IAudioEndpointVolume* endpointVolume =
+        RegisterDefaultEndpointVolume(deviceEnumerator);
+
+    CM_NOTIFY_FILTER filter{
+        .cbSize = sizeof(CM_NOTIFY_FILTER),
+        .FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE,
+    };
+    HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+
+    HCMNOTIFICATION hidNotification = nullptr;
+    CONFIGRET cr = CM_Register_Notification(
+        &filter, nullptr, HidInterfaceNotificationCallback, &hidNotification);
+    if (cr != CR_SUCCESS) {
+        Wh_Log(L"CM_Register_Notification failed: %u", cr);
+        hidNotification = nullptr;
+    }
 
-}
-BOOL FileExists(LPCTSTR szPath)
-{
-  DWORD dwAttrib = GetFileAttributes(szPath);
+    HidDeviceSession session;
+
+    // Set after a write failure. The device is then reopened when a volume is
+    // pending, but no sooner than reopenTime, and the delay grows with each
+    // failed attempt.
+    bool reopenPending = false;
+    ULONGLONG reopenTime = 0;
+    DWORD reopenDelay = kReopenMinDelay;
+
+    HANDLE waitHandles[] = {g_stopEvent, g_wakeEvent};
+    while (true) {
+        DWORD timeout = INFINITE;
+        if (reopenPending && g_volumeReportCoalescer.TakePending()) {
+            ULONGLONG now = GetTickCount64();
+            timeout = reopenTime > now ? (DWORD)(reopenTime - now) : 0;
+        }
 
-  return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
-         !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
-}
+        DWORD wait = WaitForMultipleObjects(ARRAYSIZE(waitHandles),
+                                            waitHandles, FALSE, timeout);
+        if (wait == WAIT_TIMEOUT) {
+            g_openDeviceRequested = true;
+        } else if (wait != WAIT_OBJECT_0 + 1) {
+            break;
+        }
 
+        if (g_defaultEndpointChanged.exchange(false)) {
+            WhL("Default endpoint changed")
+            UnregisterEndpointVolume(endpointVolume);
+            endpointVolume = RegisterDefaultEndpointVolume(deviceEnumerator);
+        }
 
-void UnInit_Settings() {
-    if (HID_PATH != nullptr) {
-         Wh_FreeStringSetting(HID_PATH);
-    }
-    
-}
+        // Only enumerate devices on start, arrival or settings change, not for
+        // every volume step while the device is missing.
+        if (g_openDeviceRequested.exchange(false)) {
+            HidDeviceSettings settings;
+            {
+                std::lock_guard<std::mutex> guard(g_settingsMutex);
+                settings = g_settings;
+            }
+
+            if (session.Open(settings)) {
+                g_volumeReportCoalescer.DeviceReset();
+                reopenPending = false;
+            } else if (reopenPending) {
+                Wh_Log(L"Reopen failed, retrying in %u ms", reopenDelay);
+                reopenTime = GetTickCount64() + reopenDelay;
+                reopenDelay = std::min(reopenDelay * 2, kReopenMaxDelay);
+            } else {
+                WhL("Device not found, waiting for it to arrive")
+            }
+        }
 
-void Init_Settings() {
-     UnInit_Settings();
-    HID_PATH = Wh_GetStringSetting(HIDTesterSetting);
-}
+        if (!session.IsOpen()) {
+            continue;
+        }
 
+        std::optional<int> volume = g_volumeReportCoalescer.TakePending();
+        if (!volume) {
+            continue;
+        }
 
+        std::vector<BYTE> report =
+            EncodeVolumeReport(*volume, session.OutputReportLength());
+        if (session.Write(report, g_stopEvent)) {
+            Wh_Log(L"Volume sent: %d", *volume);
+            g_volumeReportCoalescer.MarkSent(*volume);
+            reopenDelay = kReopenMinDelay;
+        } else {
+            // If unplugged, it's reopened on arrival. Otherwise, e.g. after a
+            // timeout, it's reopened with a backoff while a volume is pending.
+            Wh_Log(L"Write failed: %u", GetLastError());
+            session.Close();
+            reopenPending = true;
+            reopenTime = GetTickCount64() + reopenDelay;
+            reopenDelay = std::min(reopenDelay * 2, kReopenMaxDelay);
+        }
+    }
 
-bool Check_Requirements() {
-    if (!FileExists(HID_PATH)) {
-        Download_EXE();
-        return FALSE;
+    if (hidNotification) {
+        CM_Unregister_Notification(hidNotification);
     }
-    return TRUE;
-}
 
+    UnregisterEndpointVolume(endpointVolume);
+    deviceEnumerator->UnregisterEndpointNotificationCallback(&g_volumeNotifier);
+    deviceEnumerator->Release();
 
-void Wh_ModSettingsChanged() {
-    Init_Settings();
-}
+    session.Close();
 
-void Wh_ModBeforeUninit() {
-    UnInit_Settings();
+    CoUninitialize();
+    return 0;
 }
 
-BOOL Wh_ModInit() {
-
-    // do {                                                 
-    //  const char * ptr = Specialized_LogBuffer( (char *) "HELLO: ", (char *) "%i\n");    
-    //  Wh_Log(ptr , 42);                 
-    //  free(   ( char *)ptr);                                     
-    //  } while(0);   
 
+USHORT GetHexSetting(PCWSTR name) {
+    PCWSTR value = Wh_GetStringSetting(name);
+    USHORT result = (USHORT)wcstoul(value, nullptr, 16);
+    Wh_FreeStringSetting(value);
+    return result;
+}
 
+void Init_Settings() {
+    std::lock_guard<std::mutex> guard(g_settingsMutex);
+    g_settings.vendorId = GetHexSetting(L"vendorId");
+    g_settings.productId = GetHexSetting(L"productId");
+    g_settings.usagePage = (USHORT)Wh_GetIntSetting(L"usagePage");
+    g_settings.usage = (USHORT)Wh_GetIntSetting(L"usage");
+}
 
 
+void Wh_ModSettingsChanged() {
+    Init_Settings();
 
-    
+    g_openDeviceRequested = true;
+    SetEvent(g_wakeEvent);
+}
 
+void Wh_ModUninit();
 
+BOOL Wh_ModInit() {
     WhL("Begin INIT");
     WhL("Begin Settings")
     Init_Settings();
-    WhL("Begin Requirments")
-    if (!Check_Requirements()) {
+
+    g_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    g_wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (!g_stopEvent || !g_wakeEvent) {
+        WhL("CreateEvent failed")
+        Wh_ModUninit();
         return FALSE;
     }
-    WhL("Begin Hooks")
-    Set_Hooks();
-    //if (!FileExists(L"hidapitester.exe")) {
-        //Download_EXE();
-    //}
-
 
+    WhL("Begin Sender Thread")
+    g_openDeviceRequested = true;
+    g_senderThread = CreateThread(nullptr, 0, SenderThread, nullptr, 0, nullptr);
+    if (!g_senderThread) {
+        WhL("CreateThread failed")
+        Wh_ModUninit();
+        return FALSE;
+    }
 
     return TRUE;
 }
 
+void Wh_ModUninit() {
+    if (g_senderThread) {
+        SetEvent(g_stopEvent);
+        WaitForSingleObject(g_senderThread, INFINITE);
+        CloseHandle(g_senderThread);
+        g_senderThread = nullptr;
+    }
 
+    if (g_stopEvent) {
+        CloseHandle(g_stopEvent);
+        g_stopEvent = nullptr;
+    }
+    if (g_wakeEvent) {
+        CloseHandle(g_wakeEvent);
+        g_wakeEvent = nullptr;
+    }
+}
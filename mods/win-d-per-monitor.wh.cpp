@@ -3,7 +3,7 @@
 // @name            Win+D per monitor(show desktop)
 // @description     Press Win+D to only manage the windows on the monitor where the mouse is located.
 // @description:zh-CN   按下Win+D时 只最小化/还原鼠标所在显示器的窗口
-// @version         1.1.20250811
+// @version         1.1.20261019
 // @author          easyatm
 // @github          https://github.com/easyatm
 // @include         explorer.exe
@@ -35,6 +35,13 @@ where the mouse cursor is located.
 
 ## Changelog
 
+### 2026-10-19 (v1.1.20261019)
+- Windows are classified by their class atom, and minimized/restored in one pass without activating each other
+- 按窗口类原子分类窗口，并一次性最小化/还原窗口，不再逐个激活窗口
+
+- Restore brings back the original z-order with a single DeferWindowPos transaction once the windows are restored (except for windows which aren't responding)
+- 窗口还原后通过一次DeferWindowPos事务恢复原有的窗口Z序(无响应的窗口除外)
+
 ### 2025-08-11 (v1.1.20250811)
 - Added option to ignore topmost tool windows without title bar during Win+D operation
 - 新增忽略置顶且无标题栏的工具窗口选项，在Win+D操作时保持这类窗口可见
@@ -57,6 +64,7 @@ Fixes:
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <windhawk_api.h>
 #include <windhawk_utils.h>
@@ -89,11 +97,14 @@ class WindShowDesktop
     struct WndInfo
     {
         HWND wnd = nullptr;
-        std::string cls;
+        ATOM clsAtom = 0;
         HWND ownerWnd = nullptr;
     };
     inline static std::map<HMONITOR, std::list<WndInfo>> mapWnd;
 
+    // 窗口类原子 -> 是否忽略, 避免每个窗口都获取并比较类名
+    inline static std::unordered_map<ATOM, bool> mapIgnoredClassAtom;
+
     // 激活指定窗口
     static void activeWnd(HWND hWnd)
     {
@@ -180,12 +191,47 @@ class WindShowDesktop
         return hLastWnd != nullptr;
     }
 
-    // 获取窗口类名
-    static std::string getWindowClassName(HWND hwnd)
+    // 判断是否为需要忽略的窗口类, 结果按类原子缓存
+    static bool isIgnoredClass(HWND hwnd, ATOM& clsAtom)
+    {
+        clsAtom = (ATOM)GetClassLongPtrW(hwnd, GCW_ATOM);
+        if (clsAtom)
+        {
+            auto it = mapIgnoredClassAtom.find(clsAtom);
+            if (it != mapIgnoredClassAtom.end())
+                return it->second;
+        }
+
+        static const std::set<std::wstring_view> ignoredClass = { L"Shell_SecondaryTrayWnd", L"Shell_TrayWnd", L"WorkerW", L"SysShadow", L"TaskListThumbnailWnd" };
+
+        WCHAR className[256];
+        int len = GetClassNameW(hwnd, className, ARRAYSIZE(className));
+        bool ignored = ignoredClass.find(std::wstring_view(className, len)) != ignoredClass.end();
+
+        if (clsAtom)
+            mapIgnoredClassAtom[clsAtom] = ignored;
+        return ignored;
+    }
+
+    // 按原有Z序一次性恢复窗口的位置, vec中的窗口从下到上排列
+    static bool restoreZOrder(const std::vector<HWND>& vec)
     {
-        char className[256];
-        GetClassNameA(hwnd, className, sizeof(className));
-        return std::string(className);
+        HDWP hdwp = BeginDeferWindowPos((int)vec.size());
+        HWND hInsertAfter = HWND_TOP;
+        for (auto it = vec.rbegin(); it != vec.rend() && hdwp; ++it)
+        {
+            hdwp = DeferWindowPos(hdwp, *it, hInsertAfter, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+            hInsertAfter = *it;
+        }
+        return hdwp && EndDeferWindowPos(hdwp);
+    }
+
+    static double elapsedMs(const LARGE_INTEGER& start)
+    {
+        LARGE_INTEGER now, freq;
+        QueryPerformanceCounter(&now);
+        QueryPerformanceFrequency(&freq);
+        return (now.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
     }
 
     // 判断是否应该忽略此窗口（置顶且无标题栏的工具窗口）
@@ -248,15 +294,11 @@ public:
                     continue;
                 }
 
-                auto wndClass = getWindowClassName(hWndCcc);
-
                 // 处理需要忽略的类名.
+                ATOM clsAtom = 0;
+                if (isIgnoredClass(hWndCcc, clsAtom))
                 {
-                    static std::set<std::string> ignoredClass = { "Shell_SecondaryTrayWnd", "Shell_TrayWnd", "WorkerW", "SysShadow", "TaskListThumbnailWnd" };
-                    if (ignoredClass.find(wndClass) != ignoredClass.end())
-                    {
-                        continue;
-                    }
+                    continue;
                 }
 
                 RECT rct = { 0 };
@@ -278,27 +320,29 @@ public:
 
                 HWND ownerWnd = ::GetWindow(hWndCcc, GW_OWNER);
 
-                // 获取窗口标题
-                char windowTitle[256] = { 0 };
-                GetWindowTextA(hWndCcc, windowTitle, sizeof(windowTitle));
+                // 输出窗口信息, 不获取窗口标题, 因为GetWindowText会向其他进程的窗口发送消息
+                log("Processing window: class=0x{:x}, size={}x{}, hwnd=0x{:x}, owner=0x{:x}",
+                    clsAtom, width, height, (uintptr_t)hWndCcc, (uintptr_t)ownerWnd);
 
-                // 输出窗口信息
-                log("Processing window: class='{}', title='{}', size={}x{}, hwnd=0x{:x}, owner=0x{:x}",
-                    wndClass, windowTitle, width, height, (uintptr_t)hWndCcc, (uintptr_t)ownerWnd);
-
-                vec.push_back({ hWndCcc, wndClass, ownerWnd });
+                vec.push_back({ hWndCcc, clsAtom, ownerWnd });
             }
             return vec;
         };
 
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+
         auto vecCur = enumMonitorWnd(hDesktop, hMonitor);
         auto& listWnd = mapWnd[hMonitor];
 
+        double enumMs = elapsedMs(start);
         log("Found {} windows to process on current monitor", vecCur.size());
 
         // 允许设置前台窗口，避免窗口在任务栏闪烁
         AllowSetForegroundWindow(ASFW_ANY);
 
+        size_t processed = 0;
+
         if (!vecCur.empty())
         {
 
@@ -318,11 +362,12 @@ public:
                     ShowOwnedPopups(rc.ownerWnd, false);
                 else
                 {
-                    //::ShowWindow(rc.wnd, SW_MINIMIZE);
-                    PostMessage(rc.wnd, WM_SYSCOMMAND, SC_MINIMIZE, 0);
+                    // 异步最小化且不激活其他窗口, 避免每个窗口最小化时依次激活下一个窗口
+                    ShowWindowAsync(rc.wnd, SW_SHOWMINNOACTIVE);
                 }
 
                 listWnd.emplace_back(std::move(rc));
+                processed++;
             }
 
             activeWnd(hDesktop);
@@ -331,6 +376,7 @@ public:
         {
 
             HWND hLastWnd = nullptr;
+            std::vector<HWND> vecZOrder;
 
             for (auto it = listWnd.begin(); it != listWnd.end(); it++)
             {
@@ -344,19 +390,38 @@ public:
                 }
                 else
                 {
-                    //::ShowWindow(rc.wnd, SW_SHOWNOACTIVATE);
-                    PostMessage(rc.wnd, WM_SYSCOMMAND, SC_RESTORE, 0);
+                    // 同步还原, 确保在恢复Z序之前窗口已经还原, 否则各窗口线程稍后执行的还原会打乱Z序
+                    // 无响应的窗口只能异步还原, 其Z序无法保证
+                    if (IsHungAppWindow(rc.wnd))
+                        ShowWindowAsync(rc.wnd, SW_SHOWNOACTIVATE);
+                    else
+                        ShowWindow(rc.wnd, SW_SHOWNOACTIVATE);
                     hLastWnd = rc.wnd;
                 }
 
-                SetWindowPos(rc.wnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE);
-                SetWindowPos(rc.wnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE);
+                vecZOrder.push_back(rc.wnd);
             }
 
+            // 批量恢复失败时(例如窗口已被销毁), 逐个窗口恢复Z序
+            if (!vecZOrder.empty() && !restoreZOrder(vecZOrder))
+            {
+                log("DeferWindowPos error:{}", ::GetLastError());
+                for (HWND hWnd : vecZOrder)
+                {
+                    SetWindowPos(hWnd, HWND_TOP, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+                }
+            }
+
+            processed = vecZOrder.size();
             listWnd.clear();
             activeWnd(hLastWnd);
         }
 
+        // 输出耗时, 用于衡量每个窗口的处理延迟
+        double totalMs = elapsedMs(start);
+        log("Processed {} windows in {:.3f}ms (enum {:.3f}ms, {:.3f}ms per window)",
+            processed, totalMs, enumMs, processed ? totalMs / processed : 0.0);
+
         return true;
     }
 };
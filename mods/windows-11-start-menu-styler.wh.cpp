@@ -2,7 +2,7 @@
 // @id              windows-11-start-menu-styler
 // @name            Windows 11 Start Menu Styler
 // @description     Customize the start menu with themes contributed by others or create your own
-// @version         1.3.1
+// @version         1.3.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -3184,6 +3184,8 @@ using PropertyOverridesUnresolved = std::vector<StyleRule>;
 struct XamlBlurBrushParams {
     float blurAmount;
     wf::Numerics::float4 tint;
+
+    bool operator==(const XamlBlurBrushParams&) const = default;
 };
 
 using PropertyOverrideValue =
@@ -3838,27 +3840,55 @@ XamlBlurBrush::XamlBlurBrush(wuc::Compositor compositor, float blurAmount, wfn::
 	m_tint(tint)
 { }
 
-void XamlBlurBrush::OnConnected()
+// Creating an effect factory compiles the effect graph, which is expensive. A
+// single factory is created per compositor and shared by all brushes, with the
+// blur amount and the tint declared as animatable properties and set per brush.
+std::vector<std::pair<wuc::Compositor, wuc::CompositionEffectFactory>> g_blurEffectFactories;
+std::atomic<int> g_blurEffectFactoriesCreated;
+
+wuc::CompositionEffectFactory GetBlurEffectFactory(wuc::Compositor const& compositor)
 {
-	if (!CompositionBrush())
+	for (const auto& [factoryCompositor, factory] : g_blurEffectFactories)
 	{
-		auto backdropBrush = m_compositor.CreateBackdropBrush();
+		if (factoryCompositor == compositor)
+		{
+			return factory;
+		}
+	}
+
+	auto blurEffect = winrt::make_self<GaussianBlurEffect>();
+	blurEffect->Source = wuc::CompositionEffectSourceParameter(L"backdrop");
+
+	auto floodEffect = winrt::make_self<FloodEffect>();
+
+	auto compositeEffect = winrt::make_self<CompositeEffect>();
+	compositeEffect->Sources.push_back(*blurEffect);
+	compositeEffect->Sources.push_back(*floodEffect);
+	compositeEffect->Mode = D2D1_COMPOSITE_MODE_SOURCE_OVER;
+
+	auto factory = compositor.CreateEffectFactory(
+		*compositeEffect,
+		// List of animatable properties.
+		{L"GaussianBlurEffect.BlurAmount", L"FloodEffect.Color"}
+	);
 
-		auto blurEffect = winrt::make_self<GaussianBlurEffect>();
-		blurEffect->Source = wuc::CompositionEffectSourceParameter(L"backdrop");
-		blurEffect->BlurAmount = m_blurAmount;
+	g_blurEffectFactories.emplace_back(compositor, factory);
 
-		auto floodEffect = winrt::make_self<FloodEffect>();
-		floodEffect->Color = m_tint;
+	Wh_Log(L"Blur effect factories created: %d", ++g_blurEffectFactoriesCreated);
 
-		auto compositeEffect = winrt::make_self<CompositeEffect>();
-		compositeEffect->Sources.push_back(*blurEffect);
-		compositeEffect->Sources.push_back(*floodEffect);
-		compositeEffect->Mode = D2D1_COMPOSITE_MODE_SOURCE_OVER;
+	return factory;
+}
+
+void XamlBlurBrush::OnConnected()
+{
+	if (!CompositionBrush())
+	{
+		auto backdropBrush = m_compositor.CreateBackdropBrush();
 
-		auto factory = m_compositor.CreateEffectFactory(*compositeEffect);
-		auto blurBrush = factory.CreateBrush();
+		auto blurBrush = GetBlurEffectFactory(m_compositor).CreateBrush();
 		blurBrush.SetSourceParameter(L"backdrop", backdropBrush);
+		blurBrush.Properties().InsertScalar(L"GaussianBlurEffect.BlurAmount", m_blurAmount);
+		blurBrush.Properties().InsertVector4(L"FloodEffect.Color", m_tint);
 
 		CompositionBrush(blurBrush);
 	}
@@ -3876,6 +3906,63 @@ void XamlBlurBrush::OnDisconnected()
 // clang-format on
 ////////////////////////////////////////////////////////////////////////////////
 
+// Elements with identical blur parameters share a brush. XAML connects a brush
+// when it's first used and disconnects it when the last element stops using
+// it, so only weak references are kept here.
+struct XamlBlurBrushCacheEntry {
+    void* compositor;
+    XamlBlurBrushParams params;
+    winrt::weak_ref<XamlBlurBrush> brush;
+};
+
+std::vector<XamlBlurBrushCacheEntry> g_xamlBlurBrushCache;
+
+std::atomic<int> g_xamlBlurBrushesCreated;
+std::atomic<int> g_xamlBlurBrushesServed;
+
+winrt::com_ptr<XamlBlurBrush> GetXamlBlurBrush(
+    wuc::Compositor compositor,
+    const XamlBlurBrushParams& params) {
+    g_xamlBlurBrushesServed++;
+
+    void* compositorAbi = winrt::get_abi(compositor);
+
+    winrt::com_ptr<XamlBlurBrush> brush;
+    for (auto it = g_xamlBlurBrushCache.begin();
+         it != g_xamlBlurBrushCache.end();) {
+        auto entryBrush = it->brush.get();
+        if (!entryBrush) {
+            it = g_xamlBlurBrushCache.erase(it);
+            continue;
+        }
+
+        if (!brush && it->compositor == compositorAbi &&
+            it->params == params) {
+            brush = std::move(entryBrush);
+        }
+
+        ++it;
+    }
+
+    if (brush) {
+        return brush;
+    }
+
+    brush = winrt::make_self<XamlBlurBrush>(std::move(compositor),
+                                            params.blurAmount, params.tint);
+
+    g_xamlBlurBrushCache.push_back({
+        .compositor = compositorAbi,
+        .params = params,
+        .brush = brush->get_weak(),
+    });
+
+    Wh_Log(L"Blur brushes created: %d, served: %d",
+           ++g_xamlBlurBrushesCreated, g_xamlBlurBrushesServed.load());
+
+    return brush;
+}
+
 void SetOrClearValue(DependencyObject elementDo,
                      DependencyProperty property,
                      const PropertyOverrideValue& overrideValue,
@@ -3892,9 +3979,8 @@ void SetOrClearValue(DependencyObject elementDo,
                 wuxh::ElementCompositionPreview::GetElementVisual(uiElement)
                     .Compositor();
 
-            value = winrt::make<XamlBlurBrush>(std::move(compositor),
-                                               blurBrushParams->blurAmount,
-                                               blurBrushParams->tint);
+            value = GetXamlBlurBrush(std::move(compositor), *blurBrushParams)
+                        .as<winrt::Windows::Foundation::IInspectable>();
         } else {
             Wh_Log(L"Can't get UIElement for blur brush");
             return;
@@ -5663,6 +5749,9 @@ void UninitializeSettingsAndTap() {
 
     g_elementsCustomizationRules.clear();
 
+    g_xamlBlurBrushCache.clear();
+    g_blurEffectFactories.clear();
+
     for (const auto& [handle, webViewCustomizationState] :
          g_webViewsCustomizationState) {
         try {